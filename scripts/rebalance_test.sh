@@ -0,0 +1,83 @@
+#!/bin/bash
+# scripts/rebalance_test.sh
+#
+# Adds a sixth node to the running cluster while clients keep writing, then
+# reads every key back from its owner with R=1. A key that was acked but
+# cannot be read was lost in the rebalance.
+
+# Run inside the network so we can reach nodes by name
+RUN="docker run --rm --network tinykv-net tinykv:latest"
+CLIENT="./build/src/tinykv_client"
+NODE1="tinykv-node1:50051"
+NODE6="tinykv-node6:50056"
+RECORDS=2000
+LIVE_WRITES=400
+
+# Colors
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+NC='\033[0m'
+
+echo "========================================"
+echo "      TinyKV Rebalance Test"
+echo "========================================"
+
+echo -n "[1/5] Loading $RECORDS keys... "
+$RUN bash -c "
+  for b in \$(seq 0 $((RECORDS / 100 - 1))); do
+    args=''
+    for i in \$(seq \$((b * 100)) \$((b * 100 + 99))); do args=\"\$args rb_\$i v\$i\"; done
+    $CLIENT tinykv-node\$((b % 5 + 1)):5005\$((b % 5 + 1)) mput \$args >/dev/null 2>&1 || exit 1
+  done"
+if [ $? -eq 0 ]; then echo -e "${GREEN}OK${NC}"; else
+  echo -e "${RED}FAIL${NC}"
+  exit 1
+fi
+
+echo -n "[2/5] Writing in the background while node 6 joins... "
+ACKED=$(mktemp)
+$RUN bash -c "
+  for i in \$(seq 1 $LIVE_WRITES); do
+    n=\$((i % 5 + 1))
+    $CLIENT tinykv-node\$n:5005\$n put live_\$i w\$i 3 2 >/dev/null 2>&1 && echo live_\$i
+  done" >"$ACKED" &
+WRITER=$!
+sleep 1
+
+docker rm -f tinykv-node6 >/dev/null 2>&1
+docker run -d --name tinykv-node6 --network tinykv-net tinykv:latest \
+  ./build/src/tinykv_server 50056 --address $NODE6 --join $NODE1 >/dev/null
+echo -e "${GREEN}STARTED${NC}"
+
+echo -n "[3/5] Waiting for the handoff to finish... "
+for t in $(seq 1 60); do
+  sleep 1
+  RING=$($RUN $CLIENT $NODE6 ring 2>/dev/null | head -1)
+  [[ "$RING" == *"6 nodes" ]] && break
+done
+if [[ "$RING" == *"6 nodes" ]]; then echo -e "${GREEN}OK${NC} ($RING)"; else
+  echo -e "${RED}FAIL${NC} (Got: $RING)"
+  exit 1
+fi
+wait $WRITER
+
+echo -n "[4/5] Reading preloaded keys (R=1)... "
+LOST=$($RUN bash -c "
+  for i in \$(seq 0 $((RECORDS - 1))); do
+    n=\$((i % 6 + 1))
+    [ \"\$($CLIENT tinykv-node\$n:5005\$n get rb_\$i 1 2>/dev/null)\" == \"v\$i\" ] || echo rb_\$i
+  done" | wc -l)
+if [ "$LOST" -eq 0 ]; then echo -e "${GREEN}OK${NC}"; else echo -e "${RED}FAIL${NC} ($LOST lost)"; fi
+
+echo -n "[5/5] Reading $(wc -l <"$ACKED") keys acked during the join (R=1)... "
+LOST_LIVE=$($RUN bash -c "
+  for k in $(tr '\n' ' ' <"$ACKED"); do
+    i=\${k#live_}
+    n=\$((i % 6 + 1))
+    [ \"\$($CLIENT tinykv-node\$n:5005\$n get \$k 1 2>/dev/null)\" == \"w\$i\" ] || echo \$k
+  done" | wc -l)
+if [ "$LOST_LIVE" -eq 0 ]; then echo -e "${GREEN}OK${NC}"; else echo -e "${RED}FAIL${NC} ($LOST_LIVE lost)"; fi
+rm -f "$ACKED"
+
+echo "========================================"
+[ "$LOST" -eq 0 ] && [ "$LOST_LIVE" -eq 0 ]
@@ -0,0 +1,82 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/*
+ * Reads 8 bytes as a little-endian integer, a plain load on little-endian
+ * machines
+ */
+inline uint64_t load_le64(const uint8_t *data) {
+  uint64_t k = 0;
+  if constexpr (std::endian::native == std::endian::little) {
+    memcpy(&k, data, 8);
+  } else {
+    for (int i = 0; i < 8; ++i)
+      k |= uint64_t(data[i]) << (8 * i);
+  }
+  return k;
+}
+
+/*
+ * MurmurHash64A. Unlike std::hash it gives the same result in every build
+ * and on every byte order, so it is safe to persist and to compare across
+ * nodes.
+ */
+inline uint64_t murmur64(const void *key, size_t len,
+                         uint64_t seed = 0xe17a1465) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+
+  uint64_t h = seed ^ (len * m);
+
+  const uint8_t *data = static_cast<const uint8_t *>(key);
+  const uint8_t *end = data + (len / 8) * 8;
+
+  while (data != end) {
+    uint64_t k = load_le64(data);
+    data += 8;
+
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+
+    h ^= k;
+    h *= m;
+  }
+
+  switch (len & 7) {
+  case 7:
+    h ^= uint64_t(data[6]) << 48;
+    [[fallthrough]];
+  case 6:
+    h ^= uint64_t(data[5]) << 40;
+    [[fallthrough]];
+  case 5:
+    h ^= uint64_t(data[4]) << 32;
+    [[fallthrough]];
+  case 4:
+    h ^= uint64_t(data[3]) << 24;
+    [[fallthrough]];
+  case 3:
+    h ^= uint64_t(data[2]) << 16;
+    [[fallthrough]];
+  case 2:
+    h ^= uint64_t(data[1]) << 8;
+    [[fallthrough]];
+  case 1:
+    h ^= uint64_t(data[0]);
+    h *= m;
+  };
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+
+  return h;
+}
+
+inline uint64_t murmur64(const std::string &key) {
+  return murmur64(key.data(), key.size());
+}
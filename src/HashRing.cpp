@@ -0,0 +1,117 @@
+#include "HashRing.h"
+#include "Hash.h"
+#include <algorithm>
+
+HashRing::HashRing(int n) { virtual_nodes = n; }
+
+void HashRing::add_node(std::string address) {
+  if (std::find(nodes.begin(), nodes.end(), address) != nodes.end())
+    return;
+  nodes.push_back(address);
+  rebuild();
+}
+
+void HashRing::remove_node(std::string address) {
+  auto it = std::find(nodes.begin(), nodes.end(), address);
+  if (it == nodes.end())
+    return;
+  nodes.erase(it);
+  rebuild();
+}
+
+/*
+ * Recomputes the vnode array and every vnode's preference list.
+ * Membership changes are rare, lookups are not.
+ */
+void HashRing::rebuild() {
+  ring.clear();
+  for (uint16_t node = 0; node < nodes.size(); ++node) {
+    for (int i = 0; i < virtual_nodes; ++i) {
+      std::string v_node_id = nodes[node] + "#" + std::to_string(i);
+      ring.push_back({murmur64(v_node_id), node});
+    }
+  }
+  std::sort(ring.begin(), ring.end(),
+            [](const VirtualNode &a, const VirtualNode &b) {
+              return a.position < b.position;
+            });
+
+  size_t n = nodes.size();
+  preference.assign(ring.size() * n, 0);
+  std::vector<bool> seen(n);
+
+  for (size_t i = 0; i < ring.size(); ++i) {
+    std::fill(seen.begin(), seen.end(), false);
+    size_t found = 0;
+    for (size_t j = i; found < n; j = (j + 1) % ring.size()) {
+      uint16_t node = ring[j].node;
+      if (!seen[node]) {
+        seen[node] = true;
+        preference[i * n + found++] = node;
+      }
+    }
+  }
+}
+
+size_t HashRing::find_vnode(const std::string &key) const {
+  return successor(murmur64(key));
+}
+
+size_t HashRing::successor(uint64_t position) const {
+  auto it = std::upper_bound(
+      ring.begin(), ring.end(), position,
+      [](uint64_t h, const VirtualNode &v) { return h < v.position; });
+  if (it == ring.end())
+    it = ring.begin();
+  return it - ring.begin();
+}
+
+const std::string &HashRing::get_owner(const std::string &key) const {
+  static const std::string none;
+  if (ring.empty())
+    return none;
+  return nodes[ring[find_vnode(key)].node];
+}
+
+std::span<const uint16_t>
+HashRing::get_preference_list(const std::string &key, int n) const {
+  if (ring.empty())
+    return {};
+  return vnode_preference(find_vnode(key), n);
+}
+
+std::span<const uint16_t> HashRing::vnode_preference(size_t vnode,
+                                                     int n) const {
+  size_t count = std::min<size_t>(std::max(n, 0), nodes.size());
+  return {preference.data() + vnode * nodes.size(), count};
+}
+
+int HashRing::node_index(const std::string &address) const {
+  auto it = std::find(nodes.begin(), nodes.end(), address);
+  return it == nodes.end() ? -1 : it - nodes.begin();
+}
+
+std::vector<std::string> HashRing::get_owner_and_neighbours(std::string key,
+                                                            int n) {
+  std::vector<std::string> node_list;
+  for (uint16_t node : get_preference_list(key, n))
+    node_list.push_back(nodes[node]);
+  return node_list;
+}
+
+std::vector<double> HashRing::ownership() const {
+  std::vector<double> share(nodes.size(), 0.0);
+  if (ring.empty())
+    return share;
+
+  // A vnode owns the arc from its predecessor up to itself
+  const double space = 18446744073709551616.0; // 2^64
+  for (size_t i = 0; i < ring.size(); ++i) {
+    uint64_t prev = ring[(i + ring.size() - 1) % ring.size()].position;
+    uint64_t arc = ring[i].position - prev; // wraps for the first vnode
+    share[ring[i].node] += arc / space;
+  }
+  if (ring.size() == 1)
+    share[ring[0].node] = 1.0;
+  return share;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/*
+ * Consistent hash ring with virtual nodes.
+ *
+ * Virtual nodes live in one sorted array of (position, node index), and
+ * every virtual node stores the precomputed list of distinct nodes that
+ * follow it clockwise. A lookup is one binary search and returns a view
+ * into that list, without hashing strings twice or allocating.
+ */
+class HashRing {
+public:
+  HashRing(int n = 20);
+  void add_node(std::string address);
+
+  void remove_node(std::string address);
+
+  const std::string &get_owner(const std::string &key) const;
+
+  /*
+   * The first n distinct nodes clockwise from the key, owner first, as
+   * indices for get_address(). The view is valid until the ring changes.
+   */
+  std::span<const uint16_t> get_preference_list(const std::string &key,
+                                                int n) const;
+
+  const std::string &get_address(uint16_t node) const { return nodes[node]; }
+
+  std::vector<std::string> get_owner_and_neighbours(std::string key, int n);
+
+  int get_virtual_nodes() const { return virtual_nodes; }
+
+  size_t node_count() const { return nodes.size(); }
+
+  const std::vector<std::string> &members() const { return nodes; }
+
+  /*
+   * Fraction of the hash space owned by each node, indexed like get_address
+   */
+  std::vector<double> ownership() const;
+
+  /*
+   * Virtual nodes in ring order. Vnode i owns the arc from the position of
+   * vnode i - 1 (exclusive) up to its own position (inclusive).
+   */
+  size_t vnode_count() const { return ring.size(); }
+
+  uint64_t vnode_position(size_t vnode) const { return ring[vnode].position; }
+
+  size_t find_vnode(const std::string &key) const;
+
+  /*
+   * The first vnode clockwise after a position, the one whose arc holds it
+   */
+  size_t successor(uint64_t position) const;
+
+  std::span<const uint16_t> vnode_preference(size_t vnode, int n) const;
+
+  /*
+   * Index of a node for get_address(), or -1 if it is not on the ring
+   */
+  int node_index(const std::string &address) const;
+
+private:
+  struct VirtualNode {
+    uint64_t position;
+    uint16_t node;
+  };
+
+  int virtual_nodes;
+  std::vector<std::string> nodes;
+  std::vector<VirtualNode> ring;
+  // preference[i * nodes.size() + k] is the k-th distinct node after vnode i
+  std::vector<uint16_t> preference;
+
+  void rebuild();
+};
@@ -0,0 +1,271 @@
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<int> Log::min_level{static_cast<int>(LogLevel::INFO)};
+
+static const size_t RING_SLOTS = 1024;
+static const auto DRAIN_INTERVAL = std::chrono::milliseconds(2);
+
+static const char *LevelName(LogLevel level) {
+  switch (level) {
+  case LogLevel::DEBUG:
+    return "DEBUG";
+  case LogLevel::INFO:
+    return "INFO";
+  case LogLevel::WARN:
+    return "WARN";
+  case LogLevel::ERROR:
+    return "ERROR";
+  }
+  return "?";
+}
+
+namespace {
+
+/*
+ * One thread's records. Only the owning thread moves tail and only the
+ * writer moves head.
+ */
+struct Ring {
+  Log::Record slots[RING_SLOTS];
+  alignas(64) std::atomic<uint64_t> head{0};
+  alignas(64) std::atomic<uint64_t> tail{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> orphaned{false}; // the owning thread has exited
+};
+
+class Writer {
+public:
+  Writer() : thread(&Writer::run, this) {}
+
+  ~Writer() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+  }
+
+  std::shared_ptr<Ring> add_ring() {
+    auto ring = std::make_shared<Ring>();
+    std::lock_guard lock(mutex);
+    rings.push_back(ring);
+    return ring;
+  }
+
+  void flush() {
+    std::unique_lock lock(mutex);
+    // A pass that started before this call may have missed our records
+    uint64_t target = passes + 2;
+    wake.notify_all();
+    done.wait(lock, [&] { return passes >= target || stopping; });
+  }
+
+private:
+  struct Line {
+    int64_t time_us;
+    std::string text;
+  };
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::vector<std::shared_ptr<Ring>> rings;
+  uint64_t passes = 0;
+  bool stopping = false;
+  std::thread thread;
+
+  void run() {
+    std::unique_lock lock(mutex);
+    while (true) {
+      bool last = stopping;
+      std::vector<std::shared_ptr<Ring>> snapshot = rings;
+      lock.unlock();
+
+      drain(snapshot);
+
+      lock.lock();
+      // Rings of exited threads go once they are empty
+      rings.erase(std::remove_if(rings.begin(), rings.end(),
+                                 [](const std::shared_ptr<Ring> &ring) {
+                                   return ring->orphaned &&
+                                          ring->head == ring->tail;
+                                 }),
+                  rings.end());
+      passes++;
+      done.notify_all();
+      if (last)
+        return;
+      wake.wait_for(lock, DRAIN_INTERVAL);
+    }
+  }
+
+  void drain(const std::vector<std::shared_ptr<Ring>> &snapshot) {
+    std::vector<Line> lines;
+    for (const auto &ring : snapshot) {
+      uint64_t head = ring->head.load(std::memory_order_relaxed);
+      uint64_t tail = ring->tail.load(std::memory_order_acquire);
+      for (; head < tail; ++head) {
+        const Log::Record &record = ring->slots[head % RING_SLOTS];
+        lines.push_back({record.time_us, format(record)});
+      }
+      ring->head.store(head, std::memory_order_release);
+
+      if (uint64_t dropped = ring->dropped.exchange(0)) {
+        lines.push_back({lines.empty() ? 0 : lines.back().time_us,
+                         "WARN [Log] Dropped " + std::to_string(dropped) +
+                             " records, ring full\n"});
+      }
+    }
+    if (lines.empty())
+      return;
+
+    // Each ring is in order already, interleave the threads by time
+    std::stable_sort(lines.begin(), lines.end(),
+                     [](const Line &a, const Line &b) {
+                       return a.time_us < b.time_us;
+                     });
+    std::string out;
+    for (const Line &line : lines)
+      out += line.text;
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+  }
+
+  static std::string format(const Log::Record &record) {
+    std::string out;
+    out.reserve(128);
+
+    time_t seconds = record.time_us / 1000000;
+    struct tm parts;
+    localtime_r(&seconds, &parts);
+    char stamp[32];
+    size_t n = std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &parts);
+    std::snprintf(stamp + n, sizeof(stamp) - n, ".%06lld",
+                  static_cast<long long>(record.time_us % 1000000));
+    out += stamp;
+    out += ' ';
+    out += LevelName(record.level);
+    out += " [";
+    out += record.component;
+    out += "] ";
+
+    size_t offset = 0;
+    for (const char *p = record.format; *p; ++p) {
+      if (p[0] == '{' && p[1] == '}') {
+        if (offset < record.size)
+          append_arg(record, &offset, &out);
+        ++p;
+      } else {
+        out += *p;
+      }
+    }
+    out += '\n';
+    return out;
+  }
+
+  static void append_arg(const Log::Record &record, size_t *offset,
+                         std::string *out) {
+    const char *data = record.args + *offset + 1;
+    switch (static_cast<Log::ArgType>(record.args[*offset])) {
+    case Log::ArgType::INT: {
+      int64_t value;
+      std::memcpy(&value, data, sizeof(value));
+      *out += std::to_string(value);
+      *offset += 1 + sizeof(value);
+      break;
+    }
+    case Log::ArgType::UINT: {
+      uint64_t value;
+      std::memcpy(&value, data, sizeof(value));
+      *out += std::to_string(value);
+      *offset += 1 + sizeof(value);
+      break;
+    }
+    case Log::ArgType::DOUBLE: {
+      double value;
+      std::memcpy(&value, data, sizeof(value));
+      char text[32];
+      std::snprintf(text, sizeof(text), "%g", value);
+      *out += text;
+      *offset += 1 + sizeof(value);
+      break;
+    }
+    case Log::ArgType::BOOL:
+      *out += *data ? "true" : "false";
+      *offset += 2;
+      break;
+    case Log::ArgType::CHAR:
+      *out += *data;
+      *offset += 2;
+      break;
+    case Log::ArgType::STRING: {
+      uint16_t length;
+      std::memcpy(&length, data, sizeof(length));
+      out->append(data + sizeof(length), length);
+      *offset += 1 + sizeof(length) + length;
+      break;
+    }
+    }
+  }
+};
+
+Writer &writer() {
+  static Writer instance;
+  return instance;
+}
+
+// Registers the calling thread's ring on first use, orphans it on exit
+struct ThreadRing {
+  std::shared_ptr<Ring> ring = writer().add_ring();
+  ~ThreadRing() { ring->orphaned = true; }
+};
+
+thread_local ThreadRing thread_ring;
+
+} // namespace
+
+Log::Record *Log::begin_record() {
+  Ring &ring = *thread_ring.ring;
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  if (tail - ring.head.load(std::memory_order_acquire) == RING_SLOTS) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  Record *record = &ring.slots[tail % RING_SLOTS];
+  record->time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+  return record;
+}
+
+void Log::commit_record() {
+  Ring &ring = *thread_ring.ring;
+  ring.tail.store(ring.tail.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+}
+
+void Log::flush() { writer().flush(); }
+
+bool Log::parse_level(const std::string &name, LogLevel *level) {
+  for (LogLevel l : {LogLevel::DEBUG, LogLevel::INFO, LogLevel::WARN,
+                     LogLevel::ERROR}) {
+    std::string lower = LevelName(l);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (name == lower) {
+      *level = l;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+enum class LogLevel : int { DEBUG = 0, INFO = 1, WARN = 2, ERROR = 3 };
+
+// Statements below this level are compiled out, e.g. -DTINYKV_LOG_LEVEL=1
+// drops every LOG_DEBUG from the binary
+#ifndef TINYKV_LOG_LEVEL
+#define TINYKV_LOG_LEVEL 0
+#endif
+
+/*
+ * LOG_INFO("Server", "Listening on {}", address);
+ *
+ * The arguments are only evaluated if the level is enabled. The format
+ * string must be a literal, it is kept by pointer and applied later.
+ */
+#define TINYKV_LOG(level, component, ...)                                     \
+  do {                                                                        \
+    if constexpr (static_cast<int>(level) >= TINYKV_LOG_LEVEL) {              \
+      if (Log::enabled(level))                                                \
+        Log::write(level, component, __VA_ARGS__);                            \
+    }                                                                         \
+  } while (0)
+
+#define LOG_DEBUG(component, ...)                                             \
+  TINYKV_LOG(LogLevel::DEBUG, component, __VA_ARGS__)
+#define LOG_INFO(component, ...)                                              \
+  TINYKV_LOG(LogLevel::INFO, component, __VA_ARGS__)
+#define LOG_WARN(component, ...)                                              \
+  TINYKV_LOG(LogLevel::WARN, component, __VA_ARGS__)
+#define LOG_ERROR(component, ...)                                             \
+  TINYKV_LOG(LogLevel::ERROR, component, __VA_ARGS__)
+
+/*
+ * Asynchronous logger.
+ *
+ * A logging thread never formats, locks or writes. It copies the format
+ * string pointer and its raw arguments into a slot of its own ring buffer,
+ * a single producer single consumer queue, and goes on. A background thread
+ * drains all rings every few milliseconds, formats the records in time
+ * order and writes them to stdout in one go.
+ *
+ * If a ring is full the record is dropped and counted rather than making
+ * the caller wait. Strings that do not fit in a slot are truncated.
+ */
+class Log {
+public:
+  static void set_level(LogLevel level) {
+    min_level.store(static_cast<int>(level), std::memory_order_relaxed);
+  }
+
+  static bool enabled(LogLevel level) {
+    return static_cast<int>(level) >=
+           min_level.load(std::memory_order_relaxed);
+  }
+
+  /*
+   * Parses "debug", "info", "warn" or "error"
+   */
+  static bool parse_level(const std::string &name, LogLevel *level);
+
+  /*
+   * Blocks until everything logged before the call has been written
+   */
+  static void flush();
+
+  template <typename... Args>
+  static void write(LogLevel level, const char *component,
+                    const char *format, const Args &...args) {
+    Record *record = begin_record();
+    if (!record)
+      return;
+    record->level = level;
+    record->component = component;
+    record->format = format;
+    record->size = 0;
+    (encode(record, args), ...);
+    commit_record();
+  }
+
+  // Record layout, public for the writer in Log.cpp
+  enum class ArgType : uint8_t { INT, UINT, DOUBLE, BOOL, CHAR, STRING };
+
+  static const size_t RECORD_SIZE = 256;
+
+  struct Record {
+    int64_t time_us;
+    const char *component;
+    const char *format;
+    LogLevel level;
+    uint16_t size; // bytes used in args
+    char args[RECORD_SIZE - 32];
+  };
+
+private:
+  static std::atomic<int> min_level;
+
+  static Record *begin_record();
+  static void commit_record();
+
+  static void put(Record *record, ArgType type, const void *data,
+                  size_t size) {
+    size_t room = sizeof(record->args) - record->size;
+    if (room < 1 + size)
+      return;
+    record->args[record->size++] = static_cast<char>(type);
+    std::memcpy(record->args + record->size, data, size);
+    record->size += size;
+  }
+
+  static void put_string(Record *record, std::string_view s) {
+    size_t room = sizeof(record->args) - record->size;
+    if (room < 3)
+      return;
+    uint16_t length = static_cast<uint16_t>(std::min(s.size(), room - 3));
+    record->args[record->size++] = static_cast<char>(ArgType::STRING);
+    std::memcpy(record->args + record->size, &length, sizeof(length));
+    std::memcpy(record->args + record->size + sizeof(length), s.data(),
+                length);
+    record->size += sizeof(length) + length;
+  }
+
+  template <typename T> static void encode(Record *record, const T &arg) {
+    if constexpr (std::is_same_v<T, bool>) {
+      put(record, ArgType::BOOL, &arg, sizeof(arg));
+    } else if constexpr (std::is_same_v<T, char>) {
+      put(record, ArgType::CHAR, &arg, sizeof(arg));
+    } else if constexpr (std::is_enum_v<T>) {
+      int64_t value = static_cast<int64_t>(arg);
+      put(record, ArgType::INT, &value, sizeof(value));
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      int64_t value = arg;
+      put(record, ArgType::INT, &value, sizeof(value));
+    } else if constexpr (std::is_integral_v<T>) {
+      uint64_t value = arg;
+      put(record, ArgType::UINT, &value, sizeof(value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+      double value = arg;
+      put(record, ArgType::DOUBLE, &value, sizeof(value));
+    } else {
+      static_assert(std::is_convertible_v<const T &, std::string_view>,
+                    "unsupported log argument type");
+      put_string(record, std::string_view(arg));
+    }
+  }
+};
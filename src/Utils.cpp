@@ -1,3 +1,4 @@
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <iostream>
@@ -25,7 +26,7 @@ std::vector<std::string> LoadClusterConfig(const std::string &filename) {
   return addresses;
 }
 
-void RunBenchmark(Client &client, int total_ops, int rf, int num_threads) {
+void RunBenchmark(PutFunc put, int total_ops, int rf, int num_threads) {
   std::cout << "==========================================\n"
             << "  Running C++ Concurrent Benchmark\n"
             << "  Total Ops: " << total_ops << "\n"
@@ -41,13 +42,13 @@ void RunBenchmark(Client &client, int total_ops, int rf, int num_threads) {
   auto start_total = std::chrono::high_resolution_clock::now();
 
   for (int t = 0; t < num_threads; ++t) {
-    threads.emplace_back([&client, t, ops_per_thread, rf, &completed_ops]() {
+    threads.emplace_back([&put, t, ops_per_thread, rf, &completed_ops]() {
       for (int i = 0; i < ops_per_thread; ++i) {
         std::string key =
             "bench_t" + std::to_string(t) + "_" + std::to_string(i);
         std::string val = "x";
 
-        client.put(key, val, "bench_client", rf);
+        put(key, val, rf);
         completed_ops++;
       }
     });
@@ -1,9 +1,11 @@
 #pragma once
+#include <functional>
 #include <string>
 #include <vector>
 
-#include "Client.h"
-
 std::vector<std::string> LoadClusterConfig(const std::string &filename);
 
-void RunBenchmark(Client &client, int count, int rf, int num_threads);
+using PutFunc = std::function<bool(const std::string &key,
+                                   const std::string &val, int rf)>;
+
+void RunBenchmark(PutFunc put, int count, int rf, int num_threads);
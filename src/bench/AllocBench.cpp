@@ -0,0 +1,271 @@
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <google/protobuf/arena.h>
+#include <grpc/grpc.h>
+
+#include "MapEngine.h"
+#include "ShardedEngine.h"
+#include "WireFormat.h"
+#include "tinykv.pb.h"
+
+/*
+ * Counts heap allocations per operation on the single key data path, for
+ * the copying path the server used before values were shared ("Copy") and
+ * the current one ("Shared"). Each iteration does what a node does for one
+ * request, minus the network: parse the request, touch the store and
+ * serialize what it sends on.
+ *
+ * The copying path stores values by value, as MapEngine still does, parses
+ * into heap messages and copies the value into every outgoing message. The
+ * shared path parses into an arena, stores one reference counted buffer and
+ * serializes outgoing messages around it.
+ */
+
+using namespace tinykv;
+
+static std::atomic<int64_t> allocations{0};
+
+// Counted at malloc, below both operator new and the gRPC core allocator
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(p, size);
+}
+}
+
+static const int KEYS = 1024;
+static const int REPLICAS = 2; // peers a write is sent to at N=3
+static const size_t ARENA_BLOCK_SIZE = 1024;
+
+static std::vector<std::string> make_keys() {
+  std::vector<std::string> keys;
+  for (int i = 0; i < KEYS; ++i)
+    keys.push_back("user_" + std::to_string(i));
+  return keys;
+}
+
+static grpc::ByteBuffer put_request(const std::string &key, size_t size) {
+  PutRequest request;
+  request.set_key(key);
+  request.set_val(std::string(size, 'v'));
+  request.set_sender_id("client");
+  request.set_replication_factor(3);
+  return Serialize(request);
+}
+
+static grpc::ByteBuffer get_request(const std::string &key) {
+  GetRequest request;
+  request.set_key(key);
+  request.set_sender_id("client");
+  request.set_quorum_size(1);
+  return Serialize(request);
+}
+
+static google::protobuf::ArenaOptions arena_options(char *block) {
+  google::protobuf::ArenaOptions options;
+  options.initial_block = block;
+  options.initial_block_size = ARENA_BLOCK_SIZE;
+  return options;
+}
+
+// Starts counting once the fixture is built, reports the average per op
+class AllocCounter {
+public:
+  AllocCounter(benchmark::State &state)
+      : state(state), start(allocations.load()) {}
+  ~AllocCounter() {
+    state.counters["allocs/op"] =
+        double(allocations.load() - start) / state.iterations();
+  }
+
+private:
+  benchmark::State &state;
+  int64_t start;
+};
+
+/*
+ * Owner side of a Put: store the value and send it to the replicas
+ */
+static void BM_PutCopy(benchmark::State &state) {
+  std::vector<std::string> keys = make_keys();
+  std::vector<grpc::ByteBuffer> requests;
+  for (const std::string &key : keys)
+    requests.push_back(put_request(key, state.range(0)));
+  MapEngine store;
+  int64_t timestamp = 0;
+
+  AllocCounter counter(state);
+  for (auto _ : state) {
+    PutRequest request;
+    Parse(requests[timestamp % KEYS], &request);
+    store.write(request.key(), request.val(), ++timestamp);
+
+    for (int r = 0; r < REPLICAS; ++r) {
+      PutRequest replica;
+      replica.set_key(request.key());
+      replica.set_val(request.val());
+      replica.set_sender_id("localhost:50051");
+      replica.set_timestamp(timestamp);
+      grpc::ByteBuffer wire = Serialize(replica);
+      benchmark::DoNotOptimize(&wire);
+    }
+  }
+}
+
+static void BM_PutShared(benchmark::State &state) {
+  std::vector<std::string> keys = make_keys();
+  std::vector<grpc::ByteBuffer> requests;
+  for (const std::string &key : keys)
+    requests.push_back(put_request(key, state.range(0)));
+  ShardedEngine store;
+  int64_t timestamp = 0;
+
+  AllocCounter counter(state);
+  for (auto _ : state) {
+    alignas(8) char block[ARENA_BLOCK_SIZE];
+    google::protobuf::Arena arena(arena_options(block));
+    auto request = google::protobuf::Arena::CreateMessage<PutRequest>(&arena);
+    Parse(requests[timestamp % KEYS], request);
+    auto value = std::make_shared<const std::string>(request->val());
+    store.write_shared(request->key(), value, ++timestamp);
+
+    auto replica = google::protobuf::Arena::CreateMessage<PutRequest>(&arena);
+    replica->set_key(request->key());
+    replica->set_sender_id("localhost:50051");
+    replica->set_timestamp(timestamp);
+    for (int r = 0; r < REPLICAS; ++r) {
+      grpc::ByteBuffer wire =
+          SerializeWithValue(*replica, PutRequest::kValFieldNumber, value);
+      benchmark::DoNotOptimize(&wire);
+    }
+  }
+}
+
+/*
+ * Owner side of a Get answered from the local copy
+ */
+static void BM_GetCopy(benchmark::State &state) {
+  std::vector<std::string> keys = make_keys();
+  std::vector<grpc::ByteBuffer> requests;
+  MapEngine store;
+  for (const std::string &key : keys) {
+    requests.push_back(get_request(key));
+    store.write(key, std::string(state.range(0), 'v'), 1);
+  }
+  size_t i = 0;
+
+  AllocCounter counter(state);
+  for (auto _ : state) {
+    GetRequest request;
+    Parse(requests[i++ % KEYS], &request);
+    Val_TS value = store.read(request.key());
+
+    GetResponse reply;
+    reply.set_val(value.first);
+    reply.set_timestamp(value.second);
+    reply.set_operation_success(true);
+    grpc::ByteBuffer wire = Serialize(reply);
+    benchmark::DoNotOptimize(&wire);
+  }
+}
+
+static void BM_GetShared(benchmark::State &state) {
+  std::vector<std::string> keys = make_keys();
+  std::vector<grpc::ByteBuffer> requests;
+  ShardedEngine store;
+  for (const std::string &key : keys) {
+    requests.push_back(get_request(key));
+    store.write(key, std::string(state.range(0), 'v'), 1);
+  }
+  size_t i = 0;
+
+  AllocCounter counter(state);
+  for (auto _ : state) {
+    alignas(8) char block[ARENA_BLOCK_SIZE];
+    google::protobuf::Arena arena(arena_options(block));
+    auto request = google::protobuf::Arena::CreateMessage<GetRequest>(&arena);
+    Parse(requests[i++ % KEYS], request);
+    Ref_TS value = store.read_shared(request->key());
+
+    auto reply = google::protobuf::Arena::CreateMessage<GetResponse>(&arena);
+    reply->set_timestamp(value.second);
+    reply->set_operation_success(true);
+    grpc::ByteBuffer wire =
+        SerializeWithValue(*reply, GetResponse::kValFieldNumber, value.first);
+    benchmark::DoNotOptimize(&wire);
+  }
+}
+
+/*
+ * A non-owner passing a client Put on to the owner
+ */
+static void BM_ForwardCopy(benchmark::State &state) {
+  grpc::ByteBuffer received = put_request("user_1", state.range(0));
+
+  AllocCounter counter(state);
+  for (auto _ : state) {
+    PutRequest request;
+    Parse(received, &request);
+
+    PutRequest forwarded;
+    forwarded.set_key(request.key());
+    forwarded.set_val(request.val());
+    forwarded.set_sender_id("client");
+    forwarded.set_replication_factor(request.replication_factor());
+    grpc::ByteBuffer wire = Serialize(forwarded);
+    benchmark::DoNotOptimize(&wire);
+  }
+}
+
+static void BM_ForwardShared(benchmark::State &state) {
+  grpc::ByteBuffer received = put_request("user_1", state.range(0));
+
+  AllocCounter counter(state);
+  for (auto _ : state) {
+    alignas(8) char block[ARENA_BLOCK_SIZE];
+    google::protobuf::Arena arena(arena_options(block));
+    auto request = google::protobuf::Arena::CreateMessage<PutRequest>(&arena);
+    Parse(received, request);
+
+    grpc::ByteBuffer wire(received);
+    benchmark::DoNotOptimize(&wire);
+  }
+}
+
+static void ValueSizes(benchmark::internal::Benchmark *b) {
+  for (int size : {16, 1024, 16384})
+    b->Arg(size);
+}
+
+BENCHMARK(BM_PutCopy)->Apply(ValueSizes);
+BENCHMARK(BM_PutShared)->Apply(ValueSizes);
+BENCHMARK(BM_GetCopy)->Apply(ValueSizes);
+BENCHMARK(BM_GetShared)->Apply(ValueSizes);
+BENCHMARK(BM_ForwardCopy)->Apply(ValueSizes);
+BENCHMARK(BM_ForwardShared)->Apply(ValueSizes);
+
+int main(int argc, char **argv) {
+  grpc_init(); // slices come from the gRPC core allocator
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  grpc_shutdown();
+  return 0;
+}
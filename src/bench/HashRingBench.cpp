@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "HashRing.h"
+
+/*
+ * Measures ring lookups per second for a range of cluster sizes and
+ * virtual node counts, and reports how unevenly the hash space is split.
+ */
+
+static const int KEY_SPACE = 1 << 16;
+
+static HashRing make_ring(int nodes, int vnodes) {
+  HashRing ring(vnodes);
+  for (int i = 0; i < nodes; ++i)
+    ring.add_node("10.0.0." + std::to_string(i) + ":50051");
+  return ring;
+}
+
+static std::vector<std::string> make_keys() {
+  std::vector<std::string> keys;
+  keys.reserve(KEY_SPACE);
+  for (int i = 0; i < KEY_SPACE; ++i)
+    keys.push_back("key_" + std::to_string(i));
+  return keys;
+}
+
+// max/mean of per-node ownership; 1.0 is a perfectly even split
+static void report_skew(benchmark::State &state, const HashRing &ring) {
+  std::vector<double> share = ring.ownership();
+  double mean = std::accumulate(share.begin(), share.end(), 0.0) /
+                share.size();
+  state.counters["skew_max"] =
+      *std::max_element(share.begin(), share.end()) / mean;
+  state.counters["skew_min"] =
+      *std::min_element(share.begin(), share.end()) / mean;
+}
+
+static void BM_GetOwner(benchmark::State &state) {
+  HashRing ring = make_ring(state.range(0), state.range(1));
+  std::vector<std::string> keys = make_keys();
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&ring.get_owner(keys[i++ & (KEY_SPACE - 1)]));
+  }
+  state.SetItemsProcessed(state.iterations());
+  report_skew(state, ring);
+}
+
+static void BM_GetPreferenceList(benchmark::State &state) {
+  HashRing ring = make_ring(state.range(0), state.range(1));
+  std::vector<std::string> keys = make_keys();
+  size_t i = 0;
+  for (auto _ : state) {
+    auto list = ring.get_preference_list(keys[i++ & (KEY_SPACE - 1)], 3);
+    benchmark::DoNotOptimize(list.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void ClusterSizes(benchmark::internal::Benchmark *b) {
+  for (int nodes : {5, 16, 64})
+    for (int vnodes : {20, 100, 200})
+      b->Args({nodes, vnodes});
+}
+
+BENCHMARK(BM_GetOwner)->Apply(ClusterSizes);
+BENCHMARK(BM_GetPreferenceList)->Apply(ClusterSizes);
+
+BENCHMARK_MAIN();
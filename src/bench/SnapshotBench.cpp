@@ -0,0 +1,154 @@
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ShardedEngine.h"
+#include "Snapshot.h"
+#include "WriteAheadLog.h"
+
+/*
+ * Measures how long a node takes to start with a given number of keys on
+ * disk: replaying the whole write ahead log, as a node did before
+ * snapshots, against loading a snapshot and replaying the log written
+ * after it. Also reports how long taking the snapshot paused writers.
+ */
+
+static const char *WAL_PATH = "snapshot_bench.log";
+static const char *SNAPSHOT_PATH = "snapshot_bench.snap";
+static const size_t LOG_BATCH = 1024;
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::string key_for(size_t i) { return "user_" + std::to_string(i); }
+
+/*
+ * Writes keys [from, to) to both the store and the log
+ */
+static void load(ShardedEngine &store, WriteAheadLog &wal, size_t from,
+                 size_t to, const std::string &value, int64_t timestamp) {
+  std::vector<std::string> keys;
+  std::vector<LogRecord> batch;
+  auto shared = std::make_shared<const std::string>(value);
+  for (size_t i = from; i < to; i += LOG_BATCH) {
+    keys.clear();
+    batch.clear();
+    for (size_t j = i; j < std::min(to, i + LOG_BATCH); ++j)
+      keys.push_back(key_for(j));
+    for (const std::string &key : keys) {
+      store.write(key, value, timestamp);
+      batch.push_back({key, shared, timestamp});
+    }
+    wal.append_batch(batch);
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t keys = (argc >= 2) ? std::stoull(argv[1]) : 10000000;
+  int value_size = (argc >= 3) ? std::stoi(argv[2]) : 32;
+  int threads = (argc >= 4) ? std::stoi(argv[3])
+                            : std::max(1u, std::thread::hardware_concurrency());
+  size_t tail = keys / 100; // written after the snapshot
+
+  std::cout << "==========================================\n"
+            << "  Snapshot Startup Benchmark\n"
+            << "  Keys:         " << keys << "\n"
+            << "  Value size:   " << value_size << " bytes\n"
+            << "  Load threads: " << threads << "\n"
+            << "  Log tail:     " << tail << " writes\n"
+            << "==========================================" << std::endl;
+
+  WriteAheadLog::remove(WAL_PATH);
+  std::filesystem::remove(SNAPSHOT_PATH);
+  std::string value(value_size, 'v');
+  std::cout << std::fixed << std::setprecision(1);
+
+  {
+    auto store = std::make_unique<ShardedEngine>();
+    WriteAheadLog wal(WAL_PATH, SyncPolicy::NONE);
+    auto start = Clock::now();
+    load(*store, wal, 0, keys, value, 1);
+    std::cout << "Loaded store and log in " << seconds_since(start) << " s"
+              << std::endl;
+
+    start = Clock::now();
+    Clock::time_point forked;
+    pid_t child = ForkSnapshot(SNAPSHOT_PATH, *store, [&] {
+      return wal.written_bytes();
+    });
+    forked = Clock::now();
+    if (child < 0 || !WaitSnapshot(child)) {
+      std::cerr << "Snapshot failed" << std::endl;
+      return 1;
+    }
+    std::cout << "Snapshot written in " << seconds_since(start) << " s, "
+              << "writers paused "
+              << std::chrono::duration<double, std::milli>(forked - start)
+                     .count()
+              << " ms, "
+              << std::filesystem::file_size(SNAPSHOT_PATH) / double(keys)
+              << " bytes/key (log: " << wal.written_bytes() / double(keys)
+              << " bytes/key)" << std::endl;
+
+    // Overwrites that land in the log after the snapshot
+    load(*store, wal, 0, tail, value, 2);
+  }
+
+  std::cout << std::setw(28) << "Startup" << std::setw(12) << "Seconds"
+            << std::setw(14) << "Keys/s" << std::endl;
+  auto report = [&](const std::string &name, double elapsed, size_t size) {
+    std::cout << std::setw(28) << name << std::setw(12) << elapsed
+              << std::setw(14) << std::setprecision(0) << keys / elapsed
+              << std::setprecision(1) << std::endl;
+    if (size != keys)
+      std::cerr << "  expected " << keys << " keys, found " << size
+                << std::endl;
+  };
+
+  {
+    auto store = std::make_unique<ShardedEngine>();
+    auto start = Clock::now();
+    WriteAheadLog wal(WAL_PATH, SyncPolicy::NONE);
+    wal.replay([&](const std::string &key, const std::string &val,
+                   int64_t timestamp) { store->write(key, val, timestamp); });
+    report("full log replay", seconds_since(start), store->size());
+  }
+
+  {
+    auto store = std::make_unique<ShardedEngine>();
+    auto start = Clock::now();
+    SnapshotInfo info;
+    if (!LoadSnapshot(SNAPSHOT_PATH, threads,
+                      [&](const std::string &key, const ValueRef &val,
+                          int64_t timestamp) {
+                        store->write_shared(key, val, timestamp);
+                      },
+                      &info)) {
+      std::cerr << "Snapshot is corrupt" << std::endl;
+      return 1;
+    }
+    double loaded = seconds_since(start);
+    WriteAheadLog wal(WAL_PATH, SyncPolicy::NONE);
+    size_t replayed =
+        wal.replay([&](const std::string &key, const std::string &val,
+                       int64_t timestamp) { store->write(key, val, timestamp); },
+                   info.wal_offset);
+    report("snapshot + log tail", seconds_since(start), store->size());
+    std::cout << std::setw(28) << "  of which snapshot" << std::setw(12)
+              << loaded << "\n"
+              << std::setw(28) << "  tail writes" << std::setw(12)
+              << replayed << std::endl;
+  }
+
+  WriteAheadLog::remove(WAL_PATH);
+  std::filesystem::remove(SNAPSHOT_PATH);
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "MapEngine.h"
+#include "ShardedEngine.h"
+
+/*
+ * Compares the storage engines under a 90% read / 10% write mix
+ * at an increasing number of threads, then what each costs in memory
+ * per key.
+ */
+
+static const int KEY_SPACE = 100000;
+static const int OPS_PER_THREAD = 100000;
+static const int MEMORY_KEYS = 1000000;
+static const size_t MEMORY_VALUE_SIZE = 32;
+
+double run(StorageEngine &engine, int num_threads) {
+  std::vector<std::thread> threads;
+  std::atomic<bool> start{false};
+
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&engine, &start, t, num_threads]() {
+      std::mt19937 rng(t);
+      std::uniform_int_distribution<int> key_dist(0, KEY_SPACE - 1);
+      std::uniform_int_distribution<int> op_dist(0, 9);
+
+      while (!start)
+        std::this_thread::yield();
+
+      for (int i = 0; i < OPS_PER_THREAD; ++i) {
+        std::string key = "key_" + std::to_string(key_dist(rng));
+        if (op_dist(rng) == 0) {
+          engine.write(key, "value", (int64_t)i * num_threads + t + 1);
+        } else {
+          engine.read(key);
+        }
+      }
+    });
+  }
+
+  auto start_time = std::chrono::steady_clock::now();
+  start = true;
+  for (auto &t : threads)
+    t.join();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start_time;
+
+  return (double)num_threads * OPS_PER_THREAD / elapsed.count();
+}
+
+void preload(StorageEngine &engine) {
+  for (int i = 0; i < KEY_SPACE; ++i)
+    engine.write("key_" + std::to_string(i), "value", 0);
+}
+
+size_t resident_bytes() {
+  FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (!statm)
+    return 0;
+  unsigned long size = 0, resident = 0;
+  int fields = std::fscanf(statm, "%lu %lu", &size, &resident);
+  std::fclose(statm);
+  return fields == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+/*
+ * Fills an engine with MEMORY_KEYS 12 byte keys and prints what each
+ * cost, both as resident memory grown and as the engine's own accounting.
+ * Runs in a child process so the heap left by one engine does not hide
+ * the growth of the next.
+ */
+void measure(const std::string &name,
+             const std::function<std::unique_ptr<StorageEngine>()> &make) {
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid != 0) {
+    waitpid(pid, nullptr, 0);
+    return;
+  }
+
+  std::string value(MEMORY_VALUE_SIZE, 'v');
+  size_t before = resident_bytes();
+  std::unique_ptr<StorageEngine> engine = make();
+  char key[16];
+  for (int i = 0; i < MEMORY_KEYS; ++i) {
+    std::snprintf(key, sizeof(key), "key_%08d", i);
+    engine->write(key, value, 1);
+  }
+  double resident = double(resident_bytes() - before) / MEMORY_KEYS;
+  StorageEngine::MemoryStats memory = engine->memory_stats();
+
+  std::cout << std::setw(10) << name << std::setw(16) << std::fixed
+            << std::setprecision(1) << resident << std::setw(16);
+  if (memory.bytes > 0)
+    std::cout << double(memory.bytes) / MEMORY_KEYS;
+  else
+    std::cout << "-";
+  std::cout << std::endl;
+  _exit(0);
+}
+
+int main() {
+  std::cout << "==========================================\n"
+            << "  Storage Engine Benchmark (90% reads)\n"
+            << "  Key space:  " << KEY_SPACE << "\n"
+            << "  Ops/thread: " << OPS_PER_THREAD << "\n"
+            << "==========================================" << std::endl;
+
+  std::cout << std::setw(8) << "Threads" << std::setw(16) << "Map OPS"
+            << std::setw(16) << "Sharded OPS" << std::setw(10) << "Speedup"
+            << std::endl;
+
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    MapEngine map_engine;
+    ShardedEngine sharded_engine;
+    preload(map_engine);
+    preload(sharded_engine);
+
+    double map_ops = run(map_engine, threads);
+    double sharded_ops = run(sharded_engine, threads);
+
+    std::cout << std::setw(8) << threads << std::setw(16) << std::fixed
+              << std::setprecision(0) << map_ops << std::setw(16)
+              << sharded_ops << std::setw(9) << std::setprecision(2)
+              << sharded_ops / map_ops << "x" << std::endl;
+  }
+
+  std::cout << "\nMemory per key (" << MEMORY_KEYS << " keys, 12 byte keys, "
+            << MEMORY_VALUE_SIZE << " byte values)\n"
+            << std::setw(10) << "Engine" << std::setw(16) << "Resident B"
+            << std::setw(16) << "Accounted B" << std::endl;
+  measure("Map", [] { return std::make_unique<MapEngine>(); });
+  measure("Sharded", [] { return std::make_unique<ShardedEngine>(); });
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WriteAheadLog.h"
+
+/*
+ * Measures write throughput and latency of the write ahead log
+ * under each sync policy.
+ */
+
+struct Result {
+  double ops;
+  double p50_us;
+  double p99_us;
+};
+
+Result run(SyncPolicy policy, int num_threads, int ops_per_thread,
+           int value_size) {
+  std::string path = "wal_bench.log";
+  WriteAheadLog::remove(path);
+
+  std::vector<std::vector<double>> latencies(num_threads);
+  std::string value(value_size, 'x');
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    WriteAheadLog wal(path, policy, 500);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t]() {
+        latencies[t].reserve(ops_per_thread);
+        for (int i = 0; i < ops_per_thread; ++i) {
+          std::string key = "key_" + std::to_string(t) + "_" + std::to_string(i);
+          auto op_start = std::chrono::steady_clock::now();
+          wal.append(key, value, i);
+          std::chrono::duration<double, std::micro> op_time =
+              std::chrono::steady_clock::now() - op_start;
+          latencies[t].push_back(op_time.count());
+        }
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  WriteAheadLog::remove(path);
+
+  std::vector<double> all;
+  for (auto &l : latencies)
+    all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+
+  return {all.size() / elapsed.count(), all[all.size() / 2],
+          all[all.size() * 99 / 100]};
+}
+
+int main(int argc, char **argv) {
+  int num_threads = (argc >= 2) ? std::stoi(argv[1]) : 16;
+  int ops_per_thread = (argc >= 3) ? std::stoi(argv[2]) : 2000;
+  int value_size = (argc >= 4) ? std::stoi(argv[3]) : 100;
+
+  std::cout << "==========================================\n"
+            << "  Write Ahead Log Benchmark\n"
+            << "  Threads:    " << num_threads << "\n"
+            << "  Ops/thread: " << ops_per_thread << "\n"
+            << "  Value size: " << value_size << " bytes\n"
+            << "==========================================" << std::endl;
+
+  std::cout << std::setw(8) << "Policy" << std::setw(14) << "OPS"
+            << std::setw(14) << "p50 (us)" << std::setw(14) << "p99 (us)"
+            << std::endl;
+
+  std::vector<std::pair<std::string, SyncPolicy>> policies = {
+      {"none", SyncPolicy::NONE},
+      {"group", SyncPolicy::GROUP},
+      {"always", SyncPolicy::ALWAYS}};
+
+  for (const auto &[name, policy] : policies) {
+    Result r = run(policy, num_threads, ops_per_thread, value_size);
+    std::cout << std::setw(8) << name << std::setw(14) << std::fixed
+              << std::setprecision(0) << r.ops << std::setw(14)
+              << std::setprecision(1) << r.p50_us << std::setw(14)
+              << r.p99_us << std::endl;
+  }
+
+  return 0;
+}
@@ -1,6 +1,6 @@
 #include "Client.h"
+#include "Log.h"
 #include <cstdarg>
-#include <iostream>
 
 using grpc::ClientContext;
 using grpc::Status;
@@ -8,10 +8,65 @@ using grpc::Status;
 using namespace tinykv;
 using Val_TS = std::pair<std::string, int64_t>; // a timestamped string value
 
+const std::string Client::PUT_METHOD = "/tinykv.TinyKV/Put";
+const std::string Client::GET_METHOD = "/tinykv.TinyKV/Get";
+const std::string Client::REPLICATE_BATCH_METHOD =
+    "/tinykv.TinyKV/ReplicateBatch";
+const std::string Client::MULTI_PUT_METHOD = "/tinykv.TinyKV/MultiPut";
+
 Client::Client(std::shared_ptr<grpc::Channel> channel)
-    : stub_(tinykv::TinyKV::NewStub(channel)) {}
+    : stub_(tinykv::TinyKV::NewStub(channel)), generic_stub_(channel) {}
+
+std::shared_ptr<grpc::Channel> Client::connect(const std::string &address) {
+  grpc::ChannelArguments args;
+  args.SetMaxReceiveMessageSize(-1);
+  return grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(),
+                                   args);
+}
+
+Client::InFlight Client::begin_call(ClientContext *context) {
+  if (call_timeout.count() > 0)
+    context->set_deadline(std::chrono::system_clock::now() + call_timeout);
+  return InFlight(in_flight_calls);
+}
+
+std::string Client::decode(const std::string &val) {
+  std::string raw;
+  return DecompressValue(val, &raw) ? raw : val;
+}
+
+Status Client::send_put(PutRequest &request, const std::string &val,
+                        PutResponse *reply) {
+  std::string encoded;
+  bool compressed = CompressValue(val, compression_threshold, &encoded);
+  const std::string &sent = compressed ? encoded : val;
+  ClientContext context;
 
-bool Client::ping(bool is_verbose, std::string sender_id) {
+  if (sent.size() < PUT_STREAM_THRESHOLD) {
+    if (compressed)
+      request.set_val(std::move(encoded));
+    else
+      request.set_val(val);
+    return stub_->Put(&context, request, reply);
+  }
+
+  // The value is never copied whole into a message, only a chunk at a time
+  auto writer = stub_->PutStream(&context, reply);
+  PutChunk chunk;
+  *chunk.mutable_header() = request;
+  chunk.set_size(sent.size());
+  for (size_t offset = 0; offset < sent.size(); offset += PUT_CHUNK_SIZE) {
+    chunk.set_data(sent.data() + offset,
+                   std::min(PUT_CHUNK_SIZE, sent.size() - offset));
+    if (!writer->Write(chunk))
+      break;
+    chunk.clear_header();
+  }
+  writer->WritesDone();
+  return writer->Finish();
+}
+
+bool Client::ping(bool is_verbose, const std::string &sender_id) {
   PingRequest request;
   PingResponse reply;
   ClientContext context;
@@ -22,38 +77,40 @@ bool Client::ping(bool is_verbose, std::string sender_id) {
 
   if (status.ok()) {
     if (is_verbose)
-      std::cout << "[Client] Ping success! Server is ready." << std::endl;
+      LOG_INFO("Client", "Ping success! Server is ready.");
     return reply.is_ready();
   } else {
     if (is_verbose)
-      std::cout << "[Client] Ping failed." << std::endl;
+      LOG_WARN("Client", "Ping failed.");
     return false;
   }
 }
-bool Client::put(std::string key, std::string val, std::string sender_id,
-                 int replication_factor, int64_t timestamp) {
+bool Client::put(const std::string &key, const std::string &val,
+                 const std::string &sender_id,
+                 int replication_factor, int64_t timestamp,
+                 int write_quorum, int64_t ttl_ms) {
   PutRequest request;
   request.set_key(key);
-  request.set_val(val);
   request.set_sender_id(sender_id);
   request.set_replication_factor(replication_factor);
   request.set_timestamp(timestamp);
+  request.set_write_quorum(write_quorum);
+  request.set_ttl_ms(ttl_ms);
 
   PutResponse reply;
-  ClientContext context;
-
-  Status status = stub_->Put(&context, request, &reply);
+  Status status = send_put(request, val, &reply);
 
   if (status.ok()) {
-    std::cout << "[Client] PutRequest success! Server is ready." << std::endl;
+    LOG_DEBUG("Client", "PutRequest success! Server is ready.");
     return reply.operation_success();
   } else {
-    std::cout << "[Client] PutRequest failed." << std::endl;
+    LOG_WARN("Client", "PutRequest failed.");
     return false;
   }
 }
 
-Val_TS Client::get(std::string key, std::string sender_id, int quorum_size) {
+Val_TS Client::get(const std::string &key, const std::string &sender_id,
+                   int quorum_size) {
   GetRequest request;
   request.set_key(key);
   request.set_sender_id(sender_id);
@@ -65,9 +122,493 @@ Val_TS Client::get(std::string key, std::string sender_id, int quorum_size) {
   Status status = stub_->Get(&context, request, &reply);
 
   if (status.ok()) {
-    return {reply.val(), reply.timestamp()};
+    return {decode(reply.val()), reply.timestamp()};
   } else {
-    std::cerr << "[Client] GetRequest failed." << std::endl;
+    LOG_WARN("Client", "GetRequest failed.");
     return {"", -1}; // Error indicator
   }
 }
+
+void Client::put_async(const std::string &key, const std::string &val,
+                       const std::string &sender_id, int replication_factor,
+                       int64_t timestamp, int write_quorum,
+                       std::function<void(bool ok, bool success)> callback) {
+  // The call state must outlive this function, it is freed by the callback
+  struct Call {
+    PutRequest request;
+    PutResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request.set_key(key);
+  std::string encoded;
+  if (CompressValue(val, compression_threshold, &encoded))
+    call->request.set_val(std::move(encoded));
+  else
+    call->request.set_val(val);
+  call->request.set_sender_id(sender_id);
+  call->request.set_replication_factor(replication_factor);
+  call->request.set_timestamp(timestamp);
+  call->request.set_write_quorum(write_quorum);
+
+  stub_->async()->Put(&call->context, &call->request, &call->reply,
+                      [call, callback](Status status) {
+                        callback(status.ok(), call->reply.operation_success());
+                        delete call;
+                      });
+}
+
+void Client::put_async(PutRequest request,
+                       std::function<void(bool ok, bool success)> callback) {
+  struct Call {
+    PutRequest request;
+    PutResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request = std::move(request);
+
+  stub_->async()->Put(&call->context, &call->request, &call->reply,
+                      [call, callback](Status status) {
+                        callback(status.ok(), call->reply.operation_success());
+                        delete call;
+                      });
+}
+
+void Client::put_async(grpc::ByteBuffer request,
+                       std::function<void(bool ok, bool success)> callback) {
+  call_raw_async(PUT_METHOD, request,
+                 [callback](Status status, const grpc::ByteBuffer &reply) {
+                   PutResponse response;
+                   grpc::ByteBuffer buffer(reply);
+                   bool parsed =
+                       status.ok() && grpc::SerializationTraits<
+                                          PutResponse>::Deserialize(&buffer,
+                                                                    &response)
+                                          .ok();
+                   callback(parsed, response.operation_success());
+                 });
+}
+
+void Client::call_raw_async(
+    const std::string &method, grpc::ByteBuffer request,
+    std::function<void(Status status, const grpc::ByteBuffer &reply)>
+        callback) {
+  struct Call {
+    grpc::ByteBuffer request;
+    grpc::ByteBuffer reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request.Swap(&request);
+
+  generic_stub_.UnaryCall(&call->context, method, grpc::StubOptions(),
+                          &call->request, &call->reply,
+                          [call, callback](Status status) {
+                            callback(status, call->reply);
+                            delete call;
+                          });
+}
+
+void Client::get_async(const std::string &key, const std::string &sender_id,
+                       int quorum_size,
+                       std::function<void(bool ok, Val_TS value)> callback) {
+  struct Call {
+    GetRequest request;
+    GetResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request.set_key(key);
+  call->request.set_sender_id(sender_id);
+  call->request.set_quorum_size(quorum_size);
+
+  stub_->async()->Get(&call->context, &call->request, &call->reply,
+                      [call, callback](Status status) {
+                        if (status.ok()) {
+                          callback(true, {decode(call->reply.val()),
+                                          call->reply.timestamp()});
+                        } else {
+                          callback(false, {"", -1});
+                        }
+                        delete call;
+                      });
+}
+
+void Client::ping_async(
+    PingRequest request, std::chrono::milliseconds timeout,
+    std::function<void(bool ok, const PingResponse &reply)> callback) {
+  struct Call {
+    PingRequest request;
+    PingResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request = std::move(request);
+  call->context.set_deadline(std::chrono::system_clock::now() + timeout);
+
+  stub_->async()->Ping(&call->context, &call->request, &call->reply,
+                       [call, callback](Status status) {
+                         callback(status.ok() && call->reply.is_ready(),
+                                  call->reply);
+                         delete call;
+                       });
+}
+
+void Client::ping_req_async(
+    PingReqRequest request, std::chrono::milliseconds timeout,
+    std::function<void(bool ok, const PingResponse &reply)> callback) {
+  struct Call {
+    PingReqRequest request;
+    PingResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request = std::move(request);
+  call->context.set_deadline(std::chrono::system_clock::now() + timeout);
+
+  stub_->async()->PingReq(&call->context, &call->request, &call->reply,
+                          [call, callback](Status status) {
+                            callback(status.ok() && call->reply.is_ready(),
+                                     call->reply);
+                            delete call;
+                          });
+}
+
+void Client::get_async(
+    GetRequest request,
+    std::function<void(bool ok, const GetResponse &reply)> callback) {
+  struct Call {
+    GetRequest request;
+    GetResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request = std::move(request);
+
+  stub_->async()->Get(&call->context, &call->request, &call->reply,
+                      [call, callback](Status status) {
+                        callback(status.ok(), call->reply);
+                        delete call;
+                      });
+}
+
+MultiPutRequest Client::multi_put_request(
+    const std::vector<std::pair<std::string, std::string>> &entries,
+    const std::string &sender_id, int replication_factor, int write_quorum) {
+  MultiPutRequest request;
+  for (const auto &[key, val] : entries) {
+    KeyValue *entry = request.add_entries();
+    entry->set_key(key);
+    std::string encoded;
+    if (CompressValue(val, compression_threshold, &encoded))
+      entry->set_val(std::move(encoded));
+    else
+      entry->set_val(val);
+  }
+  request.set_sender_id(sender_id);
+  request.set_replication_factor(replication_factor);
+  request.set_write_quorum(write_quorum);
+  return request;
+}
+
+std::vector<bool> Client::multi_put(
+    const std::vector<std::pair<std::string, std::string>> &entries,
+    const std::string &sender_id, int replication_factor, int write_quorum) {
+  MultiPutRequest request =
+      multi_put_request(entries, sender_id, replication_factor, write_quorum);
+
+  MultiPutResponse reply;
+  ClientContext context;
+
+  Status status = stub_->MultiPut(&context, request, &reply);
+
+  std::vector<bool> results(entries.size(), false);
+  if (!status.ok()) {
+    LOG_WARN("Client", "MultiPutRequest failed.");
+    return results;
+  }
+  for (int i = 0; i < reply.operation_success_size() && i < (int)results.size();
+       ++i)
+    results[i] = reply.operation_success(i);
+  return results;
+}
+
+std::vector<Val_TS> Client::multi_get(const std::vector<std::string> &keys,
+                                      const std::string &sender_id,
+                                      int quorum_size) {
+  MultiGetRequest request;
+  for (const std::string &key : keys)
+    request.add_keys(key);
+  request.set_sender_id(sender_id);
+  request.set_quorum_size(quorum_size);
+
+  MultiGetResponse reply;
+  ClientContext context;
+
+  Status status = stub_->MultiGet(&context, request, &reply);
+
+  std::vector<Val_TS> results(keys.size(), {"", -1});
+  if (!status.ok()) {
+    LOG_WARN("Client", "MultiGetRequest failed.");
+    return results;
+  }
+  for (int i = 0; i < reply.entries_size() && i < (int)results.size(); ++i)
+    results[i] = {decode(reply.entries(i).val()), reply.entries(i).timestamp()};
+  return results;
+}
+
+Status Client::put_routed(const std::string &key, const std::string &val,
+                          int replication_factor, int write_quorum,
+                          bool *success, int64_t ttl_ms) {
+  PutRequest request;
+  request.set_key(key);
+  request.set_sender_id("client");
+  request.set_replication_factor(replication_factor);
+  request.set_write_quorum(write_quorum);
+  request.set_routed(true);
+  request.set_ttl_ms(ttl_ms);
+
+  PutResponse reply;
+  Status status = send_put(request, val, &reply);
+  *success = status.ok() && reply.operation_success();
+  return status;
+}
+
+Status Client::get_routed(const std::string &key, int quorum_size,
+                          Val_TS *value) {
+  GetRequest request;
+  request.set_key(key);
+  request.set_sender_id("client");
+  request.set_quorum_size(quorum_size);
+  request.set_routed(true);
+
+  GetResponse reply;
+  ClientContext context;
+
+  Status status = stub_->Get(&context, request, &reply);
+  if (status.ok())
+    *value = {decode(reply.val()), reply.timestamp()};
+  else
+    *value = {"", -1};
+  return status;
+}
+
+Status Client::del(const DeleteRequest &request, DeleteResponse *reply) {
+  ClientContext context;
+  return stub_->Delete(&context, request, reply);
+}
+
+std::unique_ptr<grpc::ClientReader<ScanResponse>>
+Client::scan(ClientContext *context, const ScanRequest &request) {
+  return stub_->Scan(context, request);
+}
+
+std::unique_ptr<grpc::ClientWriter<PutChunk>>
+Client::put_stream(ClientContext *context, PutResponse *reply) {
+  return stub_->PutStream(context, reply);
+}
+
+bool Client::membership(std::vector<std::string> *nodes, int *virtual_nodes) {
+  MembershipRequest request;
+  request.set_sender_id("client");
+
+  MembershipResponse reply;
+  ClientContext context;
+
+  Status status = stub_->GetMembership(&context, request, &reply);
+  if (!status.ok()) {
+    LOG_WARN("Client", "MembershipRequest failed.");
+    return false;
+  }
+
+  nodes->assign(reply.nodes().begin(), reply.nodes().end());
+  *virtual_nodes = reply.virtual_nodes();
+  return true;
+}
+
+Status Client::ring(MembershipResponse *reply) {
+  MembershipRequest request;
+  request.set_sender_id("client");
+  ClientContext context;
+  return stub_->GetMembership(&context, request, reply);
+}
+
+Status Client::join(const std::string &address, RingResponse *reply,
+                    bool forwarded) {
+  JoinRequest request;
+  request.set_address(address);
+  request.set_forwarded(forwarded);
+  ClientContext context;
+  return stub_->Join(&context, request, reply);
+}
+
+Status Client::leave(const std::string &address, RingResponse *reply,
+                     bool forwarded) {
+  LeaveRequest request;
+  request.set_address(address);
+  request.set_forwarded(forwarded);
+  ClientContext context;
+  return stub_->Leave(&context, request, reply);
+}
+
+Status Client::stats(StatsResponse *reply) {
+  StatsRequest request;
+  ClientContext context;
+  return stub_->Stats(&context, request, reply);
+}
+
+Status Client::update_ring(const RingUpdate &update,
+                           std::chrono::milliseconds timeout,
+                           RingResponse *reply) {
+  ClientContext context;
+  context.set_deadline(std::chrono::system_clock::now() + timeout);
+  return stub_->UpdateRing(&context, update, reply);
+}
+
+Status Client::handoff_done(const HandoffDoneRequest &request) {
+  HandoffDoneResponse reply;
+  ClientContext context;
+  return stub_->HandoffDone(&context, request, &reply);
+}
+
+Status Client::merkle_digest(const DigestRequest &request,
+                             DigestResponse *reply) {
+  ClientContext context;
+  return stub_->MerkleDigest(&context, request, reply);
+}
+
+Status Client::sync_range(const SyncRangeRequest &request,
+                          SyncRangeResponse *reply) {
+  ClientContext context;
+  return stub_->SyncRange(&context, request, reply);
+}
+
+void Client::replicate_batch_async(
+    grpc::ByteBuffer request, size_t writes,
+    std::function<void(bool ok, std::vector<bool> success)> callback) {
+  call_raw_async(
+      REPLICATE_BATCH_METHOD, request,
+      [writes, callback](Status status, const grpc::ByteBuffer &reply) {
+        ReplicateBatchResponse response;
+        grpc::ByteBuffer buffer(reply);
+        bool parsed =
+            status.ok() &&
+            grpc::SerializationTraits<ReplicateBatchResponse>::Deserialize(
+                &buffer, &response)
+                .ok();
+        std::vector<bool> success(writes, false);
+        for (int i = 0; parsed && i < response.operation_success_size() &&
+                        i < (int)writes;
+             ++i)
+          success[i] = response.operation_success(i);
+        callback(parsed, std::move(success));
+      });
+}
+
+void Client::invalidate_async(InvalidateRequest request) {
+  struct Call {
+    InvalidateRequest request;
+    InvalidateResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request = std::move(request);
+
+  stub_->async()->Invalidate(&call->context, &call->request, &call->reply,
+                             [call](Status) { delete call; });
+}
+
+void Client::multi_put_async(
+    MultiPutRequest request,
+    std::function<void(bool ok, std::vector<bool> success)> callback) {
+  struct Call {
+    MultiPutRequest request;
+    MultiPutResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request = std::move(request);
+
+  stub_->async()->MultiPut(
+      &call->context, &call->request, &call->reply,
+      [call, callback](Status status) {
+        std::vector<bool> success(call->request.entries_size(), false);
+        if (status.ok()) {
+          for (int i = 0; i < call->reply.operation_success_size() &&
+                          i < (int)success.size();
+               ++i)
+            success[i] = call->reply.operation_success(i);
+        }
+        callback(status.ok(), std::move(success));
+        delete call;
+      });
+}
+
+void Client::multi_put_async(
+    grpc::ByteBuffer request, size_t entries,
+    std::function<void(bool ok, std::vector<bool> success)> callback) {
+  call_raw_async(
+      MULTI_PUT_METHOD, request,
+      [entries, callback](Status status, const grpc::ByteBuffer &reply) {
+        MultiPutResponse response;
+        grpc::ByteBuffer buffer(reply);
+        bool parsed =
+            status.ok() &&
+            grpc::SerializationTraits<MultiPutResponse>::Deserialize(
+                &buffer, &response)
+                .ok();
+        std::vector<bool> success(entries, false);
+        for (int i = 0; parsed && i < response.operation_success_size() &&
+                        i < (int)entries;
+             ++i)
+          success[i] = response.operation_success(i);
+        callback(parsed, std::move(success));
+      });
+}
+
+void Client::multi_get_async(
+    MultiGetRequest request,
+    std::function<void(bool ok, std::vector<Val_TS> values)> callback) {
+  struct Call {
+    MultiGetRequest request;
+    MultiGetResponse reply;
+    ClientContext context;
+    InFlight in_flight;
+  };
+  auto call = new Call();
+  call->in_flight = begin_call(&call->context);
+  call->request = std::move(request);
+
+  stub_->async()->MultiGet(
+      &call->context, &call->request, &call->reply,
+      [call, callback](Status status) {
+        std::vector<Val_TS> values(call->request.keys_size(), {"", -1});
+        if (status.ok()) {
+          for (int i = 0;
+               i < call->reply.entries_size() && i < (int)values.size(); ++i)
+            values[i] = {call->reply.entries(i).val(),
+                         call->reply.entries(i).timestamp()};
+        }
+        callback(status.ok(), std::move(values));
+        delete call;
+      });
+}
@@ -1,21 +1,302 @@
 #pragma once
+#include "Compression.h"
 #include "tinykv.grpc.pb.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <grpcpp/generic/generic_stub.h>
 #include <grpcpp/grpcpp.h>
 #include <memory>
+#include <vector>
 
 using Val_TS = std::pair<std::string, int64_t>; // a timestamped string value
 
+/*
+ * Values are compressed and decompressed by the client, see Compression.h.
+ * A value whose sent form is PUT_STREAM_THRESHOLD bytes or more goes out
+ * as a PutStream of PUT_CHUNK_SIZE chunks instead of one message.
+ * Variants that take or return whole protobuf messages are for peers and
+ * pass values through untouched.
+ */
 class Client {
 public:
   Client(std::shared_ptr<grpc::Channel> channel);
 
-  bool ping(bool is_verbose, std::string sender_id);
+  // Full method names, for calls made on serialized messages
+  static const std::string PUT_METHOD;
+  static const std::string GET_METHOD;
+  static const std::string REPLICATE_BATCH_METHOD;
+  static const std::string MULTI_PUT_METHOD;
 
-  bool put(std::string key, std::string val, std::string sender_id,
-           int replication_factor = 3, int64_t timestamp = 0);
+  static constexpr size_t PUT_STREAM_THRESHOLD = 1024 * 1024;
+  static constexpr size_t PUT_CHUNK_SIZE = 64 * 1024;
 
-  Val_TS get(std::string key, std::string sender_id, int quorum_size = 1);
+  /*
+   * Channel for a client, it accepts replies of any size
+   */
+  static std::shared_ptr<grpc::Channel> connect(const std::string &address);
+
+  /*
+   * Values this large or larger are compressed, 0 disables compression
+   */
+  void set_compression_threshold(size_t threshold) {
+    compression_threshold = threshold;
+  }
+
+  /*
+   * Deadline for the async calls, 0 for none. Gossip probes keep their
+   * own timeout.
+   */
+  void set_call_timeout(std::chrono::milliseconds timeout) {
+    call_timeout = timeout;
+  }
+
+  /*
+   * Async calls sent on this client that have not completed yet
+   */
+  int in_flight() const {
+    return in_flight_calls->load(std::memory_order_relaxed);
+  }
+
+  bool ping(bool is_verbose, const std::string &sender_id);
+
+  /*
+   * A ttl_ms above 0 makes the key expire that many milliseconds after
+   * the write
+   */
+  bool put(const std::string &key, const std::string &val,
+           const std::string &sender_id,
+           int replication_factor = 3, int64_t timestamp = 0,
+           int write_quorum = 0, int64_t ttl_ms = 0);
+
+  Val_TS get(const std::string &key, const std::string &sender_id,
+             int quorum_size = 1);
+
+  /*
+   * Non-blocking variants. The callback runs on a gRPC thread once the
+   * RPC completes, and receives whether the RPC itself succeeded.
+   */
+  void put_async(const std::string &key, const std::string &val,
+                 const std::string &sender_id, int replication_factor,
+                 int64_t timestamp, int write_quorum,
+                 std::function<void(bool ok, bool success)> callback);
+
+  void get_async(const std::string &key, const std::string &sender_id,
+                 int quorum_size,
+                 std::function<void(bool ok, Val_TS value)> callback);
+
+  /*
+   * Batched operations, results are returned in request order. The node
+   * splits the batch by owner and forwards one sub-batch per owner.
+   */
+  std::vector<bool>
+  multi_put(const std::vector<std::pair<std::string, std::string>> &entries,
+            const std::string &sender_id, int replication_factor = 3,
+            int write_quorum = 0);
+
+  std::vector<Val_TS> multi_get(const std::vector<std::string> &keys,
+                                const std::string &sender_id,
+                                int quorum_size = 1);
+
+  /*
+   * The request multi_put sends, with its values compressed. For sending
+   * a client's batch through multi_put_async.
+   */
+  tinykv::MultiPutRequest multi_put_request(
+      const std::vector<std::pair<std::string, std::string>> &entries,
+      const std::string &sender_id, int replication_factor,
+      int write_quorum);
+
+  /*
+   * Used by clients that route keys themselves. The node answers
+   * FAILED_PRECONDITION instead of forwarding if it does not own the key.
+   */
+  grpc::Status put_routed(const std::string &key, const std::string &val,
+                          int replication_factor, int write_quorum,
+                          bool *success, int64_t ttl_ms = 0);
+
+  grpc::Status get_routed(const std::string &key, int quorum_size,
+                          Val_TS *value);
+
+  /*
+   * Deletes a key. Any node accepts the request and passes it on to the
+   * key's owner.
+   */
+  grpc::Status del(const tinykv::DeleteRequest &request,
+                   tinykv::DeleteResponse *reply);
+
+  /*
+   * Opens a Scan stream. The caller reads it until Read() returns false
+   * and then calls Finish(). Any node accepts a scan and merges what every
+   * node holds.
+   */
+  std::unique_ptr<grpc::ClientReader<tinykv::ScanResponse>>
+  scan(grpc::ClientContext *context, const tinykv::ScanRequest &request);
+
+  /*
+   * Opens a PutStream, for relaying the chunks of a client's put
+   */
+  std::unique_ptr<grpc::ClientWriter<tinykv::PutChunk>>
+  put_stream(grpc::ClientContext *context, tinykv::PutResponse *reply);
+
+  /*
+   * Restores a value as the client wrote it
+   */
+  static std::string decode(const std::string &val);
+
+  /*
+   * Fetches the node addresses and virtual node count of the ring
+   */
+  bool membership(std::vector<std::string> *nodes, int *virtual_nodes);
+
+  /*
+   * Ring epoch, members and whether a rebalance is still moving data
+   */
+  grpc::Status ring(tinykv::MembershipResponse *reply);
+
+  /*
+   * Asks the cluster to add or remove a node. Any member accepts the
+   * request and hands it to the node that serializes ring changes.
+   */
+  grpc::Status join(const std::string &address, tinykv::RingResponse *reply,
+                    bool forwarded = false);
+
+  grpc::Status leave(const std::string &address, tinykv::RingResponse *reply,
+                     bool forwarded = false);
+
+  /*
+   * Counters, latencies and peer states the node has recorded
+   */
+  grpc::Status stats(tinykv::StatsResponse *reply);
+
+  /*
+   * Ring changes between peers, abandoned after timeout
+   */
+  grpc::Status update_ring(const tinykv::RingUpdate &update,
+                           std::chrono::milliseconds timeout,
+                           tinykv::RingResponse *reply);
+
+  grpc::Status handoff_done(const tinykv::HandoffDoneRequest &request);
+
+  /*
+   * Anti-entropy exchanges between peers
+   */
+  grpc::Status merkle_digest(const tinykv::DigestRequest &request,
+                             tinykv::DigestResponse *reply);
+
+  grpc::Status sync_range(const tinykv::SyncRangeRequest &request,
+                          tinykv::SyncRangeResponse *reply);
+
+  /*
+   * Sends a fully built request, for fields the other variants do not set
+   */
+  void put_async(tinykv::PutRequest request,
+                 std::function<void(bool ok, bool success)> callback);
+
+  /*
+   * Sends a PutRequest that is already serialized, e.g. one whose value
+   * slice references a stored buffer
+   */
+  void put_async(grpc::ByteBuffer request,
+                 std::function<void(bool ok, bool success)> callback);
+
+  /*
+   * Calls method with a serialized request and hands back the serialized
+   * reply, so a node can relay a call without parsing or rebuilding it
+   */
+  void call_raw_async(
+      const std::string &method, grpc::ByteBuffer request,
+      std::function<void(grpc::Status status, const grpc::ByteBuffer &reply)>
+          callback);
+
+  /*
+   * Gossip probes, abandoned after timeout
+   */
+  void ping_async(
+      tinykv::PingRequest request, std::chrono::milliseconds timeout,
+      std::function<void(bool ok, const tinykv::PingResponse &reply)>
+          callback);
+
+  void ping_req_async(
+      tinykv::PingReqRequest request, std::chrono::milliseconds timeout,
+      std::function<void(bool ok, const tinykv::PingResponse &reply)>
+          callback);
+
+  void get_async(tinykv::GetRequest request,
+                 std::function<void(bool ok, const tinykv::GetResponse &reply)>
+                     callback);
+
+  /*
+   * Sends a serialized ReplicateBatchRequest of writes entries, success
+   * has one flag per write
+   */
+  void replicate_batch_async(
+      grpc::ByteBuffer request, size_t writes,
+      std::function<void(bool ok, std::vector<bool> success)> callback);
+
+  /*
+   * Tells a node caching a key that it changed, nobody waits for the
+   * answer
+   */
+  void invalidate_async(tinykv::InvalidateRequest request);
+
+  void multi_put_async(
+      tinykv::MultiPutRequest request,
+      std::function<void(bool ok, std::vector<bool> success)> callback);
+
+  /*
+   * Sends a serialized MultiPutRequest of entries entries, e.g. one whose
+   * values reference stored buffers
+   */
+  void multi_put_async(
+      grpc::ByteBuffer request, size_t entries,
+      std::function<void(bool ok, std::vector<bool> success)> callback);
+
+  void multi_get_async(
+      tinykv::MultiGetRequest request,
+      std::function<void(bool ok, std::vector<Val_TS> values)> callback);
 
 private:
   std::unique_ptr<tinykv::TinyKV::Stub> stub_;
+  grpc::GenericStub generic_stub_;
+  size_t compression_threshold = DEFAULT_COMPRESSION_THRESHOLD;
+  std::chrono::milliseconds call_timeout{0};
+  // Shared with the calls, which may complete after the client is gone
+  std::shared_ptr<std::atomic<int>> in_flight_calls =
+      std::make_shared<std::atomic<int>>(0);
+
+  /*
+   * Counts an async call in flight for as long as its state lives
+   */
+  class InFlight {
+  public:
+    InFlight() = default;
+    explicit InFlight(std::shared_ptr<std::atomic<int>> count)
+        : count(std::move(count)) {
+      this->count->fetch_add(1, std::memory_order_relaxed);
+    }
+    InFlight(const InFlight &) = delete;
+    InFlight &operator=(InFlight &&other) {
+      std::swap(count, other.count);
+      return *this;
+    }
+    ~InFlight() {
+      if (count)
+        count->fetch_sub(1, std::memory_order_relaxed);
+    }
+
+  private:
+    std::shared_ptr<std::atomic<int>> count;
+  };
+
+  /*
+   * Applies the call timeout to an async call and counts it in flight
+   */
+  InFlight begin_call(grpc::ClientContext *context);
+
+  /*
+   * Sends a client's put of val, compressed and chunked as needed
+   */
+  grpc::Status send_put(tinykv::PutRequest &request, const std::string &val,
+                        tinykv::PutResponse *reply);
 };
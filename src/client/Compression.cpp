@@ -0,0 +1,87 @@
+#include "Compression.h"
+#include "Log.h"
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+
+static const char MARKER[4] = {'\xFF', 'T', 'K', 'Z'};
+static const size_t METHOD_OFFSET = sizeof(MARKER);
+static const size_t HEADER_SIZE = METHOD_OFFSET + 1;
+static const size_t DEFLATE_HEADER_SIZE = HEADER_SIZE + sizeof(uint32_t);
+
+enum class Method : uint8_t { STORED = 0, DEFLATE = 1 };
+
+static bool HasMarker(std::string_view value) {
+  return value.size() >= HEADER_SIZE &&
+         std::memcmp(value.data(), MARKER, sizeof(MARKER)) == 0;
+}
+
+static void AppendHeader(Method method, std::string *out) {
+  out->append(MARKER, sizeof(MARKER));
+  out->push_back(static_cast<char>(method));
+}
+
+bool CompressValue(const std::string &val, size_t threshold,
+                   std::string *out) {
+  if (threshold > 0 && val.size() >= threshold && val.size() <= UINT32_MAX) {
+    std::string frame;
+    uLongf size = compressBound(val.size());
+    frame.resize(DEFLATE_HEADER_SIZE + size);
+    int level = val.size() < COMPRESSION_LEVEL_SWITCH ? Z_BEST_SPEED
+                                                      : Z_DEFAULT_COMPRESSION;
+    int result = compress2(
+        reinterpret_cast<Bytef *>(frame.data() + DEFLATE_HEADER_SIZE), &size,
+        reinterpret_cast<const Bytef *>(val.data()), val.size(), level);
+
+    if (result == Z_OK &&
+        DEFLATE_HEADER_SIZE + size <= val.size() - val.size() / 8) {
+      frame.resize(DEFLATE_HEADER_SIZE + size);
+      std::memcpy(frame.data(), MARKER, sizeof(MARKER));
+      frame[METHOD_OFFSET] = static_cast<char>(Method::DEFLATE);
+      uint32_t raw_size = val.size();
+      std::memcpy(frame.data() + HEADER_SIZE, &raw_size, sizeof(raw_size));
+      *out = std::move(frame);
+      return true;
+    }
+  }
+
+  if (!HasMarker(val))
+    return false;
+  out->clear();
+  out->reserve(HEADER_SIZE + val.size());
+  AppendHeader(Method::STORED, out);
+  *out += val;
+  return true;
+}
+
+bool DecompressValue(std::string_view val, std::string *out) {
+  if (!HasMarker(val))
+    return false;
+
+  switch (static_cast<Method>(val[METHOD_OFFSET])) {
+  case Method::STORED:
+    out->assign(val.substr(HEADER_SIZE));
+    return true;
+  case Method::DEFLATE: {
+    uint32_t raw_size;
+    if (val.size() >= DEFLATE_HEADER_SIZE) {
+      std::memcpy(&raw_size, val.data() + HEADER_SIZE, sizeof(raw_size));
+      std::string raw(raw_size, '\0');
+      uLongf size = raw_size;
+      int result = uncompress(
+          reinterpret_cast<Bytef *>(raw.data()), &size,
+          reinterpret_cast<const Bytef *>(val.data() + DEFLATE_HEADER_SIZE),
+          val.size() - DEFLATE_HEADER_SIZE);
+      if (result == Z_OK && size == raw_size) {
+        *out = std::move(raw);
+        return true;
+      }
+    }
+    break;
+  }
+  }
+
+  LOG_WARN("Client", "Value has a corrupt compression frame");
+  out->clear();
+  return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/*
+ * Client side value compression.
+ *
+ * Values at or above a size threshold are deflated by the client before
+ * they are sent and travel as a frame:
+ *
+ *   [0xFF 'T' 'K' 'Z'][method u8][raw size u32, DEFLATE only][data]
+ *
+ * Nodes treat the frame as the client's bytes, so it is forwarded,
+ * replicated, logged and stored compressed and only inflated by the
+ * client that reads it. Values below COMPRESSION_LEVEL_SWITCH get the
+ * fastest zlib level, larger ones the default level, which is slower but
+ * pays off on the values that dominate traffic. A value that does not
+ * shrink by at least an eighth is sent as is. One that happens to start
+ * with the frame marker is sent in a STORED frame, so it is never taken
+ * for a compressed one.
+ */
+static const size_t DEFAULT_COMPRESSION_THRESHOLD = 4096;
+static const size_t COMPRESSION_LEVEL_SWITCH = 64 * 1024;
+
+/*
+ * Builds the form of val that is sent to the cluster. Returns false, with
+ * out untouched, if val can be sent as it is. A threshold of 0 disables
+ * compression.
+ */
+bool CompressValue(const std::string &val, size_t threshold, std::string *out);
+
+/*
+ * Restores a value read from the cluster. Returns false, with out
+ * untouched, if val is not a frame. A corrupt frame decodes to "".
+ */
+bool DecompressValue(std::string_view val, std::string *out);
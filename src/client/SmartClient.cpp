@@ -0,0 +1,217 @@
+#include "SmartClient.h"
+#include "Log.h"
+#include <atomic>
+#include <future>
+#include <mutex>
+
+SmartClient::SmartClient(const std::vector<std::string> &addresses,
+                         int virtual_nodes) {
+  rebuild(addresses, virtual_nodes);
+}
+
+std::unique_ptr<SmartClient>
+SmartClient::from_seed(const std::string &address) {
+  Client seed(Client::connect(address));
+
+  std::vector<std::string> addresses;
+  int virtual_nodes;
+  if (!seed.membership(&addresses, &virtual_nodes))
+    return nullptr;
+
+  return std::make_unique<SmartClient>(addresses, virtual_nodes);
+}
+
+void SmartClient::rebuild(const std::vector<std::string> &addresses,
+                          int virtual_nodes) {
+  auto next_ring = std::make_unique<HashRing>(virtual_nodes);
+  std::unordered_map<std::string, std::shared_ptr<Client>> next_nodes;
+
+  for (const std::string &address : addresses) {
+    next_ring->add_node(address);
+
+    // Keep the channels of nodes that are still members
+    auto it = nodes.find(address);
+    if (it != nodes.end()) {
+      next_nodes[address] = it->second;
+    } else {
+      next_nodes[address] = std::make_shared<Client>(Client::connect(address));
+    }
+  }
+
+  ring = std::move(next_ring);
+  nodes = std::move(next_nodes);
+}
+
+bool SmartClient::refresh(const std::string &address) {
+  std::shared_ptr<Client> client = client_for(address);
+  if (!client)
+    return false;
+
+  std::vector<std::string> addresses;
+  int virtual_nodes;
+  if (!client->membership(&addresses, &virtual_nodes))
+    return false;
+
+  std::unique_lock lock(ring_mutex);
+  rebuild(addresses, virtual_nodes);
+  LOG_INFO("SmartClient", "Refreshed ring with {} nodes", addresses.size());
+  return true;
+}
+
+std::pair<std::string, std::shared_ptr<Client>>
+SmartClient::owner_of(const std::string &key) {
+  std::shared_lock lock(ring_mutex);
+  std::string owner = ring->get_owner(key);
+  auto it = nodes.find(owner);
+  return {owner, it == nodes.end() ? nullptr : it->second};
+}
+
+std::shared_ptr<Client> SmartClient::client_for(const std::string &address) {
+  std::shared_lock lock(ring_mutex);
+  auto it = nodes.find(address);
+  return it == nodes.end() ? nullptr : it->second;
+}
+
+bool SmartClient::put(const std::string &key, const std::string &val,
+                      int replication_factor, int write_quorum,
+                      int64_t ttl_ms) {
+  bool success = false;
+
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    auto [owner, client] = owner_of(key);
+    if (!client)
+      return false;
+
+    grpc::Status status = client->put_routed(key, val, replication_factor,
+                                             write_quorum, &success, ttl_ms);
+    if (status.error_code() != grpc::StatusCode::FAILED_PRECONDITION)
+      return success;
+
+    // Our ring is stale, ask the node that turned us away
+    if (!refresh(owner))
+      return false;
+  }
+  return success;
+}
+
+Val_TS SmartClient::get(const std::string &key, int quorum_size, bool *ok) {
+  Val_TS value = {"", -1};
+  bool answered = false;
+
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    auto [owner, client] = owner_of(key);
+    if (!client)
+      break;
+
+    grpc::Status status = client->get_routed(key, quorum_size, &value);
+    if (status.error_code() != grpc::StatusCode::FAILED_PRECONDITION) {
+      answered = status.ok();
+      break;
+    }
+
+    if (!refresh(owner))
+      break;
+  }
+  if (ok)
+    *ok = answered;
+  return value;
+}
+
+/*
+ * Every owner gets only its own keys, so no node has to forward. The
+ * sub-batches go out at once and the call returns when all are answered.
+ */
+std::vector<bool> SmartClient::multi_put(
+    const std::vector<std::pair<std::string, std::string>> &entries,
+    int replication_factor, int write_quorum) {
+  std::unordered_map<std::string, std::vector<size_t>> groups;
+  {
+    std::shared_lock lock(ring_mutex);
+    for (size_t i = 0; i < entries.size(); ++i)
+      groups[ring->get_owner(entries[i].first)].push_back(i);
+  }
+
+  std::vector<std::pair<const std::vector<size_t> *,
+                        std::future<std::vector<bool>>>>
+      pending;
+  for (const auto &[owner, indices] : groups) {
+    std::shared_ptr<Client> client = client_for(owner);
+    if (!client)
+      continue;
+
+    std::vector<std::pair<std::string, std::string>> batch;
+    for (size_t i : indices)
+      batch.push_back(entries[i]);
+
+    auto result = std::make_shared<std::promise<std::vector<bool>>>();
+    pending.emplace_back(&indices, result->get_future());
+    client->multi_put_async(
+        client->multi_put_request(batch, "client", replication_factor,
+                                  write_quorum),
+        [result, owner](bool ok, std::vector<bool> success) {
+          if (!ok)
+            LOG_WARN("SmartClient", "MultiPut to {} failed", owner);
+          result->set_value(std::move(success));
+        });
+  }
+
+  std::vector<bool> results(entries.size(), false);
+  for (auto &[indices, future] : pending) {
+    std::vector<bool> batch_results = future.get();
+    for (size_t j = 0; j < indices->size(); ++j)
+      results[(*indices)[j]] = batch_results[j];
+  }
+  return results;
+}
+
+std::vector<Val_TS> SmartClient::multi_get(const std::vector<std::string> &keys,
+                                           int quorum_size, bool *ok) {
+  std::unordered_map<std::string, std::vector<size_t>> groups;
+  {
+    std::shared_lock lock(ring_mutex);
+    for (size_t i = 0; i < keys.size(); ++i)
+      groups[ring->get_owner(keys[i])].push_back(i);
+  }
+
+  std::vector<std::pair<const std::vector<size_t> *,
+                        std::future<std::vector<Val_TS>>>>
+      pending;
+  auto answered = std::make_shared<std::atomic<bool>>(true);
+  for (const auto &[owner, indices] : groups) {
+    std::shared_ptr<Client> client = client_for(owner);
+    if (!client) {
+      *answered = false;
+      continue;
+    }
+
+    tinykv::MultiGetRequest request;
+    for (size_t i : indices)
+      request.add_keys(keys[i]);
+    request.set_sender_id("client");
+    request.set_quorum_size(quorum_size);
+
+    auto result = std::make_shared<std::promise<std::vector<Val_TS>>>();
+    pending.emplace_back(&indices, result->get_future());
+    client->multi_get_async(
+        std::move(request),
+        [result, owner, answered](bool ok, std::vector<Val_TS> values) {
+          if (!ok) {
+            LOG_WARN("SmartClient", "MultiGet to {} failed", owner);
+            *answered = false;
+          }
+          result->set_value(std::move(values));
+        });
+  }
+
+  std::vector<Val_TS> results(keys.size(), {"", -1});
+  for (auto &[indices, future] : pending) {
+    std::vector<Val_TS> batch_results = future.get();
+    for (size_t j = 0; j < indices->size(); ++j) {
+      Val_TS &value = batch_results[j];
+      results[(*indices)[j]] = {Client::decode(value.first), value.second};
+    }
+  }
+  if (ok)
+    *ok = *answered;
+  return results;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Client.h"
+#include "HashRing.h"
+
+/*
+ * Client that keeps its own copy of the hash ring and a channel per node,
+ * so every request goes straight to the owner of its key instead of paying
+ * an extra forwarding hop on a coordinator.
+ *
+ * If a node answers that it does not own a key, the ring is refreshed from
+ * that node and the request is retried once against the new owner.
+ */
+class SmartClient {
+public:
+  /*
+   * Builds the ring from a list of node addresses
+   */
+  SmartClient(const std::vector<std::string> &addresses,
+              int virtual_nodes = 20);
+
+  /*
+   * Builds the ring from the membership reported by a seed node
+   */
+  static std::unique_ptr<SmartClient> from_seed(const std::string &address);
+
+  bool put(const std::string &key, const std::string &val,
+           int replication_factor = 3, int write_quorum = 0,
+           int64_t ttl_ms = 0);
+
+  /*
+   * A missing key comes back with timestamp -1. If ok is given, it tells
+   * whether the owner answered at all, which a missing key does not show.
+   */
+  Val_TS get(const std::string &key, int quorum_size = 1,
+             bool *ok = nullptr);
+
+  std::vector<bool>
+  multi_put(const std::vector<std::pair<std::string, std::string>> &entries,
+            int replication_factor = 3, int write_quorum = 0);
+
+  /*
+   * ok, if given, is cleared when any owner's batch failed
+   */
+  std::vector<Val_TS> multi_get(const std::vector<std::string> &keys,
+                                int quorum_size = 1, bool *ok = nullptr);
+
+  /*
+   * Re-reads the membership from the given node and rebuilds the ring
+   */
+  bool refresh(const std::string &address);
+
+private:
+  std::shared_mutex ring_mutex;
+  std::unique_ptr<HashRing> ring;
+  std::unordered_map<std::string, std::shared_ptr<Client>> nodes;
+
+  void rebuild(const std::vector<std::string> &addresses, int virtual_nodes);
+  std::pair<std::string, std::shared_ptr<Client>>
+  owner_of(const std::string &key);
+  std::shared_ptr<Client> client_for(const std::string &address);
+};
@@ -1,19 +1,39 @@
 #include "Client.h"
+#include "SmartClient.h"
 #include "Utils.h"
 #include <grpcpp/grpcpp.h>
 #include <iostream>
+#include <map>
 #include <string>
 
 void print_usage() {
-  std::cerr << "Usage: ./tinykv_client <address> <command> [args...]\n"
+  std::cerr << "Usage: ./tinykv_client [--smart] <address> <command> "
+               "[args...]\n"
+            << "  --smart  fetch the ring from <address> and send every key "
+               "straight to its owner\n"
             << "Commands:\n"
             << "  ping\n"
-            << "  put <key> <val> [rf]\n"
+            << "  put <key> <val> [rf] [w] [ttl_ms]\n"
+            << "  del <key> [rf] [w]\n"
             << "  get <key> [quorum_size]\n"
-            << "  benchmark <count> <rf>\n";
+            << "  mput <key> <val> [<key> <val> ...]\n"
+            << "  mget <key> [<key> ...]\n"
+            << "  scan <start> [end] [limit]\n"
+            << "  prefix <prefix> [limit]\n"
+            << "  benchmark <count> <rf>\n"
+            << "  ring\n"
+            << "  join <address>\n"
+            << "  leave <address>\n"
+            << "  stats [--prometheus]\n";
 }
 
 int main(int argc, char *argv[]) {
+  bool smart = argc > 1 && std::string(argv[1]) == "--smart";
+  if (smart) {
+    argv++;
+    argc--;
+  }
+
   if (argc < 3) {
     print_usage();
     return 1;
@@ -22,9 +42,17 @@ int main(int argc, char *argv[]) {
   std::string target_address(argv[1]);
   std::string command(argv[2]);
 
-  auto channel =
-      grpc::CreateChannel(target_address, grpc::InsecureChannelCredentials());
-  Client client(channel);
+  Client client(Client::connect(target_address));
+
+  std::unique_ptr<SmartClient> smart_client;
+  if (smart) {
+    smart_client = SmartClient::from_seed(target_address);
+    if (!smart_client) {
+      std::cerr << "[CLI] Could not fetch the ring from " << target_address
+                << std::endl;
+      return 1;
+    }
+  }
 
   try {
     if (command == "help" || command == "--help") {
@@ -41,7 +69,30 @@ int main(int argc, char *argv[]) {
       std::string key = argv[3];
       std::string val = argv[4];
       int rf = (argc >= 6) ? std::stoi(argv[5]) : 3;
-      return client.put(key, val, "client", rf) ? 0 : 1;
+      int w = (argc >= 7) ? std::stoi(argv[6]) : 0;
+      int64_t ttl_ms = (argc >= 8) ? std::stoll(argv[7]) : 0;
+      bool ok = smart_client
+                    ? smart_client->put(key, val, rf, w, ttl_ms)
+                    : client.put(key, val, "client", rf, 0, w, ttl_ms);
+      return ok ? 0 : 1;
+    } else if (command == "del") {
+      if (argc < 4) {
+        print_usage();
+        return 1;
+      }
+      tinykv::DeleteRequest request;
+      request.set_key(argv[3]);
+      request.set_sender_id("client");
+      request.set_replication_factor((argc >= 5) ? std::stoi(argv[4]) : 3);
+      request.set_write_quorum((argc >= 6) ? std::stoi(argv[5]) : 0);
+
+      tinykv::DeleteResponse reply;
+      grpc::Status status = client.del(request, &reply);
+      if (!status.ok()) {
+        std::cerr << "[CLI] " << status.error_message() << std::endl;
+        return 1;
+      }
+      return reply.operation_success() ? 0 : 1;
     } else if (command == "get") {
       if (argc < 4) {
         print_usage();
@@ -50,13 +101,85 @@ int main(int argc, char *argv[]) {
       std::string key = argv[3];
       int quorum = (argc >= 5) ? std::stoi(argv[4]) : 2;
 
-      auto result = client.get(key, "client", quorum);
+      auto result = smart_client ? smart_client->get(key, quorum)
+                                 : client.get(key, "client", quorum);
       if (result.second == -1) {
         std::cerr << "[CLI] Key not found." << std::endl;
         return 1;
       }
       std::cout << result.first << std::endl;
       return 0;
+    } else if (command == "mput") {
+      if (argc < 5 || (argc - 3) % 2 != 0) {
+        print_usage();
+        return 1;
+      }
+      std::vector<std::pair<std::string, std::string>> entries;
+      for (int i = 3; i + 1 < argc; i += 2)
+        entries.push_back({argv[i], argv[i + 1]});
+
+      std::vector<bool> results = smart_client
+                                      ? smart_client->multi_put(entries)
+                                      : client.multi_put(entries, "client");
+      bool all_ok = true;
+      for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i]) {
+          std::cerr << "[CLI] Put failed for " << entries[i].first
+                    << std::endl;
+          all_ok = false;
+        }
+      }
+      return all_ok ? 0 : 1;
+    } else if (command == "mget") {
+      if (argc < 4) {
+        print_usage();
+        return 1;
+      }
+      std::vector<std::string> keys(argv + 3, argv + argc);
+
+      std::vector<Val_TS> results = smart_client
+                                        ? smart_client->multi_get(keys, 2)
+                                        : client.multi_get(keys, "client", 2);
+      for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i].second == -1)
+          std::cout << keys[i] << " (not found)" << std::endl;
+        else
+          std::cout << keys[i] << " " << results[i].first << std::endl;
+      }
+      return 0;
+    } else if (command == "scan" || command == "prefix") {
+      if (argc < 4) {
+        print_usage();
+        return 1;
+      }
+      tinykv::ScanRequest request;
+      request.set_sender_id("client");
+      int limit_arg = 4;
+      if (command == "scan") {
+        request.set_start(argv[3]);
+        if (argc >= 5)
+          request.set_end(argv[4]);
+        limit_arg = 5;
+      } else {
+        request.set_prefix(argv[3]);
+      }
+      if (argc > limit_arg)
+        request.set_limit(std::stoull(argv[limit_arg]));
+
+      grpc::ClientContext context;
+      auto reader = client.scan(&context, request);
+      tinykv::ScanResponse chunk;
+      while (reader->Read(&chunk)) {
+        for (const tinykv::KeyValue &entry : chunk.entries())
+          std::cout << entry.key() << " " << Client::decode(entry.val())
+                    << std::endl;
+      }
+      grpc::Status status = reader->Finish();
+      if (!status.ok()) {
+        std::cerr << "[CLI] " << status.error_message() << std::endl;
+        return 1;
+      }
+      return 0;
     } else if (command == "benchmark") {
       if (argc < 4) {
         std::cerr << "Usage: benchmark <count> <rf> [threads]" << std::endl;
@@ -66,7 +189,73 @@ int main(int argc, char *argv[]) {
       int rf = std::stoi(argv[4]);
       int threads = (argc >= 6) ? std::stoi(argv[5]) : 10;
 
-      RunBenchmark(client, count, rf, threads);
+      PutFunc put = [&](const std::string &key, const std::string &val,
+                        int rf) {
+        return smart_client ? smart_client->put(key, val, rf)
+                            : client.put(key, val, "client", rf);
+      };
+      RunBenchmark(put, count, rf, threads);
+      return 0;
+    } else if (command == "ring") {
+      tinykv::MembershipResponse ring;
+      grpc::Status status = client.ring(&ring);
+      if (!status.ok()) {
+        std::cerr << "[CLI] " << status.error_message() << std::endl;
+        return 1;
+      }
+      std::cout << "epoch " << ring.epoch() << ", " << ring.nodes_size()
+                << " nodes" << (ring.rebalancing() ? ", rebalancing" : "")
+                << std::endl;
+      for (const std::string &node : ring.nodes())
+        std::cout << "  " << node << std::endl;
+      return 0;
+    } else if (command == "join" || command == "leave") {
+      if (argc < 4) {
+        print_usage();
+        return 1;
+      }
+      tinykv::RingResponse reply;
+      grpc::Status status = command == "join"
+                                ? client.join(argv[3], &reply)
+                                : client.leave(argv[3], &reply);
+      if (!status.ok()) {
+        std::cerr << "[CLI] " << status.error_message() << std::endl;
+        return 1;
+      }
+      std::cout << "ring epoch " << reply.epoch() << " with "
+                << reply.nodes_size() << " nodes" << std::endl;
+      return 0;
+    } else if (command == "stats") {
+      tinykv::StatsResponse stats;
+      grpc::Status status = client.stats(&stats);
+      if (!status.ok()) {
+        std::cerr << "[CLI] " << status.error_message() << std::endl;
+        return 1;
+      }
+      if (argc > 3 && std::string(argv[3]) == "--prometheus") {
+        std::cout << stats.prometheus();
+        return 0;
+      }
+
+      std::cout << stats.keys() << " keys, " << stats.memory_bytes() / 1024
+                << " KiB resident, " << stats.live_peers() << " live peers"
+                << std::endl;
+      for (const tinykv::PeerState &peer : stats.peers())
+        std::cout << "  " << peer.address() << " "
+                  << tinykv::MemberState_Name(peer.state()) << std::endl;
+
+      std::cout << "latency (us)" << std::endl;
+      for (const tinykv::RpcLatency &latency : stats.latencies())
+        std::cout << "  " << latency.rpc() << "/" << latency.origin()
+                  << " count " << latency.count() << " mean "
+                  << (int)latency.mean_us() << " p50 " << (int)latency.p50_us()
+                  << " p99 " << (int)latency.p99_us() << std::endl;
+
+      std::cout << "counters" << std::endl;
+      std::map<std::string, uint64_t> counters(stats.counters().begin(),
+                                               stats.counters().end());
+      for (const auto &[name, value] : counters)
+        std::cout << "  " << name << " " << value << std::endl;
       return 0;
     }
   } catch (const std::exception &e) {
@@ -0,0 +1,57 @@
+#include "Histogram.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+Histogram::Histogram() : counts(index_of(MAX_VALUE) + 1, 0) {}
+
+size_t Histogram::index_of(uint64_t value) {
+  if (value < SUB_BUCKETS)
+    return value;
+
+  // Shift the value down until it lands in [HALF_BUCKETS, SUB_BUCKETS)
+  int shift = std::bit_width(value) - SUB_BUCKET_BITS;
+  return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS +
+         ((value >> shift) - HALF_BUCKETS);
+}
+
+uint64_t Histogram::highest_equivalent(size_t index) {
+  if (index < SUB_BUCKETS)
+    return index;
+
+  int shift = (index - SUB_BUCKETS) / HALF_BUCKETS + 1;
+  uint64_t sub = (index - SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+  return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+  value = std::min(value, MAX_VALUE);
+  counts[index_of(value)]++;
+  total++;
+  sum += value;
+  lowest = std::min(lowest, value);
+  highest = std::max(highest, value);
+}
+
+void Histogram::merge(const Histogram &other) {
+  for (size_t i = 0; i < counts.size(); ++i)
+    counts[i] += other.counts[i];
+  total += other.total;
+  sum += other.sum;
+  lowest = std::min(lowest, other.lowest);
+  highest = std::max(highest, other.highest);
+}
+
+uint64_t Histogram::percentile(double p) const {
+  if (total == 0)
+    return 0;
+
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(p / 100.0 * total));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen >= rank)
+      return std::min(highest_equivalent(i), highest);
+  }
+  return highest;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram.
+ *
+ * Values below 2048 are counted exactly. Above that, every power of two is
+ * split into 1024 equal buckets, so any recorded value is reported within
+ * 0.1% of its true size. Values above the trackable maximum are clamped.
+ *
+ * Not thread-safe: every worker records into its own histogram and the
+ * results are merged once the run is over.
+ */
+class Histogram {
+public:
+  static constexpr uint64_t MAX_VALUE = (1ull << 36) - 1;
+
+  Histogram();
+
+  void record(uint64_t value);
+
+  void merge(const Histogram &other);
+
+  uint64_t count() const { return total; }
+  uint64_t min() const { return total ? lowest : 0; }
+  uint64_t max() const { return highest; }
+  double mean() const { return total ? (double)sum / total : 0; }
+
+  /*
+   * Smallest value that at least p percent of the recorded values do not
+   * exceed, e.g. percentile(99.9)
+   */
+  uint64_t percentile(double p) const;
+
+private:
+  static constexpr int SUB_BUCKET_BITS = 11;
+  static constexpr uint64_t SUB_BUCKETS = 1ull << SUB_BUCKET_BITS;
+  static constexpr uint64_t HALF_BUCKETS = SUB_BUCKETS / 2;
+
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t lowest = UINT64_MAX;
+  uint64_t highest = 0;
+
+  static size_t index_of(uint64_t value);
+  static uint64_t highest_equivalent(size_t index);
+};
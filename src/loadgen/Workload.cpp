@@ -0,0 +1,116 @@
+#include "Workload.h"
+#include "Hash.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+const char *OperationName(Operation op) {
+  switch (op) {
+  case Operation::READ:
+    return "READ";
+  case Operation::UPDATE:
+    return "UPDATE";
+  case Operation::INSERT:
+    return "INSERT";
+  case Operation::SCAN:
+    return "SCAN";
+  case Operation::READ_MODIFY_WRITE:
+    return "READ_MODIFY_WRITE";
+  }
+  return "UNKNOWN";
+}
+
+static double uniform_double(std::mt19937_64 &rng) {
+  return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+uint64_t UniformGenerator::next(std::mt19937_64 &rng) {
+  uint64_t n = std::max<uint64_t>(1, records.load());
+  return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng);
+}
+
+static double zeta(uint64_t n, double theta) {
+  double sum = 0;
+  for (uint64_t i = 1; i <= n; ++i)
+    sum += 1.0 / std::pow((double)i, theta);
+  return sum;
+}
+
+ZipfianGenerator::ZipfianGenerator(uint64_t items, double theta)
+    : items(std::max<uint64_t>(1, items)), theta(theta) {
+  double zeta2 = zeta(2, theta);
+  zetan = zeta(this->items, theta);
+  alpha = 1.0 / (1.0 - theta);
+  eta = (1 - std::pow(2.0 / this->items, 1 - theta)) / (1 - zeta2 / zetan);
+}
+
+uint64_t ZipfianGenerator::next(std::mt19937_64 &rng) {
+  double u = uniform_double(rng);
+  double uz = u * zetan;
+  if (uz < 1.0)
+    return 0;
+  if (uz < 1.0 + std::pow(0.5, theta))
+    return std::min<uint64_t>(1, items - 1);
+
+  uint64_t item = items * std::pow(eta * u - eta + 1, alpha);
+  return std::min(item, items - 1);
+}
+
+uint64_t ScrambledZipfianGenerator::next(std::mt19937_64 &rng) {
+  uint64_t item = zipfian.next(rng);
+  return murmur64(&item, sizeof(item)) % items;
+}
+
+uint64_t LatestGenerator::next(std::mt19937_64 &rng) {
+  uint64_t latest = std::max<uint64_t>(1, records.load());
+  uint64_t age = zipfian.next(rng);
+  return age < latest ? latest - 1 - age : 0;
+}
+
+bool GetWorkload(const std::string &name, Workload *workload) {
+  // READ, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE
+  static const Workload workloads[] = {
+      {"A", {0.50, 0.50, 0, 0, 0}, "zipfian"},
+      {"B", {0.95, 0.05, 0, 0, 0}, "zipfian"},
+      {"C", {1.00, 0, 0, 0, 0}, "zipfian"},
+      {"D", {0.95, 0, 0.05, 0, 0}, "latest"},
+      {"E", {0, 0, 0.05, 0.95, 0}, "zipfian"},
+      {"F", {0.50, 0, 0, 0, 0.50}, "zipfian"},
+  };
+
+  std::string upper = name;
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+  for (const Workload &w : workloads) {
+    if (w.name == upper) {
+      *workload = w;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::unique_ptr<KeyGenerator>
+MakeKeyGenerator(const std::string &distribution,
+                 const std::atomic<uint64_t> &records, uint64_t initial) {
+  if (distribution == "uniform")
+    return std::make_unique<UniformGenerator>(records);
+  if (distribution == "zipfian")
+    return std::make_unique<ScrambledZipfianGenerator>(initial);
+  if (distribution == "latest")
+    return std::make_unique<LatestGenerator>(records, initial);
+  return nullptr;
+}
+
+Operation ChooseOperation(const Workload &workload, std::mt19937_64 &rng) {
+  double u = uniform_double(rng);
+  for (int i = 0; i < OPERATION_COUNT; ++i) {
+    if (u < workload.mix[i])
+      return (Operation)i;
+    u -= workload.mix[i];
+  }
+  return Operation::READ;
+}
+
+std::string RecordKey(uint64_t record) {
+  return "user" + std::to_string(record);
+}
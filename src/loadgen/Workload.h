@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+
+/*
+ * YCSB core workloads and the key distributions they draw from.
+ */
+
+enum class Operation { READ, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE };
+
+const int OPERATION_COUNT = 5;
+
+const char *OperationName(Operation op);
+
+/*
+ * Picks a record number in [0, records) where records is the number of
+ * keys inserted so far. Implementations are shared by all workers and
+ * must be safe to call concurrently with a per-thread rng.
+ */
+class KeyGenerator {
+public:
+  virtual ~KeyGenerator() = default;
+  virtual uint64_t next(std::mt19937_64 &rng) = 0;
+};
+
+class UniformGenerator : public KeyGenerator {
+public:
+  UniformGenerator(const std::atomic<uint64_t> &records) : records(records) {}
+  uint64_t next(std::mt19937_64 &rng) override;
+
+private:
+  const std::atomic<uint64_t> &records;
+};
+
+/*
+ * Zipfian over a fixed number of items, item 0 being the most popular.
+ * Uses the rejection-free method of Gray et al. that YCSB uses, with
+ * zeta(n) computed once up front.
+ */
+class ZipfianGenerator : public KeyGenerator {
+public:
+  static constexpr double ZIPFIAN_CONSTANT = 0.99;
+
+  ZipfianGenerator(uint64_t items, double theta = ZIPFIAN_CONSTANT);
+  uint64_t next(std::mt19937_64 &rng) override;
+
+private:
+  uint64_t items;
+  double theta, alpha, zetan, eta;
+};
+
+/*
+ * Zipfian popularity, but the popular records are spread over the whole
+ * key space instead of being the lowest record numbers
+ */
+class ScrambledZipfianGenerator : public KeyGenerator {
+public:
+  ScrambledZipfianGenerator(uint64_t items) : items(items), zipfian(items) {}
+  uint64_t next(std::mt19937_64 &rng) override;
+
+private:
+  uint64_t items;
+  ZipfianGenerator zipfian;
+};
+
+/*
+ * Zipfian over the age of a record: recently inserted records are the
+ * most popular
+ */
+class LatestGenerator : public KeyGenerator {
+public:
+  LatestGenerator(const std::atomic<uint64_t> &records, uint64_t items)
+      : records(records), zipfian(items) {}
+  uint64_t next(std::mt19937_64 &rng) override;
+
+private:
+  const std::atomic<uint64_t> &records;
+  ZipfianGenerator zipfian;
+};
+
+struct Workload {
+  std::string name;
+  // Proportions of each operation, indexed by Operation. They sum to 1.
+  double mix[OPERATION_COUNT];
+  std::string distribution;
+};
+
+/*
+ * Returns the YCSB core workload with the given letter (A-F), or false
+ */
+bool GetWorkload(const std::string &name, Workload *workload);
+
+/*
+ * Builds a generator for "uniform", "zipfian" or "latest", or nullptr
+ */
+std::unique_ptr<KeyGenerator>
+MakeKeyGenerator(const std::string &distribution,
+                 const std::atomic<uint64_t> &records, uint64_t initial);
+
+Operation ChooseOperation(const Workload &workload, std::mt19937_64 &rng);
+
+std::string RecordKey(uint64_t record);
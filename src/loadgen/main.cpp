@@ -0,0 +1,508 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "Client.h"
+#include "Histogram.h"
+#include "SmartClient.h"
+#include "Workload.h"
+
+/*
+ * YCSB-style load generator. Loads a set of records, then runs one of the
+ * core workloads against the cluster and reports latency percentiles for
+ * every operation type.
+ *
+ * With --rate the generator runs open loop: every operation has a fixed
+ * start time on a schedule and its latency is measured from that time, so
+ * a stalled server shows up as queueing delay instead of silently lowering
+ * the offered load (coordinated omission).
+ */
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadGenOptions {
+  std::string address;
+  bool smart = false;
+  Workload workload;
+  std::string distribution;
+  uint64_t records = 10000;
+  uint64_t operations = 100000;
+  int threads = 16;
+  int value_size = 100;
+  double rate = 0; // ops/s over all threads, 0 runs closed loop
+  int replication_factor = 3;
+  int write_quorum = 0;
+  int read_quorum = 2;
+  int max_scan_length = 100;
+  bool load = true;
+  std::string json_path;
+};
+
+/*
+ * The three calls a workload needs, sent either through a coordinator or
+ * straight to the owners
+ */
+class Target {
+public:
+  virtual ~Target() = default;
+  virtual bool put(const std::string &key, const std::string &val) = 0;
+  virtual bool get(const std::string &key) = 0;
+  virtual bool multi_get(const std::vector<std::string> &keys) = 0;
+};
+
+class CoordinatorTarget : public Target {
+public:
+  CoordinatorTarget(const LoadGenOptions &options)
+      : options(options),
+        client(Client::connect(options.address)) {}
+
+  bool put(const std::string &key, const std::string &val) override {
+    return client.put(key, val, "client", options.replication_factor, 0,
+                      options.write_quorum);
+  }
+
+  // The sync Get cannot tell a missing key from a failed call
+  bool get(const std::string &key) override {
+    std::promise<bool> done;
+    client.get_async(key, "client", options.read_quorum,
+                     [&done](bool ok, Val_TS) { done.set_value(ok); });
+    return done.get_future().get();
+  }
+
+  bool multi_get(const std::vector<std::string> &keys) override {
+    tinykv::MultiGetRequest request;
+    for (const std::string &key : keys)
+      request.add_keys(key);
+    request.set_sender_id("client");
+    request.set_quorum_size(options.read_quorum);
+
+    std::promise<bool> done;
+    client.multi_get_async(std::move(request),
+                           [&done](bool ok, std::vector<Val_TS>) {
+                             done.set_value(ok);
+                           });
+    return done.get_future().get();
+  }
+
+private:
+  const LoadGenOptions &options;
+  Client client;
+};
+
+class SmartTarget : public Target {
+public:
+  SmartTarget(const LoadGenOptions &options,
+              std::unique_ptr<SmartClient> client)
+      : options(options), client(std::move(client)) {}
+
+  bool put(const std::string &key, const std::string &val) override {
+    return client->put(key, val, options.replication_factor,
+                       options.write_quorum);
+  }
+
+  // A missing key is not an error, a failed call is
+  bool get(const std::string &key) override {
+    bool ok;
+    client->get(key, options.read_quorum, &ok);
+    return ok;
+  }
+
+  bool multi_get(const std::vector<std::string> &keys) override {
+    bool ok;
+    client->multi_get(keys, options.read_quorum, &ok);
+    return ok;
+  }
+
+private:
+  const LoadGenOptions &options;
+  std::unique_ptr<SmartClient> client;
+};
+
+struct PhaseResult {
+  double seconds = 0;
+  Histogram latency[OPERATION_COUNT];
+  uint64_t errors[OPERATION_COUNT] = {};
+
+  uint64_t total() const {
+    uint64_t sum = 0;
+    for (const Histogram &h : latency)
+      sum += h.count();
+    return sum;
+  }
+
+  void merge(const PhaseResult &other) {
+    for (int i = 0; i < OPERATION_COUNT; ++i) {
+      latency[i].merge(other.latency[i]);
+      errors[i] += other.errors[i];
+    }
+  }
+};
+
+/*
+ * Random printable bytes that values are sliced from, so building a value
+ * costs a copy instead of a call to the rng per byte
+ */
+class ValuePool {
+public:
+  ValuePool(int value_size) : value_size(value_size) {
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> byte('a', 'z');
+    pool.resize(value_size + (1 << 16));
+    for (char &c : pool)
+      c = byte(rng);
+  }
+
+  std::string next(std::mt19937_64 &rng) const {
+    size_t offset = rng() % (pool.size() - value_size + 1);
+    return pool.substr(offset, value_size);
+  }
+
+private:
+  int value_size;
+  std::string pool;
+};
+
+class LoadGenerator {
+public:
+  LoadGenerator(const LoadGenOptions &options, Target &target)
+      : options(options), target(target), values(options.value_size) {}
+
+  /*
+   * Inserts records [0, options.records) from all threads, closed loop
+   */
+  PhaseResult load() {
+    return run_phase([this](int t, PhaseResult &result) {
+      std::mt19937_64 rng(t);
+      for (uint64_t record = t; record < options.records;
+           record += options.threads) {
+        auto start = Clock::now();
+        bool ok = target.put(RecordKey(record), values.next(rng));
+        finish(result, Operation::INSERT, start, ok);
+      }
+    });
+  }
+
+  PhaseResult run() {
+    records = options.records;
+    next_record = options.records;
+    keys = MakeKeyGenerator(options.distribution, records, options.records);
+
+    return run_phase([this](int t, PhaseResult &result) {
+      std::mt19937_64 rng(0x9e3779b97f4a7c15ull * (t + 1));
+      uint64_t count = options.operations / options.threads +
+                       (t < (int)(options.operations % options.threads));
+
+      // Each thread owns an equal share of the target rate
+      std::chrono::nanoseconds interval(0);
+      if (options.rate > 0)
+        interval = std::chrono::nanoseconds(
+            (int64_t)(1e9 * options.threads / options.rate));
+
+      auto schedule = Clock::now();
+      for (uint64_t i = 0; i < count; ++i) {
+        auto start = Clock::now();
+        if (options.rate > 0) {
+          // Latency counts from the scheduled time, even if we are late
+          std::this_thread::sleep_until(schedule);
+          start = schedule;
+          schedule += interval;
+        }
+
+        Operation op = ChooseOperation(options.workload, rng);
+        bool ok = execute(op, rng);
+        finish(result, op, start, ok);
+      }
+    });
+  }
+
+private:
+  const LoadGenOptions &options;
+  Target &target;
+  ValuePool values;
+  std::unique_ptr<KeyGenerator> keys;
+  // Records that have been acknowledged, and the next record to insert
+  std::atomic<uint64_t> records{0};
+  std::atomic<uint64_t> next_record{0};
+
+  PhaseResult
+  run_phase(const std::function<void(int, PhaseResult &)> &worker) {
+    std::vector<PhaseResult> results(options.threads);
+    std::vector<std::thread> threads;
+
+    auto start = Clock::now();
+    for (int t = 0; t < options.threads; ++t)
+      threads.emplace_back(worker, t, std::ref(results[t]));
+    for (auto &thread : threads)
+      thread.join();
+
+    PhaseResult total;
+    total.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    for (const PhaseResult &result : results)
+      total.merge(result);
+    return total;
+  }
+
+  static void finish(PhaseResult &result, Operation op,
+                     Clock::time_point start, bool ok) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start);
+    result.latency[(int)op].record(elapsed.count());
+    if (!ok)
+      result.errors[(int)op]++;
+  }
+
+  bool execute(Operation op, std::mt19937_64 &rng) {
+    switch (op) {
+    case Operation::READ:
+      return target.get(RecordKey(keys->next(rng)));
+    case Operation::UPDATE:
+      return target.put(RecordKey(keys->next(rng)), values.next(rng));
+    case Operation::INSERT: {
+      uint64_t record = next_record++;
+      bool ok = target.put(RecordKey(record), values.next(rng));
+      records++;
+      return ok;
+    }
+    case Operation::SCAN: {
+      // There is no range query, so a scan reads a run of record numbers
+      uint64_t first = keys->next(rng);
+      uint64_t length = std::uniform_int_distribution<uint64_t>(
+          1, options.max_scan_length)(rng);
+      uint64_t end = std::min(first + length, records.load());
+      std::vector<std::string> batch;
+      for (uint64_t record = first; record < std::max(end, first + 1);
+           ++record)
+        batch.push_back(RecordKey(record));
+      return target.multi_get(batch);
+    }
+    case Operation::READ_MODIFY_WRITE: {
+      std::string key = RecordKey(keys->next(rng));
+      bool ok = target.get(key);
+      return target.put(key, values.next(rng)) && ok;
+    }
+    }
+    return false;
+  }
+};
+
+void print_phase(const std::string &name, const PhaseResult &result) {
+  std::cout << "------------------------------------------\n"
+            << "[" << name << "] " << result.total() << " ops in "
+            << std::fixed << std::setprecision(2) << result.seconds << " s, "
+            << (uint64_t)(result.total() / result.seconds) << " OPS\n";
+
+  for (int i = 0; i < OPERATION_COUNT; ++i) {
+    const Histogram &h = result.latency[i];
+    if (h.count() == 0)
+      continue;
+    std::cout << "  " << std::left << std::setw(18)
+              << OperationName((Operation)i) << std::right
+              << " count=" << h.count() << " errors=" << result.errors[i]
+              << std::setprecision(1) << " p50=" << h.percentile(50) / 1e3
+              << "us p99=" << h.percentile(99) / 1e3
+              << "us p999=" << h.percentile(99.9) / 1e3
+              << "us max=" << h.max() / 1e3 << "us\n";
+  }
+  std::cout << std::flush;
+}
+
+std::string phase_json(const PhaseResult &result) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3);
+  out << "{\"seconds\": " << result.seconds
+      << ", \"throughput\": " << result.total() / result.seconds
+      << ", \"operations\": {";
+
+  bool first = true;
+  for (int i = 0; i < OPERATION_COUNT; ++i) {
+    const Histogram &h = result.latency[i];
+    if (h.count() == 0)
+      continue;
+    out << (first ? "" : ", ") << "\"" << OperationName((Operation)i)
+        << "\": {\"count\": " << h.count()
+        << ", \"errors\": " << result.errors[i]
+        << ", \"mean_us\": " << h.mean() / 1e3
+        << ", \"p50_us\": " << h.percentile(50) / 1e3
+        << ", \"p99_us\": " << h.percentile(99) / 1e3
+        << ", \"p999_us\": " << h.percentile(99.9) / 1e3
+        << ", \"max_us\": " << h.max() / 1e3 << "}";
+    first = false;
+  }
+  out << "}}";
+  return out.str();
+}
+
+std::string report_json(const LoadGenOptions &options,
+                        const PhaseResult *load, const PhaseResult &run) {
+  std::ostringstream out;
+  out << "{\n"
+      << "  \"workload\": \"" << options.workload.name << "\",\n"
+      << "  \"distribution\": \"" << options.distribution << "\",\n"
+      << "  \"smart\": " << (options.smart ? "true" : "false") << ",\n"
+      << "  \"threads\": " << options.threads << ",\n"
+      << "  \"records\": " << options.records << ",\n"
+      << "  \"value_size\": " << options.value_size << ",\n"
+      << "  \"target_rate\": " << options.rate << ",\n"
+      << "  \"replication_factor\": " << options.replication_factor << ",\n";
+  if (load)
+    out << "  \"load\": " << phase_json(*load) << ",\n";
+  out << "  \"run\": " << phase_json(run) << "\n"
+      << "}\n";
+  return out.str();
+}
+
+void print_usage() {
+  std::cerr
+      << "Usage: ./tinykv_loadgen [--smart] <address> [options]\n"
+      << "  --smart  fetch the ring from <address> and send every key "
+         "straight to its owner\n"
+      << "Options:\n"
+      << "  --workload <A-F>        YCSB core workload (default: A)\n"
+      << "  --distribution <name>   uniform | zipfian | latest (default: "
+         "per workload)\n"
+      << "  --records <n>           records to load (default: 10000)\n"
+      << "  --operations <n>        operations to run (default: 100000)\n"
+      << "  --threads <n>           worker threads (default: 16)\n"
+      << "  --value-size <bytes>    size of every value (default: 100)\n"
+      << "  --rate <ops/s>          run open loop at this rate (default: "
+         "closed loop)\n"
+      << "  --rf <n>                replication factor (default: 3)\n"
+      << "  --write-quorum <n>      write quorum, 0 for the server default\n"
+      << "  --read-quorum <n>       read quorum (default: 2)\n"
+      << "  --max-scan <n>          longest scan in workload E (default: "
+         "100)\n"
+      << "  --skip-load             run against records loaded earlier\n"
+      << "  --json <file>           write the results as JSON, - for "
+         "stdout\n";
+}
+
+int main(int argc, char **argv) {
+  bool smart = argc > 1 && std::string(argv[1]) == "--smart";
+  if (smart) {
+    argv++;
+    argc--;
+  }
+
+  if (argc < 2) {
+    print_usage();
+    return 1;
+  }
+
+  LoadGenOptions options;
+  options.address = argv[1];
+  options.smart = smart;
+  GetWorkload("A", &options.workload);
+
+  for (int i = 2; i < argc; ++i) {
+    std::string flag(argv[i]);
+    if (flag == "--workload" && i + 1 < argc) {
+      if (!GetWorkload(argv[++i], &options.workload)) {
+        print_usage();
+        return 1;
+      }
+    } else if (flag == "--distribution" && i + 1 < argc) {
+      options.distribution = argv[++i];
+    } else if (flag == "--records" && i + 1 < argc) {
+      options.records = std::max(1ll, std::stoll(argv[++i]));
+    } else if (flag == "--operations" && i + 1 < argc) {
+      options.operations = std::max(0ll, std::stoll(argv[++i]));
+    } else if (flag == "--threads" && i + 1 < argc) {
+      options.threads = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--value-size" && i + 1 < argc) {
+      options.value_size = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--rate" && i + 1 < argc) {
+      options.rate = std::max(0.0, std::stod(argv[++i]));
+    } else if (flag == "--rf" && i + 1 < argc) {
+      options.replication_factor = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--write-quorum" && i + 1 < argc) {
+      options.write_quorum = std::max(0, std::stoi(argv[++i]));
+    } else if (flag == "--read-quorum" && i + 1 < argc) {
+      options.read_quorum = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--max-scan" && i + 1 < argc) {
+      options.max_scan_length = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--skip-load") {
+      options.load = false;
+    } else if (flag == "--json" && i + 1 < argc) {
+      options.json_path = argv[++i];
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+
+  if (options.distribution.empty())
+    options.distribution = options.workload.distribution;
+  std::atomic<uint64_t> probe{1};
+  if (!MakeKeyGenerator(options.distribution, probe, 1)) {
+    print_usage();
+    return 1;
+  }
+
+  std::unique_ptr<Target> target;
+  if (smart) {
+    auto client = SmartClient::from_seed(options.address);
+    if (!client) {
+      std::cerr << "[LoadGen] Could not fetch the ring from "
+                << options.address << std::endl;
+      return 1;
+    }
+    target = std::make_unique<SmartTarget>(options, std::move(client));
+  } else {
+    target = std::make_unique<CoordinatorTarget>(options);
+  }
+
+  std::cout << "==========================================\n"
+            << "  Workload:     " << options.workload.name << " ("
+            << options.distribution << ")\n"
+            << "  Records:      " << options.records << "\n"
+            << "  Operations:   " << options.operations << "\n"
+            << "  Threads:      " << options.threads << "\n"
+            << "  Value size:   " << options.value_size << "\n"
+            << "  Target rate:  "
+            << (options.rate > 0 ? std::to_string((uint64_t)options.rate) +
+                                       " OPS"
+                                 : std::string("closed loop"))
+            << "\n"
+            << "==========================================" << std::endl;
+
+  LoadGenerator generator(options, *target);
+
+  std::unique_ptr<PhaseResult> load;
+  if (options.load) {
+    load = std::make_unique<PhaseResult>(generator.load());
+    print_phase("Load", *load);
+  }
+
+  PhaseResult run = generator.run();
+  print_phase("Run", run);
+
+  if (!options.json_path.empty()) {
+    std::string json = report_json(options, load.get(), run);
+    if (options.json_path == "-") {
+      std::cout << json;
+    } else {
+      std::ofstream file(options.json_path);
+      if (!file) {
+        std::cerr << "[LoadGen] Could not write " << options.json_path
+                  << std::endl;
+        return 1;
+      }
+      file << json;
+    }
+  }
+  return 0;
+}
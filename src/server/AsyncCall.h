@@ -0,0 +1,163 @@
+#pragma once
+#include <functional>
+#include <google/protobuf/arena.h>
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/support/async_unary_call.h>
+
+#include "WireFormat.h"
+
+/*
+ * Tag placed on a completion queue, proceed() is called by the
+ * polling thread once the operation the tag belongs to completes.
+ */
+class AsyncTag {
+public:
+  virtual ~AsyncTag() = default;
+  virtual void proceed(bool ok) = 0;
+};
+
+/*
+ * State machine for one unary RPC served from a completion queue.
+ *
+ * The call first waits for a request to arrive. It then posts a fresh call
+ * so the queue keeps accepting requests, and hands the request to the
+ * handler. The handler may finish on any thread by calling done(), and the
+ * call deletes itself once gRPC has sent the response.
+ */
+template <typename Request, typename Response>
+class AsyncCall : public AsyncTag {
+public:
+  using Done = std::function<void(grpc::Status)>;
+  using Handler = std::function<void(const Request *, Response *, Done)>;
+  using Requester = std::function<void(
+      grpc::ServerContext *, Request *,
+      grpc::ServerAsyncResponseWriter<Response> *,
+      grpc::ServerCompletionQueue *, void *)>;
+
+  static void listen(Requester requester, Handler handler,
+                     grpc::ServerCompletionQueue *cq) {
+    new AsyncCall(std::move(requester), std::move(handler), cq);
+  }
+
+  void proceed(bool ok) override {
+    if (!ok || finished) {
+      // Either the server is shutting down or the response was sent
+      delete this;
+      return;
+    }
+
+    listen(requester, handler, cq);
+
+    handler(&request, &response, [this](grpc::Status status) {
+      finished = true;
+      responder.Finish(response, status, this);
+    });
+  }
+
+private:
+  AsyncCall(Requester requester, Handler handler,
+            grpc::ServerCompletionQueue *cq)
+      : requester(std::move(requester)), handler(std::move(handler)), cq(cq),
+        responder(&context) {
+    this->requester(&context, &request, &responder, cq, this);
+  }
+
+  Requester requester;
+  Handler handler;
+  grpc::ServerCompletionQueue *cq;
+
+  grpc::ServerContext context;
+  Request request;
+  Response response;
+  grpc::ServerAsyncResponseWriter<Response> responder;
+  bool finished = false;
+};
+
+/*
+ * The serialized form of a call served raw. The handler can relay request
+ * to another node as it arrived, and can set response to send bytes it
+ * already has instead of the reply message.
+ */
+struct RawMessages {
+  grpc::ByteBuffer request;
+  grpc::ByteBuffer response;
+  bool has_response = false;
+};
+
+/*
+ * Same as AsyncCall for a method marked raw. gRPC hands over the request
+ * bytes and the call parses them itself, into an arena that starts inside
+ * the call object, so a typical request and its reply cost no allocations
+ * beyond the call itself.
+ */
+template <typename Request, typename Response>
+class RawAsyncCall : public AsyncTag {
+public:
+  using Done = std::function<void(grpc::Status)>;
+  using Handler =
+      std::function<void(const Request *, Response *, Done, RawMessages *)>;
+  using Requester = std::function<void(
+      grpc::ServerContext *, grpc::ByteBuffer *,
+      grpc::ServerAsyncResponseWriter<grpc::ByteBuffer> *,
+      grpc::ServerCompletionQueue *, void *)>;
+
+  static void listen(Requester requester, Handler handler,
+                     grpc::ServerCompletionQueue *cq) {
+    new RawAsyncCall(std::move(requester), std::move(handler), cq);
+  }
+
+  void proceed(bool ok) override {
+    if (!ok || finished) {
+      delete this;
+      return;
+    }
+
+    listen(requester, handler, cq);
+
+    auto request = google::protobuf::Arena::CreateMessage<Request>(&arena);
+    auto response = google::protobuf::Arena::CreateMessage<Response>(&arena);
+    if (!Parse(raw.request, request)) {
+      finished = true;
+      return responder.FinishWithError(
+          grpc::Status(grpc::StatusCode::INTERNAL, "malformed request"),
+          this);
+    }
+
+    handler(request, response, [this, response](grpc::Status status) {
+      finished = true;
+      if (!status.ok())
+        return responder.FinishWithError(status, this);
+      if (!raw.has_response)
+        raw.response = Serialize(*response);
+      responder.Finish(raw.response, status, this);
+    }, &raw);
+  }
+
+private:
+  static const size_t ARENA_BLOCK_SIZE = 1024;
+
+  RawAsyncCall(Requester requester, Handler handler,
+               grpc::ServerCompletionQueue *cq)
+      : requester(std::move(requester)), handler(std::move(handler)), cq(cq),
+        arena(arena_options(arena_block)), responder(&context) {
+    this->requester(&context, &raw.request, &responder, cq, this);
+  }
+
+  static google::protobuf::ArenaOptions arena_options(char *block) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = ARENA_BLOCK_SIZE;
+    return options;
+  }
+
+  Requester requester;
+  Handler handler;
+  grpc::ServerCompletionQueue *cq;
+
+  alignas(8) char arena_block[ARENA_BLOCK_SIZE];
+  google::protobuf::Arena arena;
+  grpc::ServerContext context;
+  RawMessages raw;
+  grpc::ServerAsyncResponseWriter<grpc::ByteBuffer> responder;
+  bool finished = false;
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/*
+ * CRC-32C (Castagnoli), used to detect torn or corrupt records on disk
+ */
+inline uint32_t crc32c_portable(const void *data, size_t n, uint32_t crc) {
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i)
+    crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+/*
+ * The same checksum with the SSE4.2 crc32 instruction, 8 bytes at a time
+ */
+__attribute__((target("sse4.2"))) inline uint32_t
+crc32c_sse42(const void *data, size_t n, uint32_t crc) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  uint64_t c = ~crc;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    c = _mm_crc32_u64(c, word);
+  }
+  uint32_t c32 = static_cast<uint32_t>(c);
+  for (; n > 0; --n, ++p)
+    c32 = _mm_crc32_u8(c32, *p);
+  return ~c32;
+}
+#endif
+
+inline uint32_t crc32c(const void *data, size_t n, uint32_t crc = 0) {
+#if defined(__x86_64__)
+  static const bool hardware = __builtin_cpu_supports("sse4.2");
+  if (hardware)
+    return crc32c_sse42(data, n, crc);
+#endif
+  return crc32c_portable(data, n, crc);
+}
@@ -0,0 +1,73 @@
+#include "HintStore.h"
+
+HintStore::HintStore(size_t max_hints) : max_hints(max_hints) {}
+
+bool HintStore::add(const std::string &target, const std::string &key,
+                    const std::string &val, int64_t timestamp) {
+  std::lock_guard lock(mutex);
+
+  auto &pending = hints[target];
+  auto it = pending.find(key);
+  if (it != pending.end()) {
+    if (timestamp > it->second.second)
+      it->second = {val, timestamp};
+    return true;
+  }
+
+  if (count >= max_hints)
+    return false;
+  pending.emplace(key, Val_TS{val, timestamp});
+  count++;
+  return true;
+}
+
+std::vector<std::string> HintStore::targets() {
+  std::lock_guard lock(mutex);
+
+  std::vector<std::string> result;
+  for (const auto &[target, pending] : hints) {
+    if (!pending.empty())
+      result.push_back(target);
+  }
+  return result;
+}
+
+std::vector<Hint> HintStore::peek(const std::string &target, size_t n) {
+  std::lock_guard lock(mutex);
+
+  std::vector<Hint> batch;
+  auto it = hints.find(target);
+  if (it == hints.end())
+    return batch;
+
+  for (const auto &[key, value] : it->second) {
+    if (batch.size() >= n)
+      break;
+    batch.push_back({key, value.first, value.second});
+  }
+  return batch;
+}
+
+void HintStore::acknowledge(const std::string &target,
+                            const std::vector<Hint> &delivered) {
+  std::lock_guard lock(mutex);
+
+  auto it = hints.find(target);
+  if (it == hints.end())
+    return;
+
+  for (const Hint &hint : delivered) {
+    auto entry = it->second.find(hint.key);
+    if (entry != it->second.end() && entry->second.second == hint.timestamp) {
+      it->second.erase(entry);
+      count--;
+    }
+  }
+  if (it->second.empty())
+    hints.erase(it);
+}
+
+size_t HintStore::size() {
+  std::lock_guard lock(mutex);
+  return count;
+}
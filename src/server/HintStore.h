@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "StorageEngine.h"
+
+struct Hint {
+  std::string key;
+  std::string val;
+  int64_t timestamp;
+};
+
+/*
+ * Writes held on behalf of replicas that were down when they were sent.
+ *
+ * Hints are grouped by the node they belong to and collapsed per key with
+ * last writer wins, so a hot key written many times during an outage is
+ * only handed back once. Hints live in memory and are capped; anything
+ * lost is left for anti-entropy to repair.
+ */
+class HintStore {
+public:
+  HintStore(size_t max_hints = 1000000);
+
+  /*
+   * Stores a hint for target. Returns false if the store is full.
+   */
+  bool add(const std::string &target, const std::string &key,
+           const std::string &val, int64_t timestamp);
+
+  /*
+   * Nodes that have hints waiting
+   */
+  std::vector<std::string> targets();
+
+  /*
+   * Copies up to n hints for target, they stay stored until acknowledged
+   */
+  std::vector<Hint> peek(const std::string &target, size_t n);
+
+  /*
+   * Drops delivered hints, unless a newer write for the key arrived
+   * while they were in flight
+   */
+  void acknowledge(const std::string &target, const std::vector<Hint> &hints);
+
+  size_t size();
+
+private:
+  std::mutex mutex;
+  std::unordered_map<std::string, std::unordered_map<std::string, Val_TS>>
+      hints;
+  size_t count = 0;
+  size_t max_hints;
+};
@@ -0,0 +1,206 @@
+#include "HotKeyCache.h"
+#include <algorithm>
+#include <bit>
+
+#include "Hash.h"
+
+FrequencySketch::FrequencySketch(size_t capacity) {
+  size_t width = std::bit_ceil(std::max<size_t>(capacity * 4, 1024));
+  width_mask = width - 1;
+  sample_size = std::max<size_t>(capacity * 10, 10000);
+  counters = std::make_unique<std::atomic<uint8_t>[]>(width * DEPTH);
+}
+
+size_t FrequencySketch::cell(uint64_t hash, int row) const {
+  uint64_t step = (hash >> 32) | 1;
+  return row * (width_mask + 1) + ((hash + row * step) & width_mask);
+}
+
+void FrequencySketch::increment(const std::string &key) {
+  uint64_t hash = murmur64(key);
+  for (int row = 0; row < DEPTH; ++row) {
+    std::atomic<uint8_t> &counter = counters[cell(hash, row)];
+    uint8_t value = counter.load(std::memory_order_relaxed);
+    // A lost race only undercounts, which the sketch tolerates
+    if (value < UINT8_MAX)
+      counter.compare_exchange_weak(value, value + 1,
+                                    std::memory_order_relaxed);
+  }
+  if (additions.fetch_add(1, std::memory_order_relaxed) + 1 == sample_size)
+    age();
+}
+
+uint32_t FrequencySketch::estimate(const std::string &key) const {
+  uint64_t hash = murmur64(key);
+  uint32_t lowest = UINT8_MAX;
+  for (int row = 0; row < DEPTH; ++row)
+    lowest = std::min<uint32_t>(
+        lowest, counters[cell(hash, row)].load(std::memory_order_relaxed));
+  return lowest;
+}
+
+void FrequencySketch::age() {
+  for (size_t i = 0; i < (width_mask + 1) * DEPTH; ++i)
+    counters[i].store(counters[i].load(std::memory_order_relaxed) / 2,
+                      std::memory_order_relaxed);
+  additions.store(0, std::memory_order_relaxed);
+}
+
+HotKeyCache::HotKeyCache(size_t capacity, std::chrono::milliseconds staleness)
+    : sketch(capacity), max_staleness(staleness),
+      shard_capacity(std::max<size_t>(1, capacity / SHARDS)) {}
+
+HotKeyCache::Shard &HotKeyCache::shard_of(const std::string &key) {
+  return shards[murmur64(key) % SHARDS];
+}
+
+void HotKeyCache::erase(Shard &shard, std::list<Entry>::iterator it) {
+  shard.index.erase(it->key);
+  shard.lru.erase(it);
+}
+
+void HotKeyCache::make_room(Shard &shard) {
+  if (shard.lru.size() < shard_capacity)
+    return;
+  erase(shard, std::prev(shard.lru.end()));
+  evictions.add();
+}
+
+bool HotKeyCache::lookup(const std::string &key, int quorum,
+                         grpc::ByteBuffer *response) {
+  sketch.increment(key);
+  Shard &shard = shard_of(key);
+  {
+    std::lock_guard lock(shard.mutex);
+    auto found = shard.index.find(key);
+    if (found != shard.index.end()) {
+      auto it = found->second;
+      if (it->expires <= Clock::now()) {
+        erase(shard, it);
+      } else if (!it->fence && it->quorum >= quorum) {
+        *response = it->response;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it);
+        hits.add();
+        return true;
+      }
+    }
+  }
+  misses.add();
+  return false;
+}
+
+bool HotKeyCache::admits(const std::string &key) {
+  uint32_t frequency = sketch.estimate(key);
+  if (frequency < ADMIT_FREQUENCY)
+    return false;
+
+  Shard &shard = shard_of(key);
+  std::lock_guard lock(shard.mutex);
+  if (shard.lru.size() < shard_capacity || shard.index.count(key))
+    return true;
+  return frequency > sketch.estimate(shard.lru.back().key);
+}
+
+void HotKeyCache::fill(const std::string &key, int quorum, int64_t timestamp,
+                       const grpc::ByteBuffer &response) {
+  Shard &shard = shard_of(key);
+  std::lock_guard lock(shard.mutex);
+  auto now = Clock::now();
+
+  auto found = shard.index.find(key);
+  if (found != shard.index.end()) {
+    Entry &entry = *found->second;
+    // A fence or a newer reply that is still fresh wins
+    if (entry.expires > now && entry.timestamp > timestamp)
+      return;
+    erase(shard, found->second);
+  }
+
+  make_room(shard);
+  shard.lru.push_front(
+      {key, response, timestamp, quorum, now + max_staleness, false});
+  shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+  fills.add();
+}
+
+void HotKeyCache::invalidate(const std::string &key, int64_t timestamp) {
+  invalidations.add();
+  Shard &shard = shard_of(key);
+  std::lock_guard lock(shard.mutex);
+  auto expires = Clock::now() + max_staleness;
+
+  auto found = shard.index.find(key);
+  if (found != shard.index.end()) {
+    Entry &entry = *found->second;
+    if (entry.timestamp >= timestamp && !entry.fence)
+      return;
+    entry.response.Clear();
+    entry.timestamp = std::max(entry.timestamp, timestamp);
+    entry.expires = expires;
+    entry.fence = true;
+    return;
+  }
+
+  make_room(shard);
+  shard.lru.push_front({key, grpc::ByteBuffer(), timestamp, 0, expires, true});
+  shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+}
+
+size_t HotKeyCache::size() const {
+  size_t total = 0;
+  for (const Shard &shard : shards) {
+    std::lock_guard lock(shard.mutex);
+    total += shard.lru.size();
+  }
+  return total;
+}
+
+void CacheHolders::add(const std::string &key, const std::string &holder,
+                       std::chrono::milliseconds ttl) {
+  Shard &shard = shards[murmur64(key) % SHARDS];
+  std::lock_guard lock(shard.mutex);
+  auto now = Clock::now();
+  if (++shard.adds % SWEEP_EVERY == 0)
+    sweep(shard, now);
+
+  auto [it, added] = shard.keys.try_emplace(key);
+  if (added)
+    count.fetch_add(1, std::memory_order_relaxed);
+  for (Holder &h : it->second) {
+    if (h.address == holder) {
+      h.until = std::max(h.until, now + ttl);
+      return;
+    }
+  }
+  it->second.push_back({holder, now + ttl});
+}
+
+std::vector<std::string> CacheHolders::take(const std::string &key) {
+  Shard &shard = shards[murmur64(key) % SHARDS];
+  std::vector<std::string> holders;
+  std::lock_guard lock(shard.mutex);
+  auto it = shard.keys.find(key);
+  if (it == shard.keys.end())
+    return holders;
+
+  auto now = Clock::now();
+  for (const Holder &h : it->second) {
+    if (h.until > now)
+      holders.push_back(h.address);
+  }
+  shard.keys.erase(it);
+  count.fetch_sub(1, std::memory_order_relaxed);
+  return holders;
+}
+
+void CacheHolders::sweep(Shard &shard, Clock::time_point now) {
+  for (auto it = shard.keys.begin(); it != shard.keys.end();) {
+    std::erase_if(it->second, [now](const Holder &h) { return h.until <= now; });
+    if (it->second.empty()) {
+      it = shard.keys.erase(it);
+      count.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+      ++it;
+    }
+  }
+}
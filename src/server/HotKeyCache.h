@@ -0,0 +1,159 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "Metrics.h"
+
+/*
+ * Count-min sketch of how often keys are read, with 8-bit counters. All
+ * counters are halved once it has counted ten times as many reads as the
+ * cache holds keys, so keys that were hot a while ago fade.
+ */
+class FrequencySketch {
+public:
+  explicit FrequencySketch(size_t capacity);
+
+  void increment(const std::string &key);
+  uint32_t estimate(const std::string &key) const;
+
+private:
+  static const int DEPTH = 4;
+
+  std::unique_ptr<std::atomic<uint8_t>[]> counters; // DEPTH rows
+  size_t width_mask;
+  size_t sample_size;
+  std::atomic<size_t> additions{0};
+
+  size_t cell(uint64_t hash, int row) const;
+  void age();
+};
+
+/*
+ * Read-through cache of the owner's Get replies on nodes that do not own
+ * the key.
+ *
+ * Only hot keys get in: a key read on this node is admitted once the
+ * sketch has seen it ADMIT_FREQUENCY times, and if the cache is full,
+ * more often than the key it would evict (TinyLFU). An entry is served
+ * for at most the staleness bound, and dropped earlier when the owner
+ * sends an invalidation for a newer version. An invalidation that
+ * overtakes the reply it applies to leaves a fence, so the older reply is
+ * not cached when it arrives. Replies are kept serialized, so a hit on
+ * the raw path sends the cached bytes as they are.
+ *
+ * Entries are split over shards, each with its own lock and LRU list.
+ */
+class HotKeyCache {
+public:
+  static const uint32_t ADMIT_FREQUENCY = 3;
+
+  HotKeyCache(size_t capacity, std::chrono::milliseconds staleness);
+
+  /*
+   * Counts a read of key and copies the cached reply into response if
+   * there is a fresh one from a read of at least quorum replicas
+   */
+  bool lookup(const std::string &key, int quorum, grpc::ByteBuffer *response);
+
+  /*
+   * Whether the owner's reply to a missed read of key should be cached
+   */
+  bool admits(const std::string &key);
+
+  void fill(const std::string &key, int quorum, int64_t timestamp,
+            const grpc::ByteBuffer &response);
+
+  /*
+   * Drops the cached reply of key if it is older than timestamp
+   */
+  void invalidate(const std::string &key, int64_t timestamp);
+
+  std::chrono::milliseconds staleness() const { return max_staleness; }
+  size_t size() const;
+
+  Counter hits;
+  Counter misses;
+  Counter fills;
+  Counter invalidations;
+  Counter evictions;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  static const size_t SHARDS = 16;
+
+  struct Entry {
+    std::string key;
+    grpc::ByteBuffer response; // empty for a fence
+    int64_t timestamp;
+    int quorum;
+    Clock::time_point expires;
+    bool fence;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+  };
+
+  FrequencySketch sketch;
+  std::chrono::milliseconds max_staleness;
+  size_t shard_capacity;
+  Shard shards[SHARDS];
+
+  Shard &shard_of(const std::string &key);
+
+  /*
+   * Makes room for one more entry, with the shard locked
+   */
+  void make_room(Shard &shard);
+  void erase(Shard &shard, std::list<Entry>::iterator it);
+};
+
+/*
+ * The nodes caching each key, kept by the key's owner until their
+ * staleness bound runs out, so a write knows whom to invalidate
+ */
+class CacheHolders {
+public:
+  void add(const std::string &key, const std::string &holder,
+           std::chrono::milliseconds ttl);
+
+  /*
+   * Removes and returns the nodes that may still cache key
+   */
+  std::vector<std::string> take(const std::string &key);
+
+  bool empty() const { return count.load(std::memory_order_relaxed) == 0; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+  static const size_t SHARDS = 16;
+  static const size_t SWEEP_EVERY = 1024; // adds between sweeps of a shard
+
+  struct Holder {
+    std::string address;
+    Clock::time_point until;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<Holder>> keys;
+    size_t adds = 0;
+  };
+
+  Shard shards[SHARDS];
+  std::atomic<size_t> count{0}; // keys with holders
+
+  void sweep(Shard &shard, Clock::time_point now);
+};
@@ -0,0 +1,87 @@
+#include "KeyIndex.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+// Followed in the same slot by height links and then the key
+struct alignas(void *) KeyIndex::Node {
+  uint32_t key_size;
+  uint32_t height;
+
+  Node(uint32_t key_size, uint32_t height)
+      : key_size(key_size), height(height) {
+    for (uint32_t level = 0; level < height; ++level)
+      next(level) = nullptr;
+  }
+
+  static size_t size_for(int height, size_t key_size) {
+    return sizeof(Node) + height * sizeof(Node *) + key_size;
+  }
+
+  Node *&next(int level) { return reinterpret_cast<Node **>(this + 1)[level]; }
+  char *key_data() { return reinterpret_cast<char *>(&next(height)); }
+  std::string_view key() { return {key_data(), key_size}; }
+};
+
+KeyIndex::KeyIndex(SlabAllocator &slab)
+    : slab(slab), rng(std::random_device{}()) {
+  head = new (slab.allocate(Node::size_for(MAX_HEIGHT, 0))) Node(0, MAX_HEIGHT);
+}
+
+int KeyIndex::random_height() {
+  // Each level up is taken with probability 1/4
+  int h = 1;
+  while (h < MAX_HEIGHT && (rng() & 3) == 0)
+    h++;
+  return h;
+}
+
+KeyIndex::Node *KeyIndex::find_greater_or_equal(std::string_view key,
+                                                Node **prev) {
+  Node *node = head;
+  for (int level = height - 1; level >= 0; --level) {
+    while (node->next(level) && node->next(level)->key() < key)
+      node = node->next(level);
+    if (prev)
+      prev[level] = node;
+  }
+  return node->next(0);
+}
+
+void KeyIndex::insert(std::string_view key) {
+  Node *prev[MAX_HEIGHT];
+  find_greater_or_equal(key, prev);
+
+  int h = random_height();
+  for (int level = height; level < h; ++level)
+    prev[level] = head;
+  height = std::max(height, h);
+
+  Node *node = new (slab.allocate(Node::size_for(h, key.size())))
+      Node(static_cast<uint32_t>(key.size()), static_cast<uint32_t>(h));
+  std::memcpy(node->key_data(), key.data(), key.size());
+  for (int level = 0; level < h; ++level) {
+    node->next(level) = prev[level]->next(level);
+    prev[level]->next(level) = node;
+  }
+}
+
+void KeyIndex::remove(std::string_view key) {
+  Node *prev[MAX_HEIGHT];
+  Node *node = find_greater_or_equal(key, prev);
+  if (!node || node->key() != key)
+    return;
+
+  for (uint32_t level = 0; level < node->height; ++level)
+    prev[level]->next(level) = node->next(level);
+  slab.deallocate(node, Node::size_for(node->height, node->key_size));
+}
+
+KeyIndex::Iterator KeyIndex::seek(std::string_view key) {
+  return Iterator(find_greater_or_equal(key, nullptr));
+}
+
+std::string_view KeyIndex::Iterator::key() const { return node->key(); }
+
+void KeyIndex::Iterator::next() { node = node->next(0); }
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <string_view>
+
+#include "SlabAllocator.h"
+
+/*
+ * Keys of one storage shard in sorted order, backed by a skiplist.
+ *
+ * Only keys are kept, a scan looks their values up in the shard's hash
+ * table. Nodes are variable sized, holding as many links as their height
+ * and then the key, and come from the shard's slab, so a short key costs
+ * one small slot. Not thread safe, used under the shard's lock like the
+ * slab.
+ */
+class KeyIndex {
+  struct Node;
+
+public:
+  KeyIndex(SlabAllocator &slab);
+  KeyIndex(const KeyIndex &) = delete;
+  KeyIndex &operator=(const KeyIndex &) = delete;
+
+  /*
+   * key must not be in the index yet
+   */
+  void insert(std::string_view key);
+
+  void remove(std::string_view key);
+
+  class Iterator {
+  public:
+    bool valid() const { return node != nullptr; }
+    std::string_view key() const;
+    void next();
+
+  private:
+    friend class KeyIndex;
+    Node *node;
+    Iterator(Node *node) : node(node) {}
+  };
+
+  /*
+   * Positioned at the first key not less than key
+   */
+  Iterator seek(std::string_view key);
+
+private:
+  static const int MAX_HEIGHT = 12;
+
+  // Nodes only hold plain bytes, they go back to the system with the slab
+  Node *head;
+  int height = 1;
+  SlabAllocator &slab;
+  std::minstd_rand rng;
+
+  int random_height();
+  Node *find_greater_or_equal(std::string_view key, Node **prev);
+};
@@ -0,0 +1,37 @@
+#include "MapEngine.h"
+
+bool MapEngine::write(const std::string &key, const std::string &val,
+                      int64_t timestamp, int64_t *replaced) {
+  std::lock_guard<std::mutex> lock(kv_mutex);
+
+  auto it = kv_store.find(key);
+  if (it == kv_store.end()) {
+    kv_store.emplace(key, Val_TS{val, timestamp});
+    if (replaced)
+      *replaced = -1;
+    return true;
+  }
+
+  if (timestamp <= it->second.second)
+    return false;
+
+  if (replaced)
+    *replaced = it->second.second;
+  it->second = {val, timestamp};
+  return true;
+}
+
+Val_TS MapEngine::read(const std::string &key) {
+  std::lock_guard<std::mutex> lock(kv_mutex);
+
+  auto it = kv_store.find(key);
+  if (it == kv_store.end())
+    return {"", -1};
+
+  return it->second;
+}
+
+size_t MapEngine::size() {
+  std::lock_guard<std::mutex> lock(kv_mutex);
+  return kv_store.size();
+}
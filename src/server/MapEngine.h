@@ -0,0 +1,23 @@
+#pragma once
+#include <mutex>
+#include <unordered_map>
+
+#include "StorageEngine.h"
+
+/*
+ * A single hash map guarded by one mutex.
+ * Simple, but every operation on the node serializes on the same lock.
+ */
+class MapEngine : public StorageEngine {
+public:
+  bool write(const std::string &key, const std::string &val,
+             int64_t timestamp, int64_t *replaced = nullptr) override;
+
+  Val_TS read(const std::string &key) override;
+
+  size_t size() override;
+
+private:
+  std::unordered_map<std::string, Val_TS> kv_store;
+  std::mutex kv_mutex;
+};
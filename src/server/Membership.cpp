@@ -0,0 +1,359 @@
+#include "Membership.h"
+#include <algorithm>
+#include <cmath>
+
+#include "Log.h"
+
+using tinykv::MemberState;
+using tinykv::MemberUpdate;
+
+static const char *StateName(MemberState state) {
+  switch (state) {
+  case tinykv::ALIVE:
+    return "ALIVE";
+  case tinykv::SUSPECT:
+    return "SUSPECT";
+  case tinykv::DEAD:
+    return "DEAD";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+Membership::Membership(const std::string &self,
+                       const std::vector<std::string> &peers,
+                       const MembershipOptions &options)
+    : self(self), opts(options), rng(std::random_device{}()) {
+  incarnation = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count();
+
+  // Peers start out alive, as if we had just heard from them. A peer that
+  // is down fails its first probe and is suspected within a few periods.
+  auto directory_table = std::make_shared<Directory>();
+  int64_t now = Clock::now().time_since_epoch().count();
+  for (const std::string &address : peers) {
+    if (address == self || directory_table->members.count(address))
+      continue;
+    auto member = std::make_unique<Member>();
+    member->address = address;
+    member->last_heard = now;
+    member->sampled_heard = now;
+    directory_table->members[address] = member.get();
+    probe_order.push_back(member.get());
+    members.push_back(std::move(member));
+  }
+  live = members.size();
+  std::shuffle(probe_order.begin(), probe_order.end(), rng);
+
+  directory.store(std::move(directory_table));
+  directory_version = 1;
+}
+
+/*
+ * Swaps in a lookup table built from the current members. Callers hold
+ * the mutex.
+ */
+void Membership::publish_directory() {
+  auto directory_table = std::make_shared<Directory>();
+  for (const auto &member : members)
+    directory_table->members[member->address] = member.get();
+  directory.store(std::move(directory_table));
+  directory_version.fetch_add(1, std::memory_order_release);
+}
+
+void Membership::add_member(const std::string &address) {
+  std::lock_guard lock(mutex);
+  if (address == self || find(address))
+    return;
+
+  auto member = std::make_unique<Member>();
+  member->address = address;
+  member->last_heard = Clock::now().time_since_epoch().count();
+  member->sampled_heard = member->last_heard;
+  probe_order.push_back(member.get());
+  members.push_back(std::move(member));
+  live.fetch_add(1);
+  publish_directory();
+
+  LOG_INFO("Gossip", "Tracking new member {}", address);
+}
+
+void Membership::remove_member(const std::string &address) {
+  std::lock_guard lock(mutex);
+  auto it = std::find_if(members.begin(), members.end(),
+                         [&](const auto &m) { return m->address == address; });
+  if (it == members.end())
+    return;
+
+  auto order = std::find(probe_order.begin(), probe_order.end(), it->get());
+  if (order - probe_order.begin() < (ptrdiff_t)probe_cursor)
+    probe_cursor--;
+  probe_order.erase(order);
+
+  if ((*it)->state == tinykv::ALIVE)
+    live.fetch_sub(1);
+  retired.push_back(std::move(*it));
+  members.erase(it);
+  publish_directory();
+
+  LOG_INFO("Gossip", "Stopped tracking {}", address);
+}
+
+Membership::Member *Membership::find(const std::string &address) const {
+  // Each thread keeps the directory it saw last and only reloads it when
+  // the version moves, so lookups are a relaxed load and a hash probe
+  struct Cache {
+    const Membership *owner = nullptr;
+    uint64_t version = 0;
+    std::shared_ptr<const Directory> directory;
+  };
+  static thread_local Cache cache;
+
+  uint64_t version = directory_version.load(std::memory_order_acquire);
+  if (cache.owner != this || cache.version != version) {
+    cache.directory = directory.load(std::memory_order_acquire);
+    cache.owner = this;
+    cache.version = version;
+  }
+
+  auto it = cache.directory->members.find(address);
+  return it == cache.directory->members.end() ? nullptr : it->second;
+}
+
+void Membership::heard_from(const std::string &address) {
+  if (Member *member = find(address))
+    member->last_heard.store(Clock::now().time_since_epoch().count(),
+                             std::memory_order_relaxed);
+}
+
+bool Membership::is_alive(const std::string &address) const {
+  Member *member = find(address);
+  return member &&
+         member->state.load(std::memory_order_relaxed) == tinykv::ALIVE;
+}
+
+int Membership::retransmit_limit() const {
+  return 3 * (int)std::ceil(std::log10(members.size() + 2));
+}
+
+Membership::Clock::duration Membership::suspicion_timeout() const {
+  double scale = std::max(1.0, std::log10(members.size() + 1));
+  return opts.period * (int)std::ceil(opts.suspicion_multiplier * scale);
+}
+
+/*
+ * Phi of the exponential distribution fitted to the arrival intervals:
+ * -log10(P(silence >= elapsed)) = elapsed / mean * log10(e)
+ *
+ * The mean is floored at one period. Bursts of traffic make the sampled
+ * intervals tiny, and a healthy peer may still be quiet for a whole period.
+ */
+double Membership::phi(const Member &member, Clock::time_point now) const {
+  double period = std::chrono::duration<double>(opts.period).count();
+  double mean = member.intervals.empty()
+                    ? period
+                    : member.interval_sum / member.intervals.size();
+  Clock::time_point last{Clock::duration(member.last_heard.load())};
+  double elapsed = std::chrono::duration<double>(now - last).count();
+  return elapsed / std::max(mean, period) * std::log10(std::exp(1.0));
+}
+
+void Membership::set_state(Member &member, MemberState state,
+                           uint64_t member_incarnation) {
+  MemberState previous = member.state.load();
+  member.incarnation = member_incarnation;
+  if (previous == state)
+    return;
+
+  if (state == tinykv::SUSPECT)
+    member.suspected_at = Clock::now();
+  if (state == tinykv::ALIVE) {
+    // Do not hold the outage against the peer's arrival statistics
+    member.last_heard = Clock::now().time_since_epoch().count();
+    member.sampled_heard = member.last_heard;
+  }
+
+  bool was_live = previous == tinykv::ALIVE;
+  bool is_live = state == tinykv::ALIVE;
+  member.state.store(state);
+  if (was_live != is_live)
+    live.fetch_add(is_live ? 1 : -1);
+
+  LOG_INFO("Gossip", "{} is {} (incarnation {})", member.address,
+           StateName(state), member_incarnation);
+  enqueue(member.address, state, member_incarnation);
+}
+
+void Membership::enqueue(const std::string &address, MemberState state,
+                         uint64_t member_incarnation) {
+  auto it = std::find_if(
+      broadcasts.begin(), broadcasts.end(),
+      [&](const Broadcast &b) { return b.update.address() == address; });
+  if (it == broadcasts.end())
+    it = broadcasts.insert(broadcasts.end(), Broadcast{});
+
+  it->update.set_address(address);
+  it->update.set_state(state);
+  it->update.set_incarnation(member_incarnation);
+  it->transmits = 0;
+}
+
+void Membership::merge(
+    const google::protobuf::RepeatedPtrField<MemberUpdate> &updates) {
+  std::lock_guard lock(mutex);
+
+  for (const MemberUpdate &update : updates) {
+    if (update.address() == self) {
+      // Refute a rumour about ourselves with a newer incarnation
+      if (update.state() != tinykv::ALIVE &&
+          update.incarnation() >= incarnation)
+        incarnation = update.incarnation() + 1;
+      continue;
+    }
+
+    Member *member = find(update.address());
+    if (!member)
+      continue;
+
+    MemberState current = member->state.load();
+    uint64_t known = member->incarnation;
+    bool newer = update.incarnation() > known;
+    bool same = update.incarnation() == known;
+
+    switch (update.state()) {
+    case tinykv::ALIVE:
+      if (newer)
+        set_state(*member, tinykv::ALIVE, update.incarnation());
+      break;
+    case tinykv::SUSPECT:
+      if ((current == tinykv::ALIVE && (newer || same)) ||
+          (current == tinykv::SUSPECT && newer))
+        set_state(*member, tinykv::SUSPECT, update.incarnation());
+      break;
+    case tinykv::DEAD:
+      if (current != tinykv::DEAD && (newer || same))
+        set_state(*member, tinykv::DEAD, update.incarnation());
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void Membership::piggyback(
+    google::protobuf::RepeatedPtrField<MemberUpdate> *updates) {
+  std::lock_guard lock(mutex);
+
+  MemberUpdate *own = updates->Add();
+  own->set_address(self);
+  own->set_state(tinykv::ALIVE);
+  own->set_incarnation(incarnation);
+
+  // Least transmitted first, so new updates spread fastest
+  std::sort(broadcasts.begin(), broadcasts.end(),
+            [](const Broadcast &a, const Broadcast &b) {
+              return a.transmits < b.transmits;
+            });
+
+  int limit = retransmit_limit();
+  int sent = 0;
+  for (Broadcast &b : broadcasts) {
+    if (sent == MAX_PIGGYBACK)
+      break;
+    *updates->Add() = b.update;
+    b.transmits++;
+    sent++;
+  }
+
+  broadcasts.erase(std::remove_if(broadcasts.begin(), broadcasts.end(),
+                                  [limit](const Broadcast &b) {
+                                    return b.transmits >= limit;
+                                  }),
+                   broadcasts.end());
+}
+
+std::vector<std::pair<std::string, MemberState>> Membership::states() {
+  std::lock_guard lock(mutex);
+  std::vector<std::pair<std::string, MemberState>> result;
+  for (const auto &member : members)
+    result.emplace_back(member->address, member->state.load());
+  return result;
+}
+
+std::string Membership::next_probe_target() {
+  std::lock_guard lock(mutex);
+  if (probe_order.empty())
+    return "";
+
+  // Reshuffle after every full round
+  if (probe_cursor >= probe_order.size()) {
+    std::shuffle(probe_order.begin(), probe_order.end(), rng);
+    probe_cursor = 0;
+  }
+  return probe_order[probe_cursor++]->address;
+}
+
+std::vector<std::string>
+Membership::indirect_helpers(const std::string &target, int k) {
+  std::lock_guard lock(mutex);
+
+  std::vector<std::string> candidates;
+  for (const auto &member : members) {
+    if (member->address != target && member->state == tinykv::ALIVE)
+      candidates.push_back(member->address);
+  }
+  std::shuffle(candidates.begin(), candidates.end(), rng);
+  if ((int)candidates.size() > k)
+    candidates.resize(k);
+  return candidates;
+}
+
+void Membership::probe_result(const std::string &target, bool acked) {
+  std::lock_guard lock(mutex);
+
+  Member *member = find(target);
+  if (!member)
+    return;
+
+  if (acked) {
+    member->last_heard = Clock::now().time_since_epoch().count();
+    // Only the peer itself can clear a suspicion, by refuting it with a
+    // newer incarnation. Make sure the rumour reaches it.
+    if (member->state != tinykv::ALIVE)
+      enqueue(target, member->state, member->incarnation);
+    return;
+  }
+  if (member->state == tinykv::ALIVE)
+    set_state(*member, tinykv::SUSPECT, member->incarnation);
+}
+
+void Membership::tick() {
+  std::lock_guard lock(mutex);
+  auto now = Clock::now();
+
+  for (const auto &member : members) {
+    int64_t heard = member->last_heard.load(std::memory_order_relaxed);
+    if (heard != member->sampled_heard) {
+      double interval =
+          std::chrono::duration<double>(Clock::duration(heard) -
+                                        Clock::duration(member->sampled_heard))
+              .count();
+      member->sampled_heard = heard;
+      member->intervals.push_back(interval);
+      member->interval_sum += interval;
+      if (member->intervals.size() > WINDOW) {
+        member->interval_sum -= member->intervals.front();
+        member->intervals.pop_front();
+      }
+    }
+
+    MemberState state = member->state.load();
+    if (state == tinykv::ALIVE && phi(*member, now) > opts.phi_threshold) {
+      set_state(*member, tinykv::SUSPECT, member->incarnation);
+    } else if (state == tinykv::SUSPECT &&
+               now - member->suspected_at > suspicion_timeout()) {
+      set_state(*member, tinykv::DEAD, member->incarnation);
+    }
+  }
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tinykv.pb.h"
+
+struct MembershipOptions {
+  std::chrono::milliseconds period{500};        // one probe per period
+  std::chrono::milliseconds probe_timeout{200}; // direct and indirect probes
+  int indirect_probes = 3;                      // helpers asked on a miss
+  double phi_threshold = 8.0;
+  int suspicion_multiplier = 5; // suspicion lasts mult * log10(N) periods
+};
+
+/*
+ * SWIM-style membership and failure detection.
+ *
+ * Every protocol period the gossip thread probes one peer, walking the
+ * peers in a shuffled round-robin order, so every peer is probed within N
+ * periods. If the peer misses the probe, a few other peers are asked to
+ * probe it on our behalf before it is suspected. A peer is also suspected
+ * when its phi-accrual score crosses phi_threshold, i.e. when the silence
+ * since we last heard from it is unlikely given the intervals seen so far.
+ * A suspected peer that does not refute within the suspicion timeout is
+ * declared dead.
+ *
+ * State changes are piggybacked on probes and their acks and retransmitted
+ * about log(N) times, so they reach every node in O(log N) periods.
+ * Incarnation numbers order the changes: a node that hears it is suspected
+ * bumps its own and gossips that it is alive. Incarnations start at the wall
+ * clock, so a restarted node is newer than its old death.
+ *
+ * heard_from(), is_alive() and live_count() are on the request path and
+ * never take a lock.
+ */
+class Membership {
+public:
+  Membership(const std::string &self, const std::vector<std::string> &peers,
+             const MembershipOptions &options = {});
+
+  /*
+   * Starts or stops tracking a peer after a ring change. A new peer starts
+   * out alive, the same as the peers known at startup.
+   */
+  void add_member(const std::string &address);
+
+  void remove_member(const std::string &address);
+
+  /*
+   * Records that a peer just sent us a message
+   */
+  void heard_from(const std::string &address);
+
+  bool is_alive(const std::string &address) const;
+
+  /*
+   * Peers currently considered alive, excluding ourselves
+   */
+  int live_count() const { return live.load(std::memory_order_relaxed); }
+
+  /*
+   * Applies updates piggybacked on a message from a peer
+   */
+  void merge(const google::protobuf::RepeatedPtrField<tinykv::MemberUpdate>
+                 &updates);
+
+  /*
+   * Adds our own state and the freshest pending updates to a message
+   */
+  void piggyback(
+      google::protobuf::RepeatedPtrField<tinykv::MemberUpdate> *updates);
+
+  /*
+   * The peer to probe this period, or "" if there are none
+   */
+  std::string next_probe_target();
+
+  /*
+   * Up to k live peers other than target to probe it indirectly
+   */
+  std::vector<std::string> indirect_helpers(const std::string &target, int k);
+
+  /*
+   * Outcome of probing target directly and, if needed, indirectly
+   */
+  void probe_result(const std::string &target, bool acked);
+
+  /*
+   * Runs once per period: samples arrival intervals, raises suspicion for
+   * peers whose phi is too high and declares expired suspects dead
+   */
+  void tick();
+
+  const MembershipOptions &options() const { return opts; }
+
+  /*
+   * Every peer and the state we currently hold for it
+   */
+  std::vector<std::pair<std::string, tinykv::MemberState>> states();
+
+private:
+  static constexpr size_t WINDOW = 64;
+  static constexpr int MAX_PIGGYBACK = 8;
+
+  using Clock = std::chrono::steady_clock;
+
+  struct Member {
+    std::string address;
+    std::atomic<int64_t> last_heard{0}; // Clock ticks, written lock free
+    std::atomic<tinykv::MemberState> state{tinykv::ALIVE};
+
+    // Guarded by mutex
+    uint64_t incarnation = 0;
+    Clock::time_point suspected_at;
+    int64_t sampled_heard = 0;
+    std::deque<double> intervals; // seconds between arrivals
+    double interval_sum = 0;
+  };
+
+  // Immutable lookup table, replaced as a whole when members are added
+  struct Directory {
+    std::unordered_map<std::string, Member *> members;
+  };
+
+  struct Broadcast {
+    tinykv::MemberUpdate update;
+    int transmits;
+  };
+
+  std::string self;
+  MembershipOptions opts;
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Member>> members;
+  // Removed peers, kept because other threads may still hold a pointer
+  std::vector<std::unique_ptr<Member>> retired;
+  std::vector<Broadcast> broadcasts;
+  std::vector<Member *> probe_order;
+  size_t probe_cursor = 0;
+  uint64_t incarnation;
+  std::mt19937 rng;
+
+  std::atomic<std::shared_ptr<const Directory>> directory;
+  std::atomic<uint64_t> directory_version{0};
+  std::atomic<int> live{0};
+
+  Member *find(const std::string &address) const;
+  void publish_directory();
+  double phi(const Member &member, Clock::time_point now) const;
+  void set_state(Member &member, tinykv::MemberState state,
+                 uint64_t incarnation);
+  void enqueue(const std::string &address, tinykv::MemberState state,
+               uint64_t incarnation);
+  int retransmit_limit() const;
+  Clock::duration suspicion_timeout() const;
+};
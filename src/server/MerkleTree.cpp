@@ -0,0 +1,145 @@
+#include "MerkleTree.h"
+#include "Hash.h"
+#include <algorithm>
+
+static uint64_t version_hash(const std::string &key, int64_t timestamp) {
+  return murmur64(key.data(), key.size(), timestamp);
+}
+
+MerkleTree::MerkleTree(const HashRing &ring, const std::string &self,
+                       int replicas)
+    : ring(ring), replicas(replicas) {
+  size_t count = ring.vnode_count();
+  slot_of_vnode.assign(count, -1);
+
+  int self_index = ring.node_index(self);
+  for (size_t v = 0; v < count; ++v) {
+    auto holders = ring.vnode_preference(v, replicas);
+    if (std::find(holders.begin(), holders.end(), self_index) ==
+        holders.end())
+      continue;
+
+    uint64_t start = ring.vnode_position((v + count - 1) % count);
+    slot_of_vnode[v] = ranges.size();
+    ranges.push_back({start, ring.vnode_position(v) - start,
+                      std::make_unique<Leaf[]>(LEAVES)});
+  }
+}
+
+MerkleTree::Leaf *MerkleTree::leaf_of(const std::string &key) {
+  if (ranges.empty())
+    return nullptr;
+  int slot = slot_of_vnode[ring.find_vnode(key)];
+  if (slot < 0)
+    return nullptr;
+
+  Range &range = ranges[slot];
+  uint64_t offset = murmur64(key) - range.start;
+  size_t index = range.length == 0
+                     ? offset / (UINT64_MAX / LEAVES + 1)
+                     : (unsigned __int128)offset * LEAVES / range.length;
+  return &range.leaves[std::min<size_t>(index, LEAVES - 1)];
+}
+
+void MerkleTree::update(const std::string &key, int64_t replaced,
+                        int64_t timestamp) {
+  Leaf *target = leaf_of(key);
+  if (!target)
+    return;
+
+  uint64_t delta = version_hash(key, timestamp);
+  if (replaced >= 0) {
+    delta ^= version_hash(key, replaced);
+  } else {
+    std::lock_guard lock(target->mutex);
+    target->keys.push_back(key);
+  }
+  target->digest.fetch_xor(delta, std::memory_order_relaxed);
+}
+
+void MerkleTree::remove(const std::string &key, int64_t timestamp) {
+  Leaf *target = leaf_of(key);
+  if (!target)
+    return;
+
+  {
+    std::lock_guard lock(target->mutex);
+    auto it = std::find(target->keys.begin(), target->keys.end(), key);
+    if (it == target->keys.end())
+      return;
+    *it = std::move(target->keys.back());
+    target->keys.pop_back();
+  }
+  target->digest.fetch_xor(version_hash(key, timestamp),
+                           std::memory_order_relaxed);
+}
+
+std::vector<uint32_t>
+MerkleTree::shared_ranges(const std::string &peer) const {
+  std::vector<uint32_t> shared;
+  int peer_index = ring.node_index(peer);
+  for (uint32_t v = 0; v < slot_of_vnode.size(); ++v) {
+    if (slot_of_vnode[v] < 0)
+      continue;
+    auto holders = ring.vnode_preference(v, replicas);
+    if (std::find(holders.begin(), holders.end(), peer_index) !=
+        holders.end())
+      shared.push_back(v);
+  }
+  return shared;
+}
+
+const MerkleTree::Leaf *MerkleTree::leaf(uint32_t vnode,
+                                         uint32_t index) const {
+  if (vnode >= slot_of_vnode.size() || slot_of_vnode[vnode] < 0 ||
+      index >= LEAVES)
+    return nullptr;
+  return &ranges[slot_of_vnode[vnode]].leaves[index];
+}
+
+uint64_t MerkleTree::hash(uint32_t vnode, uint32_t level,
+                          uint32_t index) const {
+  if (level == LEAF_LEVEL) {
+    const Leaf *l = leaf(vnode, index);
+    return l ? l->digest.load(std::memory_order_relaxed) : 0;
+  }
+  if (level > LEAF_LEVEL || index >= (level == 0 ? 1u : FANOUT))
+    return 0;
+
+  uint64_t children[FANOUT];
+  for (int i = 0; i < FANOUT; ++i)
+    children[i] = hash(vnode, level + 1, index * FANOUT + i);
+  return murmur64(children, sizeof(children));
+}
+
+std::vector<uint32_t> MerkleTree::held_ranges() const {
+  std::vector<uint32_t> held;
+  for (uint32_t v = 0; v < slot_of_vnode.size(); ++v) {
+    if (slot_of_vnode[v] >= 0)
+      held.push_back(v);
+  }
+  return held;
+}
+
+std::vector<std::string> MerkleTree::range_keys(uint32_t vnode) const {
+  std::vector<std::string> all;
+  if (vnode >= slot_of_vnode.size() || slot_of_vnode[vnode] < 0)
+    return all;
+
+  const Range &range = ranges[slot_of_vnode[vnode]];
+  for (int i = 0; i < LEAVES; ++i) {
+    std::lock_guard lock(range.leaves[i].mutex);
+    all.insert(all.end(), range.leaves[i].keys.begin(),
+               range.leaves[i].keys.end());
+  }
+  return all;
+}
+
+std::vector<std::string> MerkleTree::keys(uint32_t vnode,
+                                          uint32_t index) const {
+  const Leaf *l = leaf(vnode, index);
+  if (!l)
+    return {};
+  std::lock_guard lock(l->mutex);
+  return l->keys;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HashRing.h"
+
+/*
+ * Merkle trees over the key ranges this node replicates, used to find
+ * where two replicas disagree without comparing every key.
+ *
+ * There is one tree per vnode arc the node holds a replica of. Each tree
+ * has a root, FANOUT inner nodes and FANOUT^2 leaves, and a key falls in
+ * the leaf that covers its ring position. A leaf digest is the XOR of a
+ * hash of every (key, timestamp) in it, so a write updates it in place
+ * by XORing out the replaced version and XORing in the new one. Inner
+ * hashes are computed from the leaves when they are asked for.
+ *
+ * Each leaf also lists its keys, so a divergent leaf can be repaired
+ * without scanning the store.
+ */
+class MerkleTree {
+public:
+  static constexpr int FANOUT = 16;
+  static constexpr int LEAVES = FANOUT * FANOUT;
+  static constexpr int LEAF_LEVEL = 2;
+
+  /*
+   * Builds empty trees for the arcs whose first `replicas` nodes include
+   * self. The ring must outlive the tree and not change.
+   */
+  MerkleTree(const HashRing &ring, const std::string &self, int replicas);
+
+  /*
+   * Records an accepted write. replaced is the timestamp of the version it
+   * overwrote, or -1 for a new key.
+   */
+  void update(const std::string &key, int64_t replaced, int64_t timestamp);
+
+  /*
+   * Records that the version timestamp of key was dropped from the store
+   */
+  void remove(const std::string &key, int64_t timestamp);
+
+  /*
+   * The vnodes whose arcs both this node and peer replicate
+   */
+  std::vector<uint32_t> shared_ranges(const std::string &peer) const;
+
+  /*
+   * Hash of a tree node. Level 0 is the root, level LEAF_LEVEL the leaves.
+   * Arcs this node does not hold hash to 0.
+   */
+  uint64_t hash(uint32_t vnode, uint32_t level, uint32_t index) const;
+
+  std::vector<std::string> keys(uint32_t vnode, uint32_t leaf) const;
+
+  /*
+   * The vnodes whose arcs this node holds, and every key in one of them.
+   * Rebalancing uses these to find the data a ring change moves.
+   */
+  std::vector<uint32_t> held_ranges() const;
+
+  std::vector<std::string> range_keys(uint32_t vnode) const;
+
+  size_t range_count() const { return ranges.size(); }
+
+private:
+  struct Leaf {
+    std::atomic<uint64_t> digest{0};
+    mutable std::mutex mutex;
+    std::vector<std::string> keys;
+  };
+
+  struct Range {
+    uint64_t start;  // position of the previous vnode, exclusive
+    uint64_t length; // 0 when one vnode owns the whole ring
+    std::unique_ptr<Leaf[]> leaves;
+  };
+
+  const HashRing &ring;
+  int replicas;
+  std::vector<int> slot_of_vnode; // -1 for arcs we do not hold
+  std::vector<Range> ranges;
+
+  const Leaf *leaf(uint32_t vnode, uint32_t index) const;
+  Leaf *leaf_of(const std::string &key);
+};
@@ -0,0 +1,144 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+size_t MetricShard() {
+  static std::atomic<size_t> next{0};
+  static thread_local size_t shard =
+      next.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+  return shard;
+}
+
+uint64_t Counter::value() const {
+  uint64_t total = 0;
+  for (const Slot &slot : slots)
+    total += slot.value.load(std::memory_order_relaxed);
+  return total;
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+  size_t bucket =
+      std::lower_bound(BOUNDS.begin(), BOUNDS.end(), micros) - BOUNDS.begin();
+  Shard &shard = shards[MetricShard()];
+  shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.sum_us.fetch_add(micros, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot snapshot;
+  for (const Shard &shard : shards) {
+    for (size_t i = 0; i < snapshot.buckets.size(); ++i)
+      snapshot.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+    snapshot.sum_us += shard.sum_us.load(std::memory_order_relaxed);
+  }
+  for (uint64_t n : snapshot.buckets)
+    snapshot.count += n;
+  return snapshot;
+}
+
+double LatencyHistogram::Snapshot::percentile(double p) const {
+  if (count == 0)
+    return 0;
+
+  double rank = p / 100.0 * count;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    if (buckets[i] == 0 || seen + buckets[i] < rank) {
+      seen += buckets[i];
+      continue;
+    }
+    // The overflow bucket has no upper bound, report its lower one
+    if (i == BOUNDS.size())
+      return BOUNDS.back();
+    double lower = i == 0 ? 0 : BOUNDS[i - 1];
+    double fraction = (rank - seen) / buckets[i];
+    return lower + fraction * (BOUNDS[i] - lower);
+  }
+  return BOUNDS.back();
+}
+
+const char *RpcName(Rpc rpc) {
+  switch (rpc) {
+  case Rpc::PING:
+    return "ping";
+  case Rpc::PUT:
+    return "put";
+  case Rpc::GET:
+    return "get";
+  case Rpc::MULTI_PUT:
+    return "multi_put";
+  case Rpc::MULTI_GET:
+    return "multi_get";
+  case Rpc::DELETE:
+    return "delete";
+  case Rpc::SCAN:
+    return "scan";
+  case Rpc::REPLICATE_BATCH:
+    return "replicate_batch";
+  }
+  return "unknown";
+}
+
+const char *OriginName(Origin origin) {
+  switch (origin) {
+  case Origin::CLIENT:
+    return "client";
+  case Origin::PEER:
+    return "peer";
+  case Origin::FORWARDED:
+    return "forwarded";
+  }
+  return "unknown";
+}
+
+static std::string FormatValue(double value) {
+  char text[32];
+  if (value == (double)(uint64_t)value)
+    std::snprintf(text, sizeof(text), "%llu", (unsigned long long)value);
+  else
+    std::snprintf(text, sizeof(text), "%.9g", value);
+  return text;
+}
+
+void PrometheusWriter::family(const std::string &name,
+                              const std::string &type,
+                              const std::string &help) {
+  out += "# HELP " + name + " " + help + "\n";
+  out += "# TYPE " + name + " " + type + "\n";
+}
+
+void PrometheusWriter::sample(const std::string &name,
+                              const std::string &labels, double value) {
+  out += name;
+  if (!labels.empty())
+    out += "{" + labels + "}";
+  out += " " + FormatValue(value) + "\n";
+}
+
+void PrometheusWriter::histogram(const std::string &name,
+                                 const std::string &labels,
+                                 const LatencyHistogram::Snapshot &snapshot) {
+  std::string prefix = labels.empty() ? "" : labels + ",";
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < LatencyHistogram::BOUNDS.size(); ++i) {
+    cumulative += snapshot.buckets[i];
+    sample(name + "_bucket",
+           prefix + "le=\"" +
+               FormatValue(LatencyHistogram::BOUNDS[i] / 1e6) + "\"",
+           cumulative);
+  }
+  sample(name + "_bucket", prefix + "le=\"+Inf\"", snapshot.count);
+  sample(name + "_sum", labels, snapshot.sum_us / 1e6);
+  sample(name + "_count", labels, snapshot.count);
+}
+
+uint64_t ResidentMemoryBytes() {
+  FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (!statm)
+    return 0;
+  unsigned long size = 0, resident = 0;
+  int fields = std::fscanf(statm, "%lu %lu", &size, &resident);
+  std::fclose(statm);
+  return fields == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
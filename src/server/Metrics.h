@@ -0,0 +1,141 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Counters and histograms that are cheap to record from any thread.
+ *
+ * Every metric is split into shards, each on its own cache line, and a
+ * thread always records into the same shard. Recording is one relaxed
+ * atomic add on a line that other threads rarely touch. Reading sums the
+ * shards, which is only done when the metrics are exported.
+ */
+
+static const size_t METRIC_SHARDS = 16;
+
+/*
+ * The shard the calling thread records into
+ */
+size_t MetricShard();
+
+class Counter {
+public:
+  void add(uint64_t n = 1) {
+    slots[MetricShard()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const;
+
+private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> value{0};
+  };
+  Slot slots[METRIC_SHARDS];
+};
+
+/*
+ * Latency histogram with fixed bucket bounds in microseconds, the same
+ * bounds Prometheus sees, so exporting needs no conversion
+ */
+class LatencyHistogram {
+public:
+  static constexpr std::array<uint64_t, 15> BOUNDS = {
+      50,    100,    250,    500,    1000,    2500,    5000,   10000,
+      25000, 50000, 100000, 250000, 500000, 1000000, 2500000};
+
+  struct Snapshot {
+    std::array<uint64_t, BOUNDS.size() + 1> buckets{}; // last is +Inf
+    uint64_t count = 0;
+    uint64_t sum_us = 0;
+
+    /*
+     * Estimate of the p-th percentile, interpolated within its bucket
+     */
+    double percentile(double p) const;
+  };
+
+  void record(uint64_t micros);
+
+  Snapshot snapshot() const;
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> buckets[BOUNDS.size() + 1] = {};
+    std::atomic<uint64_t> sum_us{0};
+  };
+  Shard shards[METRIC_SHARDS];
+};
+
+enum class Rpc {
+  PING,
+  PUT,
+  GET,
+  MULTI_PUT,
+  MULTI_GET,
+  DELETE,
+  SCAN,
+  REPLICATE_BATCH
+};
+enum class Origin { CLIENT, PEER, FORWARDED };
+
+static const int RPC_COUNT = 8;
+static const int ORIGIN_COUNT = 3;
+
+const char *RpcName(Rpc rpc);
+const char *OriginName(Origin origin);
+
+/*
+ * Everything a node records on its request path.
+ *
+ * A client request is CLIENT on its owner and FORWARDED on a node that
+ * passes it on, requests from other nodes are PEER.
+ */
+struct NodeMetrics {
+  using Clock = std::chrono::steady_clock;
+
+  LatencyHistogram rpc_latency[RPC_COUNT][ORIGIN_COUNT];
+
+  Counter write_quorums_reached;
+  Counter write_quorums_failed;
+  Counter read_quorums_reached;
+  Counter read_quorums_failed;
+  Counter replica_writes_acked;
+  Counter replica_writes_failed;
+  Counter hints_stored;
+  Counter read_repairs;
+  Counter keys_expired;
+  Counter tombstones_purged;
+
+  LatencyHistogram &latency(Rpc rpc, Origin origin) {
+    return rpc_latency[static_cast<int>(rpc)][static_cast<int>(origin)];
+  }
+};
+
+/*
+ * Builds a Prometheus text exposition, one metric family at a time
+ */
+class PrometheusWriter {
+public:
+  void family(const std::string &name, const std::string &type,
+              const std::string &help);
+
+  void sample(const std::string &name, const std::string &labels,
+              double value);
+
+  void histogram(const std::string &name, const std::string &labels,
+                 const LatencyHistogram::Snapshot &snapshot);
+
+  const std::string &text() const { return out; }
+
+private:
+  std::string out;
+};
+
+/*
+ * Resident set size of this process, 0 if unknown
+ */
+uint64_t ResidentMemoryBytes();
@@ -0,0 +1,52 @@
+#include "PeerPool.h"
+#include <algorithm>
+
+PeerPool::PeerPool(const std::string &address,
+                   const PeerChannelOptions &options)
+    : pick(options.pick) {
+  for (int i = 0; i < std::max(1, options.channels); ++i) {
+    data_lane.push_back(
+        std::make_unique<Client>(channel(address, options)));
+    data_lane.back()->set_call_timeout(options.deadline);
+  }
+  control_lane = std::make_unique<Client>(channel(address, options));
+}
+
+Client *PeerPool::data() {
+  size_t first = next.fetch_add(1, std::memory_order_relaxed);
+  if (pick == PeerPick::ROUND_ROBIN || data_lane.size() == 1)
+    return data_lane[first % data_lane.size()].get();
+
+  // Ties go round-robin, so an idle pool still spreads its calls
+  Client *best = nullptr;
+  for (size_t i = 0; i < data_lane.size(); ++i) {
+    Client *client = data_lane[(first + i) % data_lane.size()].get();
+    if (!best || client->in_flight() < best->in_flight())
+      best = client;
+  }
+  return best;
+}
+
+std::shared_ptr<grpc::Channel>
+PeerPool::channel(const std::string &address,
+                  const PeerChannelOptions &options) {
+  grpc::ChannelArguments args;
+  args.SetCompressionAlgorithm(options.compression);
+  args.SetMaxReceiveMessageSize(options.max_message_bytes);
+  args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+  if (options.keepalive.count() > 0) {
+    // Notices a dead connection between calls instead of on the next one
+    args.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, options.keepalive.count());
+    args.SetInt(GRPC_ARG_KEEPALIVE_TIMEOUT_MS,
+                std::max<int64_t>(1000, options.keepalive.count() / 2));
+    args.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+    args.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+  }
+  if (options.window_bytes > 0) {
+    args.SetInt(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, options.window_bytes);
+    args.SetInt(GRPC_ARG_HTTP2_BDP_PROBE, 0);
+  }
+  return grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(),
+                                   args);
+}
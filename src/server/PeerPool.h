@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Client.h"
+
+enum class PeerPick { ROUND_ROBIN, LEAST_IN_FLIGHT };
+
+struct PeerChannelOptions {
+  int channels = 2; // data lane connections per peer
+  PeerPick pick = PeerPick::LEAST_IN_FLIGHT;
+  grpc_compression_algorithm compression = GRPC_COMPRESS_GZIP;
+  int max_message_bytes = 256 * 1024 * 1024; // a replica write is a value
+  std::chrono::milliseconds keepalive{10000}; // 0 disables keepalive pings
+  int window_bytes = 0;            // HTTP/2 stream window, 0 to auto-tune
+  std::chrono::milliseconds deadline{0}; // per data lane call, 0 for none
+};
+
+/*
+ * The connections to one peer, split in two lanes.
+ *
+ * The data lane is a pool of channels, each with its own HTTP/2
+ * connection and flow control window, that forwards, replication, quorum
+ * reads and bulk transfers are spread over. The control lane is a
+ * connection of its own for gossip and ring changes, so a probe never
+ * waits behind a window full of replica writes and a busy node is not
+ * suspected because its data connections are.
+ */
+class PeerPool {
+public:
+  PeerPool(const std::string &address, const PeerChannelOptions &options);
+
+  /*
+   * A data lane client, picked round-robin or as the one with the fewest
+   * calls in flight
+   */
+  Client *data();
+
+  Client *control() { return control_lane.get(); }
+
+  /*
+   * Channel to address with the options' arguments. Each channel gets a
+   * connection of its own rather than sharing one with channels to the
+   * same address.
+   */
+  static std::shared_ptr<grpc::Channel>
+  channel(const std::string &address, const PeerChannelOptions &options);
+
+private:
+  PeerPick pick;
+  std::vector<std::unique_ptr<Client>> data_lane;
+  std::unique_ptr<Client> control_lane;
+  std::atomic<size_t> next{0};
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/*
+ * Collects responses from replicas that are contacted in parallel.
+ *
+ * on_done fires exactly once: as soon as `required` successful responses have
+ * arrived, or as soon as so many have failed that the quorum can no longer be
+ * reached. Callbacks hold a shared_ptr to the call, so responses that arrive
+ * after on_done has fired are still collected safely.
+ */
+template <typename T> class QuorumCall {
+public:
+  using Callback =
+      std::function<void(bool reached, const std::vector<T> &responses)>;
+
+  QuorumCall(int required, int total, Callback on_done)
+      : required(required), total(total), on_done(std::move(on_done)) {
+    // Nothing to wait for, or the quorum is unreachable from the start
+    if (required <= 0 || total < required) {
+      done = true;
+      this->on_done(required <= 0, responses);
+    }
+  }
+
+  void ack(T response) {
+    std::unique_lock<std::mutex> lock(mutex);
+    responses.push_back(std::move(response));
+    complete_if_decided(lock);
+  }
+
+  void fail() {
+    std::unique_lock<std::mutex> lock(mutex);
+    failures++;
+    complete_if_decided(lock);
+  }
+
+private:
+  int required;
+  int total;
+  int failures = 0;
+  bool done = false;
+  std::vector<T> responses;
+  Callback on_done;
+  std::mutex mutex;
+
+  void complete_if_decided(std::unique_lock<std::mutex> &lock) {
+    if (done)
+      return;
+
+    bool reached = (int)responses.size() >= required;
+    if (!reached && total - failures >= required)
+      return;
+
+    done = true;
+    std::vector<T> snapshot = responses;
+    Callback callback = std::move(on_done);
+    lock.unlock();
+
+    callback(reached, snapshot);
+  }
+};
+
+/*
+ * Calls on_done once `count` sub-requests have finished, whatever their
+ * outcome. Used to answer a batch after every group in it is resolved.
+ */
+class CountdownCall {
+public:
+  CountdownCall(int count, std::function<void()> on_done)
+      : remaining(count), on_done(std::move(on_done)) {
+    if (count <= 0)
+      this->on_done();
+  }
+
+  void finish() {
+    if (remaining.fetch_sub(1) == 1)
+      on_done();
+  }
+
+private:
+  std::atomic<int> remaining;
+  std::function<void()> on_done;
+};
@@ -0,0 +1,140 @@
+#include "ReplicationBatcher.h"
+#include <algorithm>
+
+#include "WireFormat.h"
+#include "tinykv.pb.h"
+
+ReplicationBatcher::ReplicationBatcher(std::string sender_id, Send send,
+                                       std::chrono::microseconds delay,
+                                       size_t max_writes, size_t max_bytes)
+    : sender_id(std::move(sender_id)), send_batch(std::move(send)),
+      delay(delay), max_writes(std::max<size_t>(1, max_writes)),
+      max_bytes(max_bytes) {
+  timer = std::thread(&ReplicationBatcher::run_timer, this);
+}
+
+ReplicationBatcher::~ReplicationBatcher() { stop(); }
+
+void ReplicationBatcher::stop() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  timer_cv.notify_one();
+  if (timer.joinable())
+    timer.join();
+}
+
+void ReplicationBatcher::add(const std::string &address,
+                             const std::string &key, const ValueRef &value,
+                             int64_t timestamp, const std::string &hint_for,
+                             Ack ack) {
+  std::vector<Write> full;
+  bool first = false;
+  {
+    std::lock_guard lock(mutex);
+    Queue &queue = queues[address];
+    auto [it, added] =
+        queue.positions.try_emplace(hint_for + '\0' + key, queue.writes.size());
+
+    if (added) {
+      first = queue.writes.empty();
+      if (first)
+        queue.deadline = Clock::now() + delay;
+      queue.writes.push_back({key, hint_for, value, timestamp, {}});
+      queue.bytes += value->size();
+    } else {
+      Write &write = queue.writes[it->second];
+      if (timestamp > write.timestamp) {
+        queue.bytes += value->size() - write.value->size();
+        write.value = value;
+        write.timestamp = timestamp;
+      }
+      writes_collapsed.add();
+    }
+    queue.writes[it->second].acks.push_back(std::move(ack));
+
+    // Nothing waits on the timer once it is stopped
+    if (stopping || queue.writes.size() >= max_writes ||
+        queue.bytes >= max_bytes) {
+      full = take(queue);
+      first = false;
+    }
+  }
+
+  if (first)
+    timer_cv.notify_one();
+  if (!full.empty())
+    send(address, std::move(full));
+}
+
+void ReplicationBatcher::run_timer() {
+  std::unique_lock lock(mutex);
+  while (true) {
+    auto now = Clock::now();
+    auto next = Clock::time_point::max();
+    std::vector<std::pair<std::string, std::vector<Write>>> due;
+    for (auto &[address, queue] : queues) {
+      if (queue.writes.empty())
+        continue;
+      if (stopping || queue.deadline <= now)
+        due.emplace_back(address, take(queue));
+      else
+        next = std::min(next, queue.deadline);
+    }
+
+    if (!due.empty()) {
+      lock.unlock();
+      for (auto &[address, writes] : due)
+        send(address, std::move(writes));
+      lock.lock();
+      continue;
+    }
+    if (stopping)
+      return;
+
+    if (next == Clock::time_point::max())
+      timer_cv.wait(lock);
+    else
+      timer_cv.wait_until(lock, next);
+  }
+}
+
+std::vector<ReplicationBatcher::Write>
+ReplicationBatcher::take(Queue &queue) {
+  std::vector<Write> writes;
+  writes.swap(queue.writes);
+  queue.positions.clear();
+  queue.bytes = 0;
+  return writes;
+}
+
+void ReplicationBatcher::send(const std::string &address,
+                              std::vector<Write> writes) {
+  tinykv::ReplicateBatchRequest header;
+  header.set_sender_id(sender_id);
+
+  MessageWriter request;
+  request.append(header);
+  tinykv::ReplicaWrite entry;
+  for (const Write &write : writes) {
+    entry.set_key(write.key);
+    entry.set_timestamp(write.timestamp);
+    entry.set_hint_for(write.hint_for);
+    request.append_entry(tinykv::ReplicateBatchRequest::kWritesFieldNumber,
+                         entry, tinykv::ReplicaWrite::kValFieldNumber,
+                         write.value);
+  }
+
+  batches_sent.add();
+  writes_sent.add(writes.size());
+  size_t count = writes.size();
+  auto pending = std::make_shared<std::vector<Write>>(std::move(writes));
+  send_batch(address, request.finish(), count,
+             [pending](bool ok, std::vector<bool> success) {
+               for (size_t i = 0; i < pending->size(); ++i) {
+                 for (Ack &ack : (*pending)[i].acks)
+                   ack(ok && success[i]);
+               }
+             });
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "Metrics.h"
+#include "StorageEngine.h"
+
+/*
+ * Coalesces the replica writes an owner sends into one ReplicateBatch
+ * call per peer.
+ *
+ * Each peer has a queue. A queue is sent once it holds max_writes writes
+ * or max_bytes of values, or delay after its first write arrived,
+ * whichever comes first. Writes to the same key (and hint) that meet in a
+ * queue collapse into the one with the highest timestamp, the same
+ * version last writer wins keeps on the replica. Every caller's ack runs
+ * once the write that carries its version, or a newer one, is acked, so a
+ * Put's quorum means what it meant with one call per write.
+ */
+class ReplicationBatcher {
+public:
+  using Ack = std::function<void(bool ok)>;
+  using Reply = std::function<void(bool ok, std::vector<bool> success)>;
+  // Sends a serialized ReplicateBatchRequest of writes entries to address
+  using Send = std::function<void(const std::string &address,
+                                  grpc::ByteBuffer request, size_t writes,
+                                  Reply reply)>;
+
+  ReplicationBatcher(std::string sender_id, Send send,
+                     std::chrono::microseconds delay, size_t max_writes,
+                     size_t max_bytes);
+  ~ReplicationBatcher();
+
+  /*
+   * Queues a replica write for address, ack runs once it is answered
+   */
+  void add(const std::string &address, const std::string &key,
+           const ValueRef &value, int64_t timestamp,
+           const std::string &hint_for, Ack ack);
+
+  /*
+   * Sends what is queued and stops the timer
+   */
+  void stop();
+
+  Counter batches_sent;
+  Counter writes_sent;
+  Counter writes_collapsed;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Write {
+    std::string key;
+    std::string hint_for;
+    ValueRef value;
+    int64_t timestamp;
+    std::vector<Ack> acks;
+  };
+
+  struct Queue {
+    std::vector<Write> writes;
+    std::unordered_map<std::string, size_t> positions; // hint_for + key
+    size_t bytes = 0;
+    Clock::time_point deadline;
+  };
+
+  std::string sender_id;
+  Send send_batch;
+  std::chrono::microseconds delay;
+  size_t max_writes;
+  size_t max_bytes;
+
+  std::mutex mutex;
+  std::condition_variable timer_cv;
+  std::unordered_map<std::string, Queue> queues;
+  bool stopping = false;
+  std::thread timer;
+
+  void run_timer();
+
+  /*
+   * Takes the writes out of a queue, with mutex held
+   */
+  std::vector<Write> take(Queue &queue);
+
+  void send(const std::string &address, std::vector<Write> writes);
+};
@@ -0,0 +1,134 @@
+#include "ScanMerge.h"
+#include <algorithm>
+
+using tinykv::KeyValue;
+using tinykv::ScanRequest;
+using tinykv::ScanResponse;
+
+std::string PrefixEnd(const std::string &prefix) {
+  std::string end = prefix;
+  while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xFF)
+    end.pop_back();
+  if (!end.empty())
+    end.back()++;
+  return end;
+}
+
+LocalScanSource::LocalScanSource(StorageEngine *store, std::string start,
+                                 std::string end, size_t chunk_size)
+    : store(store), start(std::move(start)), end(std::move(end)),
+      chunk_size(chunk_size) {}
+
+bool LocalScanSource::next(std::vector<ScanEntry> *chunk) {
+  chunk->clear();
+  store->scan(start, end, chunk_size, chunk);
+  if (chunk->empty())
+    return false;
+  // The smallest key after the last one
+  start = chunk->back().key + '\0';
+  return true;
+}
+
+PeerScanSource::PeerScanSource(Client *peer, const ScanRequest &request)
+    : reader(peer->scan(&context, request)) {}
+
+PeerScanSource::~PeerScanSource() {
+  if (finished)
+    return;
+  // Abandoned by the merge, drain what is in flight so the call can end
+  context.TryCancel();
+  ScanResponse response;
+  while (reader->Read(&response)) {
+  }
+  reader->Finish();
+}
+
+bool PeerScanSource::next(std::vector<ScanEntry> *chunk) {
+  chunk->clear();
+  if (finished)
+    return false;
+
+  ScanResponse response;
+  while (reader->Read(&response)) {
+    if (response.entries_size() == 0)
+      continue;
+    chunk->reserve(response.entries_size());
+    for (KeyValue &entry : *response.mutable_entries())
+      chunk->push_back(
+          {std::move(*entry.mutable_key()),
+           std::make_shared<const std::string>(std::move(*entry.mutable_val())),
+           entry.timestamp()});
+    return true;
+  }
+
+  finished = true;
+  error = !reader->Finish().ok();
+  return false;
+}
+
+ScanMerger::ScanMerger(std::vector<std::unique_ptr<ScanSource>> sources) {
+  cursors.resize(sources.size());
+  for (size_t i = 0; i < sources.size(); ++i) {
+    cursors[i].source = std::move(sources[i]);
+    if (cursors[i].source->next(&cursors[i].chunk))
+      push(i);
+  }
+}
+
+const std::string &ScanMerger::key_of(size_t cursor) const {
+  const Cursor &c = cursors[cursor];
+  return c.chunk[c.position].key;
+}
+
+/*
+ * Moves a cursor past its current entry, returns false once it runs dry
+ */
+bool ScanMerger::advance(Cursor &cursor) {
+  if (++cursor.position < cursor.chunk.size())
+    return true;
+  cursor.position = 0;
+  return cursor.source->next(&cursor.chunk);
+}
+
+void ScanMerger::push(size_t cursor) {
+  heap.push_back(cursor);
+  std::push_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) {
+    return key_of(a) > key_of(b);
+  });
+}
+
+size_t ScanMerger::pop() {
+  std::pop_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) {
+    return key_of(a) > key_of(b);
+  });
+  size_t cursor = heap.back();
+  heap.pop_back();
+  return cursor;
+}
+
+bool ScanMerger::next(ScanEntry *out) {
+  if (heap.empty())
+    return false;
+
+  size_t first = pop();
+  Cursor &cursor = cursors[first];
+  *out = std::move(cursor.chunk[cursor.position]);
+  if (advance(cursor))
+    push(first);
+
+  // Other copies of the same key, keep the newest
+  while (!heap.empty() && key_of(heap.front()) == out->key) {
+    size_t other = pop();
+    Cursor &c = cursors[other];
+    if (c.chunk[c.position].timestamp > out->timestamp)
+      *out = std::move(c.chunk[c.position]);
+    if (advance(c))
+      push(other);
+  }
+  return true;
+}
+
+size_t ScanMerger::failed_sources() const {
+  return std::count_if(cursors.begin(), cursors.end(),
+                       [](const Cursor &c) { return c.source->failed(); });
+}
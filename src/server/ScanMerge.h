@@ -0,0 +1,106 @@
+#pragma once
+#include <grpcpp/grpcpp.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Client.h"
+#include "StorageEngine.h"
+
+using ScanEntry = StorageEngine::ScanEntry;
+
+/*
+ * The first key past every key that starts with prefix, or "" if there is
+ * none
+ */
+std::string PrefixEnd(const std::string &prefix);
+
+/*
+ * A stream of stored versions in key order, read a chunk at a time
+ */
+class ScanSource {
+public:
+  virtual ~ScanSource() = default;
+
+  /*
+   * Replaces chunk with the next entries. Returns false, leaving chunk
+   * empty, once the stream is over.
+   */
+  virtual bool next(std::vector<ScanEntry> *chunk) = 0;
+
+  /*
+   * Whether the stream ended on an error rather than at its end
+   */
+  virtual bool failed() const { return false; }
+};
+
+/*
+ * Pages through a range of the local store
+ */
+class LocalScanSource : public ScanSource {
+public:
+  LocalScanSource(StorageEngine *store, std::string start, std::string end,
+                  size_t chunk_size);
+
+  bool next(std::vector<ScanEntry> *chunk) override;
+
+private:
+  StorageEngine *store;
+  std::string start; // just past the last key handed out
+  std::string end;
+  size_t chunk_size;
+};
+
+/*
+ * Reads a peer's Scan stream. The stream is only read as the merge needs
+ * it, so gRPC flow control holds the peer back when we fall behind.
+ */
+class PeerScanSource : public ScanSource {
+public:
+  PeerScanSource(Client *peer, const tinykv::ScanRequest &request);
+  ~PeerScanSource();
+
+  bool next(std::vector<ScanEntry> *chunk) override;
+  bool failed() const override { return error; }
+
+private:
+  grpc::ClientContext context;
+  std::unique_ptr<grpc::ClientReader<tinykv::ScanResponse>> reader;
+  bool finished = false;
+  bool error = false;
+};
+
+/*
+ * K-way merge of sorted sources on a min-heap of their current keys. A key
+ * found in several sources comes out once, as the version with the
+ * highest timestamp.
+ */
+class ScanMerger {
+public:
+  ScanMerger(std::vector<std::unique_ptr<ScanSource>> sources);
+
+  /*
+   * Returns false once every source is exhausted
+   */
+  bool next(ScanEntry *out);
+
+  /*
+   * Sources that ended on an error so far
+   */
+  size_t failed_sources() const;
+
+private:
+  struct Cursor {
+    std::unique_ptr<ScanSource> source;
+    std::vector<ScanEntry> chunk;
+    size_t position = 0;
+  };
+
+  std::vector<Cursor> cursors;
+  std::vector<size_t> heap; // cursors that still have entries
+
+  const std::string &key_of(size_t cursor) const;
+  bool advance(Cursor &cursor);
+  void push(size_t cursor);
+  size_t pop();
+};
@@ -1,17 +1,42 @@
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <future>
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/support/status.h>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <set>
+#include <shared_mutex>
 #include <thread>
 #include <unordered_map>
 
+#include "AsyncCall.h"
 #include "Client.h"
+#include "Hash.h"
 #include "HashRing.h"
+#include "HintStore.h"
+#include "HotKeyCache.h"
+#include "Log.h"
+#include "LsmEngine.h"
+#include "Membership.h"
+#include "MerkleTree.h"
+#include "Metrics.h"
+#include "PeerPool.h"
+#include "Quorum.h"
+#include "ReplicationBatcher.h"
+#include "ScanMerge.h"
+#include "ShardedEngine.h"
+#include "Snapshot.h"
+#include "StoredValue.h"
+#include "TimerWheel.h"
 #include "Utils.h"
+#include "WireFormat.h"
+#include "WriteAheadLog.h"
 
 #include "tinykv.grpc.pb.h"
 #include "tinykv.pb.h"
@@ -24,27 +49,282 @@ using grpc::Status;
 using namespace tinykv;
 using Val_TS = std::pair<std::string, int64_t>; // a timestamped string value
 
-class TinyServer final : public TinyKV::Service {
+static const int CALLS_PER_QUEUE = 8;
+static const size_t HINT_BATCH_SIZE = 128;
+static const auto HINT_REPLAY_INTERVAL = std::chrono::seconds(1);
+static const size_t DIGEST_BATCH_SIZE = 4096;
+static const size_t REPAIR_BATCH_SIZE = 128;
+static const int REBALANCE_BATCH_SIZE = 256;
+static const int REBALANCE_ATTEMPTS = 3;
+static const auto RING_UPDATE_TIMEOUT = std::chrono::seconds(30);
+static const auto REAP_TICK = std::chrono::milliseconds(100);
+static const size_t REAP_BATCH = 1024; // most keys reaped per tick
+static const size_t STORE_SHARDS = 64;
+static const size_t SCAN_CHUNK = 256;             // most keys per Scan message
+static const size_t SCAN_CHUNK_BYTES = 512 * 1024; // or value bytes
+static const size_t REPLICATE_BATCH_WRITES = 256;  // most writes per batch
+static const size_t REPLICATE_BATCH_BYTES = 1024 * 1024; // or value bytes
+static const size_t HOT_CACHE_MAX_REPLY = 64 * 1024; // larger ones not cached
+
+struct ServerOptions {
+  std::string port;
+  bool async_mode = false;
+  int cq_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::string engine = "memory";
+  bool wal_enabled = true;
+  std::string data_dir = "data";
+  SyncPolicy sync_policy = SyncPolicy::GROUP;
+  int group_commit_us = 500;
+  int replication_factor = 3;     // replicas anti-entropy keeps in sync
+  int anti_entropy_interval = 30; // seconds between rounds, 0 disables
+  int repair_rate = 10000;        // keys per second anti-entropy may move
+  int rebalance_rate = 20000;     // keys per second a ring change may move
+  int snapshot_interval = 60;     // seconds between snapshots, 0 disables
+  int tombstone_grace = 3600;     // seconds a deleted key's tombstone is kept
+  size_t memory_limit = 0;        // MiB the memory engine may hold, 0 for none
+  int replicate_batch_us = 100;   // replica write coalescing, 0 disables
+  size_t hot_cache_keys = 0;      // hot keys cached off their owner, 0 for none
+  int hot_cache_ms = 100;         // longest a cached reply is served
+  PeerChannelOptions peer;        // connections to other nodes
+  std::string address;            // how peers dial us, if not in the config
+  std::string join;               // seed to join through instead of the config
+  MembershipOptions membership;
+};
+
+/*
+ * Handlers are written in continuation style: each one fills in the reply
+ * and calls done() once, possibly from a gRPC callback thread after peer
+ * RPCs complete. The synchronous service blocks on done(), the async server
+ * sends the response from it and never holds a thread while waiting.
+ */
+using Done = std::function<void(Status)>;
+
+class TinyServer : public TinyKV::Service {
 public:
-  TinyServer(std::string port) {
-    this->port = port;
+  // Method indices in the order they are declared in tinykv.proto
+  static const int PING_METHOD = 0;
+  static const int PUT_METHOD = 1;
+  static const int GET_METHOD = 2;
+  static const int MULTI_PUT_METHOD = 3;
+  static const int MULTI_GET_METHOD = 4;
+  static const int REPLICATE_BATCH_METHOD = 17;
+
+  TinyServer(const ServerOptions &options) {
+    this->port = options.port;
+    anti_entropy_interval = options.anti_entropy_interval;
+    repair_rate = options.repair_rate;
+    rebalance_rate = options.rebalance_rate;
+    snapshot_interval = options.snapshot_interval;
+    tombstone_grace_us = options.tombstone_grace * 1000000LL;
+    peer_options = options.peer;
+    replication_factor = options.replication_factor;
+
+    // A joining node starts out alone and gets the ring from the cluster
+    // once it is listening
+    std::vector<std::string> cluster_adresses;
+    if (options.join.empty())
+      cluster_adresses = LoadClusterConfig("config/clusters.txt");
+
+    self_address = options.address;
+    for (const std::string &address : cluster_adresses) {
+      if (self_address.empty() && address.ends_with(":" + port))
+        self_address = address;
+    }
+    if (self_address.empty())
+      self_address = "localhost:" + port;
+
+    membership = std::make_unique<Membership>(self_address, cluster_adresses,
+                                              options.membership);
+    if (options.hot_cache_keys > 0)
+      hot_cache = std::make_unique<HotKeyCache>(
+          options.hot_cache_keys,
+          std::chrono::milliseconds(options.hot_cache_ms));
+    if (options.replicate_batch_us > 0)
+      replicator = std::make_unique<ReplicationBatcher>(
+          self_address,
+          [this](const std::string &address, grpc::ByteBuffer request,
+                 size_t writes, ReplicationBatcher::Reply reply) {
+            Client *client = cluster_view()->peer(address);
+            if (!client)
+              return reply(false, {});
+            client->replicate_batch_async(std::move(request), writes,
+                                          std::move(reply));
+          },
+          std::chrono::microseconds(options.replicate_batch_us),
+          REPLICATE_BATCH_WRITES, REPLICATE_BATCH_BYTES);
+    _initialize_cluster_map(cluster_adresses, options.join.empty() ? 1 : 0);
+
+    if (options.engine == "lsm") {
+      LsmOptions lsm_options;
+      lsm_options.dir = options.data_dir + "/lsm_" + port;
+      auto lsm = std::make_unique<LsmEngine>(lsm_options);
+      lsm_engine = lsm.get();
+      store = std::move(lsm);
+      if (options.memory_limit > 0)
+        LOG_WARN("Server", "--memory-limit only applies to the memory engine");
+    } else {
+      store = std::make_unique<ShardedEngine>(
+          STORE_SHARDS, options.memory_limit * 1024 * 1024);
+    }
 
-    std::vector<std::string> cluster_adresses =
-        LoadClusterConfig("config/clusters.txt");
-    _initialize_cluster_map(cluster_adresses);
+    if (options.wal_enabled) {
+      std::filesystem::create_directories(options.data_dir);
+      std::string wal_path = options.data_dir + "/wal_" + port + ".log";
+      wal = std::make_unique<WriteAheadLog>(wal_path, options.sync_policy,
+                                            options.group_commit_us);
+
+      snapshot_path = options.data_dir + "/snapshot_" + port + ".snap";
+      recover(wal_path);
+
+      // From here on a flushed memtable lets the log before it go
+      if (lsm_engine)
+        lsm_engine->attach_log([this] { return wal->rotate(); },
+                               [this](uint64_t position) {
+                                 wal->truncate(position);
+                               });
+    }
 
-    _build_hash_ring();
+    if (options.async_mode) {
+      for (int method : {PING_METHOD, MULTI_PUT_METHOD, MULTI_GET_METHOD,
+                         REPLICATE_BATCH_METHOD})
+        MarkMethodAsync(method);
+      // Single key calls arrive as bytes, so they can be relayed as is
+      for (int method : {PUT_METHOD, GET_METHOD})
+        MarkMethodRaw(method);
+    }
   };
 
   Status Ping(ServerContext *context, const PingRequest *request,
               PingResponse *reply) override {
-    std::cout << "[Server] Received a Ping!" << std::endl;
+    return wait_for([&](Done done) { handle_ping(request, reply, done); });
+  }
+
+  Status Put(ServerContext *context, const PutRequest *request,
+             PutResponse *reply) override {
+    return wait_for([&](Done done) { handle_put(request, reply, done); });
+  }
+
+  Status Get(ServerContext *context, const GetRequest *request,
+             GetResponse *reply) override {
+    return wait_for([&](Done done) { handle_get(request, reply, done); });
+  }
+
+  Status MultiPut(ServerContext *context, const MultiPutRequest *request,
+                  MultiPutResponse *reply) override {
+    return wait_for(
+        [&](Done done) { handle_multi_put(request, reply, done); });
+  }
+
+  Status MultiGet(ServerContext *context, const MultiGetRequest *request,
+                  MultiGetResponse *reply) override {
+    return wait_for(
+        [&](Done done) { handle_multi_get(request, reply, done); });
+  }
+
+  Status ReplicateBatch(ServerContext *context,
+                        const ReplicateBatchRequest *request,
+                        ReplicateBatchResponse *reply) override {
+    return wait_for(
+        [&](Done done) { handle_replicate_batch(request, reply, done); });
+  }
+
+  Status Invalidate(ServerContext *context, const InvalidateRequest *request,
+                    InvalidateResponse *reply) override {
+    update_last_seen(request->sender_id());
+    if (hot_cache)
+      hot_cache->invalidate(request->key(), request->timestamp());
+    return Status::OK;
+  }
+
+  /*
+   * Put whose value arrives in chunks. A node that does not own the key
+   * relays the chunks to the owner as they arrive, so it never holds more
+   * than one. The owner appends them to a buffer sized up front and then
+   * handles the request like any Put.
+   */
+  Status PutStream(ServerContext *context,
+                   grpc::ServerReader<PutChunk> *reader,
+                   PutResponse *reply) override {
+    PutChunk chunk;
+    if (!reader->Read(&chunk) || !chunk.has_header())
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    "stream must start with the request");
+    PutRequest request = chunk.header();
+
+    auto view = cluster_view();
+    const std::string &owner_address = view->ring.get_owner(request.key());
+    if (owner_address != self_address && request.sender_id() == "client") {
+      if (request.routed())
+        return Status(grpc::StatusCode::FAILED_PRECONDITION, "wrong owner");
+
+      grpc::ClientContext owner_context;
+      auto writer =
+          view->peer(owner_address)->put_stream(&owner_context, reply);
+      bool sent = writer->Write(chunk);
+      while (sent && reader->Read(&chunk))
+        sent = writer->Write(chunk);
+      // A clean half-close would have the owner store what arrived so far
+      if (context->IsCancelled())
+        owner_context.TryCancel();
+      else
+        writer->WritesDone();
+      return writer->Finish();
+    }
 
-    if (request->sender_id() != "client")
+    // Read() also ends when the client goes away, only a stream that
+    // brought the whole value is a put
+    uint64_t size = chunk.size();
+    std::string *val = request.mutable_val();
+    val->reserve(std::min<uint64_t>(size, peer_options.max_message_bytes));
+    val->append(chunk.data());
+    while (reader->Read(&chunk))
+      val->append(chunk.data());
+    if (context->IsCancelled())
+      return Status(grpc::StatusCode::CANCELLED, "put stream cancelled");
+    if (val->size() != size)
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    "put stream ended after " + std::to_string(val->size()) +
+                        " of " + std::to_string(size) + " bytes");
+    return wait_for([&](Done done) { handle_put(&request, reply, done); });
+  }
+
+  void handle_ping(const PingRequest *request, PingResponse *reply,
+                   Done done) {
+    done = timed(Rpc::PING,
+                 request->sender_id() == "client" ? Origin::CLIENT
+                                                  : Origin::PEER,
+                 NodeMetrics::Clock::now(), std::move(done));
+
+    if (request->sender_id() != "client") {
+      // Gossip probe, trade membership updates
       update_last_seen(request->sender_id());
+      membership->merge(request->updates());
+      membership->piggyback(reply->mutable_updates());
+      check_ring_epoch(request->sender_id(), request->ring_epoch());
+      reply->set_ring_epoch(cluster_view()->epoch);
+    } else {
+      LOG_DEBUG("Server", "Received a Ping!");
+    }
 
     reply->set_is_ready(true);
 
+    done(Status::OK);
+  }
+
+  /*
+   * Probes a peer on behalf of another node that could not reach it
+   */
+  Status PingReq(ServerContext *context, const PingReqRequest *request,
+                 PingResponse *reply) override {
+    update_last_seen(request->sender_id());
+    membership->merge(request->updates());
+
+    if (!cluster_view()->peer(request->target()))
+      return Status(grpc::StatusCode::NOT_FOUND, "unknown target");
+
+    bool acked = probe(request->target());
+    reply->set_is_ready(acked);
+    membership->piggyback(reply->mutable_updates());
     return Status::OK;
   }
 
@@ -59,349 +339,2913 @@ public:
    *
    * If the request is from a peer node, we simply perform a write
    */
-  Status Put(ServerContext *context, const PutRequest *request,
-             PutResponse *reply) override {
+  void handle_put(const PutRequest *request, PutResponse *reply, Done done,
+                  RawMessages *raw = nullptr) {
+    auto started = NodeMetrics::Clock::now();
 
-    std::cout << "[Server]: " << self_address
-              << " received Put request key: " << request->key()
-              << " val: " << request->val()
-              << " sender_id: " << request->sender_id() << std::endl;
+    LOG_DEBUG("Server", "{} received Put request key: {} val: {} sender_id: {}",
+              self_address, request->key(), request->val(),
+              request->sender_id());
 
     if (request->sender_id() != "client") {
       // Request is from peer node,
       update_last_seen(request->sender_id());
-      write(request->key(), request->val(), request->timestamp());
-      reply->set_operation_success(true);
-      return Status::OK;
-    }
-
-    else {
-      // Request is from client
-      std::string owner_address = hash_ring.get_owner(request->key());
-      bool isOwner = (owner_address == self_address);
-
-      if (!isOwner) {
-        // pass request on to owner
-        bool status = forward_put_to_owner(request, owner_address);
-        reply->set_operation_success(status);
-        return Status::OK;
+      done = timed(Rpc::PUT, Origin::PEER, started, std::move(done));
+
+      // Held for a replica that is down, not ours to serve
+      if (!request->hint_for().empty() && request->hint_for() != self_address) {
+        reply->set_operation_success(store_hint(request->hint_for(),
+                                                request->key(), request->val(),
+                                                request->timestamp()));
+        return done(Status::OK);
       }
-      // We are the owner
 
-      // Ensure enough nodes are available for replication
-      if (request->replication_factor() - 1 > live_node_count()) {
-        reply->set_operation_success(false);
-        return Status(grpc::StatusCode::UNAVAILABLE,
-                      "Not enough live node for replication");
-      }
+      reply->set_operation_success(
+          write(request->key(), request->val(), request->timestamp()));
+      return done(Status::OK);
+    }
 
-      int64_t timestamp =
-          std::chrono::duration_cast<std::chrono::microseconds>(
-              std::chrono::system_clock::now().time_since_epoch())
-              .count();
+    // Request is from client
+    auto view = cluster_view();
+    const std::string &owner_address = view->ring.get_owner(request->key());
+    bool isOwner = (owner_address == self_address);
+    done = timed(Rpc::PUT, isOwner ? Origin::CLIENT : Origin::FORWARDED,
+                 started, std::move(done));
+
+    if (!isOwner) {
+      // A client that routes by itself has a stale ring, let it refresh
+      if (request->routed())
+        return done(Status(grpc::StatusCode::FAILED_PRECONDITION,
+                           "wrong owner"));
+
+      // pass request on to owner
+      return forward_put_to_owner(request, reply, view->peer(owner_address),
+                                  done, raw);
+    }
+    // We are the owner
 
-      write(request->key(), request->val(), timestamp);
+    // Ensure enough nodes are available for replication
+    if (request->replication_factor() - 1 > live_node_count()) {
+      reply->set_operation_success(false);
+      return done(Status(grpc::StatusCode::UNAVAILABLE,
+                         "Not enough live node for replication"));
+    }
 
-      bool success = replicate_key(request, timestamp);
+    int64_t timestamp = WallClockMicros();
+
+    // The one copy of the value, shared by the store, the log and the
+    // replica requests. Its expiry follows from the version's timestamp,
+    // so every replica expires it at the same time.
+    int64_t expires_at =
+        request->ttl_ms() > 0 ? timestamp + request->ttl_ms() * 1000 : 0;
+    ValueRef value = EncodeValue(request->val(), expires_at);
+    if (!write(request->key(), value, timestamp)) {
+      reply->set_operation_success(false);
+      return done(Status(grpc::StatusCode::INTERNAL,
+                         "Write ahead log failed"));
+    }
 
+    replicate_key(*view, request, value, timestamp,
+                  [reply, done](bool success) {
       reply->set_operation_success(success);
-      return Status::OK;
-    }
+      done(Status::OK);
+    });
   }
 
-  Status Get(ServerContext *context, const GetRequest *request,
-             GetResponse *reply) override {
-    std::cout << "[Server] Get key: " << request->key() << std::endl;
+  void handle_get(const GetRequest *request, GetResponse *reply, Done done,
+                  RawMessages *raw = nullptr) {
+    auto started = NodeMetrics::Clock::now();
+    LOG_DEBUG("Server", "Get key: {}", request->key());
+
+    auto view = cluster_view();
+    const std::string &owner_address = view->ring.get_owner(request->key());
+    bool isOwner = (owner_address == self_address);
+    Origin origin = request->sender_id() != "client" ? Origin::PEER
+                    : isOwner                        ? Origin::CLIENT
+                                                     : Origin::FORWARDED;
+    done = timed(Rpc::GET, origin, started, std::move(done));
 
     if (request->quorum_size() > live_node_count() + 1) {
-      return Status(grpc::StatusCode::UNAVAILABLE,
-                    "Not enough live nodes to satisfy quorum size");
+      return done(Status(grpc::StatusCode::UNAVAILABLE,
+                         "Not enough live nodes to satisfy quorum size"));
     }
 
     if (request->sender_id() != "client") {
       update_last_seen(request->sender_id());
     }
 
-    std::string owner_address = hash_ring.get_owner(request->key());
-    bool isOwner = (owner_address == self_address);
-
     // Forward get request to owner
     if (!isOwner && request->sender_id() == "client") {
-      Val_TS timestamped_value = forward_get_to_owner(request, owner_address);
-
-      reply->set_val(timestamped_value.first);
-      reply->set_timestamp(timestamped_value.second);
-      reply->set_operation_success(true);
-
-      return Status::OK;
+      if (request->routed())
+        return done(Status(grpc::StatusCode::FAILED_PRECONDITION,
+                           "wrong owner"));
+
+      if (hot_cache)
+        return cached_get(request, reply, view->peer(owner_address), done,
+                          raw);
+      return forward_get_to_owner(request, reply, view->peer(owner_address),
+                                  done, raw);
     }
 
-    if (isOwner) {
+    if (isOwner && request->sender_id() == "client") {
+      // Before the read, so a write that follows it invalidates the copy
+      if (!request->cache_holder().empty())
+        cache_holders.add(request->key(), request->cache_holder(),
+                          std::chrono::milliseconds(request->cache_ms()));
+
       // Read and consult quorum
-      std::vector<std::string> preference_list =
-          hash_ring.get_owner_and_neighbours(request->key(),
-                                             request->quorum_size());
+      std::string key = request->key();
+      int required = request->quorum_size() - 1;
+      std::vector<std::string> replicas;
+      for (uint16_t node :
+           view->ring.get_preference_list(key, request->quorum_size())) {
+        if (view->ring.get_address(node) != self_address)
+          replicas.push_back(view->ring.get_address(node));
+      }
 
-      auto cmp = [](const Val_TS &t1, const Val_TS &t2) {
-        return t1.second > t2.second;
-      };
-      std::priority_queue<Val_TS, std::vector<Val_TS>, decltype(cmp)>
-          priority_queue(cmp);
+      // The previous owner may hold the only copy until its handoff is done
+      std::string previous = previous_owner(key);
+      if (!previous.empty() && previous != self_address &&
+          std::find(replicas.begin(), replicas.end(), previous) ==
+              replicas.end()) {
+        replicas.push_back(previous);
+        required++;
+      }
 
-      // Add owners value to priority queue
-      kv_mutex.lock();
-      if (kv_store.contains(request->key())) {
-        priority_queue.push(kv_store[request->key()]);
-      } else {
-        priority_queue.push({"", -1});
+      Ref_TS local_value = store->read_shared(key);
+
+      // Ask the neighbours in parallel, the owner's read counts as one vote.
+      // They only send a timestamp and a digest of their value.
+      auto quorum = std::make_shared<QuorumCall<ReplicaVersion>>(
+          required, replicas.size(),
+          [this, view, reply, done, local_value, key,
+           raw](bool reached, const std::vector<ReplicaVersion> &responses) {
+            (reached ? metrics.read_quorums_reached
+                     : metrics.read_quorums_failed)
+                .add();
+            resolve_read(view, key, local_value, responses, reply, done, raw);
+          });
+
+      for (const std::string &peer_address : replicas) {
+        GetRequest digest_request;
+        digest_request.set_key(key);
+        digest_request.set_sender_id(self_address);
+        digest_request.set_quorum_size(1);
+        digest_request.set_digest_only(true);
+
+        view->peer(peer_address)->get_async(
+            std::move(digest_request),
+            [quorum, peer_address](bool ok, const GetResponse &version) {
+              if (ok)
+                quorum->ack({peer_address, version.timestamp(),
+                             version.digest()});
+              else
+                quorum->fail();
+            });
       }
-      kv_mutex.unlock();
+      return;
+    }
 
-      int i = 1;
-      bool ok = false;
+    // We are not the owner, we simply do a read
 
-      // Read from neighbours until quorum size is met
-      while (i < request->quorum_size()) {
-        std::string peer_adress = preference_list.at(i);
-        Client *peer_client = cluster_map[peer_adress].get();
-        Val_TS val = peer_client->get(request->key(), self_address, 1);
-        if (val.second > 0) {
-          priority_queue.push(val);
-        }
+    Ref_TS local_value = store->read_shared(request->key());
+    reply->set_timestamp(local_value.second);
+    if (request->digest_only()) {
+      if (local_value.first)
+        reply->set_digest(murmur64(*local_value.first));
+      else
+        reply->set_digest(murmur64(""));
+    } else {
+      reply_value(reply, local_value.first, raw);
+    }
 
-        if (i > preference_list.size() - 1) {
-          break;
-        }
-        i++;
-      }
+    done(Status::OK);
+  }
 
-      if (priority_queue.size() == request->quorum_size()) {
-        ok = true;
-      }
+  /*
+   * Reports the ring so clients can route keys to their owners directly
+   */
+  Status GetMembership(ServerContext *context,
+                       const MembershipRequest *request,
+                       MembershipResponse *reply) override {
+    auto view = cluster_view();
+    for (const std::string &address : view->ring.members())
+      reply->add_nodes(address);
+    reply->set_virtual_nodes(view->ring.get_virtual_nodes());
+    reply->set_epoch(view->epoch);
+    reply->set_rebalancing(handoff_ring.load() != nullptr);
 
-      Val_TS last_write = priority_queue.top();
+    return Status::OK;
+  }
 
-      if (last_write.second < 0) {
-        std::cout << "[Server] No value found for key: " << request->key()
-                  << std::endl;
-        reply->set_val("");
-        reply->set_timestamp(-1);
-        reply->set_operation_success(false);
+  /*
+   * Adds a node to the ring. One node, the lowest live address, serializes
+   * ring changes so two of them never claim the same epoch. Any other
+   * member passes the request on to it.
+   */
+  Status Join(ServerContext *context, const JoinRequest *request,
+              RingResponse *reply) override {
+    return change_ring(request->address(), true, request->forwarded(),
+                       reply);
+  }
+
+  Status Leave(ServerContext *context, const LeaveRequest *request,
+               RingResponse *reply) override {
+    return change_ring(request->address(), false, request->forwarded(),
+                       reply);
+  }
+
+  /*
+   * Installs a ring pushed by the node that serialized the change
+   */
+  Status UpdateRing(ServerContext *context, const RingUpdate *request,
+                    RingResponse *reply) override {
+    update_last_seen(request->sender_id());
+
+    std::vector<std::string> nodes(request->nodes().begin(),
+                                   request->nodes().end());
+    reply->set_accepted(
+        install_ring(request->epoch(), nodes, request->catch_up()));
+
+    auto view = cluster_view();
+    reply->set_epoch(view->epoch);
+    for (const std::string &address : view->ring.members())
+      reply->add_nodes(address);
+    return Status::OK;
+  }
+
+  /*
+   * A peer has sent us everything it owed us for a ring change
+   */
+  Status HandoffDone(ServerContext *context,
+                     const HandoffDoneRequest *request,
+                     HandoffDoneResponse *reply) override {
+    update_last_seen(request->sender_id());
+    finish_handoff(request->sender_id(), request->epoch());
+    return Status::OK;
+  }
+
+  /*
+   * Reports what this node has recorded, both as fields for the CLI and as
+   * a Prometheus text exposition for scrapers
+   */
+  Status Stats(ServerContext *context, const StatsRequest *request,
+               StatsResponse *reply) override {
+    auto view = cluster_view();
+    PrometheusWriter prometheus;
+
+    reply->set_keys(store->size());
+    reply->set_memory_bytes(ResidentMemoryBytes());
+    reply->set_live_peers(live_node_count());
+    for (const auto &[address, state] : membership->states()) {
+      PeerState *peer = reply->add_peers();
+      peer->set_address(address);
+      peer->set_state(state);
+    }
 
-        return Status::OK;
+    prometheus.family("tinykv_rpc_duration_seconds", "histogram",
+                      "Time to answer an RPC, by caller");
+    for (int r = 0; r < RPC_COUNT; ++r) {
+      for (int o = 0; o < ORIGIN_COUNT; ++o) {
+        Rpc rpc = static_cast<Rpc>(r);
+        Origin origin = static_cast<Origin>(o);
+        LatencyHistogram::Snapshot snapshot =
+            metrics.latency(rpc, origin).snapshot();
+        if (snapshot.count == 0)
+          continue;
+
+        RpcLatency *latency = reply->add_latencies();
+        latency->set_rpc(RpcName(rpc));
+        latency->set_origin(OriginName(origin));
+        latency->set_count(snapshot.count);
+        latency->set_mean_us(double(snapshot.sum_us) / snapshot.count);
+        latency->set_p50_us(snapshot.percentile(50));
+        latency->set_p99_us(snapshot.percentile(99));
+
+        prometheus.histogram("tinykv_rpc_duration_seconds",
+                             "rpc=\"" + std::string(RpcName(rpc)) +
+                                 "\",origin=\"" + OriginName(origin) + "\"",
+                             snapshot);
       }
-      reply->set_val(last_write.first);
-      reply->set_timestamp(last_write.second);
-      reply->set_operation_success(true);
+    }
 
-      return Status::OK;
+    auto &counters = *reply->mutable_counters();
+    counters["write_quorums_reached"] = metrics.write_quorums_reached.value();
+    counters["write_quorums_failed"] = metrics.write_quorums_failed.value();
+    counters["read_quorums_reached"] = metrics.read_quorums_reached.value();
+    counters["read_quorums_failed"] = metrics.read_quorums_failed.value();
+    counters["replica_writes_acked"] = metrics.replica_writes_acked.value();
+    counters["replica_writes_failed"] = metrics.replica_writes_failed.value();
+    counters["hints_stored"] = metrics.hints_stored.value();
+    if (hot_cache) {
+      counters["hot_cache_hits"] = hot_cache->hits.value();
+      counters["hot_cache_misses"] = hot_cache->misses.value();
+      counters["hot_cache_fills"] = hot_cache->fills.value();
+      counters["hot_cache_invalidations"] = hot_cache->invalidations.value();
+      counters["hot_cache_evictions"] = hot_cache->evictions.value();
+      counters["hot_cache_keys"] = hot_cache->size();
     }
+    if (replicator) {
+      counters["replicate_batches"] = replicator->batches_sent.value();
+      counters["replicate_batch_writes"] = replicator->writes_sent.value();
+      counters["replica_writes_collapsed"] =
+          replicator->writes_collapsed.value();
+    }
+    counters["hints_pending"] = hints.size();
+    counters["read_repairs"] = metrics.read_repairs.value();
+    counters["keys_expired"] = metrics.keys_expired.value();
+    counters["tombstones_purged"] = metrics.tombstones_purged.value();
+    counters["reaper_timers_pending"] = expiry.size();
+    StorageEngine::LockStats locks = store->lock_stats();
+    counters["storage_lock_contended"] = locks.contended;
+    counters["storage_lock_wait_ns"] = locks.wait_ns;
+    StorageEngine::MemoryStats memory = store->memory_stats();
+    uint64_t keys = store->size();
+    counters["store_bytes"] = memory.bytes;
+    counters["store_reserved_bytes"] = memory.reserved;
+    counters["store_bytes_per_key"] = keys > 0 ? memory.bytes / keys : 0;
+    counters["store_memory_limit"] = memory.limit;
+    counters["evictions"] = memory.evictions;
+
+    prometheus.family("tinykv_write_quorums_total", "counter",
+                      "Coordinated writes by whether they reached quorum");
+    prometheus.sample("tinykv_write_quorums_total", "result=\"reached\"",
+                      counters["write_quorums_reached"]);
+    prometheus.sample("tinykv_write_quorums_total", "result=\"failed\"",
+                      counters["write_quorums_failed"]);
+    prometheus.family("tinykv_read_quorums_total", "counter",
+                      "Coordinated reads by whether they reached quorum");
+    prometheus.sample("tinykv_read_quorums_total", "result=\"reached\"",
+                      counters["read_quorums_reached"]);
+    prometheus.sample("tinykv_read_quorums_total", "result=\"failed\"",
+                      counters["read_quorums_failed"]);
+    prometheus.family("tinykv_replica_writes_total", "counter",
+                      "Writes sent to replicas by whether they were acked");
+    prometheus.sample("tinykv_replica_writes_total", "result=\"acked\"",
+                      counters["replica_writes_acked"]);
+    prometheus.sample("tinykv_replica_writes_total", "result=\"failed\"",
+                      counters["replica_writes_failed"]);
+    if (hot_cache) {
+      uint64_t hits = counters["hot_cache_hits"];
+      uint64_t lookups = hits + counters["hot_cache_misses"];
+      prometheus.family("tinykv_hot_cache_lookups_total", "counter",
+                        "Reads of keys owned elsewhere by whether the hot "
+                        "key cache answered them");
+      prometheus.sample("tinykv_hot_cache_lookups_total", "result=\"hit\"",
+                        hits);
+      prometheus.sample("tinykv_hot_cache_lookups_total", "result=\"miss\"",
+                        counters["hot_cache_misses"]);
+      prometheus.family("tinykv_hot_cache_hit_ratio", "gauge",
+                        "Share of those reads the cache answered");
+      prometheus.sample("tinykv_hot_cache_hit_ratio", "",
+                        lookups > 0 ? double(hits) / lookups : 0);
+      prometheus.family("tinykv_hot_cache_invalidations_total", "counter",
+                        "Invalidations owners sent for cached keys");
+      prometheus.sample("tinykv_hot_cache_invalidations_total", "",
+                        counters["hot_cache_invalidations"]);
+      prometheus.family("tinykv_hot_cache_keys", "gauge",
+                        "Keys in the hot key cache");
+      prometheus.sample("tinykv_hot_cache_keys", "",
+                        counters["hot_cache_keys"]);
+    }
+    if (replicator) {
+      prometheus.family("tinykv_replicate_batches_total", "counter",
+                        "ReplicateBatch calls sent to replicas");
+      prometheus.sample("tinykv_replicate_batches_total", "",
+                        counters["replicate_batches"]);
+      prometheus.family("tinykv_replicate_batch_writes_total", "counter",
+                        "Replica writes sent in ReplicateBatch calls");
+      prometheus.sample("tinykv_replicate_batch_writes_total", "",
+                        counters["replicate_batch_writes"]);
+      prometheus.family("tinykv_replica_writes_collapsed_total", "counter",
+                        "Replica writes superseded in their batch by a "
+                        "newer write to the key");
+      prometheus.sample("tinykv_replica_writes_collapsed_total", "",
+                        counters["replica_writes_collapsed"]);
+    }
+    prometheus.family("tinykv_hints_stored_total", "counter",
+                      "Writes held for a replica that was down");
+    prometheus.sample("tinykv_hints_stored_total", "",
+                      counters["hints_stored"]);
+    prometheus.family("tinykv_hints_pending", "gauge",
+                      "Hints waiting to be replayed");
+    prometheus.sample("tinykv_hints_pending", "", counters["hints_pending"]);
+    prometheus.family("tinykv_read_repairs_total", "counter",
+                      "Newer versions pushed to stale replicas on read");
+    prometheus.sample("tinykv_read_repairs_total", "",
+                      counters["read_repairs"]);
+    prometheus.family("tinykv_keys_expired_total", "counter",
+                      "Values whose TTL ran out, reclaimed by the reaper");
+    prometheus.sample("tinykv_keys_expired_total", "",
+                      counters["keys_expired"]);
+    prometheus.family("tinykv_tombstones_purged_total", "counter",
+                      "Tombstones dropped once their grace period was over");
+    prometheus.sample("tinykv_tombstones_purged_total", "",
+                      counters["tombstones_purged"]);
+    prometheus.family("tinykv_reaper_timers_pending", "gauge",
+                      "Expiries and purges scheduled on the timer wheel");
+    prometheus.sample("tinykv_reaper_timers_pending", "",
+                      counters["reaper_timers_pending"]);
+    prometheus.family("tinykv_storage_lock_contended_total", "counter",
+                      "Storage shard lock acquisitions that had to wait");
+    prometheus.sample("tinykv_storage_lock_contended_total", "",
+                      locks.contended);
+    prometheus.family("tinykv_storage_lock_wait_seconds_total", "counter",
+                      "Time spent waiting for storage shard locks");
+    prometheus.sample("tinykv_storage_lock_wait_seconds_total", "",
+                      locks.wait_ns / 1e9);
+    prometheus.family("tinykv_store_bytes", "gauge",
+                      "Memory the store accounts to its keys and values");
+    prometheus.sample("tinykv_store_bytes", "", memory.bytes);
+    prometheus.family("tinykv_store_reserved_bytes", "gauge",
+                      "Memory the store holds, including free slab slots");
+    prometheus.sample("tinykv_store_reserved_bytes", "", memory.reserved);
+    prometheus.family("tinykv_store_memory_limit_bytes", "gauge",
+                      "Memory the store may hold before evicting, 0 if none");
+    prometheus.sample("tinykv_store_memory_limit_bytes", "", memory.limit);
+    prometheus.family("tinykv_evictions_total", "counter",
+                      "Keys evicted to stay under the memory limit");
+    prometheus.sample("tinykv_evictions_total", "", memory.evictions);
+
+    prometheus.family("tinykv_keys", "gauge", "Keys in the local store");
+    prometheus.sample("tinykv_keys", "", reply->keys());
+    prometheus.family("tinykv_resident_memory_bytes", "gauge",
+                      "Resident set size of the server");
+    prometheus.sample("tinykv_resident_memory_bytes", "",
+                      reply->memory_bytes());
+    prometheus.family("tinykv_live_peers", "gauge",
+                      "Peers the failure detector considers alive");
+    prometheus.sample("tinykv_live_peers", "", reply->live_peers());
+    prometheus.family("tinykv_peer_up", "gauge",
+                      "1 if a peer is alive, 0 if suspect or dead");
+    for (const PeerState &peer : reply->peers())
+      prometheus.sample("tinykv_peer_up",
+                        "peer=\"" + peer.address() + "\"",
+                        peer.state() == tinykv::ALIVE);
+    prometheus.family("tinykv_ring_epoch", "gauge",
+                      "Epoch of the ring this node routes by");
+    prometheus.sample("tinykv_ring_epoch", "", view->epoch);
+
+    reply->set_prometheus(prometheus.text());
+    return Status::OK;
+  }
 
-    // We are not the owner, we simply do a read
+  /*
+   * Deletes a key by writing a tombstone under a new timestamp and
+   * replicating it like a put. A node that is not the owner passes the
+   * request on. The tombstone is kept for --tombstone-grace seconds, so
+   * replicas that missed the delete learn of it before it is purged.
+   */
+  Status Delete(ServerContext *context, const DeleteRequest *request,
+                DeleteResponse *reply) override {
+    auto started = NodeMetrics::Clock::now();
+    auto view = cluster_view();
+    const std::string &owner_address = view->ring.get_owner(request->key());
+    bool isOwner = (owner_address == self_address);
 
-    kv_mutex.lock();
-    if (kv_store.count(request->key())) {
-      reply->set_val(kv_store[request->key()].first);
-      reply->set_timestamp(kv_store[request->key()].second);
-    } else {
-      reply->set_val("");
-      reply->set_timestamp(-1);
+    return wait_for([&](Done done) {
+      done = timed(Rpc::DELETE, isOwner ? Origin::CLIENT : Origin::FORWARDED,
+                   started, std::move(done));
+
+      if (!isOwner) {
+        if (request->routed())
+          return done(Status(grpc::StatusCode::FAILED_PRECONDITION,
+                             "wrong owner"));
+        return done(view->peer(owner_address)->del(*request, reply));
+      }
+
+      PutRequest tombstone;
+      tombstone.set_key(request->key());
+      tombstone.set_replication_factor(request->replication_factor() > 0
+                                           ? request->replication_factor()
+                                           : replication_factor);
+      tombstone.set_write_quorum(request->write_quorum());
+
+      if (tombstone.replication_factor() - 1 > live_node_count())
+        return done(Status(grpc::StatusCode::UNAVAILABLE,
+                           "Not enough live node for replication"));
+
+      int64_t timestamp = WallClockMicros();
+      if (!write(request->key(), Tombstone(), timestamp))
+        return done(Status(grpc::StatusCode::INTERNAL,
+                           "Write ahead log failed"));
+      replicate_key(*view, &tombstone, Tombstone(), timestamp,
+                    [reply, done](bool success) {
+                      reply->set_operation_success(success);
+                      done(Status::OK);
+                    });
+    });
+  }
+
+  /*
+   * Streams the live keys of a range in key order. A client's scan is
+   * fanned out to every live node, each of which streams its own store
+   * unfiltered, and the sorted streams are merged: a key held by several
+   * replicas comes out once, as its newest version, and is dropped if that
+   * version is a tombstone or has expired. Chunks are sent as the merge
+   * fills them, and a peer's stream only advances as fast as the merge
+   * reads it, so flow control bounds what every hop buffers.
+   */
+  Status Scan(ServerContext *context, const ScanRequest *request,
+              grpc::ServerWriter<ScanResponse> *writer) override {
+    auto started = NodeMetrics::Clock::now();
+    bool from_peer = request->sender_id() != "client";
+    if (from_peer)
+      update_last_seen(request->sender_id());
+
+    std::string start = request->start();
+    std::string end = request->end();
+    if (!request->prefix().empty()) {
+      start = std::max(start, request->prefix());
+      std::string prefix_end = PrefixEnd(request->prefix());
+      if (!prefix_end.empty() && (end.empty() || prefix_end < end))
+        end = prefix_end;
     }
-    kv_mutex.unlock();
 
+    std::vector<ScanEntry> probe;
+    if (!store->scan(start, end, 0, &probe))
+      return Status(grpc::StatusCode::UNIMPLEMENTED,
+                    "storage engine keeps no ordered index");
+
+    Status status;
+    if (!end.empty() && start >= end)
+      status = Status::OK;
+    else if (from_peer)
+      status = stream_local_scan(start, end, request->limit(), writer);
+    else
+      status = coordinate_scan(start, end, request->limit(), writer);
+
+    metrics.latency(Rpc::SCAN, from_peer ? Origin::PEER : Origin::CLIENT)
+        .record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    NodeMetrics::Clock::now() - started)
+                    .count());
+    return status;
+  }
+
+  /*
+   * Answers a peer's anti-entropy round with our hashes for the tree
+   * nodes it asks about
+   */
+  Status MerkleDigest(ServerContext *context, const DigestRequest *request,
+                      DigestResponse *reply) override {
+    update_last_seen(request->sender_id());
+    auto view = cluster_view();
+    if (request->ring_size() != view->ring.vnode_count() ||
+        request->ring_epoch() != view->epoch)
+      return Status(grpc::StatusCode::FAILED_PRECONDITION, "ring mismatch");
+
+    for (const TreeNode &node : request->nodes())
+      reply->add_hashes(
+          view->merkle->hash(node.vnode(), node.level(), node.index()));
     return Status::OK;
   }
 
-  void _initialize_cluster_map(std::vector<std::string> clusters) {
-    for (std::string address : clusters) {
-      // Prevents the server from creating a connection to itself
-      if (address.ends_with(":" + port)) {
-        self_address = address;
-        continue;
-      }
-      auto channel =
-          grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
-      Client peer_client(channel);
+  /*
+   * Compares the peer's versions of a divergent leaf with ours. We send
+   * back what the peer is missing and name the keys it has newer, which
+   * it then pushes as replica writes.
+   */
+  Status SyncRange(ServerContext *context, const SyncRangeRequest *request,
+                   SyncRangeResponse *reply) override {
+    update_last_seen(request->sender_id());
+    auto view = cluster_view();
+    if (request->ring_epoch() != view->epoch)
+      return Status(grpc::StatusCode::FAILED_PRECONDITION, "ring mismatch");
+
+    std::unordered_map<std::string, int64_t> theirs;
+    for (const KeyVersion &version : request->versions()) {
+      theirs[version.key()] = version.timestamp();
+      if (version.timestamp() > store->read_shared(version.key()).second)
+        reply->add_wanted(version.key());
+    }
 
-      cluster_map[address] = std::make_unique<Client>(channel);
+    for (const std::string &key :
+         view->merkle->keys(request->vnode(), request->leaf())) {
+      Ref_TS local_value = store->read_shared(key);
+      auto it = theirs.find(key);
+      if (it != theirs.end() && it->second >= local_value.second)
+        continue;
+      KeyValue *entry = reply->add_newer();
+      entry->set_key(key);
+      if (local_value.first)
+        entry->set_val(*local_value.first);
+      entry->set_timestamp(local_value.second);
     }
+    return Status::OK;
   }
 
   /*
-   * Periodically pings other nodes to check alive status
+   * Batched put. Entries are grouped by owner, and each foreign group is
+   * forwarded to its owner as one sub-batch. A batch from a peer carries
+   * replica writes, which are applied locally.
    */
-  void _heartbeat() {
-    while (!shutdown_requested_) {
-      for (auto &[address, peer_client] : cluster_map) {
+  void handle_multi_put(const MultiPutRequest *request,
+                        MultiPutResponse *reply, Done done) {
+    done = timed(Rpc::MULTI_PUT,
+                 request->sender_id() == "client" ? Origin::CLIENT
+                                                  : Origin::PEER,
+                 NodeMetrics::Clock::now(), std::move(done));
+    LOG_DEBUG("Server", "{} received MultiPut of {} keys sender_id: {}",
+              self_address, request->entries_size(), request->sender_id());
+
+    reply->mutable_operation_success()->Resize(request->entries_size(), false);
+
+    if (request->sender_id() != "client") {
+      update_last_seen(request->sender_id());
 
-        if (peer_client->ping(false, self_address)) {
-          update_last_seen(address);
+      if (!request->hint_for().empty() && request->hint_for() != self_address) {
+        for (int i = 0; i < request->entries_size(); ++i) {
+          const KeyValue &entry = request->entries(i);
+          reply->set_operation_success(
+              i, store_hint(request->hint_for(), entry.key(), entry.val(),
+                            entry.timestamp()));
         }
+        return done(Status::OK);
       }
-      std::this_thread::sleep_for(std::chrono::seconds(10));
+
+      std::vector<LogRecord> records;
+      for (const KeyValue &entry : request->entries())
+        records.push_back({entry.key(),
+                           std::make_shared<const std::string>(entry.val()),
+                           entry.timestamp()});
+      bool logged = write_batch(records);
+
+      for (int i = 0; i < request->entries_size(); ++i)
+        reply->set_operation_success(i, logged);
+      return done(Status::OK);
     }
-  }
 
-  void stop() { shutdown_requested_ = true; }
+    auto view = cluster_view();
+    std::unordered_map<std::string, std::vector<int>> groups;
+    for (int i = 0; i < request->entries_size(); ++i)
+      groups[view->ring.get_owner(request->entries(i).key())].push_back(i);
 
-private:
-  std::unordered_map<std::string, Val_TS> kv_store;
-  std::mutex kv_mutex;
+    auto countdown = std::make_shared<CountdownCall>(
+        groups.size(), [done]() { done(Status::OK); });
 
-  std::string port;
-  std::string self_address;
-  std::atomic<bool> shutdown_requested_;
+    for (auto &[owner_address, indices] : groups) {
+      if (owner_address == self_address) {
+        coordinate_multi_put(*view, request, indices, reply,
+                             [countdown]() { countdown->finish(); });
+        continue;
+      }
 
-  std::unordered_map<std::string, std::unique_ptr<Client>> cluster_map;
-  std::unordered_map<std::string, std::chrono::steady_clock::time_point>
-      peer_last_seen_map;
-  std::mutex peer_status_mutex;
-  HashRing hash_ring;
+      MultiPutRequest sub_request;
+      for (int i : indices)
+        *sub_request.add_entries() = request->entries(i);
+      sub_request.set_sender_id("client");
+      sub_request.set_replication_factor(request->replication_factor());
+      sub_request.set_write_quorum(request->write_quorum());
+
+      view->peer(owner_address)->multi_put_async(
+          std::move(sub_request),
+          [reply, indices, countdown](bool ok, std::vector<bool> success) {
+            for (size_t j = 0; j < indices.size(); ++j)
+              reply->set_operation_success(indices[j], ok && success[j]);
+            countdown->finish();
+          });
+    }
+  }
 
   /*
-   * Updates last_seen of a peer to the current time in a
-   * thread safe way
+   * Replica writes an owner coalesced, each applied or held the same way
+   * as a replica Put
    */
-  void update_last_seen(std::string address) {
-    peer_status_mutex.lock();
-
-    peer_last_seen_map[address] = std::chrono::steady_clock::now();
-
-    peer_status_mutex.unlock();
+  void handle_replicate_batch(const ReplicateBatchRequest *request,
+                              ReplicateBatchResponse *reply, Done done) {
+    done = timed(Rpc::REPLICATE_BATCH, Origin::PEER,
+                 NodeMetrics::Clock::now(), std::move(done));
+    update_last_seen(request->sender_id());
+
+    std::vector<LogRecord> records;
+    std::vector<int> logged; // index in the request of each record
+    reply->mutable_operation_success()->Resize(request->writes_size(), true);
+    for (int i = 0; i < request->writes_size(); ++i) {
+      const ReplicaWrite &write = request->writes(i);
+      if (!write.hint_for().empty() && write.hint_for() != self_address) {
+        reply->set_operation_success(
+            i, store_hint(write.hint_for(), write.key(), write.val(),
+                          write.timestamp()));
+      } else {
+        records.push_back({write.key(),
+                           std::make_shared<const std::string>(write.val()),
+                           write.timestamp()});
+        logged.push_back(i);
+      }
+    }
+    if (!write_batch(records)) {
+      for (int i : logged)
+        reply->set_operation_success(i, false);
+    }
+    done(Status::OK);
   }
 
   /*
-   * Thread safe Write operation
-   * compares timestamps to ensure LWW
+   * Batched get, grouped by owner the same way as handle_multi_put
    */
-  void write(std::string key, std::string val, int64_t timestamp) {
-
-    kv_mutex.lock();
-    if (kv_store.count(key)) {
-      int64_t current_time = kv_store[key].second;
-
-      if (timestamp <= current_time) {
-        std::cout << "[Write] Ignored stale/duplicate write for " << key
-                  << " (Curr: " << current_time << ", Req: " << timestamp << ")"
-                  << std::endl;
+  void handle_multi_get(const MultiGetRequest *request,
+                        MultiGetResponse *reply, Done done) {
+    done = timed(Rpc::MULTI_GET,
+                 request->sender_id() == "client" ? Origin::CLIENT
+                                                  : Origin::PEER,
+                 NodeMetrics::Clock::now(), std::move(done));
+    LOG_DEBUG("Server", "MultiGet of {} keys", request->keys_size());
+
+    for (const std::string &key : request->keys()) {
+      KeyValue *entry = reply->add_entries();
+      entry->set_key(key);
+      entry->set_timestamp(-1);
+    }
 
-        kv_mutex.unlock();
-        return;
+    if (request->sender_id() != "client") {
+      // Quorum read from a coordinator, answer from the local store
+      update_last_seen(request->sender_id());
+      for (int i = 0; i < request->keys_size(); ++i) {
+        Ref_TS local_value = store->read_shared(request->keys(i));
+        if (local_value.first)
+          reply->mutable_entries(i)->set_val(*local_value.first);
+        reply->mutable_entries(i)->set_timestamp(local_value.second);
       }
+      return done(Status::OK);
+    }
+
+    if (request->quorum_size() > live_node_count() + 1) {
+      return done(Status(grpc::StatusCode::UNAVAILABLE,
+                         "Not enough live nodes to satisfy quorum size"));
     }
 
-    kv_store[key] = {val, timestamp};
-    std::cout << "[Write] Updated " << key << " (TS: " << timestamp << ")"
-              << std::endl;
+    auto view = cluster_view();
+    std::unordered_map<std::string, std::vector<int>> groups;
+    for (int i = 0; i < request->keys_size(); ++i)
+      groups[view->ring.get_owner(request->keys(i))].push_back(i);
+
+    auto countdown = std::make_shared<CountdownCall>(
+        groups.size(), [done]() { done(Status::OK); });
+
+    for (auto &[owner_address, indices] : groups) {
+      if (owner_address == self_address) {
+        coordinate_multi_get(*view, request, indices, reply,
+                             [countdown]() { countdown->finish(); });
+        continue;
+      }
 
-    kv_mutex.unlock();
+      MultiGetRequest sub_request;
+      for (int i : indices)
+        sub_request.add_keys(request->keys(i));
+      sub_request.set_sender_id("client");
+      sub_request.set_quorum_size(request->quorum_size());
+
+      view->peer(owner_address)->multi_get_async(
+          std::move(sub_request),
+          [reply, indices, countdown](bool ok, std::vector<Val_TS> values) {
+            for (size_t j = 0; j < indices.size(); ++j) {
+              reply->mutable_entries(indices[j])->set_val(values[j].first);
+              reply->mutable_entries(indices[j])
+                  ->set_timestamp(values[j].second);
+            }
+            countdown->finish();
+          });
+    }
   }
 
-  bool replicate_key(const PutRequest *request, int64_t timestamp) {
-    int replicas = request->replication_factor();
-    int success_count = 0;
+  /*
+   * Posts the async data path methods on a completion queue
+   */
+  void listen(grpc::ServerCompletionQueue *cq) {
+    listen_unary(PING_METHOD, cq, &TinyServer::handle_ping);
+    listen_raw(PUT_METHOD, cq, &TinyServer::handle_put);
+    listen_raw(GET_METHOD, cq, &TinyServer::handle_get);
+    listen_unary(MULTI_PUT_METHOD, cq, &TinyServer::handle_multi_put);
+    listen_unary(MULTI_GET_METHOD, cq, &TinyServer::handle_multi_get);
+    listen_unary(REPLICATE_BATCH_METHOD, cq,
+                 &TinyServer::handle_replicate_batch);
+  }
 
-    std::vector<std::string> preference_list =
-        hash_ring.get_owner_and_neighbours(request->key(), replicas);
+  void _initialize_cluster_map(const std::vector<std::string> &clusters,
+                               uint64_t epoch) {
+    auto view = std::make_shared<ClusterView>();
+    view->epoch = epoch;
+    view->ring.add_node(self_address);
 
-    for (std::string node_adress : preference_list) {
-      if (node_adress == self_address)
+    for (const std::string &address : clusters) {
+      // Prevents the server from creating a connection to itself
+      if (address == self_address)
         continue;
+      view->ring.add_node(address);
+      view->peers[address] = std::make_shared<PeerPool>(address, peer_options);
+    }
 
-      Client *peer_client = cluster_map[node_adress].get();
+    view->merkle = std::make_unique<MerkleTree>(view->ring, self_address,
+                                                replication_factor);
+    cluster.store(std::move(view));
+  }
 
-      std::cout << "[Server] Replicating key: " << request->key()
-                << " at: " << node_adress << std::endl;
+  /*
+   * Asks a member of the cluster to add us to the ring. The new ring
+   * reaches us as an UpdateRing call before this returns.
+   */
+  bool join_cluster(const std::string &seed) {
+    Client client(peer_channel(seed));
+
+    for (int attempt = 0; attempt < 5 && !shutdown_requested_; ++attempt) {
+      RingResponse reply;
+      Status status = client.join(self_address, &reply);
+      if (status.ok()) {
+        LOG_INFO("Rebalance", "Joined through {}, ring epoch {} with {} nodes",
+                 seed, reply.epoch(), reply.nodes_size());
+        return true;
+      }
+      LOG_WARN("Rebalance", "Join through {} failed: {}", seed,
+               status.error_message());
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    return false;
+  }
 
-      bool ok = peer_client->put(request->key(), request->val(), self_address,
-                                 0, timestamp);
+  /*
+   * Runs the failure detector: one probe per protocol period. A peer that
+   * misses a direct probe is probed through a few other peers before it
+   * is suspected, so one slow link does not mark it down, and a hung peer
+   * only costs this thread its probe timeouts.
+   */
+  void _gossip() {
+    const MembershipOptions &opts = membership->options();
+    auto next_period = std::chrono::steady_clock::now();
 
-      if (ok) {
-        success_count++;
+    while (!shutdown_requested_) {
+      next_period += opts.period;
+      membership->tick();
+
+      std::string target = membership->next_probe_target();
+      if (!target.empty()) {
+        bool acked = probe(target);
+        if (!acked)
+          acked = probe_indirectly(target);
+        membership->probe_result(target, acked);
       }
-    }
 
-    if (success_count < replicas - 1) {
-      std::cout
-          << "[Server] Warning, unable to find required number of replicas"
-          << std::endl;
+      std::this_thread::sleep_until(next_period);
     }
+  }
+
+  /*
+   * Hands stored hints back to their replicas in batches once heartbeats
+   * show the replica is up again
+   */
+  void _hint_handoff() {
+    while (!shutdown_requested_) {
+      auto view = cluster_view();
+      for (const std::string &target : hints.targets()) {
+        Client *peer = view->peer(target);
+        if (!is_alive(target) || !peer)
+          continue;
+
+        size_t delivered = 0;
+        while (!shutdown_requested_) {
+          std::vector<Hint> batch = hints.peek(target, HINT_BATCH_SIZE);
+          if (batch.empty())
+            break;
+
+          MultiPutRequest request;
+          request.set_sender_id(self_address);
+          for (const Hint &hint : batch) {
+            KeyValue *entry = request.add_entries();
+            entry->set_key(hint.key);
+            entry->set_val(hint.val);
+            entry->set_timestamp(hint.timestamp);
+          }
+
+          std::promise<std::vector<bool>> result;
+          peer->multi_put_async(
+              std::move(request),
+              [&result](bool ok, std::vector<bool> success) {
+                result.set_value(ok ? std::move(success)
+                                    : std::vector<bool>());
+              });
+          std::vector<bool> success = result.get_future().get();
+
+          std::vector<Hint> acked;
+          for (size_t k = 0; k < success.size(); ++k) {
+            if (success[k])
+              acked.push_back(std::move(batch[k]));
+          }
+          hints.acknowledge(target, acked);
+          delivered += acked.size();
+
+          // The replica went away again, try later
+          if (acked.size() < batch.size())
+            break;
+        }
 
-    return success_count >= (replicas - 1);
+        if (delivered > 0) {
+          LOG_INFO("Handoff", "Delivered {} hints to {}", delivered, target);
+        }
+      }
+      std::this_thread::sleep_for(HINT_REPLAY_INTERVAL);
+    }
   }
 
   /*
-   * Counts the number of live peers, excluding itself
+   * Periodically snapshots the store, as long as something was logged
+   * since the last snapshot. Each snapshot starts a new log segment just
+   * before it, and the segments before that one are deleted once the
+   * snapshot is written. The LSM engine persists itself, its flushes drop
+   * the segments instead.
    */
-  int live_node_count() {
+  void _snapshot() {
+    if (!wal || lsm_engine || snapshot_interval <= 0)
+      return;
 
-    peer_status_mutex.lock();
+    uint64_t covered = wal->written_bytes();
+    while (!shutdown_requested_) {
+      for (int i = 0; i < snapshot_interval && !shutdown_requested_; ++i)
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+      if (shutdown_requested_ || wal->written_bytes() == covered)
+        continue;
 
-    std::chrono::time_point now = std::chrono::steady_clock::now();
-    int count = 0;
+      // Rotated outside the fork so writers are not held off by it. The
+      // snapshot covers at least everything logged before cut.
+      uint64_t cut = wal->rotate();
+      auto started = std::chrono::steady_clock::now();
+      uint64_t offset = 0;
+      pid_t child = ForkSnapshot(snapshot_path, *store, [&] {
+        offset = wal->written_bytes();
+        return offset;
+      });
+      if (child < 0) {
+        LOG_WARN("Snapshot", "Store cannot be snapshotted, giving up");
+        return;
+      }
+      auto forked = std::chrono::steady_clock::now();
 
-    for (const auto &[address, last_seen] : peer_last_seen_map) {
-      if (now - last_seen < std::chrono::seconds(15)) {
-        count++;
+      if (!WaitSnapshot(child)) {
+        LOG_WARN("Snapshot", "Writing {} failed", snapshot_path);
+        continue;
       }
+      covered = offset;
+      wal->truncate(cut);
+      LOG_INFO("Snapshot",
+               "Wrote {} at log offset {} in {} ms, writers paused {} us",
+               snapshot_path, offset,
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - started)
+                   .count(),
+               std::chrono::duration_cast<std::chrono::microseconds>(
+                   forked - started)
+                   .count());
     }
-
-    peer_status_mutex.unlock();
-    return count;
   }
 
   /*
-   * Hands off a request to owner node
+   * Reclaims expired values and old tombstones as their timers come due.
+   * Each tick handles at most REAP_BATCH timers, so a burst of expiries
+   * is spread over several ticks instead of stalling writers.
    */
-  bool forward_put_to_owner(const PutRequest *request,
-                            std::string owner_address) {
-    Client *client = cluster_map[owner_address].get();
-    return client->put(request->key(), request->val(), "client",
-                       request->replication_factor());
+  void _reap() {
+    auto next_tick = std::chrono::steady_clock::now();
+    while (!shutdown_requested_) {
+      next_tick += REAP_TICK;
+      for (const TimerWheel::Timer &timer :
+           expiry.advance(WallClockMicros(), REAP_BATCH)) {
+        if (timer.kind == TimerWheel::Kind::EXPIRE)
+          expire(timer);
+        else
+          purge(timer);
+      }
+      std::this_thread::sleep_until(next_tick);
+    }
   }
 
-  Val_TS forward_get_to_owner(const GetRequest *request,
-                              std::string owner_address) {
-    Client *client = cluster_map[owner_address].get();
-    return client->get(request->key(), "client", request->quorum_size());
+  /*
+   * Periodically compares Merkle trees with every live peer we share
+   * ranges with and repairs the leaves that differ
+   */
+  void _anti_entropy() {
+    if (anti_entropy_interval <= 0)
+      return;
+
+    while (!shutdown_requested_) {
+      for (int i = 0; i < anti_entropy_interval && !shutdown_requested_; ++i)
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+      auto view = cluster_view();
+      for (const std::string &address : view->ring.members()) {
+        if (shutdown_requested_)
+          break;
+        if (address != self_address && is_alive(address))
+          sync_with(*view, address);
+      }
+    }
   }
 
-  void _build_hash_ring() {
-    hash_ring.add_node(self_address);
+  /*
+   * Moves data after ring changes, one change at a time, and catches up
+   * with rings we missed while we were unreachable
+   */
+  void _rebalance() {
+    while (!shutdown_requested_) {
+      RingChange change;
+      std::string source;
+      {
+        std::unique_lock lock(handoff_mutex);
+        rebalance_cv.wait_for(lock, std::chrono::seconds(1), [this] {
+          return shutdown_requested_ || !ring_changes.empty() ||
+                 !ring_source.empty();
+        });
+        if (!ring_changes.empty()) {
+          change = std::move(ring_changes.front());
+          ring_changes.pop_front();
+        }
+        source.swap(ring_source);
+      }
+
+      if (!source.empty())
+        catch_up(source);
+
+      if (change.next) {
+        stream_changes(*change.previous, *change.next);
+        announce_handoff(*change.next);
+      }
 
-    for (const auto &[adress, _] : cluster_map) {
-      hash_ring.add_node(adress);
+      drop_dead_senders();
     }
   }
-};
 
-void RunServer(std::string port) {
-  std::string server_address("0.0.0.0:" + port);
-  TinyServer service{port};
+  void stop() {
+    shutdown_requested_ = true;
+    rebalance_cv.notify_all();
+    if (replicator)
+      replicator->stop();
+  }
 
-  ServerBuilder builder;
-  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
-  builder.RegisterService(&service);
+private:
+  // The log outlives the store, whose last flush may still reach it
+  std::unique_ptr<WriteAheadLog> wal;
+  std::unique_ptr<StorageEngine> store;
+  LsmEngine *lsm_engine = nullptr; // store, if it is an LsmEngine
+  std::string snapshot_path;
+  int snapshot_interval;
+
+  // Expiries and tombstone purges, in wall clock time
+  TimerWheel expiry{std::chrono::microseconds(REAP_TICK).count(),
+                    WallClockMicros()};
+  int64_t tombstone_grace_us;
+  PeerChannelOptions peer_options;
+  // Coalesces replica writes into batches, null when disabled
+  std::unique_ptr<ReplicationBatcher> replicator;
+  // Replies for keys owned elsewhere, null when disabled
+  std::unique_ptr<HotKeyCache> hot_cache;
+  // Nodes caching replies for keys we own
+  CacheHolders cache_holders;
 
-  std::unique_ptr<Server> server(builder.BuildAndStart());
-  std::cout << "[Server] Listening on " << server_address << std::endl;
+  std::string port;
+  std::string self_address;
+  std::atomic<bool> shutdown_requested_;
 
-  // Initialize heartbeat as a separate thread
-  std::thread heartbeat(&TinyServer::_heartbeat, &service);
-  server->Wait();
-  service.stop();
+  /*
+   * Everything that changes with the ring. A ring change builds a new view
+   * and swaps it in whole, so a request works with one consistent ring,
+   * peer set and Merkle tree however the change interleaves with it.
+   */
+  struct ClusterView {
+    uint64_t epoch = 0;
+    HashRing ring;
+    // Members of this ring and the one before it, minus ourselves
+    std::unordered_map<std::string, std::shared_ptr<PeerPool>> peers;
+    std::unique_ptr<MerkleTree> merkle; // built over ring
+
+    /*
+     * A data lane client of the peer, for requests and data transfers
+     */
+    Client *peer(const std::string &address) const {
+      auto it = peers.find(address);
+      return it == peers.end() ? nullptr : it->second->data();
+    }
 
-  heartbeat.join();
+    /*
+     * The control lane client of the peer, for gossip and ring changes
+     */
+    Client *control(const std::string &address) const {
+      auto it = peers.find(address);
+      return it == peers.end() ? nullptr : it->second->control();
+    }
+  };
 
-  std::cout << "[Server] Goodbye!" << std::endl;
-}
+  // A ring change whose data this node still has to send
+  struct RingChange {
+    std::shared_ptr<const ClusterView> previous;
+    std::shared_ptr<const ClusterView> next;
+  };
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cerr << "Usage: ./tinykv_server <port>" << std::endl;
-    return 1;
+  std::atomic<std::shared_ptr<const ClusterView>> cluster;
+  // Writers hold it shared so no write lands in a Merkle tree that is
+  // being replaced
+  std::shared_mutex topology_mutex;
+  std::mutex ring_change_mutex;  // serializes Join and Leave on the leader
+  std::mutex ring_install_mutex; // serializes installing rings
+
+  // The ring before the last change, set while data is still moving
+  std::atomic<std::shared_ptr<const HashRing>> handoff_ring;
+  std::mutex handoff_mutex;
+  std::condition_variable rebalance_cv;
+  std::deque<RingChange> ring_changes;
+  uint64_t handoff_epoch = 0;
+  std::set<std::string> handoff_senders; // still streaming to us
+  std::unordered_map<std::string, uint64_t> handoff_finished;
+  std::string ring_source; // a peer with a newer ring than ours
+
+  std::unique_ptr<Membership> membership;
+  HintStore hints;
+  NodeMetrics metrics;
+  int anti_entropy_interval;
+  int repair_rate;
+  int rebalance_rate;
+  int replication_factor;
+
+  // A replica destination and, for a sloppy write, the node it stands in for
+  using ReplicaTarget = std::pair<std::string, std::string>;
+
+  // What a replica reported for a digest read
+  struct ReplicaVersion {
+    std::string address;
+    int64_t timestamp;
+    uint64_t digest;
+  };
+
+  std::shared_ptr<const ClusterView> cluster_view() const {
+    return cluster.load(std::memory_order_acquire);
   }
-  std::string port(argv[1]);
-  RunServer(port);
+
+  /*
+   * Owner of key under the ring before the last change, or "" if no
+   * handoff is in progress
+   */
+  std::string previous_owner(const std::string &key) {
+    auto previous = handoff_ring.load(std::memory_order_acquire);
+    return previous ? previous->get_owner(key) : std::string();
+  }
+
+  /*
+   * The live member with the lowest address, which serializes ring changes
+   */
+  std::string ring_leader(const ClusterView &view) {
+    std::string leader;
+    for (const std::string &address : view.ring.members()) {
+      if (address != self_address && !is_alive(address))
+        continue;
+      if (leader.empty() || address < leader)
+        leader = address;
+    }
+    return leader.empty() ? self_address : leader;
+  }
+
+  /*
+   * Adds or removes a node, pushes the new ring to every node of the old
+   * and the new ring, then installs it here
+   */
+  Status change_ring(const std::string &address, bool joining,
+                     bool forwarded, RingResponse *reply) {
+    if (address.empty())
+      return Status(grpc::StatusCode::INVALID_ARGUMENT, "no address");
+
+    auto view = cluster_view();
+    if (view->epoch == 0)
+      return Status(grpc::StatusCode::UNAVAILABLE, "not a member yet");
+
+    std::string leader = ring_leader(*view);
+    if (leader != self_address && !forwarded) {
+      Client *client = view->control(leader);
+      return joining ? client->join(address, reply, true)
+                     : client->leave(address, reply, true);
+    }
+
+    std::lock_guard lock(ring_change_mutex);
+    view = cluster_view();
+    std::vector<std::string> nodes = view->ring.members();
+    auto it = std::find(nodes.begin(), nodes.end(), address);
+    bool member = it != nodes.end();
+
+    if (joining != member) {
+      if (joining)
+        nodes.push_back(address);
+      else
+        nodes.erase(it);
+      if (nodes.empty())
+        return Status(grpc::StatusCode::FAILED_PRECONDITION,
+                      "cannot remove the last node");
+
+      uint64_t epoch = view->epoch + 1;
+      LOG_INFO("Rebalance", "{} {}, ring epoch {}",
+               joining ? "Adding" : "Removing", address, epoch);
+
+      RingUpdate update;
+      update.set_sender_id(self_address);
+      update.set_epoch(epoch);
+      for (const std::string &node : nodes)
+        update.add_nodes(node);
+
+      // The joining node goes first, the change is off if it cannot be
+      // reached. Members that miss the update catch up through gossip.
+      if (joining) {
+        Client joiner(peer_channel(address));
+        RingResponse ack;
+        Status status = joiner.update_ring(update, RING_UPDATE_TIMEOUT, &ack);
+        if (!status.ok())
+          return Status(grpc::StatusCode::UNAVAILABLE,
+                        "joining node unreachable: " + status.error_message());
+      }
+
+      std::vector<std::future<Status>> acks;
+      for (const std::string &target : view->ring.members()) {
+        if (target == self_address)
+          continue;
+        Client *client = view->control(target);
+        acks.push_back(std::async(std::launch::async, [client, &update] {
+          RingResponse ack;
+          return client->update_ring(update, RING_UPDATE_TIMEOUT, &ack);
+        }));
+      }
+      for (auto &ack : acks)
+        ack.wait();
+
+      install_ring(epoch, nodes);
+      view = cluster_view();
+    } else if (joining) {
+      // A member that restarted with --join only needs the current ring
+      RingUpdate update;
+      update.set_sender_id(self_address);
+      update.set_epoch(view->epoch);
+      update.set_catch_up(true);
+      for (const std::string &node : nodes)
+        update.add_nodes(node);
+
+      Client joiner(peer_channel(address));
+      RingResponse ack;
+      joiner.update_ring(update, RING_UPDATE_TIMEOUT, &ack);
+    }
+
+    reply->set_accepted(true);
+    reply->set_epoch(view->epoch);
+    for (const std::string &node : view->ring.members())
+      reply->add_nodes(node);
+    return Status::OK;
+  }
+
+  /*
+   * Swaps in the ring of a newer epoch and queues the data it moves.
+   * Returns false if we already have this epoch or a newer one.
+   *
+   * A node catching up on a change it missed does not wait for handoffs:
+   * they were sent while it was unreachable, and what they could not
+   * deliver is left to hinted handoff and anti-entropy.
+   */
+  bool install_ring(uint64_t epoch, const std::vector<std::string> &nodes,
+                    bool catching_up = false) {
+    std::lock_guard install(ring_install_mutex);
+    auto previous = cluster_view();
+    if (epoch <= previous->epoch)
+      return false;
+
+    auto view = std::make_shared<ClusterView>();
+    view->epoch = epoch;
+    for (const std::string &address : nodes)
+      view->ring.add_node(address);
+
+    // A node that joins has no ring of its own to hand off from, the
+    // cluster's ring is the new one without it
+    HashRing handoff = previous->ring;
+    if (previous->epoch == 0) {
+      handoff = HashRing(view->ring.get_virtual_nodes());
+      for (const std::string &address : nodes) {
+        if (address != self_address)
+          handoff.add_node(address);
+      }
+    }
+
+    // Keep dialing the nodes of the old ring while their data moves
+    std::vector<std::string> known = nodes;
+    known.insert(known.end(), handoff.members().begin(),
+                 handoff.members().end());
+    for (const std::string &address : known) {
+      if (address == self_address || view->peers.count(address))
+        continue;
+      auto it = previous->peers.find(address);
+      view->peers[address] =
+          it != previous->peers.end()
+              ? it->second
+              : std::make_shared<PeerPool>(address, peer_options);
+    }
+    view->merkle = std::make_unique<MerkleTree>(view->ring, self_address,
+                                                replication_factor);
+
+    {
+      // Carry the keys we hold over to the new tree while no write can
+      // land in the old one
+      std::unique_lock lock(topology_mutex);
+      for (uint32_t vnode : previous->merkle->held_ranges()) {
+        for (const std::string &key : previous->merkle->range_keys(vnode)) {
+          int64_t timestamp = store->read_shared(key).second;
+          if (timestamp >= 0)
+            view->merkle->update(key, -1, timestamp);
+        }
+      }
+      cluster.store(view, std::memory_order_release);
+    }
+
+    for (const std::string &address : nodes)
+      membership->add_member(address);
+    for (const std::string &address : previous->ring.members()) {
+      if (view->ring.node_index(address) < 0)
+        membership->remove_member(address);
+    }
+
+    {
+      std::lock_guard lock(handoff_mutex);
+      handoff_epoch = epoch;
+      handoff_senders.clear();
+      for (const std::string &address : handoff.members()) {
+        if (!catching_up && handoff_finished[address] < epoch)
+          handoff_senders.insert(address);
+      }
+      if (!handoff_senders.empty())
+        handoff_ring.store(std::make_shared<const HashRing>(handoff));
+      else
+        handoff_ring.store(nullptr);
+      ring_changes.push_back({previous, view});
+    }
+    rebalance_cv.notify_all();
+
+    LOG_INFO("Rebalance", "Installed ring epoch {} with {} nodes", epoch,
+             nodes.size());
+    return true;
+  }
+
+  /*
+   * Records that sender has streamed everything for the ring of epoch.
+   * Reads stop consulting the previous owners once every sender is done.
+   */
+  void finish_handoff(const std::string &sender, uint64_t epoch) {
+    std::lock_guard lock(handoff_mutex);
+    uint64_t &finished = handoff_finished[sender];
+    finished = std::max(finished, epoch);
+    if (epoch != handoff_epoch || !handoff_senders.erase(sender))
+      return;
+
+    if (handoff_senders.empty() && handoff_ring.load()) {
+      handoff_ring.store(nullptr);
+      LOG_INFO("Rebalance", "Handoff for ring epoch {} complete", epoch);
+    }
+  }
+
+  /*
+   * Stops waiting for senders the failure detector has given up on
+   */
+  void drop_dead_senders() {
+    std::vector<std::string> dead;
+    {
+      std::lock_guard lock(handoff_mutex);
+      for (const std::string &sender : handoff_senders) {
+        if (sender != self_address && !is_alive(sender))
+          dead.push_back(sender);
+      }
+    }
+    for (const std::string &sender : dead) {
+      LOG_WARN("Rebalance", "{} is down, not waiting for its handoff", sender);
+      finish_handoff(sender, handoff_epoch);
+    }
+  }
+
+  /*
+   * Tells every node of the new ring that our data has been sent
+   */
+  void announce_handoff(const ClusterView &view) {
+    HandoffDoneRequest request;
+    request.set_sender_id(self_address);
+    request.set_epoch(view.epoch);
+
+    for (const auto &[address, pool] : view.peers)
+      pool->control()->handoff_done(request);
+    finish_handoff(self_address, view.epoch);
+
+    if (view.ring.node_index(self_address) < 0)
+      LOG_INFO("Rebalance", "Left the ring, all data handed off");
+  }
+
+  /*
+   * Notes a peer gossiping a newer ring than ours
+   */
+  void check_ring_epoch(const std::string &peer, uint64_t epoch) {
+    if (epoch <= cluster_view()->epoch)
+      return;
+    std::lock_guard lock(handoff_mutex);
+    ring_source = peer;
+    rebalance_cv.notify_all();
+  }
+
+  /*
+   * Fetches the ring from a peer that has a newer one
+   */
+  void catch_up(const std::string &source) {
+    Client *client = cluster_view()->control(source);
+    MembershipResponse ring;
+    if (!client || !client->ring(&ring).ok())
+      return;
+
+    std::vector<std::string> nodes(ring.nodes().begin(), ring.nodes().end());
+    if (install_ring(ring.epoch(), nodes, true))
+      LOG_INFO("Rebalance", "Caught up to ring epoch {} from {}", ring.epoch(),
+               source);
+  }
+
+  /*
+   * Whether the vnode arc of the old ring has the same holders everywhere
+   * in the new ring. The arc may be split over several new vnodes.
+   */
+  bool arc_moved(const HashRing &old_ring, uint32_t vnode,
+                 const HashRing &new_ring) {
+    auto holders = [](const HashRing &ring, size_t v, int n) {
+      std::vector<std::string> addresses;
+      for (uint16_t node : ring.vnode_preference(v, n))
+        addresses.push_back(ring.get_address(node));
+      std::sort(addresses.begin(), addresses.end());
+      return addresses;
+    };
+
+    size_t count = old_ring.vnode_count();
+    uint64_t start = old_ring.vnode_position((vnode + count - 1) % count);
+    uint64_t length = old_ring.vnode_position(vnode) - start;
+    if (length == 0)
+      length = UINT64_MAX;
+
+    std::vector<std::string> before =
+        holders(old_ring, vnode, replication_factor);
+    size_t v = new_ring.successor(start);
+    for (size_t step = 0; step < new_ring.vnode_count(); ++step) {
+      if (holders(new_ring, v, replication_factor) != before)
+        return true;
+      // This vnode reaches past the end of the old arc
+      if (new_ring.vnode_position(v) - start >= length)
+        break;
+      v = (v + 1) % new_ring.vnode_count();
+    }
+    return false;
+  }
+
+  /*
+   * Sends the keys whose replicas moved to the nodes that gained them.
+   *
+   * Only arcs whose holders changed are read, and each key is sent once:
+   * by the first node that held it and is still alive. Keys go out in
+   * MultiPut chunks, at most rebalance_rate per second, so the handoff
+   * runs alongside normal traffic. They keep their timestamps, so a
+   * newer write the new holder has already taken is not overwritten.
+   */
+  void stream_changes(const ClusterView &previous, const ClusterView &view) {
+    if (previous.ring.node_index(self_address) < 0 || previous.epoch == 0)
+      return;
+
+    std::map<std::string, MultiPutRequest> chunks;
+    size_t ranges = 0, sent = 0, failed = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    auto flush = [&](const std::string &target) {
+      MultiPutRequest &chunk = chunks[target];
+      if (chunk.entries_size() == 0)
+        return;
+      size_t keys = chunk.entries_size();
+      if (send_chunk(view, target, chunk))
+        sent += keys;
+      else
+        failed += keys;
+      chunk.clear_entries();
+
+      // Stay under rebalance_rate keys per second
+      auto budget = std::chrono::microseconds(
+          (int64_t)((sent + failed) * 1e6 / std::max(1, rebalance_rate)));
+      std::this_thread::sleep_until(start + budget);
+    };
+
+    for (uint32_t vnode : previous.merkle->held_ranges()) {
+      if (shutdown_requested_)
+        break;
+      if (!arc_moved(previous.ring, vnode, view.ring))
+        continue;
+
+      std::vector<std::string> holders;
+      for (uint16_t node :
+           previous.ring.vnode_preference(vnode, replication_factor))
+        holders.push_back(previous.ring.get_address(node));
+
+      auto sender = std::find_if(
+          holders.begin(), holders.end(), [this](const std::string &a) {
+            return a == self_address || is_alive(a);
+          });
+      if (sender == holders.end() || *sender != self_address)
+        continue;
+      ranges++;
+
+      for (const std::string &key : previous.merkle->range_keys(vnode)) {
+        Val_TS value = store->read(key);
+        if (value.second < 0)
+          continue;
+
+        for (uint16_t node :
+             view.ring.get_preference_list(key, replication_factor)) {
+          const std::string &target = view.ring.get_address(node);
+          if (target == self_address ||
+              std::find(holders.begin(), holders.end(), target) !=
+                  holders.end())
+            continue;
+
+          KeyValue *entry = chunks[target].add_entries();
+          entry->set_key(key);
+          entry->set_val(value.first);
+          entry->set_timestamp(value.second);
+          if (chunks[target].entries_size() >= REBALANCE_BATCH_SIZE)
+            flush(target);
+        }
+      }
+    }
+    for (auto &[target, _] : chunks)
+      flush(target);
+
+    LOG_INFO("Rebalance",
+             "Streamed {} keys from {} ranges for ring epoch {}, {} left to "
+             "anti-entropy",
+             sent, ranges, view.epoch, failed);
+  }
+
+  /*
+   * Sends one chunk of a handoff as replica writes, retrying a few times
+   */
+  bool send_chunk(const ClusterView &view, const std::string &target,
+                  const MultiPutRequest &chunk) {
+    Client *client = view.peer(target);
+    if (!client)
+      return false;
+
+    for (int attempt = 0; attempt < REBALANCE_ATTEMPTS; ++attempt) {
+      MultiPutRequest request = chunk;
+      request.set_sender_id(self_address);
+
+      std::promise<bool> result;
+      client->multi_put_async(std::move(request),
+                              [&result](bool ok, std::vector<bool> success) {
+                                result.set_value(
+                                    ok && std::all_of(success.begin(),
+                                                      success.end(),
+                                                      [](bool s) { return s; }));
+                              });
+      if (result.get_future().get())
+        return true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    return false;
+  }
+
+  /*
+   * Tells the failure detector a peer just talked to us, lock free
+   */
+  void update_last_seen(const std::string &address) {
+    membership->heard_from(address);
+  }
+
+  /*
+   * Wraps a handler's completion so it records the time since started
+   */
+  Done timed(Rpc rpc, Origin origin, NodeMetrics::Clock::time_point started,
+             Done done) {
+    LatencyHistogram *histogram = &metrics.latency(rpc, origin);
+    return [histogram, started, done = std::move(done)](Status status) {
+      histogram->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                            NodeMetrics::Clock::now() - started)
+                            .count());
+      done(status);
+    };
+  }
+
+  /*
+   * Sends a coordinator our stored versions of a range as they are
+   */
+  Status stream_local_scan(const std::string &start, const std::string &end,
+                           uint64_t limit,
+                           grpc::ServerWriter<ScanResponse> *writer) {
+    LocalScanSource source(store.get(), start, end, SCAN_CHUNK);
+    std::vector<ScanEntry> chunk;
+    uint64_t sent = 0;
+    while ((limit == 0 || sent < limit) && source.next(&chunk)) {
+      ScanResponse response;
+      for (size_t i = 0; i < chunk.size() && (limit == 0 || sent < limit);
+           ++i, ++sent) {
+        KeyValue *entry = response.add_entries();
+        entry->set_key(std::move(chunk[i].key));
+        entry->set_val(*chunk[i].val);
+        entry->set_timestamp(chunk[i].timestamp);
+      }
+      // The coordinator hung up, it has all it needs
+      if (!writer->Write(response))
+        break;
+    }
+    return Status::OK;
+  }
+
+  /*
+   * Merges our store with every live peer's. Peers get no limit, since
+   * versions they send may lose to newer ones or be dead, and are cut off
+   * once the client has its keys. More unreachable nodes than replicas
+   * per key means some keys may be missing, the client is told so after
+   * the stream.
+   */
+  Status coordinate_scan(const std::string &start, const std::string &end,
+                         uint64_t limit,
+                         grpc::ServerWriter<ScanResponse> *writer) {
+    auto view = cluster_view();
+    ScanRequest peer_request;
+    peer_request.set_start(start);
+    peer_request.set_end(end);
+    peer_request.set_sender_id(self_address);
+
+    std::vector<std::unique_ptr<ScanSource>> sources;
+    sources.push_back(std::make_unique<LocalScanSource>(store.get(), start,
+                                                        end, SCAN_CHUNK));
+    size_t unreachable = 0;
+    for (const auto &[address, peer] : view->peers) {
+      if (!is_alive(address)) {
+        unreachable++;
+        continue;
+      }
+      sources.push_back(
+          std::make_unique<PeerScanSource>(peer->data(), peer_request));
+    }
+    ScanMerger merger(std::move(sources));
+
+    ScanResponse response;
+    size_t bytes = 0;
+    uint64_t sent = 0;
+    int64_t now = WallClockMicros();
+    ScanEntry version;
+    while ((limit == 0 || sent < limit) && merger.next(&version)) {
+      StoredValue stored = DecodeValue(*version.val);
+      if (!stored.live(now))
+        continue;
+
+      KeyValue *entry = response.add_entries();
+      entry->set_key(std::move(version.key));
+      entry->set_val(version.val->data() + stored.offset,
+                     version.val->size() - stored.offset);
+      entry->set_timestamp(version.timestamp);
+      bytes += entry->val().size();
+      sent++;
+
+      if (response.entries_size() >= static_cast<int>(SCAN_CHUNK) ||
+          bytes >= SCAN_CHUNK_BYTES) {
+        if (!writer->Write(response))
+          return Status(grpc::StatusCode::CANCELLED, "client went away");
+        response.Clear();
+        bytes = 0;
+      }
+    }
+    if (response.entries_size() > 0 && !writer->Write(response))
+      return Status(grpc::StatusCode::CANCELLED, "client went away");
+
+    if (unreachable + merger.failed_sources() >=
+        static_cast<size_t>(replication_factor))
+      return Status(grpc::StatusCode::UNAVAILABLE,
+                    "too many nodes unreachable, the scan may miss keys");
+    return Status::OK;
+  }
+
+  /*
+   * Channel to a node outside the ring, e.g. the seed we join through
+   */
+  std::shared_ptr<grpc::Channel> peer_channel(const std::string &address) {
+    return PeerPool::channel(address, peer_options);
+  }
+
+  /*
+   * Holds a write for a replica that is down, counting it if it was kept
+   */
+  bool store_hint(const std::string &target, const std::string &key,
+                  const std::string &val, int64_t timestamp) {
+    bool stored = hints.add(target, key, val, timestamp);
+    if (stored)
+      metrics.hints_stored.add();
+    return stored;
+  }
+
+  /*
+   * Pings a peer with our gossip attached and waits for the ack
+   */
+  bool probe(const std::string &target) {
+    auto view = cluster_view();
+    Client *client = view->control(target);
+    if (!client)
+      return false;
+
+    PingRequest request;
+    request.set_sender_id(self_address);
+    request.set_ring_epoch(view->epoch);
+    membership->piggyback(request.mutable_updates());
+
+    std::promise<bool> acked;
+    client->ping_async(
+        std::move(request), membership->options().probe_timeout,
+        [this, &acked, target](bool ok, const PingResponse &reply) {
+          if (ok) {
+            update_last_seen(target);
+            membership->merge(reply.updates());
+            check_ring_epoch(target, reply.ring_epoch());
+          }
+          acked.set_value(ok);
+        });
+    return acked.get_future().get();
+  }
+
+  /*
+   * Asks up to k live peers to probe target, true if any of them got an ack
+   */
+  bool probe_indirectly(const std::string &target) {
+    auto view = cluster_view();
+    const MembershipOptions &opts = membership->options();
+    std::vector<std::string> helpers =
+        membership->indirect_helpers(target, opts.indirect_probes);
+
+    auto result = std::make_shared<std::promise<bool>>();
+    auto quorum = std::make_shared<QuorumCall<bool>>(
+        1, helpers.size(),
+        [result](bool reached, const std::vector<bool> &) {
+          result->set_value(reached);
+        });
+
+    for (const std::string &helper : helpers) {
+      Client *client = view->control(helper);
+      if (!client) {
+        quorum->fail();
+        continue;
+      }
+
+      PingReqRequest request;
+      request.set_sender_id(self_address);
+      request.set_target(target);
+      membership->piggyback(request.mutable_updates());
+
+      // The helper needs time for its own probe of the target
+      client->ping_req_async(
+          std::move(request), opts.probe_timeout * 2,
+          [this, quorum, helper](bool ok, const PingResponse &reply) {
+            if (!reply.updates().empty()) {
+              update_last_seen(helper);
+              membership->merge(reply.updates());
+            }
+            if (ok)
+              quorum->ack(true);
+            else
+              quorum->fail();
+          });
+    }
+    return result->get_future().get();
+  }
+
+  /*
+   * Rebuilds the store from the latest snapshot and the log written after
+   * it, or from the whole log if there is no usable snapshot
+   */
+  void recover(const std::string &wal_path) {
+    auto started = std::chrono::steady_clock::now();
+    MerkleTree *merkle = cluster_view()->merkle.get();
+    auto apply = [this, merkle](const std::string &key, const ValueRef &val,
+                                int64_t timestamp) {
+      int64_t replaced;
+      if (store->write_shared(key, val, timestamp, &replaced)) {
+        merkle->update(key, replaced, timestamp);
+        schedule_reap(key, *val, timestamp);
+      }
+    };
+
+    uint64_t from = 0;
+    if (lsm_engine) {
+      // The tables hold every write logged before the engine's position,
+      // only the Merkle tree and the reap timers are rebuilt from them
+      size_t keys = 0;
+      bool complete = lsm_engine->visit_unlocked(
+          [this, merkle, &keys](const std::string &key, const ValueRef &val,
+                                int64_t timestamp) {
+            merkle->update(key, -1, timestamp);
+            schedule_reap(key, *val, timestamp);
+            keys++;
+          });
+      // The Merkle tree then lacks those keys, anti-entropy has to bring
+      // them back from the replicas
+      if (!complete)
+        LOG_ERROR("Server", "Skipped corrupt table blocks while recovering");
+      from = lsm_engine->log_position();
+      LOG_INFO("Server", "Found {} keys in tables up to log position {}", keys,
+               from);
+    } else {
+      SnapshotInfo snapshot;
+      int threads = std::max(1u, std::thread::hardware_concurrency());
+      if (LoadSnapshot(snapshot_path, threads, apply, &snapshot)) {
+        LOG_INFO("Server", "Loaded {} keys from {}", snapshot.entries,
+                 snapshot_path);
+        from = snapshot.wal_offset;
+      } else if (std::filesystem::exists(snapshot_path)) {
+        // Whatever did load is valid, the log brings the rest
+        LOG_WARN("Server", "Snapshot {} is corrupt, replaying the whole log",
+                 snapshot_path);
+      }
+    }
+
+    size_t records = wal->replay(
+        [&apply](const std::string &key, const std::string &val,
+                 int64_t timestamp) {
+          apply(key, std::make_shared<const std::string>(val), timestamp);
+        },
+        from);
+    LOG_INFO("Server", "Recovered {} writes from {} in {} ms", records,
+             wal_path,
+             std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - started)
+                 .count());
+  }
+
+  /*
+   * Thread safe Write operation
+   * the storage engine compares timestamps to ensure LWW
+   *
+   * Accepted writes are logged before the caller acks them. Replay goes
+   * through the same LWW check, so log order does not matter.
+   *
+   * Returns false if the log failed, the write is then in memory but may
+   * not survive a restart and must not be acked.
+   */
+  bool write(const std::string &key, const ValueRef &val, int64_t timestamp) {
+    std::shared_lock topology(topology_mutex);
+    int64_t replaced;
+    if (!store->write_shared(key, val, timestamp, &replaced)) {
+      LOG_DEBUG("Write", "Ignored stale/duplicate write for {} (Req: {})", key,
+                timestamp);
+      return true;
+    }
+
+    cluster_view()->merkle->update(key, replaced, timestamp);
+    schedule_reap(key, *val, timestamp);
+    if (!cache_holders.empty())
+      invalidate_cached(key, timestamp);
+    if (wal && !wal->append(key, *val, timestamp)) {
+      LOG_ERROR("Write", "Could not log the write of {}", key);
+      return false;
+    }
+
+    LOG_DEBUG("Write", "Updated {} (TS: {})", key, timestamp);
+    return true;
+  }
+
+  bool write(const std::string &key, const std::string &val,
+             int64_t timestamp) {
+    return write(key, std::make_shared<const std::string>(val), timestamp);
+  }
+
+  /*
+   * Writes several keys with a single log append, false if the log failed
+   */
+  bool write_batch(const std::vector<LogRecord> &records) {
+    std::shared_lock topology(topology_mutex);
+    MerkleTree *merkle = cluster_view()->merkle.get();
+    std::vector<LogRecord> accepted;
+    for (const LogRecord &r : records) {
+      int64_t replaced;
+      if (store->write_shared(r.key, r.val, r.timestamp, &replaced)) {
+        merkle->update(r.key, replaced, r.timestamp);
+        schedule_reap(r.key, *r.val, r.timestamp);
+        if (!cache_holders.empty())
+          invalidate_cached(r.key, r.timestamp);
+        accepted.push_back(r);
+      }
+    }
+
+    if (wal && !wal->append_batch(accepted)) {
+      LOG_ERROR("Write", "Could not log a batch of {} writes", accepted.size());
+      return false;
+    }
+
+    LOG_DEBUG("Write", "Batch updated {} of {} keys", accepted.size(),
+              records.size());
+    return true;
+  }
+
+  /*
+   * Tells the nodes caching key's reply that there is a newer version
+   */
+  void invalidate_cached(const std::string &key, int64_t timestamp) {
+    std::vector<std::string> holders = cache_holders.take(key);
+    if (holders.empty())
+      return;
+
+    auto view = cluster_view();
+    for (const std::string &holder : holders) {
+      Client *client = view->peer(holder);
+      if (!client)
+        continue;
+      InvalidateRequest request;
+      request.set_sender_id(self_address);
+      request.set_key(key);
+      request.set_timestamp(timestamp);
+      client->invalidate_async(std::move(request));
+    }
+  }
+
+  /*
+   * Puts a version that expires, or a tombstone, on the timer wheel
+   */
+  void schedule_reap(const std::string &key, std::string_view val,
+                     int64_t timestamp) {
+    StoredValue stored = DecodeValue(val);
+    if (stored.kind == ValueKind::EXPIRING)
+      expiry.schedule(
+          {key, timestamp, stored.expires_at, TimerWheel::Kind::EXPIRE});
+    else if (stored.kind == ValueKind::TOMBSTONE)
+      expiry.schedule({key, timestamp, timestamp + tombstone_grace_us,
+                       TimerWheel::Kind::PURGE});
+  }
+
+  /*
+   * Frees the value of an expired version by turning it into a tombstone.
+   * The version keeps its timestamp, so Merkle trees and Last Writer Wins
+   * see no change, and reads already treated it as gone.
+   */
+  void expire(const TimerWheel::Timer &timer) {
+    if (!store->replace(timer.key, timer.timestamp, Tombstone()))
+      return;
+    metrics.keys_expired.add();
+    expiry.schedule({timer.key, timer.timestamp,
+                     timer.due_us + tombstone_grace_us,
+                     TimerWheel::Kind::PURGE});
+  }
+
+  /*
+   * Drops a tombstone, unless a newer version of the key replaced it
+   */
+  void purge(const TimerWheel::Timer &timer) {
+    std::shared_lock topology(topology_mutex);
+    if (!store->erase(timer.key, timer.timestamp))
+      return;
+    cluster_view()->merkle->remove(timer.key, timer.timestamp);
+    metrics.tombstones_purged.add();
+  }
+
+  /*
+   * Writes the owned entries of a MultiPut and replicates them with one
+   * batched request per peer. Each key still needs its own write quorum.
+   */
+  void coordinate_multi_put(const ClusterView &view,
+                            const MultiPutRequest *request,
+                            const std::vector<int> &indices,
+                            MultiPutResponse *reply,
+                            std::function<void()> on_done) {
+    int replicas = request->replication_factor();
+    int write_quorum = request->write_quorum() > 0
+                           ? std::min(request->write_quorum(), replicas)
+                           : replicas;
+
+    if (replicas - 1 > live_node_count())
+      return on_done();
+
+    int64_t timestamp = WallClockMicros();
+    int64_t expires_at =
+        request->ttl_ms() > 0 ? timestamp + request->ttl_ms() * 1000 : 0;
+
+    // Shared by the replica batches and the hints, values are not copied
+    auto records = std::make_shared<std::vector<LogRecord>>();
+    for (int i : indices) {
+      const KeyValue &entry = request->entries(i);
+      records->push_back(
+          {entry.key(), EncodeValue(entry.val(), expires_at), timestamp});
+    }
+    // The entries stay unsuccessful
+    if (!write_batch(*records))
+      return on_done();
+
+    auto countdown = std::make_shared<CountdownCall>(indices.size(), on_done);
+    std::vector<std::shared_ptr<QuorumCall<bool>>> quorums;
+    // Batches are keyed by (destination, replica the writes are held for)
+    std::map<ReplicaTarget, std::vector<int>> batch_keys;
+
+    for (size_t j = 0; j < indices.size(); ++j) {
+      int peers = 0;
+      for (const ReplicaTarget &target :
+           replica_targets(view, (*records)[j].key, replicas)) {
+        batch_keys[target].push_back(j);
+        peers++;
+      }
+
+      int i = indices[j];
+      quorums.push_back(std::make_shared<QuorumCall<bool>>(
+          write_quorum - 1, peers,
+          [this, reply, i, countdown](bool reached,
+                                      const std::vector<bool> &) {
+            (reached ? metrics.write_quorums_reached
+                     : metrics.write_quorums_failed)
+                .add();
+            reply->set_operation_success(i, reached);
+            countdown->finish();
+          }));
+    }
+
+    MultiPutRequest header;
+    header.set_sender_id(self_address);
+    KeyValue replica_entry;
+    replica_entry.set_timestamp(timestamp);
+
+    for (auto &[target, keys] : batch_keys) {
+      const auto &[node_adress, hint_for] = target;
+      LOG_DEBUG("Server", "Replicating {} keys at: {}{}", keys.size(),
+                node_adress, (hint_for.empty() ? "" : " for " + hint_for));
+
+      header.set_hint_for(hint_for);
+      MessageWriter batch;
+      batch.append(header);
+      std::vector<std::shared_ptr<QuorumCall<bool>>> batch_quorums;
+      for (int j : keys) {
+        replica_entry.set_key((*records)[j].key);
+        batch.append_entry(MultiPutRequest::kEntriesFieldNumber, replica_entry,
+                           KeyValue::kValFieldNumber, (*records)[j].val);
+        batch_quorums.push_back(quorums[j]);
+      }
+
+      std::string owner = hint_for.empty() ? node_adress : hint_for;
+      view.peer(node_adress)->multi_put_async(
+          batch.finish(), keys.size(),
+          [this, batch_quorums, records, keys,
+           owner](bool ok, std::vector<bool> success) {
+            for (size_t k = 0; k < batch_quorums.size(); ++k) {
+              if (ok && success[k]) {
+                metrics.replica_writes_acked.add();
+                batch_quorums[k]->ack(true);
+              } else {
+                metrics.replica_writes_failed.add();
+                const LogRecord &record = (*records)[keys[k]];
+                store_hint(owner, record.key, *record.val, record.timestamp);
+                batch_quorums[k]->fail();
+              }
+            }
+          });
+    }
+  }
+
+  /*
+   * Reads the owned keys of a MultiGet, consulting each key's quorum with
+   * one batched request per peer
+   */
+  void coordinate_multi_get(const ClusterView &view,
+                            const MultiGetRequest *request,
+                            const std::vector<int> &indices,
+                            MultiGetResponse *reply,
+                            std::function<void()> on_done) {
+    auto countdown = std::make_shared<CountdownCall>(indices.size(), on_done);
+    std::vector<std::shared_ptr<QuorumCall<Val_TS>>> quorums;
+    std::unordered_map<std::string, MultiGetRequest> batches;
+    std::unordered_map<std::string, std::vector<int>> batch_keys;
+
+    for (size_t j = 0; j < indices.size(); ++j) {
+      int i = indices[j];
+      const std::string &key = request->keys(i);
+      std::vector<std::string> replicas;
+      for (uint16_t node :
+           view.ring.get_preference_list(key, request->quorum_size())) {
+        if (view.ring.get_address(node) != self_address)
+          replicas.push_back(view.ring.get_address(node));
+      }
+
+      // Same as a single Get, wait for the previous owner during a handoff
+      int required = request->quorum_size() - 1;
+      std::string previous = previous_owner(key);
+      if (!previous.empty() && previous != self_address &&
+          std::find(replicas.begin(), replicas.end(), previous) ==
+              replicas.end()) {
+        replicas.push_back(previous);
+        required++;
+      }
+
+      for (const std::string &peer_address : replicas) {
+        batches[peer_address].add_keys(key);
+        batch_keys[peer_address].push_back(j);
+      }
+
+      Val_TS local_value = store->read(key);
+      quorums.push_back(std::make_shared<QuorumCall<Val_TS>>(
+          required, replicas.size(),
+          [reply, i, local_value,
+           countdown](bool reached, const std::vector<Val_TS> &responses) {
+            Val_TS last_write = local_value;
+            for (const Val_TS &val : responses) {
+              if (val.second > last_write.second)
+                last_write = val;
+            }
+            StoredValue stored = DecodeValue(last_write.first);
+            if (last_write.second >= 0 && stored.live(WallClockMicros())) {
+              reply->mutable_entries(i)->set_val(
+                  last_write.first.substr(stored.offset));
+              reply->mutable_entries(i)->set_timestamp(last_write.second);
+            }
+            countdown->finish();
+          }));
+    }
+
+    for (auto &[peer_address, batch] : batches) {
+      batch.set_sender_id(self_address);
+      batch.set_quorum_size(1);
+      std::vector<std::shared_ptr<QuorumCall<Val_TS>>> batch_quorums;
+      for (int j : batch_keys[peer_address])
+        batch_quorums.push_back(quorums[j]);
+
+      view.peer(peer_address)->multi_get_async(
+          std::move(batch),
+          [batch_quorums](bool ok, std::vector<Val_TS> values) {
+            for (size_t k = 0; k < batch_quorums.size(); ++k) {
+              if (ok)
+                batch_quorums[k]->ack(values[k]);
+              else
+                batch_quorums[k]->fail();
+            }
+          });
+    }
+  }
+
+  /*
+   * Sends the write to all replicas in parallel and calls on_done once the
+   * write quorum has acknowledged it. Slower replicas finish in the
+   * background.
+   */
+  void replicate_key(const ClusterView &view, const PutRequest *request,
+                     const ValueRef &value, int64_t timestamp,
+                     std::function<void(bool)> on_done) {
+    // on_done may finish the call, and free request, before this returns,
+    // as soon as the quorum is decided. Nothing below reads request.
+    auto key = std::make_shared<const std::string>(request->key());
+    int replicas = request->replication_factor();
+    int write_quorum = request->write_quorum() > 0
+                           ? std::min(request->write_quorum(), replicas)
+                           : replicas;
+
+    std::vector<ReplicaTarget> peers = replica_targets(view, *key, replicas);
+
+    // The owner's own write counts as the first ack
+    auto quorum = std::make_shared<QuorumCall<bool>>(
+        write_quorum - 1, peers.size(),
+        [this, on_done](bool reached, const std::vector<bool> &) {
+          (reached ? metrics.write_quorums_reached
+                   : metrics.write_quorums_failed)
+              .add();
+          if (!reached) {
+            LOG_WARN("Server", "Unable to find required number of replicas");
+          }
+          on_done(reached);
+        });
+
+    // Replica requests only differ in the hint
+    PutRequest replica_request;
+    replica_request.set_key(*key);
+    replica_request.set_sender_id(self_address);
+    replica_request.set_timestamp(timestamp);
+
+    for (const auto &[node_adress, hint_for] : peers) {
+      LOG_DEBUG("Server", "Replicating key: {} at: {}{}", *key, node_adress,
+                (hint_for.empty() ? "" : " for " + hint_for));
+
+      // Kept to hint the replica ourselves if the write does not land
+      std::string owner = hint_for.empty() ? node_adress : hint_for;
+      auto on_ack = [this, quorum, key, value, timestamp, owner](bool acked) {
+        if (acked) {
+          metrics.replica_writes_acked.add();
+          quorum->ack(true);
+        } else {
+          metrics.replica_writes_failed.add();
+          store_hint(owner, *key, *value, timestamp);
+          quorum->fail();
+        }
+      };
+
+      if (replicator) {
+        replicator->add(node_adress, *key, value, timestamp, hint_for,
+                        std::move(on_ack));
+        continue;
+      }
+
+      replica_request.set_hint_for(hint_for);
+      view.peer(node_adress)->put_async(
+          SerializeWithValue(replica_request, PutRequest::kValFieldNumber,
+                             value),
+          [on_ack](bool ok, bool success) { on_ack(ok && success); });
+    }
+  }
+
+  /*
+   * Picks the node each replica of a key is sent to, excluding ourselves.
+   *
+   * Replicas on live nodes go to their own node. A replica whose node is
+   * down goes to the next live node on the ring past the preference list,
+   * with a hint naming the node it belongs to (a sloppy quorum), so writes
+   * keep their W target while a node restarts.
+   */
+  std::vector<ReplicaTarget> replica_targets(const ClusterView &view,
+                                             const std::string &key,
+                                             int replicas) {
+    const HashRing &hash_ring = view.ring;
+    auto walk = hash_ring.get_preference_list(key, hash_ring.node_count());
+    size_t home = std::min<size_t>(std::max(replicas, 0), walk.size());
+    size_t spare = home;
+
+    std::vector<ReplicaTarget> targets;
+    for (size_t i = 0; i < home; ++i) {
+      const std::string &address = hash_ring.get_address(walk[i]);
+      if (address == self_address)
+        continue;
+
+      if (is_alive(address)) {
+        targets.push_back({address, ""});
+        continue;
+      }
+
+      bool substituted = false;
+      while (spare < walk.size() && !substituted) {
+        const std::string &candidate = hash_ring.get_address(walk[spare++]);
+        if (candidate != self_address && is_alive(candidate)) {
+          targets.push_back({candidate, address});
+          substituted = true;
+        }
+      }
+      // Nowhere to hand it off, try the replica anyway
+      if (!substituted)
+        targets.push_back({address, ""});
+    }
+    return targets;
+  }
+
+  /*
+   * One anti-entropy round with a peer. Walks both trees top down, only
+   * descending into nodes whose hashes differ, then repairs the divergent
+   * leaves. The traffic grows with the number of differences, not with the
+   * number of keys.
+   */
+  void sync_with(const ClusterView &view, const std::string &peer) {
+    std::vector<TreeNode> frontier;
+    for (uint32_t vnode : view.merkle->shared_ranges(peer)) {
+      TreeNode root;
+      root.set_vnode(vnode);
+      frontier.push_back(root);
+    }
+
+    for (uint32_t level = 0; level < MerkleTree::LEAF_LEVEL; ++level) {
+      std::vector<TreeNode> divergent;
+      if (!compare_hashes(view, peer, frontier, &divergent))
+        return;
+
+      frontier.clear();
+      for (const TreeNode &node : divergent) {
+        for (int i = 0; i < MerkleTree::FANOUT; ++i) {
+          TreeNode child;
+          child.set_vnode(node.vnode());
+          child.set_level(level + 1);
+          child.set_index(node.index() * MerkleTree::FANOUT + i);
+          frontier.push_back(child);
+        }
+      }
+    }
+
+    std::vector<TreeNode> leaves;
+    if (!compare_hashes(view, peer, frontier, &leaves) || leaves.empty())
+      return;
+
+    size_t pulled = 0, pushed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const TreeNode &leaf : leaves) {
+      if (shutdown_requested_ ||
+          !repair_leaf(view, peer, leaf, &pulled, &pushed))
+        break;
+
+      // Stay under repair_rate keys per second
+      auto budget = std::chrono::microseconds(
+          (int64_t)((pulled + pushed) * 1e6 / std::max(1, repair_rate)));
+      std::this_thread::sleep_until(start + budget);
+    }
+
+    LOG_INFO("AntiEntropy",
+             "{}: {} divergent leaves, pulled {} and pushed {} keys", peer,
+             leaves.size(), pulled, pushed);
+  }
+
+  /*
+   * Asks the peer for its hashes of nodes and collects the ones that
+   * differ from ours
+   */
+  bool compare_hashes(const ClusterView &view, const std::string &peer,
+                      const std::vector<TreeNode> &nodes,
+                      std::vector<TreeNode> *divergent) {
+    for (size_t first = 0; first < nodes.size();
+         first += DIGEST_BATCH_SIZE) {
+      size_t last = std::min(nodes.size(), first + DIGEST_BATCH_SIZE);
+
+      DigestRequest request;
+      request.set_sender_id(self_address);
+      request.set_ring_size(view.ring.vnode_count());
+      request.set_ring_epoch(view.epoch);
+      for (size_t i = first; i < last; ++i)
+        *request.add_nodes() = nodes[i];
+
+      DigestResponse reply;
+      Status status = view.peer(peer)->merkle_digest(request, &reply);
+      if (!status.ok() || reply.hashes_size() != (int)(last - first))
+        return false;
+
+      for (size_t i = first; i < last; ++i) {
+        const TreeNode &node = nodes[i];
+        if (reply.hashes(i - first) !=
+            view.merkle->hash(node.vnode(), node.level(), node.index()))
+          divergent->push_back(node);
+      }
+    }
+    return true;
+  }
+
+  /*
+   * Swaps versions of one leaf with the peer: applies what it has newer
+   * and pushes what we have newer
+   */
+  bool repair_leaf(const ClusterView &view, const std::string &peer,
+                   const TreeNode &leaf, size_t *pulled, size_t *pushed) {
+    SyncRangeRequest request;
+    request.set_sender_id(self_address);
+    request.set_vnode(leaf.vnode());
+    request.set_leaf(leaf.index());
+    request.set_ring_epoch(view.epoch);
+    for (const std::string &key :
+         view.merkle->keys(leaf.vnode(), leaf.index())) {
+      KeyVersion *version = request.add_versions();
+      version->set_key(key);
+      version->set_timestamp(store->read_shared(key).second);
+    }
+
+    SyncRangeResponse reply;
+    if (!view.peer(peer)->sync_range(request, &reply).ok())
+      return false;
+
+    std::vector<LogRecord> records;
+    for (const KeyValue &entry : reply.newer())
+      records.push_back({entry.key(),
+                         std::make_shared<const std::string>(entry.val()),
+                         entry.timestamp()});
+    if (!records.empty())
+      write_batch(records);
+    *pulled += records.size();
+
+    for (int first = 0; first < reply.wanted_size();
+         first += REPAIR_BATCH_SIZE) {
+      int last = std::min(reply.wanted_size(), first + (int)REPAIR_BATCH_SIZE);
+
+      MultiPutRequest batch;
+      batch.set_sender_id(self_address);
+      for (int i = first; i < last; ++i) {
+        // Tombstones go out with their own timestamp. A key that is gone
+        // since the peer asked for it (purged or evicted) has nothing to
+        // send, and a version of -1 would only be stored as an empty value.
+        Ref_TS local_value = store->read_shared(reply.wanted(i));
+        if (local_value.second < 0)
+          continue;
+        KeyValue *entry = batch.add_entries();
+        entry->set_key(reply.wanted(i));
+        entry->set_val(*local_value.first);
+        entry->set_timestamp(local_value.second);
+      }
+      int batch_size = batch.entries_size();
+      if (batch_size == 0)
+        continue;
+
+      std::promise<bool> result;
+      view.peer(peer)->multi_put_async(
+          std::move(batch), [&result](bool ok, std::vector<bool>) {
+            result.set_value(ok);
+          });
+      if (!result.get_future().get())
+        return false;
+      *pushed += batch_size;
+    }
+    return true;
+  }
+
+  /*
+   * Picks the newest version among our own read and the replicas' digests
+   * and answers the Get with it. The value is only fetched from a replica
+   * if that replica is newer and its digest does not match what we hold.
+   * Replicas that answered with an older version are repaired afterwards.
+   */
+  void resolve_read(std::shared_ptr<const ClusterView> view,
+                    const std::string &key, const Ref_TS &local_value,
+                    const std::vector<ReplicaVersion> &responses,
+                    GetResponse *reply, Done done, RawMessages *raw) {
+    const ReplicaVersion *newest = nullptr;
+    for (const ReplicaVersion &version : responses) {
+      if (version.timestamp > local_value.second &&
+          (!newest || version.timestamp > newest->timestamp))
+        newest = &version;
+    }
+
+    int64_t winner_ts = newest ? newest->timestamp : local_value.second;
+    std::vector<std::string> stale;
+    for (const ReplicaVersion &version : responses) {
+      if (version.timestamp < winner_ts)
+        stale.push_back(version.address);
+    }
+
+    auto answer = [this, view, key, reply, done, stale, local_value,
+                   raw](const Ref_TS &winner) {
+      // Deleted and expired keys read as missing, the versions that say
+      // so are still repaired below
+      StoredValue stored;
+      if (winner.first)
+        stored = DecodeValue(*winner.first);
+      if (winner.second < 0 || !stored.live(WallClockMicros())) {
+        LOG_DEBUG("Server", "No value found for key: {}", key);
+        reply->set_timestamp(-1);
+        reply->set_operation_success(false);
+        reply_value(reply, nullptr, raw);
+      } else {
+        reply->set_timestamp(winner.second);
+        reply->set_operation_success(true);
+        reply_value(reply, winner.first, raw, stored.offset);
+      }
+      done(Status::OK);
+
+      // The reply is gone from here on
+      if (winner.second > local_value.second)
+        write(key, winner.first, winner.second);
+      read_repair(*view, key, winner, stale);
+    };
+
+    if (!newest)
+      return answer(local_value);
+
+    // Same bytes under a newer timestamp, no need to fetch them
+    if (local_value.second >= 0 &&
+        newest->digest == murmur64(*local_value.first))
+      return answer({local_value.first, newest->timestamp});
+
+    GetRequest fetch;
+    fetch.set_key(key);
+    fetch.set_sender_id(self_address);
+    fetch.set_quorum_size(1);
+    int64_t expected = newest->timestamp;
+
+    view->peer(newest->address)->get_async(
+        std::move(fetch), [answer, local_value,
+                           expected](bool ok, const GetResponse &fetched) {
+          if (ok && fetched.timestamp() >= expected)
+            answer({std::make_shared<const std::string>(fetched.val()),
+                    fetched.timestamp()});
+          else
+            answer(local_value);
+        });
+  }
+
+  /*
+   * Pushes the version a read settled on to replicas that returned an
+   * older one. Fire and forget, anything missed is left to anti-entropy.
+   */
+  void read_repair(const ClusterView &view, const std::string &key,
+                   const Ref_TS &winner,
+                   const std::vector<std::string> &stale) {
+    if (winner.second < 0)
+      return;
+
+    for (const std::string &address : stale) {
+      LOG_DEBUG("ReadRepair", "Pushing key: {} to {}", key, address);
+      metrics.read_repairs.add();
+
+      PutRequest repair;
+      repair.set_key(key);
+      repair.set_sender_id(self_address);
+      repair.set_timestamp(winner.second);
+      view.peer(address)->put_async(
+          SerializeWithValue(repair, PutRequest::kValFieldNumber,
+                             winner.first),
+          [](bool ok, bool success) {});
+    }
+  }
+
+  /*
+   * Whether the failure detector considers a peer alive
+   */
+  bool is_alive(const std::string &address) {
+    return membership->is_alive(address);
+  }
+
+  /*
+   * Counts the number of live peers, excluding itself
+   */
+  int live_node_count() { return membership->live_count(); }
+
+  /*
+   * Sets the value of a Get reply to value from offset on. A raw call
+   * sends the stored buffer itself instead of a copy, so the rest of the
+   * reply must be filled in before this is called.
+   */
+  void reply_value(GetResponse *reply, const ValueRef &value,
+                   RawMessages *raw, size_t offset = 0) {
+    if (raw) {
+      raw->response = SerializeWithValue(
+          *reply, GetResponse::kValFieldNumber, value, offset);
+      raw->has_response = true;
+    } else {
+      reply->set_val(value ? value->substr(offset) : "");
+    }
+  }
+
+  /*
+   * Hands off a request to owner node.
+   *
+   * A client request is passed on unchanged, so a raw call relays the bytes
+   * it received and sends back the owner's reply without parsing either.
+   */
+  void forward_put_to_owner(const PutRequest *request, PutResponse *reply,
+                            Client *client, Done done, RawMessages *raw) {
+    client->call_raw_async(
+        Client::PUT_METHOD, raw ? raw->request : Serialize(*request),
+        [reply, done, raw](Status status, const grpc::ByteBuffer &response) {
+          if (status.ok() && raw) {
+            raw->response = response;
+            raw->has_response = true;
+          } else if (!status.ok() || !Parse(response, reply)) {
+            reply->set_operation_success(false);
+          }
+          done(Status::OK);
+        });
+  }
+
+  /*
+   * Get on a node that does not own the key, answered from the hot key
+   * cache if it can be. A miss on a key hot enough to be cached is sent
+   * to the owner as a new request naming us as the holder of the reply,
+   * other misses are relayed as they came.
+   */
+  void cached_get(const GetRequest *request, GetResponse *reply,
+                  Client *client, Done done, RawMessages *raw) {
+    grpc::ByteBuffer cached;
+    if (hot_cache->lookup(request->key(), request->quorum_size(), &cached)) {
+      if (raw) {
+        raw->response = cached;
+        raw->has_response = true;
+      } else if (!Parse(cached, reply)) {
+        reply->set_timestamp(-1);
+      }
+      return done(Status::OK);
+    }
+    if (!hot_cache->admits(request->key()))
+      return forward_get_to_owner(request, reply, client, done, raw);
+
+    GetRequest owner_request = *request;
+    owner_request.set_cache_holder(self_address);
+    owner_request.set_cache_ms(hot_cache->staleness().count());
+    client->call_raw_async(
+        Client::GET_METHOD, Serialize(owner_request),
+        [this, key = request->key(), quorum = request->quorum_size(), reply,
+         done, raw](Status status, const grpc::ByteBuffer &response) {
+          if (!status.ok() || !Parse(response, reply)) {
+            reply->Clear();
+            reply->set_timestamp(-1);
+            return done(Status::OK);
+          }
+          if (response.Length() <= HOT_CACHE_MAX_REPLY)
+            hot_cache->fill(key, quorum, reply->timestamp(), response);
+          if (raw) {
+            raw->response = response;
+            raw->has_response = true;
+          }
+          done(Status::OK);
+        });
+  }
+
+  void forward_get_to_owner(const GetRequest *request, GetResponse *reply,
+                            Client *client, Done done, RawMessages *raw) {
+    client->call_raw_async(
+        Client::GET_METHOD, raw ? raw->request : Serialize(*request),
+        [reply, done, raw](Status status, const grpc::ByteBuffer &response) {
+          if (status.ok() && raw) {
+            raw->response = response;
+            raw->has_response = true;
+          } else if (!status.ok() || !Parse(response, reply)) {
+            reply->Clear();
+            reply->set_timestamp(-1);
+          }
+          done(Status::OK);
+        });
+  }
+
+  /*
+   * Requests one call of a unary method on a completion queue
+   */
+  template <typename Request, typename Response>
+  void listen_unary(int method, grpc::ServerCompletionQueue *cq,
+                    void (TinyServer::*handler)(const Request *, Response *,
+                                                Done)) {
+    AsyncCall<Request, Response>::listen(
+        [this, method](auto *ctx, auto *req, auto *responder, auto *cq,
+                       void *tag) {
+          RequestAsyncUnary(method, ctx, req, responder, cq, cq, tag);
+        },
+        [this, handler](const Request *req, Response *reply, Done done) {
+          (this->*handler)(req, reply, done);
+        },
+        cq);
+  }
+
+  /*
+   * Same for a method marked raw, whose handler also gets the call's bytes
+   */
+  template <typename Request, typename Response>
+  void listen_raw(int method, grpc::ServerCompletionQueue *cq,
+                  void (TinyServer::*handler)(const Request *, Response *,
+                                              Done, RawMessages *)) {
+    RawAsyncCall<Request, Response>::listen(
+        [this, method](auto *ctx, auto *req, auto *responder, auto *cq,
+                       void *tag) {
+          RequestAsyncUnary(method, ctx, req, responder, cq, cq, tag);
+        },
+        [this, handler](const Request *req, Response *reply, Done done,
+                        RawMessages *raw) {
+          (this->*handler)(req, reply, done, raw);
+        },
+        cq);
+  }
+
+  /*
+   * Runs a handler and blocks the calling gRPC thread until it is done
+   */
+  Status wait_for(std::function<void(Done)> handler) {
+    std::promise<Status> result;
+    handler([&result](Status status) { result.set_value(status); });
+    return result.get_future().get();
+  }
+};
+
+/*
+ * Polls one completion queue, pinned to a single core
+ */
+void PollCompletionQueue(grpc::ServerCompletionQueue *cq, int core) {
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(core % std::max(1u, std::thread::hardware_concurrency()), &cpuset);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+  void *tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    static_cast<AsyncTag *>(tag)->proceed(ok);
+  }
+}
+
+void RunServer(const ServerOptions &options) {
+  std::string server_address("0.0.0.0:" + options.port);
+  TinyServer service{options};
+
+  ServerBuilder builder;
+  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  builder.SetMaxReceiveMessageSize(options.peer.max_message_bytes);
+  if (options.peer.keepalive.count() > 0) {
+    // Accept the keepalive pings of idle peer connections
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+    builder.AddChannelArgument(
+        GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS,
+        static_cast<int>(options.peer.keepalive.count() / 2));
+  }
+  if (options.peer.window_bytes > 0) {
+    // Peers' replica writes are received under our window
+    builder.AddChannelArgument(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES,
+                               options.peer.window_bytes);
+    builder.AddChannelArgument(GRPC_ARG_HTTP2_BDP_PROBE, 0);
+  }
+
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> completion_queues;
+  if (options.async_mode) {
+    for (int i = 0; i < options.cq_threads; ++i)
+      completion_queues.push_back(builder.AddCompletionQueue());
+  }
+
+  std::unique_ptr<Server> server(builder.BuildAndStart());
+  LOG_INFO("Server", "Listening on {}", server_address);
+
+  std::vector<std::thread> cq_threads;
+  for (size_t i = 0; i < completion_queues.size(); ++i) {
+    // Several outstanding calls per queue absorb bursts of new requests
+    for (int j = 0; j < CALLS_PER_QUEUE; ++j)
+      service.listen(completion_queues[i].get());
+    cq_threads.emplace_back(PollCompletionQueue, completion_queues[i].get(),
+                            i);
+  }
+  if (options.async_mode) {
+    LOG_INFO("Server", "Serving async on {} completion queue threads",
+             cq_threads.size());
+  }
+
+  // Initialize heartbeat as a separate thread
+  std::thread gossip(&TinyServer::_gossip, &service);
+  std::thread handoff(&TinyServer::_hint_handoff, &service);
+  std::thread anti_entropy(&TinyServer::_anti_entropy, &service);
+  std::thread rebalance(&TinyServer::_rebalance, &service);
+  std::thread snapshot(&TinyServer::_snapshot, &service);
+  std::thread reaper(&TinyServer::_reap, &service);
+
+  // Only once we are listening, the new ring is pushed to us
+  if (!options.join.empty() && !service.join_cluster(options.join))
+    LOG_WARN("Server", "Could not join through {}, serving alone",
+             options.join);
+
+  server->Wait();
+  service.stop();
+
+  for (auto &cq : completion_queues)
+    cq->Shutdown();
+  for (auto &t : cq_threads)
+    t.join();
+
+  gossip.join();
+  handoff.join();
+  anti_entropy.join();
+  rebalance.join();
+  snapshot.join();
+  reaper.join();
+
+  LOG_INFO("Server", "Goodbye!");
+}
+
+void print_usage() {
+  std::cerr << "Usage: ./tinykv_server <port> [options]\n"
+            << "Options:\n"
+            << "  --async             serve the data path from completion "
+               "queues\n"
+            << "  --cq-threads <n>    completion queue threads for --async "
+               "(default: one per core)\n"
+            << "  --engine <name>     memory | lsm (default: memory)\n"
+            << "  --data-dir <dir>    directory for the write ahead log and "
+               "LSM tables (default: data)\n"
+            << "  --fsync <policy>    always | group | none (default: group)\n"
+            << "  --group-commit-us <n>  group commit interval (default: "
+               "500)\n"
+            << "  --no-wal            keep data in memory only\n"
+            << "  --snapshot-interval <s>  seconds between snapshots of the "
+               "store, 0 disables (default: 60)\n"
+            << "  --tombstone-grace <s>  seconds a deleted or expired key's "
+               "tombstone is kept before it is purged (default: 3600)\n"
+            << "  --memory-limit <MiB>  memory the memory engine may hold "
+               "before it evicts keys, 0 for no limit (default: 0)\n"
+            << "  --peer-compression <name>  none | deflate | gzip, for "
+               "messages between nodes (default: gzip)\n"
+            << "  --peer-channels <n> data connections to each peer, besides "
+               "the one for gossip (default: 2)\n"
+            << "  --peer-pick <name>  round-robin | least-loaded, how a data "
+               "connection is picked (default: least-loaded)\n"
+            << "  --peer-keepalive-ms <n>  keepalive ping interval on peer "
+               "connections, 0 disables (default: 10000)\n"
+            << "  --peer-window-kb <n>  HTTP/2 flow control window of peer "
+               "streams, 0 auto-tunes (default: 0)\n"
+            << "  --peer-deadline-ms <n>  deadline of requests to peers, 0 "
+               "for none (default: 0)\n"
+            << "  --max-message-mb <n>  largest message a node accepts "
+               "(default: 256)\n"
+            << "  --replicate-batch-us <n>  longest a replica write waits "
+               "to be batched with others, 0 sends each alone (default: "
+               "100)\n"
+            << "  --hot-cache-keys <n>  hot keys owned elsewhere whose "
+               "replies are cached, 0 disables (default: 0)\n"
+            << "  --hot-cache-ms <n>  longest a cached reply is served "
+               "(default: 100)\n"
+            << "  --rf <n>            replicas anti-entropy keeps in sync "
+               "(default: 3)\n"
+            << "  --anti-entropy-interval <s>  seconds between Merkle tree "
+               "exchanges, 0 disables (default: 30)\n"
+            << "  --repair-rate <n>   keys per second anti-entropy may move "
+               "(default: 10000)\n"
+            << "  --gossip-interval-ms <n>  failure detector protocol period "
+               "(default: 500)\n"
+            << "  --phi-threshold <x> suspicion level that suspects a silent "
+               "peer (default: 8)\n"
+            << "  --address <host:port>  address peers dial us on (default: "
+               "from the config, else localhost:<port>)\n"
+            << "  --join <address>    join a running cluster through one of "
+               "its nodes instead of reading the config\n"
+            << "  --rebalance-rate <n>  keys per second a ring change may "
+               "move (default: 20000)\n"
+            << "  --log-level <level> debug | info | warn | error (default: "
+               "info)\n";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    print_usage();
+    return 1;
+  }
+
+  ServerOptions options;
+  options.port = argv[1];
+
+  for (int i = 2; i < argc; ++i) {
+    std::string flag(argv[i]);
+    if (flag == "--async") {
+      options.async_mode = true;
+    } else if (flag == "--cq-threads" && i + 1 < argc) {
+      options.cq_threads = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--engine" && i + 1 < argc) {
+      options.engine = argv[++i];
+      if (options.engine != "memory" && options.engine != "lsm") {
+        print_usage();
+        return 1;
+      }
+    } else if (flag == "--data-dir" && i + 1 < argc) {
+      options.data_dir = argv[++i];
+    } else if (flag == "--fsync" && i + 1 < argc) {
+      options.sync_policy = ParseSyncPolicy(argv[++i]);
+    } else if (flag == "--group-commit-us" && i + 1 < argc) {
+      options.group_commit_us = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--no-wal") {
+      options.wal_enabled = false;
+    } else if (flag == "--snapshot-interval" && i + 1 < argc) {
+      options.snapshot_interval = std::max(0, std::stoi(argv[++i]));
+    } else if (flag == "--tombstone-grace" && i + 1 < argc) {
+      options.tombstone_grace = std::max(0, std::stoi(argv[++i]));
+    } else if (flag == "--memory-limit" && i + 1 < argc) {
+      options.memory_limit = std::max(0, std::stoi(argv[++i]));
+    } else if (flag == "--peer-compression" && i + 1 < argc) {
+      std::string name = argv[++i];
+      if (name == "none") {
+        options.peer.compression = GRPC_COMPRESS_NONE;
+      } else if (name == "deflate") {
+        options.peer.compression = GRPC_COMPRESS_DEFLATE;
+      } else if (name == "gzip") {
+        options.peer.compression = GRPC_COMPRESS_GZIP;
+      } else {
+        print_usage();
+        return 1;
+      }
+    } else if (flag == "--peer-channels" && i + 1 < argc) {
+      options.peer.channels = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--peer-pick" && i + 1 < argc) {
+      std::string name = argv[++i];
+      if (name == "round-robin") {
+        options.peer.pick = PeerPick::ROUND_ROBIN;
+      } else if (name == "least-loaded") {
+        options.peer.pick = PeerPick::LEAST_IN_FLIGHT;
+      } else {
+        print_usage();
+        return 1;
+      }
+    } else if (flag == "--peer-keepalive-ms" && i + 1 < argc) {
+      options.peer.keepalive =
+          std::chrono::milliseconds(std::max(0, std::stoi(argv[++i])));
+    } else if (flag == "--peer-window-kb" && i + 1 < argc) {
+      options.peer.window_bytes = std::max(0, std::stoi(argv[++i])) * 1024;
+    } else if (flag == "--peer-deadline-ms" && i + 1 < argc) {
+      options.peer.deadline =
+          std::chrono::milliseconds(std::max(0, std::stoi(argv[++i])));
+    } else if (flag == "--max-message-mb" && i + 1 < argc) {
+      options.peer.max_message_bytes =
+          std::clamp(std::stoi(argv[++i]), 4, 2047) * 1024 * 1024;
+    } else if (flag == "--replicate-batch-us" && i + 1 < argc) {
+      options.replicate_batch_us = std::max(0, std::stoi(argv[++i]));
+    } else if (flag == "--hot-cache-keys" && i + 1 < argc) {
+      options.hot_cache_keys = std::max(0, std::stoi(argv[++i]));
+    } else if (flag == "--hot-cache-ms" && i + 1 < argc) {
+      options.hot_cache_ms = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--rf" && i + 1 < argc) {
+      options.replication_factor = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--anti-entropy-interval" && i + 1 < argc) {
+      options.anti_entropy_interval = std::max(0, std::stoi(argv[++i]));
+    } else if (flag == "--repair-rate" && i + 1 < argc) {
+      options.repair_rate = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--gossip-interval-ms" && i + 1 < argc) {
+      auto period = std::chrono::milliseconds(std::max(10, std::stoi(argv[++i])));
+      options.membership.period = period;
+      options.membership.probe_timeout =
+          std::min(options.membership.probe_timeout, period / 2);
+    } else if (flag == "--phi-threshold" && i + 1 < argc) {
+      options.membership.phi_threshold = std::max(1.0, std::stod(argv[++i]));
+    } else if (flag == "--address" && i + 1 < argc) {
+      options.address = argv[++i];
+    } else if (flag == "--join" && i + 1 < argc) {
+      options.join = argv[++i];
+    } else if (flag == "--rebalance-rate" && i + 1 < argc) {
+      options.rebalance_rate = std::max(1, std::stoi(argv[++i]));
+    } else if (flag == "--log-level" && i + 1 < argc) {
+      LogLevel level;
+      if (!Log::parse_level(argv[++i], &level)) {
+        print_usage();
+        return 1;
+      }
+      Log::set_level(level);
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+
+  RunServer(options);
   return 0;
 }
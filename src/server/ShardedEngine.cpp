@@ -0,0 +1,445 @@
+#include "ShardedEngine.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <queue>
+
+static const size_t INITIAL_BUCKETS = 16;
+// Buckets the eviction hand may look at per write. A write that cannot
+// free enough within them leaves the rest to the writes after it.
+static const size_t EVICTION_SCAN_LIMIT = 256;
+// Heap cost of a shared value beyond its bytes: the control block and
+// string made by make_shared, and the malloc headers of both allocations
+static const size_t SHARED_VALUE_OVERHEAD = 64;
+// Keys a scan reads from a shard beyond its even share of the batch
+static const size_t SCAN_SLICE_SLACK = 16;
+
+/*
+ * One key in a shard's table, followed in the same slot by the key's bytes
+ * and, for an inline value, the value's bytes
+ */
+struct ShardedEngine::Entry {
+  Entry *next;
+  int64_t timestamp;
+  ValueRef shared;     // the value if it is not inline
+  uint32_t hash;       // low bits of the key's hash
+  uint32_t key_size;
+  uint32_t value_size; // bytes of the inline value
+  std::atomic<uint8_t> referenced;
+
+  static size_t size_for(size_t key_size, size_t value_size) {
+    return sizeof(Entry) + key_size + value_size;
+  }
+
+  char *data() { return reinterpret_cast<char *>(this + 1); }
+  const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+
+  std::string_view key() const { return {data(), key_size}; }
+  std::string_view inline_value() const {
+    return {data() + key_size, value_size};
+  }
+  size_t size() const { return size_for(key_size, value_size); }
+
+  ValueRef value() const {
+    return shared ? shared
+                  : std::make_shared<const std::string>(inline_value());
+  }
+
+  // Lets the CLOCK hand know the key is in use
+  void touch() {
+    if (!referenced.load(std::memory_order_relaxed))
+      referenced.store(1, std::memory_order_relaxed);
+  }
+};
+
+static size_t SharedValueBytes(const ValueRef &value) {
+  return value ? value->capacity() + 1 + SHARED_VALUE_OVERHEAD : 0;
+}
+
+ShardedEngine::ShardedEngine(size_t n, size_t memory_limit) {
+  size_t shard_count = std::bit_ceil(std::max<size_t>(n, 1));
+  shards = std::make_unique<Shard[]>(shard_count);
+  shard_mask = shard_count - 1;
+  shard_limit = memory_limit / shard_count;
+  for (size_t i = 0; i < shard_count; ++i)
+    shards[i].buckets.assign(INITIAL_BUCKETS, nullptr);
+}
+
+ShardedEngine::~ShardedEngine() {
+  for (size_t i = 0; i <= shard_mask; ++i) {
+    for (Entry *head : shards[i].buckets) {
+      while (head) {
+        Entry *next = head->next;
+        free_entry(shards[i], head);
+        head = next;
+      }
+    }
+  }
+}
+
+ShardedEngine::HashedKey ShardedEngine::hash_key(std::string_view key) const {
+  return {key, std::hash<std::string_view>{}(key)};
+}
+
+ShardedEngine::Shard &ShardedEngine::shard_for(const HashedKey &key) {
+  // Use the high bits so the shard choice is independent of the bucket
+  // index, which comes from the low bits.
+  return shards[(key.hash >> 48) & shard_mask];
+}
+
+/*
+ * Takes a shard lock, timing the wait only if it is already held
+ */
+template <typename Lock>
+void ShardedEngine::acquire(Shard &shard, Lock &lock) {
+  if (lock.try_lock())
+    return;
+
+  auto started = std::chrono::steady_clock::now();
+  lock.lock();
+  auto waited = std::chrono::steady_clock::now() - started;
+  shard.contended.fetch_add(1, std::memory_order_relaxed);
+  shard.wait_ns.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count(),
+      std::memory_order_relaxed);
+}
+
+/*
+ * The link that points at key's entry, or the null link ending its bucket
+ */
+ShardedEngine::Entry **ShardedEngine::find(Shard &shard, const HashedKey &key) {
+  Entry **link = &shard.buckets[key.hash & (shard.buckets.size() - 1)];
+  while (*link && ((*link)->hash != static_cast<uint32_t>(key.hash) ||
+                   (*link)->key() != key.key))
+    link = &(*link)->next;
+  return link;
+}
+
+/*
+ * Builds an entry holding either the shared value or a copy of inline_val
+ */
+ShardedEngine::Entry *ShardedEngine::make_entry(Shard &shard,
+                                                const HashedKey &key,
+                                                const ValueRef &val,
+                                                std::string_view inline_val,
+                                                int64_t timestamp) {
+  size_t value_size = val ? 0 : inline_val.size();
+  void *slot = shard.slab.allocate(Entry::size_for(key.key.size(), value_size));
+  Entry *entry = new (slot) Entry{nullptr,
+                                  timestamp,
+                                  val,
+                                  static_cast<uint32_t>(key.hash),
+                                  static_cast<uint32_t>(key.key.size()),
+                                  static_cast<uint32_t>(value_size),
+                                  {1}};
+  std::memcpy(entry->data(), key.key.data(), key.key.size());
+  if (value_size > 0)
+    std::memcpy(entry->data() + key.key.size(), inline_val.data(), value_size);
+  shard.value_bytes += SharedValueBytes(val);
+  return entry;
+}
+
+/*
+ * Returns an entry's slot to the slab. Its shared value is handed back so
+ * the caller can drop it once the lock is released.
+ */
+ValueRef ShardedEngine::free_entry(Shard &shard, Entry *entry) {
+  ValueRef value = std::move(entry->shared);
+  shard.value_bytes -= SharedValueBytes(value);
+  size_t size = entry->size();
+  entry->~Entry();
+  shard.slab.deallocate(entry, size);
+  return value;
+}
+
+/*
+ * Doubles a shard's buckets once it holds as many keys as buckets
+ */
+void ShardedEngine::grow(Shard &shard) {
+  std::vector<Entry *> buckets(shard.buckets.size() * 2, nullptr);
+  size_t mask = buckets.size() - 1;
+  for (Entry *head : shard.buckets) {
+    while (head) {
+      Entry *next = head->next;
+      Entry *&bucket = buckets[head->hash & mask];
+      head->next = bucket;
+      bucket = head;
+      head = next;
+    }
+  }
+  shard.buckets.swap(buckets);
+}
+
+/*
+ * Sweeps the CLOCK hand until the shard is back under its limit, or it
+ * has looked at EVICTION_SCAN_LIMIT buckets
+ */
+void ShardedEngine::evict(Shard &shard, const Entry *keep,
+                          std::vector<ValueRef> *released) {
+  for (size_t scanned = 0;
+       shard.bytes() > shard_limit && scanned < EVICTION_SCAN_LIMIT;
+       ++scanned) {
+    Entry **link =
+        &shard.buckets[shard.clock_hand++ & (shard.buckets.size() - 1)];
+    while (*link) {
+      Entry *entry = *link;
+      if (entry == keep || entry->referenced.load(std::memory_order_relaxed)) {
+        entry->referenced.store(0, std::memory_order_relaxed);
+        link = &entry->next;
+        continue;
+      }
+      *link = entry->next;
+      shard.count--;
+      shard.index.remove(entry->key());
+      released->push_back(free_entry(shard, entry));
+      shard.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+bool ShardedEngine::put(const HashedKey &key, const ValueRef &val,
+                        std::string_view inline_val, int64_t timestamp,
+                        int64_t *replaced) {
+  Shard &shard = shard_for(key);
+  std::vector<ValueRef> released; // freed after the lock is released
+  std::unique_lock lock(shard.mutex, std::defer_lock);
+  acquire(shard, lock);
+
+  Entry **link = find(shard, key);
+  Entry *entry;
+  if (*link) {
+    Entry *old = *link;
+    if (timestamp <= old->timestamp)
+      return false;
+    if (replaced)
+      *replaced = old->timestamp;
+
+    entry = make_entry(shard, key, val, inline_val, timestamp);
+    entry->next = old->next;
+    *link = entry;
+    released.push_back(free_entry(shard, old));
+  } else {
+    if (replaced)
+      *replaced = -1;
+    if (shard.count >= shard.buckets.size())
+      grow(shard);
+
+    entry = make_entry(shard, key, val, inline_val, timestamp);
+    Entry *&bucket = shard.buckets[key.hash & (shard.buckets.size() - 1)];
+    entry->next = bucket;
+    bucket = entry;
+    shard.count++;
+    shard.index.insert(key.key);
+  }
+
+  if (shard_limit > 0 && shard.bytes() > shard_limit)
+    evict(shard, entry, &released);
+  return true;
+}
+
+bool ShardedEngine::write(const std::string &key, const std::string &val,
+                          int64_t timestamp, int64_t *replaced) {
+  // A large value is copied before taking the lock, a stale write wastes
+  // the copy
+  if (val.size() <= INLINE_VALUE_LIMIT)
+    return put(hash_key(key), nullptr, val, timestamp, replaced);
+  return put(hash_key(key), std::make_shared<const std::string>(val), {},
+             timestamp, replaced);
+}
+
+bool ShardedEngine::write_shared(const std::string &key, const ValueRef &val,
+                                 int64_t timestamp, int64_t *replaced) {
+  if (val->size() <= INLINE_VALUE_LIMIT)
+    return put(hash_key(key), nullptr, *val, timestamp, replaced);
+  return put(hash_key(key), val, {}, timestamp, replaced);
+}
+
+Val_TS ShardedEngine::read(const std::string &key) {
+  HashedKey hashed = hash_key(key);
+  Shard &shard = shard_for(hashed);
+  std::shared_lock lock(shard.mutex, std::defer_lock);
+  acquire(shard, lock);
+
+  Entry *entry = *find(shard, hashed);
+  if (!entry)
+    return {"", -1};
+  entry->touch();
+  return {entry->shared ? *entry->shared
+                        : std::string(entry->inline_value()),
+          entry->timestamp};
+}
+
+Ref_TS ShardedEngine::read_shared(const std::string &key) {
+  HashedKey hashed = hash_key(key);
+  Shard &shard = shard_for(hashed);
+  std::shared_lock lock(shard.mutex, std::defer_lock);
+  acquire(shard, lock);
+
+  Entry *entry = *find(shard, hashed);
+  if (!entry)
+    return {nullptr, -1};
+  entry->touch();
+
+  // A shared value only has its reference count touched under the lock,
+  // an inline one is small enough to copy
+  return {entry->value(), entry->timestamp};
+}
+
+bool ShardedEngine::replace(const std::string &key, int64_t timestamp,
+                            const ValueRef &val) {
+  HashedKey hashed = hash_key(key);
+  Shard &shard = shard_for(hashed);
+  ValueRef overwritten;
+  std::unique_lock lock(shard.mutex, std::defer_lock);
+  acquire(shard, lock);
+
+  Entry **link = find(shard, hashed);
+  Entry *old = *link;
+  if (!old || old->timestamp != timestamp)
+    return false;
+
+  bool small = val->size() <= INLINE_VALUE_LIMIT;
+  Entry *entry = make_entry(shard, hashed, small ? ValueRef() : val,
+                            small ? std::string_view(*val) : "", timestamp);
+  entry->next = old->next;
+  *link = entry;
+  overwritten = free_entry(shard, old);
+  return true;
+}
+
+bool ShardedEngine::erase(const std::string &key, int64_t timestamp) {
+  HashedKey hashed = hash_key(key);
+  Shard &shard = shard_for(hashed);
+  ValueRef overwritten;
+  std::unique_lock lock(shard.mutex, std::defer_lock);
+  acquire(shard, lock);
+
+  Entry **link = find(shard, hashed);
+  Entry *entry = *link;
+  if (!entry || entry->timestamp != timestamp)
+    return false;
+  *link = entry->next;
+  shard.count--;
+  shard.index.remove(hashed.key);
+  overwritten = free_entry(shard, entry);
+  return true;
+}
+
+size_t ShardedEngine::size() {
+  size_t total = 0;
+  for (size_t i = 0; i <= shard_mask; ++i) {
+    std::shared_lock lock(shards[i].mutex);
+    total += shards[i].count;
+  }
+  return total;
+}
+
+bool ShardedEngine::freeze(const std::function<void()> &fn) {
+  // Shared locks on every shard keep writers out and let readers in
+  std::vector<std::shared_lock<std::shared_mutex>> locks;
+  locks.reserve(shard_mask + 1);
+  for (size_t i = 0; i <= shard_mask; ++i)
+    locks.emplace_back(shards[i].mutex);
+  fn();
+  return true;
+}
+
+bool ShardedEngine::visit_unlocked(const VisitFunc &visit) {
+  for (size_t i = 0; i <= shard_mask; ++i) {
+    for (const Entry *entry : shards[i].buckets) {
+      for (; entry; entry = entry->next)
+        visit(std::string(entry->key()), entry->value(), entry->timestamp);
+    }
+  }
+  return true;
+}
+
+/*
+ * Reads a slice of every shard's index from start on, then merges them.
+ * A shard with keys left past its slice bounds the batch at its last key,
+ * since its next key could sort before keys from other shards. A scan
+ * leaves reference bits alone, so it does not keep keys from eviction.
+ */
+bool ShardedEngine::scan(const std::string &start, const std::string &end,
+                         size_t limit, std::vector<ScanEntry> *out) {
+  if (limit == 0)
+    return true;
+
+  size_t slice = std::min(limit, limit / (shard_mask + 1) + SCAN_SLICE_SLACK);
+  std::vector<std::vector<ScanEntry>> slices(shard_mask + 1);
+  std::string bound;
+  bool bounded = false;
+
+  for (size_t i = 0; i <= shard_mask; ++i) {
+    Shard &shard = shards[i];
+    bool truncated = false;
+    {
+      std::shared_lock lock(shard.mutex, std::defer_lock);
+      acquire(shard, lock);
+      for (KeyIndex::Iterator it = shard.index.seek(start);
+           it.valid() && (end.empty() || it.key() < end); it.next()) {
+        if (slices[i].size() == slice) {
+          truncated = true;
+          break;
+        }
+        const Entry *entry = *find(shard, hash_key(it.key()));
+        slices[i].push_back(
+            {std::string(it.key()), entry->value(), entry->timestamp});
+      }
+    }
+    if (truncated && (!bounded || slices[i].back().key < bound)) {
+      bound = slices[i].back().key;
+      bounded = true;
+    }
+  }
+
+  // Every key lives in one shard, so the slices never share a key
+  using Cursor = std::pair<size_t, size_t>; // slice, position
+  auto later = [&slices](const Cursor &a, const Cursor &b) {
+    return slices[a.first][a.second].key > slices[b.first][b.second].key;
+  };
+  std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heap(
+      later);
+  for (size_t i = 0; i <= shard_mask; ++i) {
+    if (!slices[i].empty())
+      heap.push({i, 0});
+  }
+
+  for (size_t taken = 0; taken < limit && !heap.empty(); ++taken) {
+    auto [i, position] = heap.top();
+    heap.pop();
+    ScanEntry &entry = slices[i][position];
+    if (bounded && entry.key > bound)
+      break;
+    out->push_back(std::move(entry));
+    if (position + 1 < slices[i].size())
+      heap.push({i, position + 1});
+  }
+  return true;
+}
+
+StorageEngine::LockStats ShardedEngine::lock_stats() {
+  LockStats stats;
+  for (size_t i = 0; i <= shard_mask; ++i) {
+    stats.contended += shards[i].contended.load(std::memory_order_relaxed);
+    stats.wait_ns += shards[i].wait_ns.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+StorageEngine::MemoryStats ShardedEngine::memory_stats() {
+  MemoryStats stats;
+  for (size_t i = 0; i <= shard_mask; ++i) {
+    Shard &shard = shards[i];
+    std::shared_lock lock(shard.mutex);
+    stats.bytes += shard.bytes();
+    stats.reserved += shard.bytes() - shard.slab.used_bytes() +
+                      shard.slab.reserved_bytes();
+    stats.evictions += shard.evictions.load(std::memory_order_relaxed);
+  }
+  stats.limit = shard_limit * (shard_mask + 1);
+  return stats;
+}
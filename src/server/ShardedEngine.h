@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+#include "KeyIndex.h"
+#include "SlabAllocator.h"
+#include "StorageEngine.h"
+
+/*
+ * Lock striped hash table.
+ *
+ * Keys are spread over a power of two number of shards, each with its own
+ * reader-writer lock, so reads on any shard and writes on different shards
+ * run in parallel. Shards are padded to a cache line to avoid false sharing
+ * between neighbouring locks.
+ *
+ * Each shard is a chained hash table whose entries come from the shard's
+ * slab allocator. An entry holds its key inline, and a value of up to
+ * INLINE_VALUE_LIMIT bytes as well, so a small key value pair is a single
+ * slot with no heap allocation of its own. Reading an inline value copies
+ * it out. Larger values are kept as the shared buffer the write brought
+ * and handed out by reference.
+ *
+ * With a memory limit, a write that takes its shard over its share of the
+ * limit evicts keys by CLOCK: a hand sweeps the shard's buckets, sparing
+ * and clearing entries read or written since it last passed, and evicting
+ * the others. A key is hashed once per operation.
+ *
+ * Every shard also keeps its keys in a sorted KeyIndex. A scan reads a
+ * slice of each shard's index and merges the slices.
+ */
+class ShardedEngine : public StorageEngine {
+public:
+  static constexpr size_t INLINE_VALUE_LIMIT = 64;
+
+  /*
+   * memory_limit is in bytes, 0 for no limit
+   */
+  ShardedEngine(size_t n = 64, size_t memory_limit = 0);
+  ~ShardedEngine();
+
+  bool write(const std::string &key, const std::string &val,
+             int64_t timestamp, int64_t *replaced = nullptr) override;
+
+  Val_TS read(const std::string &key) override;
+
+  bool write_shared(const std::string &key, const ValueRef &val,
+                    int64_t timestamp, int64_t *replaced = nullptr) override;
+
+  Ref_TS read_shared(const std::string &key) override;
+
+  bool replace(const std::string &key, int64_t timestamp,
+               const ValueRef &val) override;
+
+  bool erase(const std::string &key, int64_t timestamp) override;
+
+  size_t size() override;
+
+  bool freeze(const std::function<void()> &fn) override;
+
+  bool visit_unlocked(const VisitFunc &visit) override;
+
+  bool scan(const std::string &start, const std::string &end, size_t limit,
+            std::vector<ScanEntry> *out) override;
+
+  LockStats lock_stats() override;
+
+  MemoryStats memory_stats() override;
+
+private:
+  struct Entry;
+
+  // A key together with its already computed hash
+  struct HashedKey {
+    std::string_view key;
+    size_t hash;
+  };
+
+  struct alignas(64) Shard {
+    std::shared_mutex mutex;
+    std::vector<Entry *> buckets;
+    size_t count = 0;
+    SlabAllocator slab;
+    KeyIndex index{slab};
+    size_t value_bytes = 0; // values kept out of line
+    size_t clock_hand = 0;  // next bucket the eviction sweep looks at
+    std::atomic<uint64_t> evictions{0};
+    // Only updated when the lock was taken, uncontended calls never touch
+    // the clock
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> wait_ns{0};
+
+    size_t bytes() const {
+      return slab.used_bytes() + value_bytes +
+             buckets.capacity() * sizeof(Entry *);
+    }
+  };
+
+  std::unique_ptr<Shard[]> shards;
+  size_t shard_mask;
+  size_t shard_limit; // bytes per shard, 0 for no limit
+
+  HashedKey hash_key(std::string_view key) const;
+  Shard &shard_for(const HashedKey &key);
+
+  Entry **find(Shard &shard, const HashedKey &key);
+  Entry *make_entry(Shard &shard, const HashedKey &key, const ValueRef &val,
+                    std::string_view inline_val, int64_t timestamp);
+  ValueRef free_entry(Shard &shard, Entry *entry);
+  bool put(const HashedKey &key, const ValueRef &val,
+           std::string_view inline_val, int64_t timestamp,
+           int64_t *replaced);
+  void grow(Shard &shard);
+  void evict(Shard &shard, const Entry *keep,
+             std::vector<ValueRef> *released);
+
+  template <typename Lock> static void acquire(Shard &shard, Lock &lock);
+};
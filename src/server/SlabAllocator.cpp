@@ -0,0 +1,50 @@
+#include "SlabAllocator.h"
+#include <new>
+
+SlabAllocator::~SlabAllocator() {
+  for (char *page : pages)
+    ::operator delete(page);
+}
+
+void *SlabAllocator::allocate(size_t n) {
+  size_t size = slot_size(n);
+  used += size;
+  if (size > MAX_SLOT) {
+    reserved += size;
+    return ::operator new(size);
+  }
+
+  SizeClass &c = classes[size / GRANULE - 1];
+  if (c.free) {
+    FreeSlot *slot = c.free;
+    c.free = slot->next;
+    return slot;
+  }
+
+  if (c.next + size > c.end) {
+    // The tail of the previous page that no slot fits in is left unused
+    char *page = static_cast<char *>(::operator new(PAGE_SIZE));
+    pages.push_back(page);
+    reserved += PAGE_SIZE;
+    c.next = page;
+    c.end = page + PAGE_SIZE;
+  }
+  void *slot = c.next;
+  c.next += size;
+  return slot;
+}
+
+void SlabAllocator::deallocate(void *p, size_t n) {
+  size_t size = slot_size(n);
+  used -= size;
+  if (size > MAX_SLOT) {
+    reserved -= size;
+    ::operator delete(p);
+    return;
+  }
+
+  SizeClass &c = classes[size / GRANULE - 1];
+  FreeSlot *slot = static_cast<FreeSlot *>(p);
+  slot->next = c.free;
+  c.free = slot;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Allocator for many small objects of varying size.
+ *
+ * Sizes are rounded up to a multiple of GRANULE, and each such class is
+ * carved out of PAGE_SIZE pages with a bump pointer. Freed slots go on a
+ * per class free list and are handed out again before the page grows, so
+ * an object costs its rounded size and nothing else: no malloc header and
+ * no per-object heap fragmentation. Pages are only returned on
+ * destruction. Objects larger than MAX_SLOT come from the heap.
+ *
+ * Not thread safe, every storage shard owns one and uses it under its
+ * lock.
+ */
+class SlabAllocator {
+public:
+  static constexpr size_t GRANULE = 16;
+  static constexpr size_t MAX_SLOT = 512;
+  static constexpr size_t PAGE_SIZE = 32 * 1024;
+
+  SlabAllocator() = default;
+  SlabAllocator(const SlabAllocator &) = delete;
+  SlabAllocator &operator=(const SlabAllocator &) = delete;
+  ~SlabAllocator();
+
+  /*
+   * Bytes an allocation of n really takes
+   */
+  static size_t slot_size(size_t n) {
+    return n > MAX_SLOT ? n : (n + GRANULE - 1) / GRANULE * GRANULE;
+  }
+
+  void *allocate(size_t n);
+
+  /*
+   * n must be the size the slot was allocated with
+   */
+  void deallocate(void *p, size_t n);
+
+  size_t used_bytes() const { return used; }
+
+  /*
+   * Bytes taken from the system, including free slots
+   */
+  size_t reserved_bytes() const { return reserved; }
+
+private:
+  static constexpr size_t CLASSES = MAX_SLOT / GRANULE;
+
+  struct FreeSlot {
+    FreeSlot *next;
+  };
+
+  struct SizeClass {
+    FreeSlot *free = nullptr;
+    char *next = nullptr; // unused part of the newest page
+    char *end = nullptr;
+  };
+
+  std::array<SizeClass, CLASSES> classes;
+  std::vector<char *> pages;
+  size_t used = 0;
+  size_t reserved = 0;
+};
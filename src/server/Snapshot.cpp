@@ -0,0 +1,307 @@
+#include "Snapshot.h"
+#include "Checksum.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+static const char MAGIC[8] = {'T', 'K', 'V', 'S', 'N', 'A', 'P', '1'};
+static const size_t HEADER_SIZE = sizeof(MAGIC) + 2 * sizeof(uint64_t);
+static const size_t BLOCK_HEADER_SIZE = 3 * sizeof(uint32_t);
+static const size_t INDEX_ENTRY_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+static const size_t FOOTER_SIZE = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+static const size_t BLOCK_SIZE = 1 << 20;
+
+namespace {
+
+// Byte by byte, so the file reads the same on any machine
+template <typename T> void put(std::string *out, T value) {
+  auto bits = static_cast<std::make_unsigned_t<T>>(value);
+  for (size_t i = 0; i < sizeof(T); ++i)
+    out->push_back(static_cast<char>(bits >> (8 * i)));
+}
+
+template <typename T> T get(const char *p) {
+  std::make_unsigned_t<T> bits = 0;
+  for (size_t i = 0; i < sizeof(T); ++i)
+    bits |= std::make_unsigned_t<T>(static_cast<uint8_t>(p[i])) << (8 * i);
+  return static_cast<T>(bits);
+}
+
+void put_varint(std::string *out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+bool get_varint(const char **p, const char *end, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*(*p)++);
+    *value |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool write_all(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+/*
+ * Streams blocks to a file and remembers where each one went
+ */
+class BlockWriter {
+public:
+  BlockWriter(int fd, uint64_t offset) : fd(fd), offset(offset) {
+    payload.reserve(BLOCK_SIZE + 4096);
+  }
+
+  bool add(const std::string &key, const std::string &val,
+           int64_t timestamp) {
+    put_varint(&payload, key.size());
+    put_varint(&payload, val.size());
+    put(&payload, timestamp);
+    payload += key;
+    payload += val;
+    block_entries++;
+    total++;
+    return payload.size() < BLOCK_SIZE || finish_block();
+  }
+
+  bool finish_block() {
+    if (block_entries == 0)
+      return true;
+
+    std::string header;
+    put(&header, crc32c(payload.data(), payload.size()));
+    put(&header, static_cast<uint32_t>(payload.size()));
+    put(&header, block_entries);
+    if (!write_all(fd, header) || !write_all(fd, payload))
+      return false;
+
+    put(&index, offset);
+    put(&index, block_entries);
+    blocks++;
+    offset += header.size() + payload.size();
+    payload.clear();
+    block_entries = 0;
+    return true;
+  }
+
+  int fd;
+  uint64_t offset;
+  std::string payload;
+  uint32_t block_entries = 0;
+  std::string index;
+  uint32_t blocks = 0;
+  uint64_t total = 0;
+};
+
+} // namespace
+
+bool WriteSnapshot(const std::string &path, StorageEngine &store,
+                   uint64_t wal_offset) {
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  // The entry count is only known at the end, it is patched in then
+  std::string header(MAGIC, sizeof(MAGIC));
+  put(&header, wal_offset);
+  put(&header, uint64_t(0));
+
+  BlockWriter writer(fd, header.size());
+  bool ok = write_all(fd, header);
+  if (ok) {
+    bool complete =
+        store.visit_unlocked([&](const std::string &key, const ValueRef &val,
+                                 int64_t timestamp) {
+          if (ok)
+            ok = writer.add(key, *val, timestamp);
+        });
+    ok = ok && complete;
+  }
+  ok = ok && writer.finish_block();
+
+  if (ok) {
+    header.resize(sizeof(MAGIC) + sizeof(uint64_t));
+    put(&header, writer.total);
+    uint32_t crc = crc32c(header.data(), header.size());
+    crc = crc32c(writer.index.data(), writer.index.size(), crc);
+
+    std::string footer;
+    put(&footer, writer.offset);
+    put(&footer, writer.blocks);
+    put(&footer, crc);
+    ok = write_all(fd, writer.index) && write_all(fd, footer) &&
+         pwrite(fd, header.data(), header.size(), 0) ==
+             static_cast<ssize_t>(header.size()) &&
+         fsync(fd) == 0;
+  }
+  close(fd);
+
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  // Make the rename itself durable
+  std::string dir = std::filesystem::path(path).parent_path().string();
+  int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
+
+pid_t ForkSnapshot(const std::string &path, StorageEngine &store,
+                   const std::function<uint64_t()> &wal_offset) {
+  pid_t child = -1;
+  bool frozen = store.freeze([&] {
+    uint64_t offset = wal_offset();
+    child = fork();
+    // The child owns a private copy of the store and only ever reads it.
+    // It leaves without running destructors that would touch state other
+    // threads of the parent were in the middle of.
+    if (child == 0)
+      _exit(WriteSnapshot(path, store, offset) ? 0 : 1);
+  });
+  return frozen ? child : -1;
+}
+
+bool WaitSnapshot(pid_t child) {
+  int status;
+  while (waitpid(child, &status, 0) < 0) {
+    if (errno != EINTR)
+      return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Parses one block, false if it fails its checksum or is malformed
+ */
+static bool LoadBlock(const char *data, size_t size, uint64_t offset,
+                      uint32_t entries, const SnapshotApply &apply) {
+  if (offset + BLOCK_HEADER_SIZE > size)
+    return false;
+  const char *header = data + offset;
+  uint32_t crc = get<uint32_t>(header);
+  uint32_t payload_len = get<uint32_t>(header + 4);
+  if (get<uint32_t>(header + 8) != entries ||
+      offset + BLOCK_HEADER_SIZE + payload_len > size)
+    return false;
+
+  const char *p = header + BLOCK_HEADER_SIZE;
+  const char *end = p + payload_len;
+  if (crc32c(p, payload_len) != crc)
+    return false;
+
+  for (uint32_t i = 0; i < entries; ++i) {
+    uint64_t key_len, val_len;
+    if (!get_varint(&p, end, &key_len) || !get_varint(&p, end, &val_len) ||
+        uint64_t(end - p) < sizeof(int64_t) + key_len + val_len)
+      return false;
+    int64_t timestamp = get<int64_t>(p);
+    p += sizeof(int64_t);
+
+    std::string key(p, key_len);
+    auto val = std::make_shared<const std::string>(p + key_len, val_len);
+    p += key_len + val_len;
+    apply(key, val, timestamp);
+  }
+  return p == end;
+}
+
+bool LoadSnapshot(const std::string &path, int threads,
+                  const SnapshotApply &apply, SnapshotInfo *info) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < HEADER_SIZE + FOOTER_SIZE) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    return false;
+  // Every page is about to be read, start reading them in now
+  madvise(mapped, size, MADV_WILLNEED);
+  const char *data = static_cast<const char *>(mapped);
+
+  const char *footer = data + size - FOOTER_SIZE;
+  uint64_t index_offset = get<uint64_t>(footer);
+  uint32_t blocks = get<uint32_t>(footer + 8);
+  uint32_t crc = get<uint32_t>(footer + 12);
+
+  bool ok = std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0 &&
+            index_offset <= size - FOOTER_SIZE &&
+            (size - FOOTER_SIZE - index_offset) ==
+                uint64_t(blocks) * INDEX_ENTRY_SIZE;
+  if (ok) {
+    uint32_t expected = crc32c(data, HEADER_SIZE);
+    expected = crc32c(data + index_offset, size - FOOTER_SIZE - index_offset,
+                      expected);
+    ok = expected == crc;
+  }
+
+  if (ok) {
+    info->wal_offset = get<uint64_t>(data + sizeof(MAGIC));
+    info->entries = get<uint64_t>(data + sizeof(MAGIC) + sizeof(uint64_t));
+
+    // Threads take the next unparsed block until none are left
+    std::atomic<uint32_t> next{0};
+    std::atomic<bool> intact{true};
+    auto worker = [&] {
+      for (uint32_t b = next++; b < blocks; b = next++) {
+        const char *entry = data + index_offset + b * INDEX_ENTRY_SIZE;
+        if (!LoadBlock(data, index_offset, get<uint64_t>(entry),
+                       get<uint32_t>(entry + 8), apply))
+          intact = false;
+      }
+    };
+
+    std::vector<std::thread> pool;
+    int n = std::clamp<int>(threads, 1, std::max<uint32_t>(blocks, 1));
+    for (int t = 1; t < n; ++t)
+      pool.emplace_back(worker);
+    worker();
+    for (std::thread &thread : pool)
+      thread.join();
+    ok = intact;
+  }
+
+  munmap(mapped, size);
+  return ok;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+
+#include "StorageEngine.h"
+
+/*
+ * Point-in-time copies of the store on disk.
+ *
+ * A snapshot is taken in a forked child. The parent holds off writers only
+ * for the fork itself, the child then sees the store exactly as it was at
+ * that moment, thanks to the kernel's copy-on-write pages, and writes it
+ * out while the parent goes on serving.
+ *
+ * File layout, integers little endian:
+ *
+ *   header  "TKVSNAP1" [wal_offset u64][entries u64]
+ *   blocks  [crc32c u32][payload_len u32][entries u32][payload]
+ *           payload is entries of
+ *           [key_len varint][val_len varint][timestamp i64][key][val]
+ *   index   [offset u64][entries u32] per block
+ *   footer  [index_offset u64][blocks u32][crc32c u32]
+ *
+ * Every block has its own checksum and is parsed on its own, so a loader
+ * can hand blocks to several threads. The footer checksum covers the
+ * header and the index. A snapshot is written to a temporary file and
+ * renamed into place once it is synced, so a crash leaves the previous
+ * snapshot intact.
+ */
+
+struct SnapshotInfo {
+  uint64_t wal_offset = 0; // log bytes whose writes the snapshot holds
+  uint64_t entries = 0;
+};
+
+/*
+ * Writes every key of a store that does not change meanwhile
+ */
+bool WriteSnapshot(const std::string &path, StorageEngine &store,
+                   uint64_t wal_offset);
+
+/*
+ * Starts a snapshot in a forked child. wal_offset is read while writers
+ * are held off, so every write logged before it is in the snapshot.
+ * Returns the child's pid, or -1 if the engine cannot be frozen or the
+ * fork failed.
+ */
+pid_t ForkSnapshot(const std::string &path, StorageEngine &store,
+                   const std::function<uint64_t()> &wal_offset);
+
+/*
+ * Waits for a forked snapshot, true if it was written
+ */
+bool WaitSnapshot(pid_t child);
+
+using SnapshotApply = std::function<void(
+    const std::string &key, const ValueRef &val, int64_t timestamp)>;
+
+/*
+ * Maps a snapshot and parses its blocks on up to `threads` threads, which
+ * call apply concurrently. Returns false if there is no snapshot or any
+ * part of it is corrupt, apply may have been called for the intact
+ * blocks by then.
+ */
+bool LoadSnapshot(const std::string &path, int threads,
+                  const SnapshotApply &apply, SnapshotInfo *info);
@@ -0,0 +1,139 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using Val_TS = std::pair<std::string, int64_t>; // a timestamped string value
+
+/*
+ * Stored values are immutable and shared by reference count. A read hands
+ * out the stored buffer instead of copying it, and the same buffer can back
+ * the response, the log record and the replica requests of a write.
+ */
+using ValueRef = std::shared_ptr<const std::string>;
+using Ref_TS = std::pair<ValueRef, int64_t>; // a timestamped shared value
+
+/*
+ * Interface for the node-local key value storage.
+ *
+ * Implementations must make write() an atomic compare-and-set on the
+ * timestamp of a single key so that Last Writer Wins holds under concurrency.
+ */
+class StorageEngine {
+public:
+  virtual ~StorageEngine() = default;
+
+  /*
+   * Stores val if timestamp is newer than the stored version.
+   * Returns false if the write was stale or a duplicate. If replaced is
+   * set, an accepted write stores there the timestamp of the version it
+   * overwrote, or -1 for a new key.
+   */
+  virtual bool write(const std::string &key, const std::string &val,
+                     int64_t timestamp, int64_t *replaced = nullptr) = 0;
+
+  /*
+   * Returns the stored value, or {"", -1} if the key does not exist
+   */
+  virtual Val_TS read(const std::string &key) = 0;
+
+  /*
+   * Same as write() and read(), sharing the value instead of copying it.
+   * A missing key reads as {nullptr, -1}. Engines that keep values in
+   * their own format copy at the boundary.
+   */
+  virtual bool write_shared(const std::string &key, const ValueRef &val,
+                            int64_t timestamp, int64_t *replaced = nullptr) {
+    return write(key, *val, timestamp, replaced);
+  }
+
+  virtual Ref_TS read_shared(const std::string &key) {
+    Val_TS value = read(key);
+    if (value.second < 0)
+      return {nullptr, -1};
+    return {std::make_shared<const std::string>(std::move(value.first)),
+            value.second};
+  }
+
+  /*
+   * Swaps the value of the version timestamp for val, keeping the
+   * timestamp. Returns false if that version is no longer stored or the
+   * engine cannot change a version in place.
+   */
+  virtual bool replace(const std::string &key, int64_t timestamp,
+                       const ValueRef &val) {
+    return false;
+  }
+
+  /*
+   * Removes the key if its stored version is timestamp. Returns false if
+   * it is not, or the engine cannot remove keys.
+   */
+  virtual bool erase(const std::string &key, int64_t timestamp) {
+    return false;
+  }
+
+  virtual size_t size() = 0;
+
+  /*
+   * Runs fn while every write to the store is held off, so that fn sees
+   * one point in time. Reads go on. Returns false, without calling fn, if
+   * the engine cannot be snapshotted this way.
+   */
+  virtual bool freeze(const std::function<void()> &fn) { return false; }
+
+  using VisitFunc = std::function<void(
+      const std::string &key, const ValueRef &val, int64_t timestamp)>;
+
+  /*
+   * Calls visit for every key without taking any lock. Only safe while the
+   * caller has the store to itself, like a child forked under freeze().
+   * Returns false if some keys could not be read and were left out.
+   */
+  virtual bool visit_unlocked(const VisitFunc &visit) { return true; }
+
+  struct ScanEntry {
+    std::string key;
+    ValueRef val;
+    int64_t timestamp;
+  };
+
+  /*
+   * Appends to out, in key order, up to limit keys from [start, end), an
+   * empty end meaning no upper bound. It may stop short of limit with
+   * more keys left, only an empty batch means the range is exhausted.
+   * Callers page through a range by starting the next batch just past the
+   * last key. Returns false if the engine keeps no ordered index.
+   */
+  virtual bool scan(const std::string &start, const std::string &end,
+                    size_t limit, std::vector<ScanEntry> *out) {
+    return false;
+  }
+
+  /*
+   * How often a caller found one of the engine's locks taken, and how long
+   * such callers waited in total. Engines that do not track it report 0.
+   */
+  struct LockStats {
+    uint64_t contended = 0;
+    uint64_t wait_ns = 0;
+  };
+
+  virtual LockStats lock_stats() { return {}; }
+
+  /*
+   * Memory the engine holds for its keys and how many keys it evicted to
+   * stay under its limit. Engines that do not track it report 0.
+   */
+  struct MemoryStats {
+    uint64_t bytes = 0;    // entries, values and index
+    uint64_t reserved = 0; // taken from the system, including free space
+    uint64_t limit = 0;    // 0 if unbounded
+    uint64_t evictions = 0;
+  };
+
+  virtual MemoryStats memory_stats() { return {}; }
+};
@@ -0,0 +1,67 @@
+#include "StoredValue.h"
+#include <chrono>
+#include <cstring>
+
+static const char MARKER[4] = {'\xFF', 'T', 'K', 'V'};
+static const size_t KIND_OFFSET = sizeof(MARKER);
+static const size_t HEADER_SIZE = KIND_OFFSET + 1;
+static const size_t EXPIRING_HEADER_SIZE = HEADER_SIZE + sizeof(int64_t);
+
+static bool HasMarker(std::string_view value) {
+  return value.size() >= HEADER_SIZE &&
+         std::memcmp(value.data(), MARKER, sizeof(MARKER)) == 0;
+}
+
+StoredValue DecodeValue(std::string_view stored) {
+  StoredValue decoded;
+  if (!HasMarker(stored))
+    return decoded;
+
+  switch (static_cast<ValueKind>(stored[KIND_OFFSET])) {
+  case ValueKind::PLAIN:
+    decoded.offset = HEADER_SIZE;
+    break;
+  case ValueKind::TOMBSTONE:
+    decoded.kind = ValueKind::TOMBSTONE;
+    decoded.offset = HEADER_SIZE;
+    break;
+  case ValueKind::EXPIRING:
+    if (stored.size() < EXPIRING_HEADER_SIZE)
+      break;
+    decoded.kind = ValueKind::EXPIRING;
+    std::memcpy(&decoded.expires_at, stored.data() + HEADER_SIZE,
+                sizeof(decoded.expires_at));
+    decoded.offset = EXPIRING_HEADER_SIZE;
+    break;
+  }
+  return decoded;
+}
+
+ValueRef EncodeValue(const std::string &val, int64_t expires_at) {
+  if (expires_at == 0 && !HasMarker(val))
+    return std::make_shared<const std::string>(val);
+
+  ValueKind kind = expires_at != 0 ? ValueKind::EXPIRING : ValueKind::PLAIN;
+  std::string stored;
+  stored.reserve(EXPIRING_HEADER_SIZE + val.size());
+  stored.append(MARKER, sizeof(MARKER));
+  stored.push_back(static_cast<char>(kind));
+  if (kind == ValueKind::EXPIRING)
+    stored.append(reinterpret_cast<const char *>(&expires_at),
+                  sizeof(expires_at));
+  stored += val;
+  return std::make_shared<const std::string>(std::move(stored));
+}
+
+const ValueRef &Tombstone() {
+  static const ValueRef tombstone = std::make_shared<const std::string>(
+      std::string(MARKER, sizeof(MARKER)) +
+      static_cast<char>(ValueKind::TOMBSTONE));
+  return tombstone;
+}
+
+int64_t WallClockMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
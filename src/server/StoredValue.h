@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "StorageEngine.h"
+
+/*
+ * What a stored value says about its key's lifetime.
+ *
+ * A value that never expires is stored as the client sent it. An expiring
+ * value or a tombstone is prefixed with a header:
+ *
+ *   [0xFF 'T' 'K' 'V'][kind u8][expires_at i64, EXPIRING only][payload]
+ *
+ * The header is part of the value, so everything that moves values between
+ * nodes or to disk (replication, hints, read repair, anti-entropy,
+ * rebalancing, the log, snapshots) carries it unchanged. Only replies to
+ * clients strip it. A client value that happens to start with the marker
+ * is stored behind a PLAIN header, so it is never mistaken for one.
+ *
+ * The expiry time is derived from the version's timestamp when the owner
+ * accepts the write. Every replica of a version therefore expires it at
+ * the same instant, and a newer version wins over it by the usual Last
+ * Writer Wins rule whether or not it has expired.
+ */
+enum class ValueKind : uint8_t { PLAIN = 0, EXPIRING = 1, TOMBSTONE = 2 };
+
+struct StoredValue {
+  ValueKind kind = ValueKind::PLAIN;
+  int64_t expires_at = 0; // microseconds since the epoch, EXPIRING only
+  size_t offset = 0;      // where the client's bytes start
+
+  /*
+   * Whether a read at now (microseconds since the epoch) sees the value
+   */
+  bool live(int64_t now) const {
+    return kind == ValueKind::PLAIN ||
+           (kind == ValueKind::EXPIRING && now < expires_at);
+  }
+};
+
+StoredValue DecodeValue(std::string_view stored);
+
+/*
+ * Builds the stored form of a client value. expires_at 0 means it never
+ * expires.
+ */
+ValueRef EncodeValue(const std::string &val, int64_t expires_at);
+
+/*
+ * The stored form of a deleted key, shared by every tombstone
+ */
+const ValueRef &Tombstone();
+
+/*
+ * Wall clock time in microseconds since the epoch, the unit of write
+ * timestamps
+ */
+int64_t WallClockMicros();
@@ -0,0 +1,77 @@
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel(int64_t tick_us, int64_t now_us)
+    : tick_us(tick_us), current(now_us / tick_us) {}
+
+void TimerWheel::schedule(Timer timer) {
+  std::lock_guard lock(mutex);
+  pending++;
+  place(std::move(timer));
+}
+
+void TimerWheel::place(Timer timer) {
+  // Rounded up so a timer never fires early
+  uint64_t tick =
+      timer.due_us <= 0 ? 0 : (timer.due_us + tick_us - 1) / tick_us;
+  if (tick <= current) {
+    due.push_back(std::move(timer));
+    return;
+  }
+
+  uint64_t delta = tick - current;
+  for (int level = 0; level < LEVELS; ++level) {
+    if (delta < uint64_t(1) << ((level + 1) * SLOT_BITS)) {
+      wheels[level][(tick >> (level * SLOT_BITS)) & (SLOTS - 1)].push_back(
+          std::move(timer));
+      return;
+    }
+  }
+
+  // Past the last level, wait in its furthest slot
+  uint64_t furthest = current + (uint64_t(1) << (LEVELS * SLOT_BITS)) - 1;
+  wheels[LEVELS - 1][(furthest >> ((LEVELS - 1) * SLOT_BITS)) & (SLOTS - 1)]
+      .push_back(std::move(timer));
+}
+
+void TimerWheel::cascade(int level) {
+  std::vector<Timer> &slot =
+      wheels[level][(current >> (level * SLOT_BITS)) & (SLOTS - 1)];
+  std::vector<Timer> timers;
+  timers.swap(slot);
+  for (Timer &timer : timers)
+    place(std::move(timer));
+}
+
+std::vector<TimerWheel::Timer> TimerWheel::advance(int64_t now_us,
+                                                   size_t max) {
+  std::lock_guard lock(mutex);
+  uint64_t target = now_us / tick_us;
+
+  while (current < target && due.size() < max) {
+    current++;
+    // Higher levels first, what they release may land in a lower slot that
+    // is cascaded on this same tick
+    for (int level = LEVELS - 1; level > 0; --level) {
+      if ((current & ((uint64_t(1) << (level * SLOT_BITS)) - 1)) == 0)
+        cascade(level);
+    }
+
+    std::vector<Timer> &slot = wheels[0][current & (SLOTS - 1)];
+    for (Timer &timer : slot)
+      due.push_back(std::move(timer));
+    slot.clear();
+  }
+
+  std::vector<Timer> fired;
+  while (!due.empty() && fired.size() < max) {
+    fired.push_back(std::move(due.front()));
+    due.pop_front();
+  }
+  pending -= fired.size();
+  return fired;
+}
+
+size_t TimerWheel::size() const {
+  std::lock_guard lock(mutex);
+  return pending;
+}
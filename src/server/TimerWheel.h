@@ -0,0 +1,67 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Hierarchical timing wheel for key expiry.
+ *
+ * LEVELS wheels of SLOTS slots each. A slot of level 0 spans one tick, a
+ * slot of level l spans SLOTS^l ticks. A timer goes into the lowest level
+ * whose span still reaches its due tick. Whenever level l-1 wraps around,
+ * the next slot of level l is cascaded: its timers move down to the level
+ * that now covers them. Scheduling is O(1), and each timer is moved at
+ * most LEVELS times before it fires, so finding due timers never scans
+ * the keyspace.
+ *
+ * With 100 ms ticks and 4 levels of 64 slots the wheel covers about 19
+ * days. Timers further out wait in the last slot and are placed again
+ * when it is cascaded.
+ *
+ * Timers are never cancelled. Whoever handles a fired timer checks that
+ * the version it names is still stored.
+ */
+class TimerWheel {
+public:
+  enum class Kind : uint8_t {
+    EXPIRE, // turn an expired value into a tombstone
+    PURGE,  // drop a tombstone whose grace period is over
+  };
+
+  struct Timer {
+    std::string key;
+    int64_t timestamp; // version of the key the timer is for
+    int64_t due_us;    // wall clock, microseconds since the epoch
+    Kind kind;
+  };
+
+  TimerWheel(int64_t tick_us, int64_t now_us);
+
+  void schedule(Timer timer);
+
+  /*
+   * Moves the wheel up to now_us and returns at most max of the timers due
+   * by then. Timers beyond max stay due and come out of the next call.
+   */
+  std::vector<Timer> advance(int64_t now_us, size_t max);
+
+  size_t size() const;
+
+private:
+  static constexpr int LEVELS = 4;
+  static constexpr int SLOT_BITS = 6;
+  static constexpr uint64_t SLOTS = 1 << SLOT_BITS;
+
+  mutable std::mutex mutex;
+  int64_t tick_us;
+  uint64_t current; // last tick whose timers were collected
+  std::array<std::array<std::vector<Timer>, SLOTS>, LEVELS> wheels;
+  std::deque<Timer> due;
+  size_t pending = 0;
+
+  void place(Timer timer);
+  void cascade(int level);
+};
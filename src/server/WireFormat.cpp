@@ -0,0 +1,94 @@
+#include "WireFormat.h"
+#include <cstring>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+
+static const size_t INLINE_VALUE_LIMIT = 256;
+
+static void ReleaseValue(void *value) { delete static_cast<ValueRef *>(value); }
+
+grpc::ByteBuffer SerializeWithValue(const google::protobuf::MessageLite &message,
+                                    int field_number, const ValueRef &value,
+                                    size_t value_offset) {
+  size_t message_size = message.ByteSizeLong();
+  size_t value_size = value ? value->size() - value_offset : 0;
+  bool inline_value = value_size < INLINE_VALUE_LIMIT;
+
+  uint32_t tag = WireFormatLite::MakeTag(
+      field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  size_t prefix_size =
+      value ? CodedOutputStream::VarintSize32(tag) +
+                  CodedOutputStream::VarintSize32(value_size)
+            : 0;
+
+  // Fields of a message may come in any order, the value goes last
+  grpc::Slice head(message_size + prefix_size +
+                   (inline_value ? value_size : 0));
+  uint8_t *out = const_cast<uint8_t *>(head.begin());
+  out = message.SerializeWithCachedSizesToArray(out);
+  if (!value)
+    return grpc::ByteBuffer(&head, 1);
+
+  out = CodedOutputStream::WriteVarint32ToArray(tag, out);
+  out = CodedOutputStream::WriteVarint32ToArray(value_size, out);
+  if (inline_value) {
+    std::memcpy(out, value->data() + value_offset, value_size);
+    return grpc::ByteBuffer(&head, 1);
+  }
+
+  grpc::Slice slices[2] = {
+      std::move(head),
+      grpc::Slice(const_cast<char *>(value->data()) + value_offset, value_size,
+                  ReleaseValue, new ValueRef(value))};
+  return grpc::ByteBuffer(slices, 2);
+}
+
+void MessageWriter::append_varint(uint32_t value) {
+  uint8_t buffer[5];
+  uint8_t *end = CodedOutputStream::WriteVarint32ToArray(value, buffer);
+  pending.append(reinterpret_cast<char *>(buffer), end - buffer);
+}
+
+void MessageWriter::append(const google::protobuf::MessageLite &message) {
+  message.AppendToString(&pending);
+}
+
+void MessageWriter::append_entry(int field_number,
+                                 const google::protobuf::MessageLite &entry,
+                                 int value_field, const ValueRef &value) {
+  size_t entry_size = entry.ByteSizeLong();
+  size_t value_size = value->size();
+  uint32_t value_tag = WireFormatLite::MakeTag(
+      value_field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  size_t size = entry_size + CodedOutputStream::VarintSize32(value_tag) +
+                CodedOutputStream::VarintSize32(value_size) + value_size;
+
+  append_varint(WireFormatLite::MakeTag(
+      field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+  append_varint(size);
+  entry.AppendToString(&pending);
+  append_varint(value_tag);
+  append_varint(value_size);
+
+  if (value_size < INLINE_VALUE_LIMIT) {
+    pending.append(*value);
+    return;
+  }
+  if (!pending.empty())
+    slices.emplace_back(pending.data(), pending.size());
+  pending.clear();
+  slices.emplace_back(const_cast<char *>(value->data()), value_size,
+                      ReleaseValue, new ValueRef(value));
+}
+
+grpc::ByteBuffer MessageWriter::finish() {
+  if (!pending.empty())
+    slices.emplace_back(pending.data(), pending.size());
+  pending.clear();
+  grpc::ByteBuffer buffer(slices.data(), slices.size());
+  slices.clear();
+  return buffer;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <google/protobuf/message_lite.h>
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/impl/codegen/proto_utils.h>
+#include <string>
+#include <vector>
+
+#include "StorageEngine.h"
+
+/*
+ * Helpers for handling messages in their serialized form, so a node can
+ * relay bytes it received and send stored values without copying them.
+ */
+
+/*
+ * Serializes message followed by the string field field_number holding
+ * value, which message must leave unset. A large value is not copied: it
+ * becomes its own slice holding a reference to the stored buffer until gRPC
+ * has sent it. Small values are copied, which is cheaper than the extra
+ * slice. A null value leaves the field unset. The field holds the value
+ * from value_offset on, which skips a header stored in front of it.
+ */
+grpc::ByteBuffer SerializeWithValue(const google::protobuf::MessageLite &message,
+                                    int field_number, const ValueRef &value,
+                                    size_t value_offset = 0);
+
+/*
+ * Builds a message out of parts, for requests that carry many stored
+ * values. Values are copied or referenced the same way as in
+ * SerializeWithValue, and the copied bytes between two referenced values
+ * share one slice.
+ */
+class MessageWriter {
+public:
+  /*
+   * Appends the fields set in message
+   */
+  void append(const google::protobuf::MessageLite &message);
+
+  /*
+   * Appends entry, with value as its string field value_field, as one
+   * element of the message field field_number
+   */
+  void append_entry(int field_number,
+                    const google::protobuf::MessageLite &entry,
+                    int value_field, const ValueRef &value);
+
+  grpc::ByteBuffer finish();
+
+private:
+  std::string pending; // copied bytes not cut into a slice yet
+  std::vector<grpc::Slice> slices;
+
+  void append_varint(uint32_t value);
+};
+
+inline grpc::ByteBuffer Serialize(const google::protobuf::MessageLite &message) {
+  return SerializeWithValue(message, 0, nullptr);
+}
+
+/*
+ * Parses a message out of a buffer, leaving the buffer itself untouched
+ */
+template <typename Message>
+bool Parse(const grpc::ByteBuffer &buffer, Message *message) {
+  grpc::ByteBuffer consumed(buffer); // shares the slices, Deserialize clears it
+  return grpc::SerializationTraits<Message>::Deserialize(&consumed, message)
+      .ok();
+}
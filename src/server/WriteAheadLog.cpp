@@ -0,0 +1,374 @@
+#include "WriteAheadLog.h"
+#include "Checksum.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t HEADER_SIZE = 3 * sizeof(uint32_t) + sizeof(int64_t);
+
+SyncPolicy ParseSyncPolicy(const std::string &name) {
+  if (name == "always")
+    return SyncPolicy::ALWAYS;
+  if (name == "none")
+    return SyncPolicy::NONE;
+  return SyncPolicy::GROUP;
+}
+
+/*
+ * Makes a file created in the directory of path durable
+ */
+static void sync_directory(const std::string &path) {
+  std::string dir = std::filesystem::path(path).parent_path().string();
+  int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd < 0 || fsync(dir_fd) != 0)
+    std::cerr << "[WAL] Could not sync the directory of " << path << ": "
+              << strerror(errno) << std::endl;
+  if (dir_fd >= 0)
+    close(dir_fd);
+}
+
+WriteAheadLog::WriteAheadLog(const std::string &path, SyncPolicy policy,
+                             int group_commit_us)
+    : path(path), policy(policy), group_commit_us(group_commit_us) {
+  // A log written before there were segments is the first one
+  std::error_code error;
+  if (std::filesystem::is_regular_file(path, error))
+    std::filesystem::rename(path, path + ".0");
+
+  segments = list_segments(path);
+  if (segments.empty())
+    segments.push_back({0, path + ".0"});
+
+  const Segment &last = segments.back();
+  fd = open(last.path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    std::cerr << "Error: Could not open write ahead log: " << last.path
+              << " (" << strerror(errno) << ")" << std::endl;
+    exit(1);
+  }
+  sync_directory(last.path);
+
+  struct stat st;
+  if (fstat(fd, &st) == 0)
+    file_size = last.start + st.st_size;
+
+  if (policy == SyncPolicy::GROUP)
+    group_committer = std::thread(&WriteAheadLog::_group_commit, this);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    shutdown_requested = true;
+  }
+  if (group_committer.joinable())
+    group_committer.join();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [this] { return !flushing; });
+  if (!buffer.empty() && !failed())
+    flush(lock);
+
+  close(fd);
+}
+
+size_t WriteAheadLog::replay(ApplyFunc apply, uint64_t from) {
+  // A snapshot of a log that was since removed or cut short
+  if (from > written_bytes()) {
+    std::cerr << "[WAL] " << path << " is shorter than the snapshot offset "
+              << from << ", replaying all of it" << std::endl;
+    from = 0;
+  }
+
+  size_t records = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const Segment &segment = segments[i];
+    bool last = i + 1 == segments.size();
+    if (!last && segments[i + 1].start <= from)
+      continue;
+
+    uint64_t local_from = from > segment.start ? from - segment.start : 0;
+    uint64_t size;
+    if (last) {
+      records += replay_segment(fd, segment.path, local_from, apply, &size);
+      file_size = segment.start + size;
+      continue;
+    }
+
+    int segment_fd = open(segment.path.c_str(), O_RDWR);
+    if (segment_fd < 0) {
+      std::cerr << "[WAL] Could not open " << segment.path << ": "
+                << strerror(errno) << std::endl;
+      continue;
+    }
+    records +=
+        replay_segment(segment_fd, segment.path, local_from, apply, &size);
+    close(segment_fd);
+  }
+  return records;
+}
+
+size_t WriteAheadLog::replay_segment(int segment_fd,
+                                     const std::string &segment_path,
+                                     uint64_t from, const ApplyFunc &apply,
+                                     uint64_t *size) {
+  struct stat st;
+  fstat(segment_fd, &st);
+  *size = st.st_size;
+  // Cut short by an earlier replay, nothing of it is left to read
+  if (from >= static_cast<uint64_t>(st.st_size))
+    return 0;
+
+  std::string data(st.st_size - from, '\0');
+  size_t read_bytes = 0;
+  while (read_bytes < data.size()) {
+    ssize_t n = pread(segment_fd, data.data() + read_bytes,
+                      data.size() - read_bytes, from + read_bytes);
+    if (n <= 0)
+      break;
+    read_bytes += n;
+  }
+  data.resize(read_bytes);
+
+  size_t offset = 0;
+  size_t records = 0;
+
+  while (offset + HEADER_SIZE <= data.size()) {
+    const char *header = data.data() + offset;
+    uint32_t crc, key_len, val_len;
+    int64_t timestamp;
+    memcpy(&crc, header, 4);
+    memcpy(&key_len, header + 4, 4);
+    memcpy(&val_len, header + 8, 4);
+    memcpy(&timestamp, header + 12, 8);
+
+    size_t record_size = HEADER_SIZE + (size_t)key_len + val_len;
+    if (offset + record_size > data.size())
+      break;
+    if (crc32c(header + 4, record_size - 4) != crc)
+      break;
+
+    apply(std::string(header + HEADER_SIZE, key_len),
+          std::string(header + HEADER_SIZE + key_len, val_len), timestamp);
+
+    offset += record_size;
+    records++;
+  }
+
+  if (offset < data.size()) {
+    std::cerr << "[WAL] Discarding " << data.size() - offset
+              << " bytes of torn or corrupt records from " << segment_path
+              << std::endl;
+    if (ftruncate(segment_fd, from + offset) != 0)
+      std::cerr << "[WAL] Truncate failed: " << strerror(errno) << std::endl;
+    *size = from + offset;
+  }
+
+  return records;
+}
+
+uint64_t WriteAheadLog::rotate() {
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [this] { return !flushing; });
+
+  uint64_t start = file_size.load(std::memory_order_relaxed);
+  if (failed() || start == segments.back().start)
+    return segments.back().start;
+
+  std::string segment_path = path + "." + std::to_string(start);
+  int next_fd = open(segment_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (next_fd < 0) {
+    std::cerr << "[WAL] Could not create " << segment_path << ": "
+              << strerror(errno) << std::endl;
+    return segments.back().start;
+  }
+  // Records acked from the new segment must not vanish with its name
+  sync_directory(segment_path);
+
+  // Every flush into the old segment has synced it already
+  close(fd);
+  fd = next_fd;
+  segments.push_back({start, segment_path});
+  return start;
+}
+
+void WriteAheadLog::truncate(uint64_t position) {
+  std::lock_guard<std::mutex> lock(mutex);
+  // Oldest first, so a crash never leaves a gap
+  size_t dropped = 0;
+  while (dropped + 1 < segments.size() &&
+         segments[dropped + 1].start <= position) {
+    if (unlink(segments[dropped].path.c_str()) != 0) {
+      std::cerr << "[WAL] Could not delete " << segments[dropped].path << ": "
+                << strerror(errno) << std::endl;
+      break;
+    }
+    dropped++;
+  }
+  segments.erase(segments.begin(), segments.begin() + dropped);
+}
+
+void WriteAheadLog::remove(const std::string &path) {
+  std::error_code error;
+  std::filesystem::remove(path, error);
+  for (const Segment &segment : list_segments(path))
+    std::filesystem::remove(segment.path, error);
+}
+
+std::vector<WriteAheadLog::Segment>
+WriteAheadLog::list_segments(const std::string &path) {
+  std::filesystem::path log(path);
+  std::filesystem::path dir =
+      log.has_parent_path() ? log.parent_path() : std::filesystem::path(".");
+  std::string prefix = log.filename().string() + ".";
+
+  std::vector<Segment> segments;
+  std::error_code error;
+  for (const auto &file : std::filesystem::directory_iterator(dir, error)) {
+    std::string name = file.path().filename().string();
+    if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix))
+      continue;
+    std::string position = name.substr(prefix.size());
+    if (!std::all_of(position.begin(), position.end(),
+                     [](char c) { return c >= '0' && c <= '9'; }))
+      continue;
+    segments.push_back({std::stoull(position), file.path().string()});
+  }
+  std::sort(segments.begin(), segments.end(),
+            [](const Segment &a, const Segment &b) { return a.start < b.start; });
+  return segments;
+}
+
+bool WriteAheadLog::append(const std::string &key, const std::string &val,
+                           int64_t timestamp) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (failed())
+    return false;
+  encode(key, val, timestamp);
+  return commit(lock);
+}
+
+bool WriteAheadLog::append_batch(const std::vector<LogRecord> &records) {
+  if (records.empty())
+    return true;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (failed())
+    return false;
+  for (const LogRecord &r : records)
+    encode(r.key, *r.val, r.timestamp);
+  return commit(lock);
+}
+
+void WriteAheadLog::encode(const std::string &key, const std::string &val,
+                           int64_t timestamp) {
+  // Encode the record straight into the shared buffer
+  uint32_t key_len = key.size();
+  uint32_t val_len = val.size();
+
+  size_t start = buffer.size();
+  buffer.resize(start + HEADER_SIZE + key_len + val_len);
+  char *record = buffer.data() + start;
+  memcpy(record + 4, &key_len, 4);
+  memcpy(record + 8, &val_len, 4);
+  memcpy(record + 12, &timestamp, 8);
+  memcpy(record + HEADER_SIZE, key.data(), key_len);
+  memcpy(record + HEADER_SIZE + key_len, val.data(), val_len);
+  uint32_t crc = crc32c(record + 4, HEADER_SIZE - 4 + key_len + val_len);
+  memcpy(record, &crc, 4);
+}
+
+bool WriteAheadLog::commit(std::unique_lock<std::mutex> &lock) {
+  uint64_t lsn = ++appended_lsn;
+
+  if (policy == SyncPolicy::GROUP) {
+    cv.wait(lock, [this, lsn] { return durable_lsn >= lsn || failed(); });
+    return durable_lsn >= lsn;
+  }
+
+  // The first writer to find no flush in progress becomes the leader and
+  // flushes everything buffered so far, including later writers' records.
+  while (durable_lsn < lsn && !failed()) {
+    if (!flushing)
+      flush(lock);
+    else
+      cv.wait(lock);
+  }
+  return durable_lsn >= lsn;
+}
+
+/*
+ * Writes out the buffer. Called with the lock held and no flush in
+ * progress, the lock is released during the IO.
+ *
+ * If the write or the sync fails, the batch is cut off the end of the
+ * file again, so a later replay does not stop at a torn record, and the
+ * log is marked failed. Its writers, and every later one, are told their
+ * records are not durable.
+ */
+void WriteAheadLog::flush(std::unique_lock<std::mutex> &lock) {
+  flushing = true;
+  std::string batch;
+  batch.swap(buffer);
+  uint64_t batch_lsn = appended_lsn;
+  uint64_t segment_start = segments.back().start;
+  lock.unlock();
+
+  uint64_t start = file_size.load(std::memory_order_relaxed);
+  bool ok = true;
+  size_t written = 0;
+  while (written < batch.size()) {
+    ssize_t n = ::write(fd, batch.data() + written, batch.size() - written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "[WAL] Write failed: " << strerror(errno) << std::endl;
+      ok = false;
+      break;
+    }
+    written += n;
+  }
+
+  if (ok && policy != SyncPolicy::NONE && fdatasync(fd) != 0) {
+    std::cerr << "[WAL] Sync failed: " << strerror(errno) << std::endl;
+    ok = false;
+  }
+
+  if (ok) {
+    file_size.store(start + written, std::memory_order_release);
+  } else if (written > 0 && ftruncate(fd, start - segment_start) != 0) {
+    std::cerr << "[WAL] Truncate failed: " << strerror(errno) << std::endl;
+  }
+
+  lock.lock();
+  if (ok) {
+    durable_lsn = batch_lsn;
+  } else {
+    broken.store(true, std::memory_order_release);
+    buffer.clear();
+  }
+  flushing = false;
+  cv.notify_all();
+}
+
+/*
+ * Flushes the buffer on a fixed interval for the GROUP policy
+ */
+void WriteAheadLog::_group_commit() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!shutdown_requested) {
+    lock.unlock();
+    std::this_thread::sleep_for(std::chrono::microseconds(group_commit_us));
+    lock.lock();
+
+    if (!buffer.empty() && !flushing && !failed())
+      flush(lock);
+  }
+}
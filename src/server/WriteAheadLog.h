@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StorageEngine.h"
+
+/*
+ * How long a writer waits for its record to reach the disk
+ */
+enum class SyncPolicy {
+  ALWAYS, // fsync before returning, concurrent writers share one fsync
+  GROUP,  // a background thread fsyncs every group_commit_us
+  NONE,   // hand the record to the OS page cache and return
+};
+
+SyncPolicy ParseSyncPolicy(const std::string &name);
+
+/*
+ * A write to log. It owns its key and shares its value, so a batch can
+ * be built from temporaries and outlive them.
+ */
+struct LogRecord {
+  std::string key;
+  ValueRef val;
+  int64_t timestamp;
+};
+
+/*
+ * Append-only log of writes.
+ *
+ * Each record is [crc32c][key_len][val_len][timestamp][key][val], where the
+ * checksum covers everything after itself. Writers append into a shared
+ * buffer and the buffer is flushed with a single write and fdatasync for
+ * every writer that joined it, so the cost of an fsync is spread over all
+ * concurrent writers.
+ *
+ * The log is a series of segment files, <path>.<position>, named by the
+ * log position of their first byte. Positions count the bytes written to
+ * the log since it was created, over all segments. Whoever keeps the
+ * writes elsewhere (a snapshot, flushed tables) starts a new segment with
+ * rotate() at the point its copy begins, and drops the segments before it
+ * with truncate() once that copy is durable.
+ */
+class WriteAheadLog {
+public:
+  WriteAheadLog(const std::string &path, SyncPolicy policy,
+                int group_commit_us = 500);
+  ~WriteAheadLog();
+
+  using ApplyFunc = std::function<void(const std::string &key,
+                                       const std::string &val,
+                                       int64_t timestamp)>;
+
+  /*
+   * Calls apply for every intact record in the log from position `from`
+   * on, or from the start if the log is shorter than that. A segment is
+   * read up to its first torn or corrupt record and truncated there.
+   * Returns the number of records replayed.
+   */
+  size_t replay(ApplyFunc apply, uint64_t from = 0);
+
+  /*
+   * Log position after the last record written so far. Every record
+   * before it was accepted by the store before it was logged.
+   */
+  uint64_t written_bytes() const {
+    return file_size.load(std::memory_order_acquire);
+  }
+
+  /*
+   * Starts a new segment at the current position and returns it. Records
+   * still buffered go to the new segment. If the current segment is empty
+   * or a new one cannot be created, it stays, and its start is returned.
+   */
+  uint64_t rotate();
+
+  /*
+   * Deletes the segments that only hold records before position
+   */
+  void truncate(uint64_t position);
+
+  /*
+   * Deletes every segment of the log at path
+   */
+  static void remove(const std::string &path);
+
+  /*
+   * Appends a record and blocks until it is durable under the sync policy.
+   * Returns false if the log failed before the record was durable.
+   */
+  bool append(const std::string &key, const std::string &val,
+              int64_t timestamp);
+
+  /*
+   * Appends several records that become durable together
+   */
+  bool append_batch(const std::vector<LogRecord> &records);
+
+  /*
+   * Whether a write or sync of the log failed. A failed log takes no more
+   * appends, since nothing written after the failure could be trusted.
+   */
+  bool failed() const { return broken.load(std::memory_order_acquire); }
+
+private:
+  struct Segment {
+    uint64_t start; // log position of its first byte
+    std::string path;
+  };
+
+  std::string path;
+  SyncPolicy policy;
+  int group_commit_us;
+  int fd; // the last segment, the only one written to
+  std::atomic<uint64_t> file_size{0};
+  std::vector<Segment> segments; // by start, guarded by mutex
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::string buffer;
+  uint64_t appended_lsn = 0; // last record added to the buffer
+  uint64_t durable_lsn = 0;  // last record written (and synced)
+  bool flushing = false;
+  std::atomic<bool> broken{false};
+  bool shutdown_requested = false;
+  std::thread group_committer;
+
+  /*
+   * Encodes a record into the buffer, with the lock held
+   */
+  void encode(const std::string &key, const std::string &val,
+              int64_t timestamp);
+
+  /*
+   * Waits until everything buffered so far is durable, with the lock held
+   */
+  bool commit(std::unique_lock<std::mutex> &lock);
+
+  void flush(std::unique_lock<std::mutex> &lock);
+
+  /*
+   * Replays one segment from byte `from` of the file, returns the number
+   * of records and stores the length of its intact part in size
+   */
+  size_t replay_segment(int segment_fd, const std::string &segment_path,
+                        uint64_t from, const ApplyFunc &apply,
+                        uint64_t *size);
+
+  static std::vector<Segment> list_segments(const std::string &path);
+  void _group_commit();
+};
@@ -0,0 +1,46 @@
+#include "BlockCache.h"
+#include "Hash.h"
+
+BlockCache::BlockCache(size_t capacity_bytes)
+    : shard_capacity(capacity_bytes / SHARDS) {}
+
+uint64_t BlockCache::cache_key(uint64_t table_id, uint64_t offset) {
+  // Table files stay far below 2^40 bytes
+  return (table_id << 40) ^ offset;
+}
+
+BlockCache::Block BlockCache::lookup(uint64_t table_id, uint64_t offset) {
+  uint64_t key = cache_key(table_id, offset);
+  Shard &shard = shards[murmur64(&key, sizeof(key)) % SHARDS];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  auto it = shard.index.find(key);
+  if (it == shard.index.end())
+    return nullptr;
+
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  return it->second->block;
+}
+
+void BlockCache::insert(uint64_t table_id, uint64_t offset, Block block) {
+  if (shard_capacity == 0)
+    return;
+
+  uint64_t key = cache_key(table_id, offset);
+  Shard &shard = shards[murmur64(&key, sizeof(key)) % SHARDS];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  if (shard.index.count(key))
+    return;
+
+  shard.lru.push_front({key, block});
+  shard.index[key] = shard.lru.begin();
+  shard.bytes += block->size();
+
+  while (shard.bytes > shard_capacity && shard.lru.size() > 1) {
+    Entry &victim = shard.lru.back();
+    shard.bytes -= victim.block->size();
+    shard.index.erase(victim.key);
+    shard.lru.pop_back();
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Sharded LRU cache of SSTable data blocks, bounded in bytes.
+ * Blocks are handed out as shared pointers so eviction never
+ * invalidates a block a reader is still scanning.
+ */
+class BlockCache {
+public:
+  using Block = std::shared_ptr<const std::string>;
+
+  BlockCache(size_t capacity_bytes);
+
+  Block lookup(uint64_t table_id, uint64_t offset);
+
+  void insert(uint64_t table_id, uint64_t offset, Block block);
+
+private:
+  static const int SHARDS = 16;
+
+  struct Entry {
+    uint64_t key;
+    Block block;
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::list<Entry> lru; // most recently used at the front
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+  };
+
+  size_t shard_capacity;
+  Shard shards[SHARDS];
+
+  static uint64_t cache_key(uint64_t table_id, uint64_t offset);
+};
@@ -0,0 +1,43 @@
+#include "BloomFilter.h"
+#include <algorithm>
+
+// Probes are derived from one 64-bit hash with double hashing, the last
+// byte of the filter stores the number of probes.
+
+std::string BloomFilter::build(const std::vector<uint64_t> &hashes,
+                               int bits_per_key) {
+  int probes = std::clamp((int)(bits_per_key * 0.69), 1, 30);
+  size_t bits = std::max<size_t>(hashes.size() * bits_per_key, 64);
+  size_t bytes = (bits + 7) / 8;
+  bits = bytes * 8;
+
+  std::string filter(bytes + 1, '\0');
+  filter[bytes] = (char)probes;
+
+  for (uint64_t hash : hashes) {
+    uint64_t delta = (hash >> 33) | (hash << 31);
+    for (int i = 0; i < probes; ++i) {
+      size_t bit = hash % bits;
+      filter[bit / 8] |= (char)(1 << (bit % 8));
+      hash += delta;
+    }
+  }
+  return filter;
+}
+
+bool BloomFilter::may_contain(const std::string &filter, uint64_t hash) {
+  if (filter.size() < 2)
+    return true;
+
+  size_t bits = (filter.size() - 1) * 8;
+  int probes = filter.back();
+
+  uint64_t delta = (hash >> 33) | (hash << 31);
+  for (int i = 0; i < probes; ++i) {
+    size_t bit = hash % bits;
+    if ((filter[bit / 8] & (1 << (bit % 8))) == 0)
+      return false;
+    hash += delta;
+  }
+  return true;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Bloom filter over key hashes, serialized into each SSTable so that
+ * lookups for absent keys rarely touch a data block.
+ */
+class BloomFilter {
+public:
+  /*
+   * Builds a filter for the given key hashes
+   */
+  static std::string build(const std::vector<uint64_t> &hashes,
+                           int bits_per_key = 10);
+
+  /*
+   * Checks a serialized filter, false means the key is definitely absent
+   */
+  static bool may_contain(const std::string &filter, uint64_t hash);
+};
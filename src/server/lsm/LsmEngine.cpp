@@ -0,0 +1,569 @@
+#include "LsmEngine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <unistd.h>
+
+// How long the background thread waits before retrying a failed flush
+static const auto FLUSH_RETRY_DELAY = std::chrono::seconds(1);
+
+LsmEngine::LsmEngine(const LsmOptions &options)
+    : options(options), cache(options.block_cache_bytes) {
+  std::filesystem::create_directories(options.dir);
+
+  memtable = std::make_shared<MemTable>();
+  load_manifest();
+
+  background = std::thread(&LsmEngine::_background_work, this);
+}
+
+LsmEngine::~LsmEngine() {
+  // Freeze what is left in the memtable so it is flushed before exit
+  {
+    uint64_t position = cut_log();
+    std::unique_lock lock(state_mutex);
+    state_cv.wait(lock, [this] { return !immutable; });
+    if (memtable->count() > 0) {
+      immutable = memtable;
+      immutable_log_position = position;
+      memtable = std::make_shared<MemTable>();
+    }
+    shutdown_requested = true;
+    state_cv.notify_all();
+  }
+  background.join();
+}
+
+std::string LsmEngine::table_path(uint64_t id) {
+  return options.dir + "/" + std::to_string(id) + ".sst";
+}
+
+/*
+ * The MANIFEST lists "<level> <file id>" for every live table, after a
+ * "log <position>" line. Tables that are not listed were left behind by
+ * an interrupted flush or compaction.
+ */
+void LsmEngine::load_manifest() {
+  auto v = std::make_shared<Version>();
+  std::ifstream manifest(options.dir + "/MANIFEST");
+
+  // A MANIFEST from before the line has no position, the log is replayed
+  std::string first;
+  if (manifest >> first && first == "log") {
+    manifest >> v->log_position;
+  } else {
+    manifest.clear();
+    manifest.seekg(0);
+  }
+
+  int level;
+  uint64_t id;
+  std::vector<uint64_t> live;
+  while (manifest >> level >> id) {
+    Table table = SSTable::open(table_path(id), id, &cache);
+    if (!table || level < 0 || level >= NUM_LEVELS) {
+      std::cerr << "[LSM] Skipping unreadable table " << table_path(id)
+                << std::endl;
+      continue;
+    }
+    v->levels[level].push_back(table);
+    live.push_back(id);
+    next_file_id = std::max(next_file_id, id + 1);
+  }
+
+  std::sort(v->levels[0].begin(), v->levels[0].end(),
+            [](const Table &a, const Table &b) { return a->id() > b->id(); });
+  for (int i = 1; i < NUM_LEVELS; ++i) {
+    std::sort(v->levels[i].begin(), v->levels[i].end(),
+              [](const Table &a, const Table &b) {
+                return a->smallest() < b->smallest();
+              });
+  }
+
+  for (const auto &file : std::filesystem::directory_iterator(options.dir)) {
+    if (file.path().extension() != ".sst")
+      continue;
+    uint64_t file_id = std::stoull(file.path().stem().string());
+    std::error_code error;
+    if (std::find(live.begin(), live.end(), file_id) == live.end())
+      std::filesystem::remove(file.path(), error);
+  }
+
+  version = v;
+}
+
+/*
+ * Replaces the MANIFEST. The tables it lists were synced when they were
+ * built, the new MANIFEST is synced before it is renamed into place, and
+ * the directory after, which also makes the tables' own entries durable.
+ * A crash at any point leaves either the old or the new MANIFEST, and
+ * every table it lists complete.
+ */
+bool LsmEngine::write_manifest(const Version &v) {
+  std::string contents = "log " + std::to_string(v.log_position) + "\n";
+  for (int level = 0; level < NUM_LEVELS; ++level) {
+    for (const Table &table : v.levels[level])
+      contents += std::to_string(level) + " " + std::to_string(table->id()) +
+                  "\n";
+  }
+
+  std::string tmp = options.dir + "/MANIFEST.tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0;
+  size_t written = 0;
+  while (ok && written < contents.size()) {
+    ssize_t n = ::write(fd, contents.data() + written,
+                        contents.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    ok = n > 0;
+    written += ok ? n : 0;
+  }
+  ok = ok && fsync(fd) == 0;
+  if (fd >= 0)
+    close(fd);
+
+  if (!ok || rename(tmp.c_str(), (options.dir + "/MANIFEST").c_str()) != 0) {
+    std::cerr << "[LSM] Could not write MANIFEST: " << strerror(errno)
+              << std::endl;
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  int dir_fd = ::open(options.dir.c_str(), O_RDONLY | O_DIRECTORY);
+  ok = dir_fd >= 0 && fsync(dir_fd) == 0;
+  if (dir_fd >= 0)
+    close(dir_fd);
+  if (!ok)
+    std::cerr << "[LSM] Could not sync " << options.dir << ": "
+              << strerror(errno) << std::endl;
+  return ok;
+}
+
+/*
+ * Deletes tables that were built but never installed
+ */
+void LsmEngine::remove_tables(const std::vector<Table> &tables) {
+  for (const Table &table : tables)
+    table->mark_obsolete();
+}
+
+bool LsmEngine::install(std::shared_ptr<const Version> next) {
+  if (!write_manifest(*next))
+    return false;
+  std::unique_lock lock(state_mutex);
+  version = next;
+  return true;
+}
+
+bool LsmEngine::write(const std::string &key, const std::string &val,
+                      int64_t timestamp, int64_t *replaced) {
+  std::lock_guard<std::mutex> write_lock(write_mutex);
+
+  Val_TS current = lookup(key);
+  if (current.second >= 0 && timestamp <= current.second)
+    return false;
+  if (replaced)
+    *replaced = current.second;
+
+  std::shared_ptr<MemTable> mem;
+  {
+    std::shared_lock lock(state_mutex);
+    mem = memtable;
+  }
+  mem->put(key, val, timestamp);
+
+  if (mem->memory_usage() >= options.memtable_bytes) {
+    uint64_t position = cut_log();
+    // Stall writers while the previous memtable is still being flushed
+    std::unique_lock lock(state_mutex);
+    state_cv.wait(lock, [this] { return !immutable; });
+    immutable = memtable;
+    immutable_log_position = position;
+    memtable = std::make_shared<MemTable>();
+    state_cv.notify_all();
+  }
+
+  return true;
+}
+
+Val_TS LsmEngine::read(const std::string &key) { return lookup(key); }
+
+Val_TS LsmEngine::lookup(const std::string &key) {
+  std::shared_ptr<MemTable> mem, imm;
+  std::shared_ptr<const Version> v;
+  {
+    std::shared_lock lock(state_mutex);
+    mem = memtable;
+    imm = immutable;
+    v = version;
+  }
+
+  Val_TS out;
+  if (mem->get(key, out))
+    return out;
+  if (imm && imm->get(key, out))
+    return out;
+
+  for (const Table &table : v->levels[0]) {
+    if (table->get(key, out))
+      return out;
+  }
+
+  for (int level = 1; level < NUM_LEVELS; ++level) {
+    const auto &tables = v->levels[level];
+    auto it = std::lower_bound(
+        tables.begin(), tables.end(), key,
+        [](const Table &t, const std::string &k) { return t->largest() < k; });
+    if (it != tables.end() && (*it)->get(key, out))
+      return out;
+  }
+
+  return {"", -1};
+}
+
+uint64_t LsmEngine::cut_log() {
+  std::function<uint64_t()> cut;
+  {
+    std::shared_lock lock(state_mutex);
+    cut = log_cut;
+  }
+  return cut ? cut() : 0;
+}
+
+void LsmEngine::attach_log(std::function<uint64_t()> cut,
+                           std::function<void(uint64_t)> flushed) {
+  std::unique_lock lock(state_mutex);
+  log_cut = std::move(cut);
+  log_flushed = std::move(flushed);
+}
+
+uint64_t LsmEngine::log_position() {
+  std::shared_lock lock(state_mutex);
+  return version->log_position;
+}
+
+bool LsmEngine::visit_unlocked(const VisitFunc &visit) {
+  std::shared_ptr<MemTable> mem, imm;
+  std::shared_ptr<const Version> v;
+  {
+    std::shared_lock lock(state_mutex);
+    mem = memtable;
+    imm = immutable;
+    v = version;
+  }
+
+  // The memtables are small, a sorted copy of them joins the merge
+  std::map<std::string, Val_TS> buffered;
+  for (const auto &table : {imm, mem}) {
+    if (!table)
+      continue;
+    table->for_each([&buffered](const std::string &key, const Val_TS &value) {
+      auto [it, added] = buffered.try_emplace(key, value);
+      if (!added && value.second > it->second.second)
+        it->second = value;
+    });
+  }
+  auto next_buffered = buffered.begin();
+
+  std::vector<SSTable::Iterator> iterators;
+  for (int level = 0; level < NUM_LEVELS; ++level) {
+    for (const Table &table : v->levels[level])
+      iterators.emplace_back(table);
+  }
+
+  while (true) {
+    const std::string *min_key =
+        next_buffered != buffered.end() ? &next_buffered->first : nullptr;
+    for (auto &it : iterators) {
+      if (it.valid() && (!min_key || it.key() < *min_key))
+        min_key = &it.key();
+    }
+    if (!min_key)
+      break;
+
+    std::string key = *min_key;
+    Val_TS winner = {"", -1};
+    if (next_buffered != buffered.end() && next_buffered->first == key) {
+      winner = next_buffered->second;
+      ++next_buffered;
+    }
+    for (auto &it : iterators) {
+      if (it.valid() && it.key() == key) {
+        if (it.value().second > winner.second)
+          winner = it.value();
+        it.next();
+      }
+    }
+    visit(key, std::make_shared<const std::string>(std::move(winner.first)),
+          winner.second);
+  }
+
+  bool ok = true;
+  for (auto &it : iterators)
+    ok = ok && !it.corrupt();
+  return ok;
+}
+
+size_t LsmEngine::size() {
+  std::shared_lock lock(state_mutex);
+
+  size_t total = memtable->count() + (immutable ? immutable->count() : 0);
+  for (int level = 0; level < NUM_LEVELS; ++level) {
+    for (const Table &table : version->levels[level])
+      total += table->entries();
+  }
+  return total;
+}
+
+void LsmEngine::_background_work() {
+  while (true) {
+    std::shared_ptr<const Version> current;
+    bool has_immutable;
+    {
+      std::shared_lock lock(state_mutex);
+      current = version;
+      has_immutable = immutable != nullptr;
+    }
+
+    if (has_immutable) {
+      if (!flush_immutable()) {
+        // Writers stall on the full memtable until a flush succeeds
+        std::unique_lock lock(state_mutex);
+        state_cv.wait_for(lock, FLUSH_RETRY_DELAY);
+      }
+      continue;
+    }
+    if (compact_once(current))
+      continue;
+
+    std::unique_lock lock(state_mutex);
+    if (shutdown_requested && !immutable)
+      return;
+    state_cv.wait(lock, [this] { return immutable || shutdown_requested; });
+  }
+}
+
+/*
+ * Writes the frozen memtable to a level 0 table. On failure the memtable
+ * stays frozen, so nothing it holds is lost, and the flush is retried.
+ */
+bool LsmEngine::flush_immutable() {
+  std::shared_ptr<MemTable> imm;
+  std::shared_ptr<const Version> current;
+  uint64_t position;
+  {
+    std::shared_lock lock(state_mutex);
+    imm = immutable;
+    current = version;
+    position = immutable_log_position;
+  }
+
+  uint64_t id = next_file_id++;
+  SSTableBuilder builder(table_path(id));
+  imm->for_each([&builder](const std::string &key, const Val_TS &value) {
+    builder.add(key, value);
+  });
+  Table table;
+  if (builder.finish())
+    table = SSTable::open(table_path(id), id, &cache);
+  if (!table) {
+    std::error_code error;
+    std::filesystem::remove(table_path(id), error);
+    return false;
+  }
+
+  auto next = std::make_shared<Version>(*current);
+  next->levels[0].insert(next->levels[0].begin(), table);
+  next->log_position = std::max(current->log_position, position);
+  if (!write_manifest(*next)) {
+    remove_tables({table});
+    return false;
+  }
+
+  std::function<void(uint64_t)> flushed;
+  {
+    std::unique_lock lock(state_mutex);
+    version = next;
+    immutable = nullptr;
+    flushed = log_flushed;
+    state_cv.notify_all();
+  }
+  if (flushed && position > 0)
+    flushed(next->log_position);
+  return true;
+}
+
+size_t LsmEngine::level_bytes(const Version &v, int level) {
+  size_t total = 0;
+  for (const Table &table : v.levels[level])
+    total += table->file_size();
+  return total;
+}
+
+size_t LsmEngine::max_level_bytes(int level) {
+  size_t bytes = options.level1_bytes;
+  for (int i = 1; i < level; ++i)
+    bytes *= 10;
+  return bytes;
+}
+
+/*
+ * Picks and runs one compaction, returns false if no level needs one
+ */
+bool LsmEngine::compact_once(std::shared_ptr<const Version> current) {
+  int level = -1;
+  std::vector<Table> inputs;
+  std::string smallest, largest;
+
+  if ((int)current->levels[0].size() >= options.l0_compaction_trigger) {
+    level = 0;
+    inputs = current->levels[0];
+  } else {
+    for (int i = 1; i < NUM_LEVELS - 1; ++i) {
+      if (level_bytes(*current, i) <= max_level_bytes(i))
+        continue;
+
+      // Rotate through the level so every key range gets pushed down
+      const auto &tables = current->levels[i];
+      Table picked = tables.front();
+      for (const Table &table : tables) {
+        if (table->smallest() > compact_pointer[i]) {
+          picked = table;
+          break;
+        }
+      }
+      compact_pointer[i] = picked->largest();
+      level = i;
+      inputs.push_back(picked);
+      break;
+    }
+  }
+
+  if (level < 0)
+    return false;
+
+  smallest = inputs.front()->smallest();
+  largest = inputs.front()->largest();
+  for (const Table &table : inputs) {
+    smallest = std::min(smallest, table->smallest());
+    largest = std::max(largest, table->largest());
+  }
+
+  // Pull in every table of the next level that overlaps the inputs
+  auto next = std::make_shared<Version>(*current);
+  std::vector<Table> &output_level = next->levels[level + 1];
+  std::vector<Table> kept;
+  for (const Table &table : output_level) {
+    if (table->largest() < smallest || table->smallest() > largest)
+      kept.push_back(table);
+    else
+      inputs.push_back(table);
+  }
+
+  // A failed compaction is retried after the next flush
+  std::vector<Table> outputs;
+  if (!merge_into(inputs, &outputs)) {
+    remove_tables(outputs);
+    return false;
+  }
+
+  kept.insert(kept.end(), outputs.begin(), outputs.end());
+  std::sort(kept.begin(), kept.end(), [](const Table &a, const Table &b) {
+    return a->smallest() < b->smallest();
+  });
+  output_level = kept;
+
+  auto &source = next->levels[level];
+  source.erase(std::remove_if(source.begin(), source.end(),
+                              [&inputs](const Table &t) {
+                                return std::find(inputs.begin(), inputs.end(),
+                                                 t) != inputs.end();
+                              }),
+               source.end());
+
+  if (!install(next)) {
+    remove_tables(outputs);
+    return false;
+  }
+
+  for (const Table &table : inputs)
+    table->mark_obsolete();
+
+  return true;
+}
+
+/*
+ * K-way merge of the input tables into new tables of at most
+ * target_file_bytes. When several inputs hold the same key, the version with
+ * the highest timestamp wins, matching the LWW rule in write(). Returns
+ * false if an input could not be read or a table could not be written,
+ * outputs holds the ones that were.
+ */
+bool LsmEngine::merge_into(const std::vector<Table> &inputs,
+                           std::vector<Table> *outputs) {
+  std::vector<SSTable::Iterator> iterators;
+  for (const Table &table : inputs)
+    iterators.emplace_back(table);
+
+  std::unique_ptr<SSTableBuilder> builder;
+  uint64_t builder_id = 0;
+  bool ok = true;
+
+  auto finish_output = [&]() {
+    Table table;
+    if (builder->finish())
+      table = SSTable::open(table_path(builder_id), builder_id, &cache);
+    if (table) {
+      outputs->push_back(table);
+    } else {
+      std::error_code error;
+      std::filesystem::remove(table_path(builder_id), error);
+      ok = false;
+    }
+    builder.reset();
+  };
+
+  while (ok) {
+    // Dropping the keys of a bad block would lose them with the inputs
+    const std::string *min_key = nullptr;
+    for (auto &it : iterators) {
+      if (it.corrupt())
+        ok = false;
+      if (it.valid() && (!min_key || it.key() < *min_key))
+        min_key = &it.key();
+    }
+    if (!ok || !min_key)
+      break;
+
+    std::string key = *min_key;
+    Val_TS winner = {"", -1};
+    for (auto &it : iterators) {
+      if (it.valid() && it.key() == key) {
+        if (it.value().second > winner.second)
+          winner = it.value();
+        it.next();
+      }
+    }
+
+    if (!builder) {
+      builder_id = next_file_id++;
+      builder = std::make_unique<SSTableBuilder>(table_path(builder_id));
+    }
+    builder->add(key, winner);
+    if (builder->file_size() >= options.target_file_bytes)
+      finish_output();
+  }
+
+  if (builder)
+    finish_output();
+
+  return ok;
+}
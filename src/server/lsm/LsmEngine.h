@@ -0,0 +1,127 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BlockCache.h"
+#include "MemTable.h"
+#include "SSTable.h"
+#include "StorageEngine.h"
+
+struct LsmOptions {
+  std::string dir;
+  size_t memtable_bytes = 4 << 20;
+  size_t block_cache_bytes = 64 << 20;
+  size_t target_file_bytes = 2 << 20;
+  size_t level1_bytes = 10 << 20; // each deeper level holds 10x more
+  int l0_compaction_trigger = 4;
+};
+
+/*
+ * On-disk log structured merge tree.
+ *
+ * Writes go to a skiplist memtable. A full memtable is frozen and flushed to
+ * a level 0 SSTable by a background thread, which also runs leveled
+ * compaction: all of L0 is merged into L1, and a level that outgrows its
+ * budget pushes one file into the overlapping files of the next level.
+ *
+ * write() checks the current timestamp before inserting, so a newer layer
+ * never holds an older version of a key than a deeper one and reads can stop
+ * at the first hit. Merges keep the version with the highest timestamp.
+ */
+class LsmEngine : public StorageEngine {
+public:
+  LsmEngine(const LsmOptions &options);
+  ~LsmEngine();
+
+  bool write(const std::string &key, const std::string &val,
+             int64_t timestamp, int64_t *replaced = nullptr) override;
+
+  Val_TS read(const std::string &key) override;
+
+  /*
+   * Approximate, keys that are still being compacted count once per copy
+   */
+  size_t size() override;
+
+  /*
+   * Visits the newest version of every key. Tables are immutable, so this
+   * is safe while compactions run, but writes made meanwhile may be missed.
+   */
+  bool visit_unlocked(const VisitFunc &visit) override;
+
+  /*
+   * Ties the engine to the write-ahead log the store's writes go to.
+   * cut is called whenever a memtable is frozen and returns a log
+   * position before which every logged write is in that memtable or
+   * older data. Once the memtable is flushed, that position is recorded
+   * in the MANIFEST and passed to flushed, so the log before it can go.
+   * Attach only after the log was replayed into the engine.
+   */
+  void attach_log(std::function<uint64_t()> cut,
+                  std::function<void(uint64_t)> flushed);
+
+  /*
+   * Log position recorded with the last flush. The tables hold every
+   * write logged before it, a restart only needs to replay the rest.
+   */
+  uint64_t log_position();
+
+private:
+  static const int NUM_LEVELS = 7;
+
+  using Table = std::shared_ptr<SSTable>;
+
+  struct Version {
+    std::vector<Table> levels[NUM_LEVELS]; // L0 newest first, others by key
+    uint64_t log_position = 0; // writes logged before it are in the tables
+  };
+
+  LsmOptions options;
+  BlockCache cache;
+
+  std::mutex write_mutex; // serializes the LWW check and insert
+  std::shared_mutex state_mutex;
+  std::condition_variable_any state_cv;
+  std::shared_ptr<MemTable> memtable;
+  std::shared_ptr<MemTable> immutable;
+  std::shared_ptr<const Version> version;
+  bool shutdown_requested = false;
+  std::function<uint64_t()> log_cut;
+  std::function<void(uint64_t)> log_flushed;
+  uint64_t immutable_log_position = 0;
+
+  // Only touched by the background thread after construction
+  uint64_t next_file_id = 1;
+  std::string compact_pointer[NUM_LEVELS];
+  std::thread background;
+
+  Val_TS lookup(const std::string &key);
+
+  /*
+   * Log position for a memtable about to be frozen, 0 if no log is
+   * attached. Called while no writer can add to the memtable, before
+   * state_mutex is taken.
+   */
+  uint64_t cut_log();
+
+  void _background_work();
+  bool flush_immutable();
+  bool compact_once(std::shared_ptr<const Version> current);
+  bool merge_into(const std::vector<Table> &inputs,
+                  std::vector<Table> *outputs);
+  bool install(std::shared_ptr<const Version> next);
+
+  std::string table_path(uint64_t id);
+  void load_manifest();
+  bool write_manifest(const Version &v);
+  void remove_tables(const std::vector<Table> &tables);
+  size_t level_bytes(const Version &v, int level);
+  size_t max_level_bytes(int level);
+};
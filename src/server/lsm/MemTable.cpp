@@ -0,0 +1,81 @@
+#include "MemTable.h"
+#include <mutex>
+
+MemTable::MemTable() : rng(std::random_device{}()) {}
+
+MemTable::~MemTable() {
+  Node *node = head.next[0];
+  while (node) {
+    Node *next = node->next[0];
+    delete node;
+    node = next;
+  }
+}
+
+int MemTable::random_height() {
+  // Each level up is taken with probability 1/4
+  int h = 1;
+  while (h < MAX_HEIGHT && (rng() & 3) == 0)
+    h++;
+  return h;
+}
+
+MemTable::Node *MemTable::find_greater_or_equal(const std::string &key,
+                                                Node **prev) {
+  Node *node = &head;
+  for (int level = height - 1; level >= 0; --level) {
+    while (node->next[level] && node->next[level]->key < key)
+      node = node->next[level];
+    if (prev)
+      prev[level] = node;
+  }
+  return node->next[0];
+}
+
+void MemTable::put(const std::string &key, const std::string &val,
+                   int64_t timestamp) {
+  std::unique_lock lock(mutex);
+
+  Node *prev[MAX_HEIGHT];
+  Node *node = find_greater_or_equal(key, prev);
+
+  if (node && node->key == key) {
+    bytes += val.size();
+    bytes -= node->value.first.size();
+    node->value = {val, timestamp};
+    return;
+  }
+
+  int h = random_height();
+  for (int level = height; level < h; ++level)
+    prev[level] = &head;
+  height = std::max(height, h);
+
+  node = new Node{key, {val, timestamp}};
+  for (int level = 0; level < h; ++level) {
+    node->next[level] = prev[level]->next[level];
+    prev[level]->next[level] = node;
+  }
+
+  bytes += sizeof(Node) + key.size() + val.size();
+  entries++;
+}
+
+bool MemTable::get(const std::string &key, Val_TS &out) {
+  std::shared_lock lock(mutex);
+
+  Node *node = find_greater_or_equal(key, nullptr);
+  if (node && node->key == key) {
+    out = node->value;
+    return true;
+  }
+  return false;
+}
+
+void MemTable::for_each(
+    std::function<void(const std::string &, const Val_TS &)> visit) {
+  std::shared_lock lock(mutex);
+
+  for (Node *node = head.next[0]; node; node = node->next[0])
+    visit(node->key, node->value);
+}
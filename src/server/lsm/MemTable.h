@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <random>
+#include <shared_mutex>
+#include <string>
+
+#include "StorageEngine.h"
+
+/*
+ * Sorted in-memory write buffer of the LSM engine, backed by a skiplist.
+ *
+ * Readers share the lock, so lookups run in parallel while the engine
+ * serializes writers. Once full, the table becomes immutable and is
+ * flushed to an SSTable in key order.
+ */
+class MemTable {
+public:
+  MemTable();
+  ~MemTable();
+
+  void put(const std::string &key, const std::string &val, int64_t timestamp);
+
+  bool get(const std::string &key, Val_TS &out);
+
+  /*
+   * Visits every entry in key order
+   */
+  void for_each(
+      std::function<void(const std::string &, const Val_TS &)> visit);
+
+  size_t memory_usage() { return bytes; }
+  size_t count() { return entries; }
+
+private:
+  static const int MAX_HEIGHT = 12;
+
+  struct Node {
+    std::string key;
+    Val_TS value;
+    Node *next[MAX_HEIGHT] = {};
+  };
+
+  Node head;
+  int height = 1;
+  std::shared_mutex mutex;
+  std::minstd_rand rng;
+  std::atomic<size_t> bytes{0};
+  std::atomic<size_t> entries{0};
+
+  int random_height();
+  Node *find_greater_or_equal(const std::string &key, Node **prev);
+};
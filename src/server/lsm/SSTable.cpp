@@ -0,0 +1,293 @@
+#include "SSTable.h"
+#include "BloomFilter.h"
+#include "Checksum.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t MAGIC = 0x544B5653; // "TKVS"
+static const size_t ENTRY_HEADER = 2 * sizeof(uint32_t) + sizeof(int64_t);
+static const size_t FOOTER_SIZE = 8 + 4 + 8 + 4 + 8 + 4;
+
+template <typename T> static void put_fixed(std::string &out, T v) {
+  out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+template <typename T> static T get_fixed(const char *p) {
+  T v;
+  memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+static bool read_at(int fd, std::string &out, uint64_t offset, size_t n) {
+  out.resize(n);
+  size_t done = 0;
+  while (done < n) {
+    ssize_t r = pread(fd, out.data() + done, n - done, offset + done);
+    if (r <= 0)
+      return false;
+    done += r;
+  }
+  return true;
+}
+
+/*
+ * Decodes the entry at position, returns the position of the next one
+ */
+static size_t decode_entry(const std::string &block, size_t position,
+                           std::string &key, Val_TS &value) {
+  const char *p = block.data() + position;
+  uint32_t key_len = get_fixed<uint32_t>(p);
+  uint32_t val_len = get_fixed<uint32_t>(p + 4);
+  value.second = get_fixed<int64_t>(p + 8);
+  key.assign(p + ENTRY_HEADER, key_len);
+  value.first.assign(p + ENTRY_HEADER + key_len, val_len);
+  return position + ENTRY_HEADER + key_len + val_len;
+}
+
+SSTableBuilder::SSTableBuilder(const std::string &path, size_t block_size)
+    : path(path), block_size(block_size) {
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "[SSTable] Could not create " << path << ": "
+              << strerror(errno) << std::endl;
+    failed = true;
+  }
+}
+
+void SSTableBuilder::add(const std::string &key, const Val_TS &value) {
+  put_fixed<uint32_t>(block, key.size());
+  put_fixed<uint32_t>(block, value.first.size());
+  put_fixed<int64_t>(block, value.second);
+  block += key;
+  block += value.first;
+
+  last_key = key;
+  hashes.push_back(murmur64(key));
+
+  if (block.size() >= block_size)
+    flush_block();
+}
+
+void SSTableBuilder::flush_block() {
+  if (block.empty())
+    return;
+
+  put_fixed<uint32_t>(index, last_key.size());
+  index += last_key;
+  put_fixed<uint64_t>(index, offset);
+  put_fixed<uint32_t>(index, block.size());
+
+  put_fixed<uint32_t>(block, crc32c(block.data(), block.size()));
+  write_raw(block);
+  block.clear();
+}
+
+void SSTableBuilder::write_raw(const std::string &data) {
+  if (failed)
+    return;
+
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "[SSTable] Write failed: " << strerror(errno) << std::endl;
+      failed = true;
+      return;
+    }
+    written += n;
+  }
+  offset += data.size();
+}
+
+bool SSTableBuilder::finish() {
+  flush_block();
+
+  uint64_t index_offset = offset;
+  uint32_t index_size = index.size();
+  put_fixed<uint32_t>(index, crc32c(index.data(), index.size()));
+  write_raw(index);
+
+  std::string bloom = BloomFilter::build(hashes);
+  uint64_t bloom_offset = offset;
+  uint32_t bloom_size = bloom.size();
+  put_fixed<uint32_t>(bloom, crc32c(bloom.data(), bloom.size()));
+  write_raw(bloom);
+
+  std::string footer;
+  put_fixed<uint64_t>(footer, index_offset);
+  put_fixed<uint32_t>(footer, index_size);
+  put_fixed<uint64_t>(footer, bloom_offset);
+  put_fixed<uint32_t>(footer, bloom_size);
+  put_fixed<uint64_t>(footer, hashes.size());
+  put_fixed<uint32_t>(footer, MAGIC);
+  write_raw(footer);
+
+  if (!failed && fsync(fd) != 0) {
+    std::cerr << "[SSTable] Sync of " << path << " failed: " << strerror(errno)
+              << std::endl;
+    failed = true;
+  }
+  if (fd >= 0)
+    close(fd);
+  return !failed;
+}
+
+std::shared_ptr<SSTable> SSTable::open(const std::string &path, uint64_t id,
+                                       BlockCache *cache) {
+  std::shared_ptr<SSTable> table(new SSTable());
+  table->path = path;
+  table->table_id = id;
+  table->cache = cache;
+
+  table->fd = ::open(path.c_str(), O_RDONLY);
+  if (table->fd < 0)
+    return nullptr;
+
+  struct stat st;
+  fstat(table->fd, &st);
+  table->size = st.st_size;
+  if (table->size < FOOTER_SIZE)
+    return nullptr;
+
+  std::string footer;
+  if (!read_at(table->fd, footer, table->size - FOOTER_SIZE, FOOTER_SIZE) ||
+      get_fixed<uint32_t>(footer.data() + 32) != MAGIC)
+    return nullptr;
+
+  uint64_t index_offset = get_fixed<uint64_t>(footer.data());
+  uint32_t index_size = get_fixed<uint32_t>(footer.data() + 8);
+  uint64_t bloom_offset = get_fixed<uint64_t>(footer.data() + 12);
+  uint32_t bloom_size = get_fixed<uint32_t>(footer.data() + 20);
+  table->entry_count = get_fixed<uint64_t>(footer.data() + 24);
+
+  std::string index, bloom;
+  if (!read_at(table->fd, index, index_offset, index_size + 4) ||
+      !read_at(table->fd, bloom, bloom_offset, bloom_size + 4))
+    return nullptr;
+  if (crc32c(index.data(), index_size) !=
+          get_fixed<uint32_t>(index.data() + index_size) ||
+      crc32c(bloom.data(), bloom_size) !=
+          get_fixed<uint32_t>(bloom.data() + bloom_size))
+    return nullptr;
+
+  bloom.resize(bloom_size);
+  table->bloom = std::move(bloom);
+
+  size_t position = 0;
+  while (position < index_size) {
+    const char *p = index.data() + position;
+    uint32_t key_len = get_fixed<uint32_t>(p);
+    IndexEntry entry;
+    entry.last_key.assign(p + 4, key_len);
+    entry.offset = get_fixed<uint64_t>(p + 4 + key_len);
+    entry.size = get_fixed<uint32_t>(p + 12 + key_len);
+    table->index.push_back(std::move(entry));
+    position += 16 + key_len;
+  }
+
+  if (!table->index.empty()) {
+    BlockCache::Block first = table->read_block(0, false);
+    if (!first)
+      return nullptr;
+    Val_TS unused;
+    decode_entry(*first, 0, table->smallest_key, unused);
+    table->largest_key = table->index.back().last_key;
+  }
+
+  return table;
+}
+
+SSTable::~SSTable() {
+  if (fd >= 0)
+    close(fd);
+  if (obsolete)
+    unlink(path.c_str());
+}
+
+BlockCache::Block SSTable::read_block(size_t i, bool fill_cache) {
+  const IndexEntry &entry = index[i];
+
+  if (fill_cache) {
+    BlockCache::Block cached = cache->lookup(table_id, entry.offset);
+    if (cached)
+      return cached;
+  }
+
+  std::string data;
+  if (!read_at(fd, data, entry.offset, entry.size + 4))
+    return nullptr;
+  if (crc32c(data.data(), entry.size) !=
+      get_fixed<uint32_t>(data.data() + entry.size)) {
+    std::cerr << "[SSTable] Checksum mismatch in " << path << " at "
+              << entry.offset << std::endl;
+    return nullptr;
+  }
+  data.resize(entry.size);
+
+  auto block = std::make_shared<const std::string>(std::move(data));
+  if (fill_cache)
+    cache->insert(table_id, entry.offset, block);
+  return block;
+}
+
+bool SSTable::get(const std::string &key, Val_TS &out) {
+  if (index.empty() || key < smallest_key || key > largest_key)
+    return false;
+  if (!BloomFilter::may_contain(bloom, murmur64(key)))
+    return false;
+
+  // First block whose last key is not smaller than the key
+  auto it = std::lower_bound(
+      index.begin(), index.end(), key,
+      [](const IndexEntry &e, const std::string &k) { return e.last_key < k; });
+  if (it == index.end())
+    return false;
+
+  BlockCache::Block block = read_block(it - index.begin(), true);
+  if (!block)
+    return false;
+
+  std::string entry_key;
+  Val_TS entry_value;
+  size_t position = 0;
+  while (position < block->size()) {
+    position = decode_entry(*block, position, entry_key, entry_value);
+    if (entry_key == key) {
+      out = std::move(entry_value);
+      return true;
+    }
+    if (entry_key > key)
+      break;
+  }
+  return false;
+}
+
+SSTable::Iterator::Iterator(std::shared_ptr<SSTable> table)
+    : table(std::move(table)) {
+  next();
+}
+
+void SSTable::Iterator::next() {
+  while (!block || position >= block->size()) {
+    if (block_index >= table->index.size()) {
+      is_valid = false;
+      return;
+    }
+    block = table->read_block(block_index++, false);
+    if (!block)
+      is_corrupt = true;
+    position = 0;
+  }
+
+  position = decode_entry(*block, position, current_key, current_value);
+  is_valid = true;
+}
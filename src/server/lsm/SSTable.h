@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BlockCache.h"
+#include "StorageEngine.h"
+
+/*
+ * Immutable sorted table file.
+ *
+ * Layout:
+ *   [data block][crc32c] ... [index block][crc32c][bloom filter][crc32c]
+ *   [footer]
+ * A data block holds entries [key_len][val_len][timestamp][key][val] in key
+ * order. The index maps the last key of every block to its offset and size,
+ * and the footer points at the index and the filter.
+ */
+class SSTableBuilder {
+public:
+  SSTableBuilder(const std::string &path, size_t block_size = 4096);
+
+  /*
+   * Keys must be added in strictly increasing order
+   */
+  void add(const std::string &key, const Val_TS &value);
+
+  /*
+   * Writes the index, filter and footer and syncs the file. Returns false
+   * if the file could not be created or any write or the sync failed, the
+   * table must not be installed then.
+   */
+  bool finish();
+
+  size_t file_size() { return offset + block.size(); }
+  size_t entries() { return hashes.size(); }
+
+private:
+  std::string path;
+  size_t block_size;
+  int fd;
+  uint64_t offset = 0;
+  bool failed = false;
+  std::string block;
+  std::string last_key;
+  std::string index;
+  std::vector<uint64_t> hashes;
+
+  void flush_block();
+  void write_raw(const std::string &data);
+};
+
+class SSTable {
+public:
+  /*
+   * Opens a table file, returns nullptr if it is missing or corrupt
+   */
+  static std::shared_ptr<SSTable> open(const std::string &path, uint64_t id,
+                                       BlockCache *cache);
+  ~SSTable();
+
+  bool get(const std::string &key, Val_TS &out);
+
+  uint64_t id() { return table_id; }
+  const std::string &smallest() { return smallest_key; }
+  const std::string &largest() { return largest_key; }
+  uint64_t file_size() { return size; }
+  uint64_t entries() { return entry_count; }
+
+  /*
+   * Deletes the file once the last reader drops its reference
+   */
+  void mark_obsolete() { obsolete = true; }
+
+  /*
+   * Sequential scan over all entries, bypassing the block cache
+   */
+  class Iterator {
+  public:
+    Iterator(std::shared_ptr<SSTable> table);
+    bool valid() { return is_valid; }
+    const std::string &key() { return current_key; }
+    const Val_TS &value() { return current_value; }
+    void next();
+
+    /*
+     * True once a block failed to read, its entries were skipped
+     */
+    bool corrupt() { return is_corrupt; }
+
+  private:
+    std::shared_ptr<SSTable> table;
+    size_t block_index = 0;
+    BlockCache::Block block;
+    size_t position = 0;
+    bool is_valid = false;
+    bool is_corrupt = false;
+    std::string current_key;
+    Val_TS current_value;
+  };
+
+private:
+  struct IndexEntry {
+    std::string last_key;
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  std::string path;
+  uint64_t table_id;
+  int fd = -1;
+  uint64_t size = 0;
+  uint64_t entry_count = 0;
+  BlockCache *cache;
+  std::vector<IndexEntry> index;
+  std::string bloom;
+  std::string smallest_key;
+  std::string largest_key;
+  std::atomic<bool> obsolete{false};
+
+  BlockCache::Block read_block(size_t i, bool fill_cache);
+};